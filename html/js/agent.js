@@ -25,6 +25,10 @@ var agent = {
 	 * Global AJAX timeout (in milliseconds)
 	 */
 	globaltimeout: 5000,
+	/*
+	 * The agent holds /events requests for up to 25 seconds.
+	 */
+	eventstimeout: 35000,
 	version: "",
 	varnishtoplength: 5
 };
@@ -36,6 +40,66 @@ function urlPrefix() {
     return prefix;
 }
 
+/*
+ * Settings for $.ajax are built by the xxxReq() functions with a url
+ * relative to the agent, so the same request can either be sent on its
+ * own with agentAjax() or together with others through batch().
+ */
+function agentAjax(req)
+{
+	req.url = urlPrefix() + req.url;
+	req.timeout = agent.globaltimeout;
+	$.ajax(req);
+}
+
+/*
+ * Run several requests in one round trip through /batch, calling the
+ * success/error/complete callbacks of each as $.ajax would have.
+ */
+function batch(reqs)
+{
+	var body = new Array();
+	for (var i = 0; i < reqs.length; i++) {
+		body.push({
+			method: reqs[i].type,
+			path: reqs[i].url,
+			body: reqs[i].data ? reqs[i].data : ""
+		});
+	}
+	$.ajax({
+		type: "POST",
+		url: urlPrefix() + "/batch",
+		timeout: agent.globaltimeout,
+		contentType: "application/json",
+		data: JSON.stringify(body),
+		dataType: "text",
+		success: function (data, textStatus, jqXHR) {
+			var res = JSON.parse(data);
+			for (var i = 0; i < reqs.length; i++) {
+				var xhr = {
+					status: res[i].status,
+					responseText: res[i].body
+				};
+				var ok = xhr.status >= 200 && xhr.status < 300;
+				if (ok && reqs[i].success)
+					reqs[i].success(xhr.responseText, "success", xhr);
+				if (!ok && reqs[i].error)
+					reqs[i].error(xhr, "error", xhr.responseText);
+				if (reqs[i].complete)
+					reqs[i].complete(xhr, ok ? "success" : "error");
+			}
+		},
+		error: function (jqXHR, textStatus, errorThrown) {
+			for (var i = 0; i < reqs.length; i++) {
+				if (reqs[i].error)
+					reqs[i].error(jqXHR, textStatus, errorThrown);
+				if (reqs[i].complete)
+					reqs[i].complete(jqXHR, textStatus);
+			}
+		}
+	});
+}
+
 function clog(text)
 {
 	if(agent.debug) {
@@ -138,16 +202,15 @@ function showParam()
 	topActive("param");
 }
 
-function reset_status()
+function statusReq()
 {
 	var but = document.getElementById("status-btn");
 	assert(but != null);
 	var stat;
-	$.ajax({
+	return {
 		type: "GET",
-		url: urlPrefix() + "/status",
+		url: "/status",
 		dataType: "text",
-		timeout: agent.globaltimeout,
 		success: function (data, textStatus, jqXHR) {
 			stat = data;
 			assertText(stat);
@@ -167,7 +230,12 @@ function reset_status()
 				but.className = "btn btn-danger btn-block disabled";
 			}
 		}
-	});
+	};
+}
+
+function reset_status()
+{
+	agentAjax(statusReq());
 }
 
 function show_status(state,message)
@@ -250,12 +318,11 @@ function loadVCL()
 }
 
 
-function listVCL()
+function listVCLReq()
 {
-	$.ajax({
+	return {
 		type: "GET",
-		url: urlPrefix() + "/vcljson/",
-		timeout: agent.globaltimeout,
+		url: "/vcljson/",
 		dataType: "text",
 		success: function (data, textStatus, jqXHR) {
 			var vclList = JSON.parse(data);
@@ -286,15 +353,19 @@ function listVCL()
 			clog(textStatus);
 			clog(errorThrown);
 		}
-	});
+	};
 }
 
-function list_params()
+function listVCL()
 {
-	$.ajax({
+	agentAjax(listVCLReq());
+}
+
+function listParamsReq()
+{
+	return {
 		type: "GET",
-		url: urlPrefix() + "/paramjson/",
-		timeout: agent.globaltimeout,
+		url: "/paramjson/",
 		dataType: "text",
 		success: function (data, textStatus, jqXHR) {
 			if( jqXHR.status == 200) {
@@ -333,8 +404,13 @@ function list_params()
 			}
 			out_up();
 		}
-	});
+	};
+
+}
 
+function list_params()
+{
+	agentAjax(listParamsReq());
 }
 
 function paramChange()
@@ -546,10 +622,62 @@ function start()
 
 }
 
+/*
+ * Wait for events from the agent and reload whatever they say has
+ * changed, instead of polling for it. The first request, without a
+ * cursor, only picks up where the event stream is at.
+ */
+function watchEvents(cursor)
+{
+	var url = urlPrefix() + "/events";
+	if (cursor != null)
+		url += "/" + cursor;
+	$.ajax({
+		type: "GET",
+		url: url,
+		timeout: agent.eventstimeout,
+		dataType: "text",
+		success: function (data, textStatus, jqXHR) {
+			var ev = JSON.parse(data);
+			var want = {};
+			var reqs = new Array();
+			if (cursor != null && ev.missed) {
+				want.status = want.vcl = want.params = want.backends = true;
+			} else if (cursor != null) {
+				for (var i = 0; i < ev.events.length; i++) {
+					var type = ev.events[i].type;
+					if (type.indexOf("vcl.") == 0)
+						want.vcl = true;
+					else if (type.indexOf("backend.") == 0)
+						want.backends = true;
+					else if (type == "param")
+						want.params = true;
+					else if (type == "child" || type == "panic")
+						want.status = true;
+				}
+			}
+			if (want.status)
+				reqs.push(statusReq());
+			if (want.vcl)
+				reqs.push(listVCLReq());
+			if (want.params)
+				reqs.push(listParamsReq());
+			if (want.backends)
+				reqs.push(listBackendsReq());
+			if (reqs.length > 0)
+				batch(reqs);
+			watchEvents(ev.cursor);
+		},
+		error: function (jqXHR, textStatus, errorThrown) {
+			clog("events: " + textStatus);
+			setTimeout(function() { watchEvents(cursor); }, 5000);
+		}
+	});
+}
+
 function status()
 {
-	listVCL();
-	reset_status();
+	batch([listVCLReq(), statusReq()]);
 }
 
 function verify_varnish_stat(version, data) {
@@ -591,17 +719,16 @@ function calculate_client_req(version, now, previous) {
 	}
 }
 
-function update_stats()
+function statsReq()
 {
 	var d = document.getElementById("stats-btn");
-    var version = document.getElementById("agentVersion").innerHTML;
 	assert(d != null);
-	$.ajax({
+	return {
 		type: "GET",
-		url: urlPrefix() + "/stats",
-		timeout: agent.globaltimeout,
+		url: "/stats",
 		dataType: "text",
 		success: function (data, textStatus, jqXHR) {
+			var version = document.getElementById("agentVersion").innerHTML;
 		    be_bytes(data);
 			for (i = 0; i < 3; i++) {
 				agent.stats[i] = agent.stats[i+1];
@@ -625,7 +752,12 @@ function update_stats()
 			clog(textStatus);
 			clog(errorThrown);
 		}
-	});
+	};
+}
+
+function update_stats()
+{
+	agentAjax(statsReq());
 }
 
 function varnishtopChange()
@@ -783,12 +915,11 @@ function panicClear()
 	});
 }
 
-function getVersion()
+function versionReq()
 {
-	$.ajax({
+	return {
 		type: "GET",
-		url: urlPrefix() + "/version",
-		timeout: agent.globaltimeout,
+		url: "/version",
 		dataType: "text",
 		success: function (data, textStatus, jqXHR) {
 			agent.version = data;
@@ -801,15 +932,19 @@ function getVersion()
 			clog(errorThrown);
 			out_up();
 		}
-	});
+	};
 }
 
-function list_backends()
+function getVersion()
+{
+	agentAjax(versionReq());
+}
+
+function listBackendsReq()
 {
-    $.ajax({
+    return {
         type: "GET",
-        url: urlPrefix() + "/backendjson/",
-        timeout: agent.globaltimeout,
+        url: "/backendjson/",
         dataType: "text",
         success: function (data, textStatus, jqXHR) {
             var json = JSON.parse(data);
@@ -840,7 +975,12 @@ function list_backends()
             agent.out = "Failed to list!\n" + errorThrown;
             out_be();
         }
-    });
+    };
+}
+
+function list_backends()
+{
+	agentAjax(listBackendsReq());
 }
 
 function be_bytes(data)
@@ -945,11 +1085,8 @@ function saveParam()
 
 
 $('.btn').button();
-setInterval(function(){status()},10000);
 setInterval(function(){update_stats()},agent.statsInterval * 1000);
 setInterval(function(){updateTop()},5000);
 updateTop();
-listVCL();
-list_params();
-getVersion();
-setInterval(function(){list_backends()},1000)
+batch([statusReq(), listVCLReq(), listParamsReq(), versionReq(), statsReq(), listBackendsReq()]);
+watchEvents(null);
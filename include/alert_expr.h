@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef ALERT_EXPR_H
+#define ALERT_EXPR_H
+
+/*
+ * Alert rule expressions, compiled once to a small stack machine and
+ * evaluated against counter samples.
+ *
+ *	rate(MAIN.fetch_failed) / rate(MAIN.backend_req) > 0.05
+ *	delta(MAIN.threads_limited) > 0 || VBE.boot.default.happy % 2 == 0
+ *
+ * Counters are named like in /stats: type, ident and name joined by dots.
+ * Names with other characters than letters, digits and "_.-:" can be
+ * quoted ("VBE.default(127.0.0.1,,8080).conn"). A counter is its value,
+ * delta(c) is its change since the previous sample and rate(c) that
+ * change a second. There are numbers, + - * / %, the comparisons, &&,
+ * || and !, and parentheses. Comparisons and logic give 1 or 0.
+ *
+ * A counter missing from the sample, or a division by zero, is NaN, and
+ * NaN compares false.
+ */
+struct alert_expr_t;
+
+/*
+ * NULL and *err set to a message to free if src does not compile.
+ */
+struct alert_expr_t *alert_expr_compile(const char *src, char **err);
+void alert_expr_free(struct alert_expr_t *e);
+
+/*
+ * The counters the expression uses, in the order eval wants their
+ * values.
+ */
+unsigned alert_expr_ncounters(const struct alert_expr_t *e);
+const char *alert_expr_counter(const struct alert_expr_t *e, unsigned i);
+
+/*
+ * cur and prev hold the values of the counters (NaN if missing) in this
+ * and the previous sample, dt seconds apart.
+ */
+double alert_expr_eval(const struct alert_expr_t *e, const double *cur,
+    const double *prev, double dt);
+
+/*
+ * Whether the result of alert_expr_eval() means the rule holds.
+ */
+int alert_expr_true(double v);
+#endif
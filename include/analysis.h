@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <vapi/vsl.h>
+
+struct VSM_data;
+struct vsb;
+
+/*
+ * VSL analyzers.
+ *
+ * The analysis plugin runs the analyzers enabled with -Y. It tails the
+ * shmlog of every instance in one thread, with one VSL query for each
+ * grouping the enabled analyzers ask for, and hands each group of
+ * transactions to the analyzers of that grouping. Each keeps a summary in bounded memory (see sketch.h), served as JSON at
+ * /analysis/<name>. All callbacks run with the analysis lock held.
+ *
+ * new() returns the state for one instance, and delete() frees it, which
+ * is also how DELETE /analysis/<name> starts over. feed() gets the
+ * transactions of a group, like VSLQ_dispatch_f, and is NULL for
+ * analyzers of counters only. sample(), if not NULL, is called every
+ * second with the VSM of the instance, to read counters. json() appends
+ * the members of the reply, each starting with ",\n\t".
+ *
+ * alert(), if not NULL, is called after sample() and appends members
+ * the same way when there is something to tell. It returns non-zero if
+ * it did, and the result is pushed to the URL set with
+ * PUT /push/url/analysis.
+ */
+struct analyzer_t {
+	const char *name;
+	const char *help;	// One line for /help/analysis
+	enum VSL_grouping_e grouping;
+	void *(*new)(void);
+	void (*delete)(void *priv);
+	void (*feed)(void *priv, struct VSL_transaction * const trans[]);
+	void (*sample)(void *priv, struct VSM_data *vsm);
+	void (*json)(void *priv, struct vsb *vsb);
+	int (*alert)(void *priv, struct vsb *vsb);
+};
+
+#define ANALYZER(name) extern const struct analyzer_t analyzer_##name;
+#include "analyzer-list.h"
+#undef ANALYZER
+
+/*
+ * If data is a header record ("Name: value") for header name, the value
+ * with leading white space skipped, else NULL.
+ */
+const char *analysis_header(const char *data, const char *name);
+
+/*
+ * The path of url with the query string dropped and path segments that
+ * look like ids (numbers, long hex strings) replaced by "*", so that
+ * /user/123/box?x=1 and /user/456/box are the same pattern.
+ */
+void analysis_pattern(const char *url, char *buf, size_t len);
+
+/*
+ * Sets on[i] for each analyzer named in list, comma separated, or for
+ * all of them with "all". on can be NULL to check list. Returns -1 if a
+ * name is unknown.
+ */
+int analysis_select(const char *list, unsigned char *on);
+
+/*
+ * The second field of a Timestamp record ("Label: abs since_start
+ * since_last") for label, in seconds, or -1.
+ */
+double analysis_timestamp(const char *data, const char *label);
+#endif
@@ -29,6 +29,15 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+/*
+ * A varnishd instance (-n), see instance.h.
+ */
+struct agent_instance_t {
+	char *name; // Used in /i/<name>/ URLs
+	char *n_arg;
+	const char *p_arg; // Persistence directory
+};
+
 /*
  * Configuration, handled by main for now.
  */
@@ -37,19 +46,26 @@ struct agent_config_t {
 	 * Varnishadm-related:
 	 */
 	double timeout;
-	char *T_arg;
 	char *T_arg_orig;
 	char *S_arg;
 	int S_arg_fd;
-	char *n_arg;
+	char *n_arg; // -n of the default instance
+	struct agent_instance_t *instances;
+	int ninstances;
 	char *u_arg;
 	char *g_arg;
 	const char *K_arg;
 	int r_arg;
+	int L_arg; // Lurker-friendly bans, see vban.c
+	int j_arg; // Ban journal, see vban.c
+	int B_arg; // Refuse VCL with lint findings this severe, -1 never
 
 	int d_arg; // 0 - fork. 1 - foreground.
 	int loglevel;
-	const char *bind_address;
+	const char **bind_address; // Addresses to bind against (-a, repeatable)
+	int nbind_address;
+	int l_arg; // Listening sockets per bind address (SO_REUSEPORT)
+	const char *U_arg; // Unix domain socket to listen on
 	const char *local_port; // Listening port for incoming requests
 	const char *remote_port; // Port to connect to from the outside
 	char *C_arg; // CURLOPT_CAINFO param
@@ -57,8 +73,12 @@ struct agent_config_t {
 	long w_arg; // CURLOPT_TIMEOUT param
 	const char *p_arg; // Persistence directory
 	const char *H_arg; // HTML directory
+	const char *f_arg; // Peers file, see peers.h
 	char *P_arg; // Pid file
 	char *vac_arg;
+	const char *A_arg; // VSL archive directory, see archive.c
+	long M_arg; // Archive size cap in megabytes, per instance
+	const char *Y_arg; // Analyzers to run, see analysis.c
 	char *password;
 	char *user;
 	struct vsb *auth_token;
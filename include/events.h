@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * In-process event bus.
+ *
+ * Handlers that change the state of Varnish publish an event when they
+ * succeed, and the events plugin watches varnishd for changes nobody told
+ * us about (child restarts, panics and backend health). The last events
+ * are kept in a ring buffer and served on /events.
+ *
+ * type is a short dotted name, like "vcl.deploy". data is a JSON object.
+ */
+struct event_t {
+	uintmax_t seq;
+	time_t t;
+	char *type;
+	char *data;
+};
+
+/*
+ * Publish an event. The arguments after type are key/value pairs of
+ * strings, ending with NULL, and end up as the members of data:
+ *
+ *	events_publish(core, "vcl.deploy", "name", arg, NULL);
+ *
+ * Safe to call from any thread.
+ */
+void events_publish(struct agent_core_t *core, const char *type, ...);
+
+/*
+ * Have cb called for every event published from now on. Register during
+ * plugin init. cb runs in the thread of the publisher with the bus
+ * locked, so it must be quick and must not use IPC handles or publish.
+ */
+typedef void (*events_cb_f)(const struct event_t *ev, void *priv);
+void events_subscribe(struct agent_core_t *core, events_cb_f cb, void *priv);
+#endif
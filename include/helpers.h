@@ -37,9 +37,11 @@ unsigned int help_reply(struct http_request *request, const char *arg,
 		void *data);
 
 /*
- * Run the command given on fmt and respond to the connection.
+ * Run the command given on fmt and respond to the connection. Returns the
+ * status from varnishd.
  */
-void run_and_respond(int vadmin, struct MHD_Connection *conn, const char *fmt, ...);
+unsigned run_and_respond(int vadmin, struct MHD_Connection *conn,
+			 const char *fmt, ...);
 void run_and_respond_eok(int vadmin, struct MHD_Connection *conn,
 			 unsigned min, unsigned max, const char *fmt, ...);
 
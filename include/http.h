@@ -98,6 +98,10 @@ typedef unsigned int (*http_cb_f)(struct http_request *, const char *, void *);
 
 void http_add_header(struct http_response *resp, const char *key, const char *value);
 char *http_get_header(struct MHD_Connection *connection, const char *key);
+/*
+ * Value of the query string argument key, or NULL. Not a copy.
+ */
+const char *http_get_arg(struct MHD_Connection *connection, const char *key);
 void http_set_content_type(struct http_response *resp, const char *filepath);
 void http_free_resp(struct http_response *resp);
 struct http_response *http_mkresp(struct MHD_Connection *conn, int status, const char *body);
@@ -117,6 +121,36 @@ int send_response(struct http_response *resp);
 int http_reply(struct MHD_Connection *, int, const char *);
 int http_reply_len(struct MHD_Connection *, int, const char *, unsigned);
 
+/*
+ * Long-polling. A callback can park its connection with http_suspend()
+ * instead of replying, and wake it up later with http_resume(), which may
+ * be called from any thread. The callback is then run again for the same
+ * request.
+ *
+ * http_suspend() returns false if the connection can't be suspended (old
+ * libmicrohttpd, or inside /batch). The callback must reply right away
+ * in that case.
+ */
+int http_suspend(struct MHD_Connection *conn);
+void http_resume(struct MHD_Connection *conn);
+
+/*
+ * Slow work, like talking to peers, without holding up the other
+ * requests. http_defer() suspends the connection and runs func(priv) in
+ * a thread of its own, outside the lock the callbacks run under, so func
+ * must not use IPC. The callback is then run again for the same
+ * request, and http_deferred() gives it priv back to reply from; it is
+ * NULL on the first run. If the client went away, fini(priv) is called
+ * instead.
+ *
+ * http_defer() returns false where http_suspend() would. The callback
+ * then runs func(priv) itself.
+ */
+typedef void http_defer_f(void *priv);
+int http_defer(struct http_request *request, http_defer_f *func,
+    http_defer_f *fini, void *priv);
+void *http_deferred(struct http_request *request);
+
 /*
  * URL    - the HTTP-protocol URL (e.g: req.url, not including host-header).
  * method - a bitmap of which methods to care for (e.g: 1 for just GET, 3
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+/*
+ * Several varnishd instances.
+ *
+ * Every -n argument adds an instance. The first one is the default, the
+ * others are reached by prefixing URLs with /i/<name>/, where name is the
+ * last path component of the -n argument.
+ *
+ * The instance a thread works for is thread-local, and travels along with
+ * IPC messages. Plugins that only talk to varnishd through vadmin don't
+ * need to care; plugins that open the shared memory use instance_get()
+ * to find the right -n argument.
+ */
+
+/*
+ * Used by main() while parsing arguments. instance_init() fills in the
+ * rest once all arguments are known.
+ */
+void instance_add(struct agent_config_t *config, char *n_arg);
+void instance_init(struct agent_config_t *config);
+
+/*
+ * Index of the instance the calling thread works for, and changing it.
+ */
+int instance_current(void);
+void instance_select(int idx);
+
+/*
+ * The current instance.
+ */
+struct agent_instance_t *instance_get(struct agent_core_t *core);
+
+/*
+ * Index of the instance called name (len bytes long), or -1.
+ */
+int instance_find(struct agent_core_t *core, const char *name, size_t len);
+#endif
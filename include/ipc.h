@@ -29,6 +29,8 @@
 #ifndef IPC_H
 #define IPC_H
 
+#include <pthread.h>
+
 /*
  * Essentially the upper bound on plugins.
  */
@@ -89,6 +91,15 @@ void ipc_run(int handle, struct ipc_ret_t *ret, const char *fmt, ...)
  */
 void ipc_send(int handle, void *data, int len, struct ipc_ret_t *ret);
 
+/*
+ * Let the calling thread use the IPC handles of the thread owner.
+ *
+ * Handles are per-thread. This is for thread pools that serialize their
+ * work with a lock of their own, so that only one of them talks on a
+ * handle at any given time (e.g: the HTTP daemons in modules/http.c).
+ */
+void ipc_thread_alias(pthread_t owner);
+
 /*
  * Inits the ipc structure. E.g: making sure everything is 0.
  *
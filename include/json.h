@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <sys/types.h>
+
+struct vsb;
+
+/*
+ * A small JSON parser for request bodies.
+ *
+ * json_parse() builds a tree of json_t nodes out of a nul-terminated
+ * string. Arrays and objects keep their elements as a linked list
+ * starting at child, object members also have their name in key.
+ * Numbers are kept as a double, and as written in string for integers
+ * a double can't hold exactly. Strings are unescaped and always
+ * nul-terminated.
+ *
+ * On failure, NULL is returned and *err (if err is not NULL) points to a
+ * static description of the problem.
+ */
+enum json_type {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+};
+
+struct json_t {
+	enum json_type type;
+	char *key;
+	char *string;
+	double number;
+	struct json_t *child;
+	struct json_t *next;
+};
+
+struct json_t *json_parse(const char *text, const char **err);
+void json_free(struct json_t *json);
+
+/*
+ * Look up the member named key of an object. json_get_string() returns
+ * NULL unless the member exists and is a string.
+ */
+struct json_t *json_get(const struct json_t *obj, const char *key);
+const char *json_get_string(const struct json_t *obj, const char *key);
+
+/*
+ * Append len bytes of s to vsb as a quoted JSON string. If len is -1,
+ * s is nul-terminated.
+ *
+ * VSB_quote() escapes with octal sequences, which JSON does not allow.
+ */
+void json_quote(struct vsb *vsb, const char *s, ssize_t len);
+#endif
@@ -39,6 +39,8 @@
 PLUGIN(vping)
 PLUGIN(logger)
 PLUGIN(http)
+PLUGIN(events)
+PLUGIN(peers)
 PLUGIN(echo)
 PLUGIN(vstatus)
 PLUGIN(vcl)
@@ -52,3 +54,8 @@ PLUGIN(curl)
 PLUGIN(vac_register)
 PLUGIN(vdirect)
 PLUGIN(vbackends)
+PLUGIN(warm)
+PLUGIN(analysis)
+PLUGIN(alerts)
+PLUGIN(otlp)
+PLUGIN(archive)
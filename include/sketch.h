@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stdint.h>
+
+struct vsb;
+
+/*
+ * Bounded-memory summaries for the VSL analyzers, see analysis.h.
+ *
+ * topk is the Space-Saving algorithm: it keeps at most size keys, and a
+ * new key replaces the one with the smallest count, inheriting that
+ * count as its error. Every count is an overestimate by at most error,
+ * and all keys seen more than n / size times are kept. A min-heap on
+ * count finds the one to replace in O(log size). Each key carries
+ * TOPK_VALS sums for the caller, and optionally a priv that is freed
+ * with free_priv when the key is evicted.
+ */
+#define TOPK_VALS 4
+
+struct topk_item_t {
+	char *key;
+	uint64_t count;
+	uint64_t error;
+	double vals[TOPK_VALS];
+	void *priv;
+	unsigned hnext;		// Hash chain, index + 1
+	unsigned heap;		// Position in topk_t heap
+};
+
+struct topk_t {
+	unsigned size;
+	unsigned n;
+	uint64_t total;
+	struct topk_item_t *items;
+	unsigned *hash;		// Index + 1 of the first item, 2 * size
+	unsigned *heap;		// Item indexes, smallest count first
+	void (*free_priv)(void *priv);
+};
+
+struct topk_t *topk_new(unsigned size, void (*free_priv)(void *));
+void topk_delete(struct topk_t *tk);
+
+/*
+ * Count key n times. The item stays valid until the next topk_add(). If
+ * it is a new key, vals are zero and priv is NULL, so vals only cover
+ * the last count - error times: averages of vals divide by that.
+ */
+struct topk_item_t *topk_add(struct topk_t *tk, const char *key, uint64_t n);
+struct topk_item_t *topk_find(const struct topk_t *tk, const char *key);
+
+/*
+ * The items sorted by count (val -1) or vals[val], largest first. The
+ * caller frees the array, and *n is set to its length.
+ */
+struct topk_item_t **topk_sorted(const struct topk_t *tk, int val,
+    unsigned *n);
+
+/*
+ * Power of two histogram: bucket 0 counts values below 1, bucket i
+ * values in [2^(i-1), 2^i). The caller picks the unit.
+ */
+#define LOGHIST_BUCKETS 32
+
+struct loghist_t {
+	uint64_t n;
+	double sum;
+	double min;
+	double max;
+	uint64_t bucket[LOGHIST_BUCKETS];
+};
+
+void loghist_add(struct loghist_t *h, double v);
+
+/*
+ * Upper bound of the bucket holding quantile q (0 - 1), capped by max.
+ */
+double loghist_quantile(const struct loghist_t *h, double q);
+
+/*
+ * Append the histogram as a JSON object: n, min, avg, max, p50, p90,
+ * p99 and the non-empty buckets as [{"lt": bound, "count": n}].
+ */
+void loghist_json(struct vsb *vsb, const struct loghist_t *h);
+#endif
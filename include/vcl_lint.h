@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef VCL_LINT_H
+#define VCL_LINT_H
+
+struct vsb;
+
+/*
+ * Static checks of VCL for patterns that cost hit ratio or CPU.
+ *
+ * vcl_lint() tokenizes the VCL (comments and strings are skipped
+ * properly, includes are not followed) and returns the findings in
+ * source order, or NULL if there are none. Free them with
+ * vcl_lint_free().
+ */
+enum vcl_lint_severity {
+	VCL_LINT_INFO,
+	VCL_LINT_WARNING,
+	VCL_LINT_ERROR,
+};
+
+struct vcl_lint_t {
+	unsigned line;
+	enum vcl_lint_severity severity;
+	const char *rule;
+	const char *message;
+	struct vcl_lint_t *next;
+};
+
+struct vcl_lint_t *vcl_lint(const char *vcl);
+void vcl_lint_free(struct vcl_lint_t *lint);
+
+/*
+ * The worst severity of the findings, or -1 if there are none.
+ */
+int vcl_lint_worst(const struct vcl_lint_t *lint);
+
+/*
+ * "info", "warning" or "error", and back. vcl_lint_severity() returns -1
+ * for anything else.
+ */
+const char *vcl_lint_severity_name(enum vcl_lint_severity severity);
+int vcl_lint_severity(const char *name);
+
+/*
+ * Append the findings to vsb, one "line N: severity: message (rule)"
+ * per line, or as a JSON object.
+ */
+void vcl_lint_text(struct vsb *vsb, const struct vcl_lint_t *lint);
+void vcl_lint_json(struct vsb *vsb, const struct vcl_lint_t *lint);
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef VSL_ARCHIVE_H
+#define VSL_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * On-disk VSL archive, written by the archive plugin.
+ *
+ * The archive of an instance is a directory of segments, each a data
+ * file of zlib compressed blocks, vsl-<start>.data, and an index file,
+ * vsl-<start>.idx, with an archive_idx_t for every block in the order
+ * they were written. A block holds whole request groups. The index is
+ * sparse: it tells which time and vxid range a block covers and, as
+ * bitmaps and bloom filters, which statuses, URL prefixes and backends
+ * may be in it, so that a query only inflates the blocks that can have
+ * an answer.
+ *
+ * The bloom filters set 3 of ARCHIVE_BLOOM * 64 bits for each key. A
+ * block ends early when either has ARCHIVE_BLOOM_KEYS keys, which keeps
+ * false positives at about 3% however varied the URLs are.
+ *
+ * Both files are in the byte order of the host. The index entry is
+ * written after its block, so a reader never sees an entry for a block
+ * that is not complete.
+ */
+
+#define ARCHIVE_BLOOM		64	// 64 bit words, 4096 bits
+#define ARCHIVE_BLOOM_KEYS	512
+
+struct archive_idx_t {
+	uint64_t offset;	// Of the block in the data file
+	uint32_t clen;
+	uint32_t ulen;
+	double t_min;		// Start of the first and last group
+	double t_max;
+	uint32_t vxid_min;	// Of all transactions
+	uint32_t vxid_max;
+	uint32_t groups;
+	uint32_t status;	// Bit n set for a status of n00 to n99
+	uint64_t url[ARCHIVE_BLOOM];	// First and first two path segments
+	uint64_t backend[ARCHIVE_BLOOM];
+};
+
+/*
+ * A block being built. Groups go in with archive_block_group(), then
+ * for each transaction archive_block_trans() and its records.
+ * archive_block_full() tells when the bloom filters have all the keys
+ * they can take.
+ */
+struct archive_block_t {
+	char *buf;
+	size_t len;
+	size_t size;
+	unsigned nurl;		// Keys in the bloom filters
+	unsigned nbackend;
+	struct archive_idx_t idx;
+};
+
+/*
+ * What the index knows about a group. vxids are those of all its
+ * transactions, the first is the client request.
+ */
+struct archive_group_t {
+	double t;
+	unsigned status;	// Of the response to the client, or 0
+	const char *url;
+	const char *backend;	// "" if none
+	unsigned nvxid;
+	uint32_t vxid[64];
+};
+
+void archive_block_group(struct archive_block_t *b,
+    const struct archive_group_t *g);
+void archive_block_trans(struct archive_block_t *b, uint32_t vxid,
+    uint32_t parent, unsigned type, unsigned reason);
+void archive_block_record(struct archive_block_t *b, unsigned tag,
+    const char *data, size_t len);
+void archive_block_reset(struct archive_block_t *b);
+int archive_block_full(const struct archive_block_t *b);
+
+/*
+ * Compress the block into *out, malloc'ed, and fill in b->idx.clen.
+ * Returns -1 if zlib failed.
+ */
+int archive_block_compress(struct archive_block_t *b, char **out);
+/*
+ * The content of a compressed block, malloc'ed, or NULL if it is not
+ * what idx says it is.
+ */
+char *archive_block_inflate(const struct archive_idx_t *idx,
+    const char *data);
+
+/*
+ * Walking an inflated block. archive_next() returns 'G' at a group,
+ * with group set, 'T' at a transaction and 'R' at a record, with the
+ * fields of each set, 0 at the end and -1 if the block is corrupt.
+ */
+struct archive_cursor_t {
+	const char *p;
+	const char *e;
+	struct archive_group_t group;
+	uint32_t vxid;
+	uint32_t parent;
+	unsigned type;
+	unsigned reason;
+	unsigned tag;
+	const char *data;
+	unsigned len;
+	char url[1024];
+	char backend[128];
+};
+
+void archive_cursor_init(struct archive_cursor_t *c, const char *buf,
+    size_t len);
+int archive_next(struct archive_cursor_t *c);
+
+/*
+ * A query. from and to are inclusive, 0 for no limit. status is a
+ * status, or 1-9 for a class (5 for 5xx), or 0 for any. url matches
+ * itself and everything under it, whole path segments only: /api is
+ * /api, /api/ and /api?x but not /apix. backend is a backend name, with
+ * or without the VCL name in front.
+ */
+struct archive_query_t {
+	double from;
+	double to;
+	uint32_t vxid;		// 0 for any
+	unsigned status;
+	const char *url;
+	const char *backend;
+};
+
+/* Whether a block may have a match, from its index entry */
+int archive_idx_match(const struct archive_idx_t *idx,
+    const struct archive_query_t *q);
+int archive_group_match(const struct archive_group_t *g,
+    const struct archive_query_t *q);
+
+/*
+ * The length of the first nseg path segments of url, 0 if it does not
+ * have that many.
+ */
+size_t archive_url_prefix(const char *url, unsigned nseg);
+#endif
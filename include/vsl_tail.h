@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef VSL_TAIL_H
+#define VSL_TAIL_H
+
+#include <time.h>
+#include <vapi/vsl.h>
+
+struct agent_core_t;
+struct VSM_data;
+
+/*
+ * Following the shmlog of an instance from a plugin thread, for the
+ * analysis, otlp and archive plugins.
+ *
+ * vsl_tail_poll() opens the shmlog of the current instance if it isn't
+ * open, no more often than every interval seconds, with a query for
+ * each grouping in groupings, and dispatches the new transactions to
+ * func. If varnishd restarted or we fell behind, it closes the shmlog
+ * and returns, the next call opens it again. g is the grouping being
+ * dispatched, for func. what tells the log messages what the shmlog is
+ * opened for; logger is a handle of the calling thread.
+ *
+ * Returns 1 if there was anything to read.
+ */
+struct vsl_tail_t {
+	/* Set by the caller */
+	const char *what;
+	unsigned groupings;	// 1 << VSL_grouping_e for each query
+	unsigned interval;
+
+	struct VSM_data *vsm;
+	struct VSL_data *vsl;
+	struct VSLQ *vslq[VSL_g__MAX];
+	enum VSL_grouping_e g;
+	int open;
+	int warned;
+	time_t retry;
+};
+
+/*
+ * Names of the transaction types and reasons, for showing a
+ * VSL_transaction.
+ */
+extern const char * const vsl_t_names[VSL_t__MAX];
+extern const char * const vsl_r_names[VSL_r__MAX];
+
+int vsl_tail_poll(struct vsl_tail_t *t, struct agent_core_t *core,
+    int logger, VSLQ_dispatch_f *func, void *priv);
+void vsl_tail_close(struct vsl_tail_t *t);
+#endif
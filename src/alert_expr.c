@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Alert rule expressions, see alert_expr.h.
+ *
+ * A recursive descent parser emits the code in postfix order, so that
+ * evaluating it is a loop over a fixed size stack.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "alert_expr.h"
+
+#define ALERT_EXPR_DEPTH	32	// Stack
+#define ALERT_EXPR_NEST		64	// Parentheses and unary operators
+
+enum alert_op {
+	OP_CONST,
+	OP_VALUE,
+	OP_DELTA,
+	OP_RATE,
+	OP_NEG,
+	OP_NOT,
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_EQ,
+	OP_NE,
+	OP_AND,
+	OP_OR,
+};
+
+struct alert_insn_t {
+	enum alert_op op;
+	unsigned arg;		// Constant or counter
+};
+
+struct alert_expr_t {
+	struct alert_insn_t *code;
+	unsigned ncode;
+	double *consts;
+	unsigned nconsts;
+	char **counters;
+	unsigned ncounters;
+};
+
+struct alert_parse_t {
+	const char *src;
+	const char *p;
+	struct alert_expr_t *e;
+	unsigned depth;
+	unsigned maxdepth;
+	unsigned nest;
+	char *err;
+};
+
+static void alert_or(struct alert_parse_t *ap);
+
+static void
+alert_error(struct alert_parse_t *ap, const char *msg)
+{
+	if (ap->err != NULL)
+		return;
+	if (*ap->p == '\0')
+		assert(asprintf(&ap->err, "%s at the end", msg) > 0);
+	else
+		assert(asprintf(&ap->err, "%s at column %u", msg,
+		    (unsigned)(ap->p - ap->src) + 1) > 0);
+}
+
+static void
+alert_emit(struct alert_parse_t *ap, enum alert_op op, unsigned arg)
+{
+	struct alert_expr_t *e = ap->e;
+
+	if (ap->err != NULL)
+		return;
+	e->code = realloc(e->code, (e->ncode + 1) * sizeof *e->code);
+	AN(e->code);
+	e->code[e->ncode].op = op;
+	e->code[e->ncode].arg = arg;
+	e->ncode++;
+	/* What it does to the stack */
+	if (op <= OP_RATE)
+		ap->depth++;
+	else if (op > OP_NOT)
+		ap->depth--;
+	if (ap->depth > ap->maxdepth)
+		ap->maxdepth = ap->depth;
+	if (ap->maxdepth > ALERT_EXPR_DEPTH)
+		alert_error(ap, "Expression too complex");
+}
+
+static void
+alert_space(struct alert_parse_t *ap)
+{
+	while (isspace((unsigned char)*ap->p))
+		ap->p++;
+}
+
+/*
+ * Skip tok if it comes next.
+ */
+static int
+alert_accept(struct alert_parse_t *ap, const char *tok)
+{
+	size_t l = strlen(tok);
+
+	alert_space(ap);
+	if (strncmp(ap->p, tok, l))
+		return (0);
+	/* Not the start of "<=", "==" and the like */
+	if (l == 1 && strchr("<>=!", *tok) != NULL && ap->p[1] == '=')
+		return (0);
+	ap->p += l;
+	return (1);
+}
+
+static int
+alert_namechar(int c)
+{
+	return (isalnum(c) || c == '_' || c == '.' || c == '-' || c == ':');
+}
+
+static unsigned
+alert_counter(struct alert_parse_t *ap, const char *name, size_t l)
+{
+	struct alert_expr_t *e = ap->e;
+	unsigned i;
+
+	for (i = 0; i < e->ncounters; i++)
+		if (strlen(e->counters[i]) == l &&
+		    !strncmp(e->counters[i], name, l))
+			return (i);
+	e->counters = realloc(e->counters,
+	    (e->ncounters + 1) * sizeof *e->counters);
+	AN(e->counters);
+	e->counters[i] = strndup(name, l);
+	AN(e->counters[i]);
+	e->ncounters++;
+	return (i);
+}
+
+/*
+ * A counter name, bare or quoted, and its index.
+ */
+static int
+alert_name(struct alert_parse_t *ap, unsigned *idx)
+{
+	const char *s;
+
+	alert_space(ap);
+	s = ap->p;
+	if (*s == '"') {
+		for (ap->p++; *ap->p != '"'; ap->p++)
+			if (*ap->p == '\0') {
+				alert_error(ap, "Unterminated name");
+				return (0);
+			}
+		*idx = alert_counter(ap, s + 1, ap->p - s - 1);
+		ap->p++;
+		return (1);
+	}
+	while (alert_namechar((unsigned char)*ap->p))
+		ap->p++;
+	if (ap->p == s || !isalpha((unsigned char)*s)) {
+		ap->p = s;
+		alert_error(ap, "Expected a counter");
+		return (0);
+	}
+	*idx = alert_counter(ap, s, ap->p - s);
+	return (1);
+}
+
+static void
+alert_primary(struct alert_parse_t *ap)
+{
+	struct alert_expr_t *e = ap->e;
+	enum alert_op op;
+	unsigned idx;
+	char *end;
+	double v;
+
+	alert_space(ap);
+	if (alert_accept(ap, "(")) {
+		alert_or(ap);
+		if (!alert_accept(ap, ")"))
+			alert_error(ap, "Expected ')'");
+		return;
+	}
+	if (isdigit((unsigned char)*ap->p) || *ap->p == '.') {
+		v = strtod(ap->p, &end);
+		ap->p = end;
+		e->consts = realloc(e->consts,
+		    (e->nconsts + 1) * sizeof *e->consts);
+		AN(e->consts);
+		e->consts[e->nconsts] = v;
+		alert_emit(ap, OP_CONST, e->nconsts++);
+		return;
+	}
+	if (!strncmp(ap->p, "rate", 4) || !strncmp(ap->p, "delta", 5)) {
+		op = *ap->p == 'r' ? OP_RATE : OP_DELTA;
+		end = (char *)ap->p + (op == OP_RATE ? 4 : 5);
+		while (isspace((unsigned char)*end))
+			end++;
+		if (*end == '(') {
+			ap->p = end + 1;
+			if (!alert_name(ap, &idx))
+				return;
+			if (!alert_accept(ap, ")"))
+				alert_error(ap, "Expected ')'");
+			alert_emit(ap, op, idx);
+			return;
+		}
+	}
+	if (!alert_name(ap, &idx))
+		return;
+	alert_space(ap);
+	if (*ap->p == '(') {
+		alert_error(ap, "Unknown function");
+		return;
+	}
+	alert_emit(ap, OP_VALUE, idx);
+}
+
+static void
+alert_unary(struct alert_parse_t *ap)
+{
+	if (++ap->nest > ALERT_EXPR_NEST)
+		alert_error(ap, "Expression too deep");
+	if (ap->err != NULL)
+		return;
+	if (alert_accept(ap, "-")) {
+		alert_unary(ap);
+		alert_emit(ap, OP_NEG, 0);
+	} else if (alert_accept(ap, "!")) {
+		alert_unary(ap);
+		alert_emit(ap, OP_NOT, 0);
+	} else
+		alert_primary(ap);
+	ap->nest--;
+}
+
+static void
+alert_mul(struct alert_parse_t *ap)
+{
+	enum alert_op op;
+
+	alert_unary(ap);
+	while (ap->err == NULL) {
+		if (alert_accept(ap, "*"))
+			op = OP_MUL;
+		else if (alert_accept(ap, "/"))
+			op = OP_DIV;
+		else if (alert_accept(ap, "%"))
+			op = OP_MOD;
+		else
+			return;
+		alert_unary(ap);
+		alert_emit(ap, op, 0);
+	}
+}
+
+static void
+alert_add(struct alert_parse_t *ap)
+{
+	enum alert_op op;
+
+	alert_mul(ap);
+	while (ap->err == NULL) {
+		if (alert_accept(ap, "+"))
+			op = OP_ADD;
+		else if (alert_accept(ap, "-"))
+			op = OP_SUB;
+		else
+			return;
+		alert_mul(ap);
+		alert_emit(ap, op, 0);
+	}
+}
+
+static void
+alert_cmp(struct alert_parse_t *ap)
+{
+	static const struct {
+		const char *tok;
+		enum alert_op op;
+	} cmps[] = {
+		{ "<=", OP_LE }, { ">=", OP_GE }, { "==", OP_EQ },
+		{ "!=", OP_NE }, { "<", OP_LT }, { ">", OP_GT },
+	};
+	unsigned i;
+
+	alert_add(ap);
+	for (i = 0; i < sizeof cmps / sizeof *cmps; i++)
+		if (alert_accept(ap, cmps[i].tok)) {
+			alert_add(ap);
+			alert_emit(ap, cmps[i].op, 0);
+			return;
+		}
+}
+
+static void
+alert_and(struct alert_parse_t *ap)
+{
+	alert_cmp(ap);
+	while (ap->err == NULL && alert_accept(ap, "&&")) {
+		alert_cmp(ap);
+		alert_emit(ap, OP_AND, 0);
+	}
+}
+
+static void
+alert_or(struct alert_parse_t *ap)
+{
+	alert_and(ap);
+	while (ap->err == NULL && alert_accept(ap, "||")) {
+		alert_and(ap);
+		alert_emit(ap, OP_OR, 0);
+	}
+}
+
+struct alert_expr_t *
+alert_expr_compile(const char *src, char **err)
+{
+	struct alert_parse_t ap;
+
+	AN(src);
+	AN(err);
+	memset(&ap, 0, sizeof ap);
+	ap.src = ap.p = src;
+	ALLOC_OBJ(ap.e);
+	alert_or(&ap);
+	alert_space(&ap);
+	if (ap.err == NULL && *ap.p != '\0')
+		alert_error(&ap, "Unexpected input");
+	if (ap.err != NULL) {
+		alert_expr_free(ap.e);
+		*err = ap.err;
+		return (NULL);
+	}
+	*err = NULL;
+	return (ap.e);
+}
+
+void
+alert_expr_free(struct alert_expr_t *e)
+{
+	unsigned i;
+
+	if (e == NULL)
+		return;
+	for (i = 0; i < e->ncounters; i++)
+		free(e->counters[i]);
+	free(e->counters);
+	free(e->consts);
+	free(e->code);
+	free(e);
+}
+
+unsigned
+alert_expr_ncounters(const struct alert_expr_t *e)
+{
+	return (e->ncounters);
+}
+
+const char *
+alert_expr_counter(const struct alert_expr_t *e, unsigned i)
+{
+	assert(i < e->ncounters);
+	return (e->counters[i]);
+}
+
+int
+alert_expr_true(double v)
+{
+	return (!isnan(v) && v != 0);
+}
+
+double
+alert_expr_eval(const struct alert_expr_t *e, const double *cur,
+    const double *prev, double dt)
+{
+	double st[ALERT_EXPR_DEPTH], a, b;
+	const struct alert_insn_t *in;
+	unsigned sp = 0, i;
+
+	for (i = 0; i < e->ncode; i++) {
+		in = &e->code[i];
+		switch (in->op) {
+		case OP_CONST:
+			st[sp++] = e->consts[in->arg];
+			continue;
+		case OP_VALUE:
+			st[sp++] = cur[in->arg];
+			continue;
+		case OP_DELTA:
+			st[sp++] = cur[in->arg] - prev[in->arg];
+			continue;
+		case OP_RATE:
+			st[sp++] = dt > 0 ?
+			    (cur[in->arg] - prev[in->arg]) / dt : NAN;
+			continue;
+		case OP_NEG:
+			st[sp - 1] = -st[sp - 1];
+			continue;
+		case OP_NOT:
+			st[sp - 1] = !alert_expr_true(st[sp - 1]);
+			continue;
+		default:
+			break;
+		}
+		assert(sp >= 2);
+		b = st[--sp];
+		a = st[sp - 1];
+		switch (in->op) {
+		case OP_ADD:	a += b; break;
+		case OP_SUB:	a -= b; break;
+		case OP_MUL:	a *= b; break;
+		case OP_DIV:	a = b != 0 ? a / b : NAN; break;
+		case OP_MOD:	a = b != 0 ? fmod(a, b) : NAN; break;
+		case OP_LT:	a = a < b; break;
+		case OP_LE:	a = a <= b; break;
+		case OP_GT:	a = a > b; break;
+		case OP_GE:	a = a >= b; break;
+		case OP_EQ:	a = a == b; break;
+		case OP_NE:	a = !isnan(a) && !isnan(b) && a != b; break;
+		case OP_AND:
+			a = alert_expr_true(a) && alert_expr_true(b);
+			break;
+		case OP_OR:
+			a = alert_expr_true(a) || alert_expr_true(b);
+			break;
+		default:
+			assert(0);
+		}
+		st[sp - 1] = a;
+	}
+	assert(sp == 1);
+	return (st[0]);
+}
@@ -72,13 +72,14 @@ run_and_respond_eok(int vadmin, struct MHD_Connection *conn,
  * Run a varnishadm-command and send the result of that command back to the
  * http connection. If varnishd returns 200, then so do we. Otherwise: 500.
  */
-void
+unsigned
 run_and_respond(int vadmin, struct MHD_Connection *conn, const char *fmt, ...)
 {
 	struct ipc_ret_t vret;
 	va_list ap;
 	char *buffer;
 	int iret;
+	unsigned status;
 
 	va_start(ap, fmt);
 	iret = vasprintf(&buffer, fmt, ap);
@@ -87,8 +88,10 @@ run_and_respond(int vadmin, struct MHD_Connection *conn, const char *fmt, ...)
 	ipc_run(vadmin, &vret, "%s", buffer);
 
 	http_reply(conn, vret.status == 200 ? 200 : 500, vret.answer);
+	status = vret.status;
 	free(buffer);
 	free(vret.answer);
+	return (status);
 }
 
 unsigned int
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Bookkeeping for multiple varnishd instances. See instance.h.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "instance.h"
+
+static __thread int instance_cur;
+
+void
+instance_add(struct agent_config_t *config, char *n_arg)
+{
+	struct agent_instance_t *inst;
+
+	AN(n_arg);
+	config->instances = realloc(config->instances,
+	    (config->ninstances + 1) * sizeof *config->instances);
+	AN(config->instances);
+	inst = &config->instances[config->ninstances++];
+	memset(inst, 0, sizeof *inst);
+	inst->n_arg = n_arg;
+}
+
+void
+instance_init(struct agent_config_t *config)
+{
+	struct agent_instance_t *inst;
+	char *p;
+	int i, j;
+
+	if (config->ninstances == 0) {
+		p = strdup("");
+		AN(p);
+		instance_add(config, p);
+	}
+	config->n_arg = config->instances[0].n_arg;
+
+	for (i = 0; i < config->ninstances; i++) {
+		inst = &config->instances[i];
+		inst->name = strdup(inst->n_arg);
+		AN(inst->name);
+		while ((p = strrchr(inst->name, '/')) != NULL && p[1] == '\0')
+			*p = '\0';
+		if (p != NULL)
+			memmove(inst->name, p + 1, strlen(p + 1) + 1);
+		if (*inst->name == '\0') {
+			free(inst->name);
+			inst->name = strdup("default");
+			AN(inst->name);
+		}
+		for (j = 0; j < i; j++)
+			if (!strcmp(config->instances[j].name, inst->name))
+				errx(1, "Two instances named \"%s\". The last "
+				    "part of each -n argument must be unique.",
+				    inst->name);
+
+		/* The default instance keeps its VCL where it always did */
+		if (i == 0)
+			inst->p_arg = config->p_arg;
+		else {
+			assert(0 < asprintf(&p, "%s/%s", config->p_arg,
+			    inst->name));
+			inst->p_arg = p;
+		}
+	}
+}
+
+int
+instance_current(void)
+{
+
+	return (instance_cur);
+}
+
+void
+instance_select(int idx)
+{
+
+	assert(idx >= 0);
+	instance_cur = idx;
+}
+
+struct agent_instance_t *
+instance_get(struct agent_core_t *core)
+{
+
+	assert(instance_cur < core->config->ninstances);
+	return (&core->config->instances[instance_cur]);
+}
+
+int
+instance_find(struct agent_core_t *core, const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < core->config->ninstances; i++)
+		if (strlen(core->config->instances[i].name) == len &&
+		    !strncmp(core->config->instances[i].name, name, len))
+			return (i);
+	return (-1);
+}
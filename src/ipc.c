@@ -62,6 +62,7 @@
 #include <vcli.h>
 
 #include "common.h"
+#include "instance.h"
 #include "ipc.h"
 #include "plugins.h"
 
@@ -78,17 +79,44 @@
  */
 static pthread_t tid_to_fd[1024];
 
+/*
+ * "%09d %04d ": length and instance.
+ */
+#define IPC_HDR_LEN	15
+
+/*
+ * Set by ipc_thread_alias() for threads that take turns using the handles
+ * of another thread.
+ */
+static __thread pthread_t ipc_owner;
+static __thread int ipc_aliased;
+
+static pthread_t
+ipc_self(void)
+{
+
+	return (ipc_aliased ? ipc_owner : pthread_self());
+}
+
 static void
 ipc_verify_sock_thread(int sock)
 {
 
 	if (sock < 1024) {
 		if (tid_to_fd[sock] == 0)
-			tid_to_fd[sock] = pthread_self();
-		assert(tid_to_fd[sock] == pthread_self());
+			tid_to_fd[sock] = ipc_self();
+		assert(tid_to_fd[sock] == ipc_self());
 	}
 }
 
+void
+ipc_thread_alias(pthread_t owner)
+{
+
+	ipc_owner = owner;
+	ipc_aliased = 1;
+}
+
 /*
  * Client
  */
@@ -114,19 +142,23 @@ ipc_write(int sock, const char *s, int len)
 /*
  * Write the command, read the result.
  * XXX: VCLI_ReadResult will allocate ret->answer. Caller MUST free it.
+ *
+ * The header is the length, then the instance we are working for, so the
+ * provider can act on the same one (see instance.h).
  */
 void
 ipc_send(int handle, void *data, int len, struct ipc_ret_t *ret)
 {
-	char buffer[12];
+	char buffer[IPC_HDR_LEN + 1];
 
 	assert(data);
 	assert(len < 1000000000);
 	assert(len >= 0);
 	assert(threads_started > 0);
+	assert(instance_current() < 10000);
 
-	snprintf(buffer,11,"%09d ",len);
-	ipc_write(handle, buffer, 10);
+	snprintf(buffer, sizeof buffer, "%09d %04d ", len, instance_current());
+	ipc_write(handle, buffer, IPC_HDR_LEN);
 	ipc_write(handle, data, len);
 
 	VCLI_ReadResult(handle, &ret->status, &ret->answer, 5.0);
@@ -182,24 +214,28 @@ ipc_register(struct agent_core_t *core, const char *name)
 /*
  * A command was apparently issued.
  *
- * Commands now have 16 bytes of decimal-encoded size.
+ * Commands have a header with the decimal-encoded size and instance, see
+ * ipc_send().
  *
  * Note that &ret must be populated with something we can free().
  */
 static int
 ipc_cmd(int fd, struct ipc_t *ipc)
 {
-	char buffer[11];
+	char buffer[IPC_HDR_LEN + 1];
 	struct ipc_ret_t ret;
 	int length = 0;
 	char *data;
 	int i, oldi;
 
-	i = read(fd, buffer, 10);
-	assert(i == 10);
+	i = read(fd, buffer, IPC_HDR_LEN);
+	assert(i == IPC_HDR_LEN);
 	assert(buffer[9] == ' ');
+	assert(buffer[IPC_HDR_LEN - 1] == ' ');
+	buffer[IPC_HDR_LEN] = '\0';
 	length = atoi(buffer);
 	assert(length >= 0);
+	instance_select(atoi(buffer + 10));
 
 	data = malloc(length+1);
 	assert(data);
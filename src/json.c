@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Minimal recursive descent JSON parser, see json.h.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "json.h"
+#include "vsb.h"
+
+#define JSON_MAX_DEPTH 64
+
+struct json_parser {
+	const char *p;
+	const char *err;
+	int depth;
+};
+
+static struct json_t *json_value(struct json_parser *jp);
+
+static void
+json_ws(struct json_parser *jp)
+{
+	while (*jp->p == ' ' || *jp->p == '\t' || *jp->p == '\n' ||
+	    *jp->p == '\r')
+		jp->p++;
+}
+
+static int
+json_hex4(const char *p, unsigned *u)
+{
+	int i;
+
+	*u = 0;
+	for (i = 0; i < 4; i++) {
+		if (!isxdigit((unsigned char)p[i]))
+			return (0);
+		*u <<= 4;
+		if (p[i] <= '9')
+			*u |= p[i] - '0';
+		else
+			*u |= (p[i] | 0x20) - 'a' + 10;
+	}
+	return (1);
+}
+
+static void
+json_utf8(struct vsb *vsb, unsigned u)
+{
+	if (u < 0x80) {
+		VSB_putc(vsb, u);
+	} else if (u < 0x800) {
+		VSB_putc(vsb, 0xc0 | (u >> 6));
+		VSB_putc(vsb, 0x80 | (u & 0x3f));
+	} else if (u < 0x10000) {
+		VSB_putc(vsb, 0xe0 | (u >> 12));
+		VSB_putc(vsb, 0x80 | ((u >> 6) & 0x3f));
+		VSB_putc(vsb, 0x80 | (u & 0x3f));
+	} else {
+		VSB_putc(vsb, 0xf0 | (u >> 18));
+		VSB_putc(vsb, 0x80 | ((u >> 12) & 0x3f));
+		VSB_putc(vsb, 0x80 | ((u >> 6) & 0x3f));
+		VSB_putc(vsb, 0x80 | (u & 0x3f));
+	}
+}
+
+/*
+ * Parse a string starting at the opening quote. Returns a malloc'ed,
+ * unescaped copy.
+ */
+static char *
+json_string(struct json_parser *jp)
+{
+	struct vsb *vsb;
+	unsigned u, lo;
+	char *s;
+
+	assert(*jp->p == '"');
+	jp->p++;
+	vsb = VSB_new_auto();
+	AN(vsb);
+	while (*jp->p != '"') {
+		if (*jp->p == '\0' || (unsigned char)*jp->p < 0x20) {
+			jp->err = "Unterminated string";
+			VSB_delete(vsb);
+			return (NULL);
+		}
+		if (*jp->p != '\\') {
+			VSB_putc(vsb, *jp->p++);
+			continue;
+		}
+		jp->p++;
+		switch (*jp->p) {
+		case '"': VSB_putc(vsb, '"'); break;
+		case '\\': VSB_putc(vsb, '\\'); break;
+		case '/': VSB_putc(vsb, '/'); break;
+		case 'b': VSB_putc(vsb, '\b'); break;
+		case 'f': VSB_putc(vsb, '\f'); break;
+		case 'n': VSB_putc(vsb, '\n'); break;
+		case 'r': VSB_putc(vsb, '\r'); break;
+		case 't': VSB_putc(vsb, '\t'); break;
+		case 'u':
+			if (!json_hex4(jp->p + 1, &u)) {
+				jp->err = "Bad \\u escape";
+				VSB_delete(vsb);
+				return (NULL);
+			}
+			jp->p += 4;
+			if (u >= 0xd800 && u < 0xdc00 && jp->p[1] == '\\' &&
+			    jp->p[2] == 'u' && json_hex4(jp->p + 3, &lo) &&
+			    lo >= 0xdc00 && lo < 0xe000) {
+				u = 0x10000 + ((u - 0xd800) << 10) +
+				    (lo - 0xdc00);
+				jp->p += 6;
+			}
+			json_utf8(vsb, u);
+			break;
+		default:
+			jp->err = "Bad escape";
+			VSB_delete(vsb);
+			return (NULL);
+		}
+		jp->p++;
+	}
+	jp->p++;
+	AZ(VSB_finish(vsb));
+	s = strdup(VSB_data(vsb));
+	AN(s);
+	VSB_delete(vsb);
+	return (s);
+}
+
+static int
+json_literal(struct json_parser *jp, const char *lit)
+{
+	size_t len = strlen(lit);
+
+	if (strncmp(jp->p, lit, len))
+		return (0);
+	jp->p += len;
+	return (1);
+}
+
+/*
+ * Parse the elements of an array or the members of an object, starting
+ * after the opening bracket.
+ */
+static int
+json_members(struct json_parser *jp, struct json_t *json, char close)
+{
+	struct json_t **tail = &json->child;
+	struct json_t *child;
+	char *key = NULL;
+
+	json_ws(jp);
+	if (*jp->p == close) {
+		jp->p++;
+		return (1);
+	}
+	for (;;) {
+		json_ws(jp);
+		if (close == '}') {
+			if (*jp->p != '"') {
+				jp->err = "Expected member name";
+				return (0);
+			}
+			key = json_string(jp);
+			if (key == NULL)
+				return (0);
+			json_ws(jp);
+			if (*jp->p != ':') {
+				jp->err = "Expected ':'";
+				free(key);
+				return (0);
+			}
+			jp->p++;
+		}
+		child = json_value(jp);
+		if (child == NULL) {
+			free(key);
+			return (0);
+		}
+		child->key = key;
+		key = NULL;
+		*tail = child;
+		tail = &child->next;
+		json_ws(jp);
+		if (*jp->p == close) {
+			jp->p++;
+			return (1);
+		}
+		if (*jp->p != ',') {
+			jp->err = close == '}' ? "Expected ',' or '}'" :
+			    "Expected ',' or ']'";
+			return (0);
+		}
+		jp->p++;
+	}
+}
+
+static struct json_t *
+json_value(struct json_parser *jp)
+{
+	struct json_t *json;
+	char *end;
+
+	json_ws(jp);
+	ALLOC_OBJ(json);
+	switch (*jp->p) {
+	case '{':
+	case '[':
+		if (++jp->depth > JSON_MAX_DEPTH) {
+			jp->err = "Nested too deep";
+			break;
+		}
+		json->type = *jp->p == '{' ? JSON_OBJECT : JSON_ARRAY;
+		jp->p++;
+		if (!json_members(jp, json, json->type == JSON_OBJECT ?
+		    '}' : ']'))
+			break;
+		jp->depth--;
+		return (json);
+	case '"':
+		json->type = JSON_STRING;
+		json->string = json_string(jp);
+		if (json->string == NULL)
+			break;
+		return (json);
+	case 't':
+	case 'f':
+		json->type = JSON_BOOL;
+		if (json_literal(jp, "true")) {
+			json->number = 1;
+			return (json);
+		}
+		if (json_literal(jp, "false"))
+			return (json);
+		jp->err = "Bad literal";
+		break;
+	case 'n':
+		json->type = JSON_NULL;
+		if (json_literal(jp, "null"))
+			return (json);
+		jp->err = "Bad literal";
+		break;
+	default:
+		if (*jp->p != '-' && !isdigit((unsigned char)*jp->p)) {
+			jp->err = *jp->p ? "Unexpected character" :
+			    "Unexpected end of input";
+			break;
+		}
+		json->type = JSON_NUMBER;
+		json->number = strtod(jp->p, &end);
+		if (end == jp->p) {
+			jp->err = "Bad number";
+			break;
+		}
+		json->string = malloc(end - jp->p + 1);
+		AN(json->string);
+		memcpy(json->string, jp->p, end - jp->p);
+		json->string[end - jp->p] = '\0';
+		jp->p = end;
+		return (json);
+	}
+	json_free(json);
+	return (NULL);
+}
+
+struct json_t *
+json_parse(const char *text, const char **err)
+{
+	struct json_parser jp;
+	struct json_t *json;
+
+	AN(text);
+	memset(&jp, 0, sizeof jp);
+	jp.p = text;
+	jp.err = "Bad JSON";
+	json = json_value(&jp);
+	if (json) {
+		json_ws(&jp);
+		if (*jp.p != '\0') {
+			jp.err = "Trailing garbage";
+			json_free(json);
+			json = NULL;
+		}
+	}
+	if (json == NULL && err)
+		*err = jp.err;
+	return (json);
+}
+
+void
+json_free(struct json_t *json)
+{
+	struct json_t *next;
+
+	while (json) {
+		next = json->next;
+		json_free(json->child);
+		free(json->key);
+		free(json->string);
+		free(json);
+		json = next;
+	}
+}
+
+struct json_t *
+json_get(const struct json_t *obj, const char *key)
+{
+	struct json_t *json;
+
+	if (obj == NULL || obj->type != JSON_OBJECT)
+		return (NULL);
+	for (json = obj->child; json; json = json->next)
+		if (!strcmp(json->key, key))
+			return (json);
+	return (NULL);
+}
+
+const char *
+json_get_string(const struct json_t *obj, const char *key)
+{
+	struct json_t *json;
+
+	json = json_get(obj, key);
+	if (json == NULL || json->type != JSON_STRING)
+		return (NULL);
+	return (json->string);
+}
+
+void
+json_quote(struct vsb *vsb, const char *s, ssize_t len)
+{
+	const char *end;
+
+	AN(s);
+	if (len < 0)
+		len = strlen(s);
+	end = s + len;
+	VSB_putc(vsb, '"');
+	for (; s < end; s++) {
+		switch (*s) {
+		case '"': VSB_cat(vsb, "\\\""); break;
+		case '\\': VSB_cat(vsb, "\\\\"); break;
+		case '\n': VSB_cat(vsb, "\\n"); break;
+		case '\r': VSB_cat(vsb, "\\r"); break;
+		case '\t': VSB_cat(vsb, "\\t"); break;
+		default:
+			if ((unsigned char)*s < 0x20)
+				VSB_printf(vsb, "\\u%04x", (unsigned char)*s);
+			else
+				VSB_putc(vsb, *s);
+		}
+	}
+	VSB_putc(vsb, '"');
+}
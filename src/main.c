@@ -60,6 +60,9 @@
 #include "common.h"
 #include "plugins.h"
 #include "ipc.h"
+#include "instance.h"
+#include "vcl_lint.h"
+#include "analysis.h"
 #include "base64.h"
 
 #ifdef __APPLE__
@@ -106,18 +109,38 @@ usage(const char *argv0)
 {
 	fprintf(stderr,
 	    "usage %s [options]\n"
+	    "    -A directory          Archive the shmlog in directory, see\n"
+	    "                          GET /log/archive.\n"
 	    "    -a bind_address       Address to bind against. (default: 0.0.0.0)\n"
+	    "                          Can be given multiple times.\n"
+	    "    -B severity           Refuse VCL with lint findings of this severity\n"
+	    "                          or worse: info, warning or error. See\n"
+	    "                          POST /vcl/lint.\n"
 	    "    -c port               HTTP listen port (default: 6085).\n"
 	    "    -C cafile             CA certificate file for cURL outgoing requests.\n"
 	    "    -d                    Debug. Runs in foreground.\n"
+	    "    -f peers-file         Other agents, one host:port per line, for\n"
+	    "                          ?fanout=all.\n"
 	    "    -g group              Group to run as (default: varnish)\n"
 	    "    -H directory          Where /html/ is located. Default: " AGENT_HTML_DIR "\n"
 	    "    -h                    This help.\n"
+	    "    -j                    Journal bans and add them again when the\n"
+	    "                          varnishd child restarts, for persistent\n"
+	    "                          storage. See /help/ban.\n"
 	    "    -k                    This option explicitly allows curl to perform 'insecure'\n"
 	    "                          SSL connections and transfers.\n"
 	    "    -K agent-secret-file  File containing username:password for authentication.\n"
 	    "                          Default: " AGENT_CONF_DIR "/agent_secret\n"
+	    "    -l listeners          Listening sockets per bind address, each served by\n"
+	    "                          its own thread (default: 1).\n"
+	    "    -L                    Lurker-friendly bans: rewrite req.url and\n"
+	    "                          req.http.host bans to obj.http.x-url and\n"
+	    "                          obj.http.x-host, see /banlurker.\n"
+	    "    -M megabytes          Size of the archive of each instance\n"
+	    "                          (default: 1024).\n"
 	    "    -n name               Name. Should match varnishd -n option.\n"
+	    "                          Can be given multiple times to manage several\n"
+	    "                          instances, see /i/<name>/.\n"
 	    "    -P pidfile            Write pidfile.\n"
 	    "    -p directory          Persistence directory: where VCL and parameters\n"
 	    "                          are stored. Default: " AGENT_PERSIST_DIR "\n"
@@ -127,10 +150,14 @@ usage(const char *argv0)
 	    "                          Location of the varnishd secret file.\n"
 	    "    -T host:port          Varnishd administrative interface.\n"
 	    "    -t timeout            Timeout for talking to varnishd (default: 5 seconds).\n"
+	    "    -U path               Also listen on a unix domain socket. Local clients\n"
+	    "                          running as our user or group need no password.\n"
 	    "    -u user               User to run as (default: varnish)\n"
 	    "    -w curl-timeout       Timeout for pushing stats against the VAC (default: 2 seconds).\n"
 	    "    -V                    Print version.\n"
 	    "    -v                    Verbose mode. Output everything.\n"
+	    "    -Y analyzers          Analyzers to run on the shmlog, comma separated,\n"
+	    "                          or all. See /help/analysis.\n"
 	    "    -z vac_register_url   VAC interface.\n\n",
 	    argv0);
 }
@@ -147,22 +174,39 @@ core_opt(struct agent_core_t *core, int argc, char **argv)
 
 	memset(core->config, '\0', sizeof(*core->config));
 	core->config->S_arg_fd = -1;
-	core->config->bind_address = "0.0.0.0";
 	core->config->local_port = "6085";
 	core->config->remote_port = "6085";
 	core->config->w_arg = 2;
 	core->config->timeout = 5;
+	core->config->l_arg = 1;
 	core->config->p_arg = AGENT_PERSIST_DIR;
 	core->config->H_arg = AGENT_HTML_DIR;
 	core->config->K_arg = AGENT_CONF_DIR "/agent_secret";
 	core->config->loglevel = 2;
 	core->config->k_arg = 0;
-	core->config->n_arg = strdup("");
-	AN(core->config->n_arg);
-	while ((opt = getopt(argc, argv, "a:C:c:dg:H:hkK:n:P:p:qrS:T:t:u:w:Vvz:")) != -1) {
+	core->config->B_arg = -1;
+	core->config->M_arg = 1024;
+	while ((opt = getopt(argc, argv, "A:a:B:C:c:df:g:H:hjkK:Ll:M:n:P:p:qrS:T:t:U:u:w:VvY:z:")) != -1) {
 		switch (opt) {
 		case 'a':
-			core->config->bind_address = optarg;
+			core->config->bind_address = realloc(
+			    core->config->bind_address,
+			    (core->config->nbind_address + 1) *
+			    sizeof *core->config->bind_address);
+			AN(core->config->bind_address);
+			core->config->bind_address[
+			    core->config->nbind_address++] = optarg;
+			break;
+		case 'A':
+			core->config->A_arg = optarg;
+			break;
+		case 'B':
+			core->config->B_arg = vcl_lint_severity(optarg);
+			if (core->config->B_arg < 0) {
+				fprintf(stderr,
+				    "Invalid lint severity: '%s'\n", optarg);
+				exit(1);
+			}
 			break;
 		case 'C':
 			core->config->C_arg = optarg;
@@ -179,6 +223,9 @@ core_opt(struct agent_core_t *core, int argc, char **argv)
 		case 'd':
 			core->config->d_arg = 1;
 			break;
+		case 'f':
+			core->config->f_arg = optarg;
+			break;
 		case 'g':
 			core->config->g_arg = optarg;
 			break;
@@ -194,8 +241,31 @@ core_opt(struct agent_core_t *core, int argc, char **argv)
 		case 'k':
 			core->config->k_arg = 1;
 			break;
+		case 'j':
+			core->config->j_arg = 1;
+			break;
+		case 'L':
+			core->config->L_arg = 1;
+			break;
+		case 'l':
+			core->config->l_arg = strtol(optarg, &sep, 10);
+			if (*sep != '\0' || core->config->l_arg <= 0) {
+				fprintf(stderr,
+				    "Invalid number of listeners: '%s'\n",
+				    optarg);
+				exit(1);
+			}
+			break;
+		case 'M':
+			core->config->M_arg = strtol(optarg, &sep, 10);
+			if (*sep != '\0' || core->config->M_arg <= 0) {
+				fprintf(stderr,
+				    "Invalid archive size: '%s'\n", optarg);
+				exit(1);
+			}
+			break;
 		case 'n':
-			core->config->n_arg = optarg;
+			instance_add(core->config, optarg);
 			break;
 		case 'P':
 			core->config->P_arg = optarg;
@@ -234,6 +304,9 @@ core_opt(struct agent_core_t *core, int argc, char **argv)
 			}
 			core->config->w_arg = curl_timeout;
 			break;
+		case 'U':
+			core->config->U_arg = optarg;
+			break;
 		case 'u':
 			core->config->u_arg = optarg;
 			break;
@@ -245,12 +318,28 @@ core_opt(struct agent_core_t *core, int argc, char **argv)
 		case 'v':
 			core->config->loglevel = 3;
 			break;
+		case 'Y':
+			if (analysis_select(optarg, NULL)) {
+				fprintf(stderr,
+				    "Invalid analyzers: '%s'\n", optarg);
+				exit(1);
+			}
+			core->config->Y_arg = optarg;
+			break;
 		case 'z':
 			core->config->vac_arg = strdup(optarg);
 			break;
 		}
 	}
 
+	if (core->config->nbind_address == 0) {
+		ALLOC_OBJ(core->config->bind_address);
+		core->config->bind_address[0] = "0.0.0.0";
+		core->config->nbind_address = 1;
+	}
+
+	instance_init(core->config);
+
 	if (optind < argc) {
 		fprintf(stderr, "Error: too many arguments.\n\n");
 		usage(*argv);
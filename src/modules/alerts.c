@@ -0,0 +1,806 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Alert rules evaluated in the agent.
+ *
+ * Every second the counters of each instance are sampled and every rule
+ * (see alert_expr.h) evaluated against them. A rule that holds for
+ * "for" seconds fires, and one that has not held for "clear" seconds
+ * resolves. Only those transitions are POSTed, once, to the webhook of
+ * the rule through the curl plugin; a failed delivery, a status other
+ * than 2xx included, is tried again every ALERTS_RETRY seconds until it
+ * goes through or is not true any more.
+ */
+
+#define _GNU_SOURCE
+#include <sys/time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vapi/vsc.h>
+#include <vapi/vsm.h>
+
+#include "common.h"
+#include "alert_expr.h"
+#include "http.h"
+#include "helpers.h"
+#include "instance.h"
+#include "ipc.h"
+#include "json.h"
+#include "plugins.h"
+#include "vsb.h"
+
+#define ALERTS_FILE	"alert.rules"
+#define ALERTS_RETRY	10	// Seconds between deliveries that failed
+#define ALERTS_NAME	64
+
+#define ALERTS_HELP \
+"GET /alerts - the rules and their state\n" \
+"GET /alerts/<name> - one rule\n" \
+"PUT /alerts/<name> - add or replace a rule, with a JSON object like\n" \
+"  {\"expr\": \"rate(MAIN.fetch_failed) > 1\", \"for\": 10, \"clear\": 30,\n" \
+"   \"url\": \"http://alerts.example.com/hook\"}\n" \
+"DELETE /alerts/<name> - remove a rule\n" \
+"PUT /push/url/alerts - the webhook of rules without an url\n" \
+"\n" \
+"Rules are evaluated every second against the counters, named like in\n" \
+"/stats (MAIN.client_req, VBE.boot.default.happy). delta(c) is the\n" \
+"change of a counter since the previous second and rate(c) the change\n" \
+"a second. There are numbers, + - * / %, comparisons, && || ! and\n" \
+"parentheses.\n" \
+"\n" \
+"A rule fires when its expression has held for \"for\" seconds (0),\n" \
+"and resolves when it has not for \"clear\" seconds (0). Each\n" \
+"transition is POSTed to the webhook as JSON, and tried again\n" \
+"until the webhook answers with a 2xx. Rules are kept in\n" \
+ALERTS_FILE " in the persistence directory.\n"
+
+enum alert_state {
+	ALERT_OK,
+	ALERT_PENDING,		// Holds, not for long enough
+	ALERT_FIRING,
+	ALERT_RESOLVING,	// Does not hold, not for long enough
+};
+
+static const char * const alert_states[] = {
+	[ALERT_OK]		= "ok",
+	[ALERT_PENDING]		= "pending",
+	[ALERT_FIRING]		= "firing",
+	[ALERT_RESOLVING]	= "resolving",
+};
+
+/* A rule on one instance */
+struct alert_inst_t {
+	enum alert_state state;
+	time_t since;		// Of state
+	double value;
+	int notified;		// The webhook knows it fires
+	time_t retry;
+	double *cur;
+	double *prev;
+};
+
+struct alert_rule_t {
+	char *name;
+	char *expr;
+	char *url;		// NULL for push_url
+	unsigned hold;		// "for"
+	unsigned clear;
+	struct alert_expr_t *code;
+	struct alert_inst_t *inst;
+	struct alert_rule_t *next;
+};
+
+struct alerts_vsm_t {
+	struct VSM_data *vsm;
+	int open;
+	time_t retry;
+	double t;		// Of the last sample
+};
+
+/* A transition to deliver */
+struct alert_note_t {
+	struct alert_rule_t *rule;
+	char *name;
+	int instance;
+	int firing;
+	char *url;
+	struct vsb *body;
+};
+
+struct alerts_priv_t {
+	int logger;
+	int tlogger;		// The thread, as curl
+	int curl;
+	pthread_mutex_t lck;	// rules, push_url
+	struct alert_rule_t *rules;
+	char *push_url;
+	int ninstances;
+	struct alerts_vsm_t *vsm;
+	const char *path;
+};
+
+static double
+alerts_now(void)
+{
+	struct timeval tv;
+
+	AZ(gettimeofday(&tv, NULL));
+	return (tv.tv_sec + tv.tv_usec * 1e-6);
+}
+
+static void
+alerts_rule_free(struct alert_rule_t *r, int ninstances)
+{
+	int i;
+
+	for (i = 0; i < ninstances; i++) {
+		free(r->inst[i].cur);
+		free(r->inst[i].prev);
+	}
+	free(r->inst);
+	alert_expr_free(r->code);
+	free(r->name);
+	free(r->expr);
+	free(r->url);
+	free(r);
+}
+
+/*
+ * The cur and prev arrays of the rule on every instance, for its
+ * counters, which start out missing.
+ */
+static void
+alerts_rule_arrays(struct alert_rule_t *r, int ninstances)
+{
+	unsigned n = alert_expr_ncounters(r->code), j;
+	int i;
+
+	for (i = 0; i < ninstances; i++) {
+		free(r->inst[i].cur);
+		free(r->inst[i].prev);
+		r->inst[i].cur = calloc(n + 1, sizeof(double));
+		r->inst[i].prev = calloc(n + 1, sizeof(double));
+		AN(r->inst[i].cur);
+		AN(r->inst[i].prev);
+		for (j = 0; j < n; j++)
+			r->inst[i].cur[j] = r->inst[i].prev[j] = NAN;
+		r->inst[i].value = NAN;
+	}
+}
+
+static struct alert_rule_t **
+alerts_find(struct alerts_priv_t *alerts, const char *name)
+{
+	struct alert_rule_t **rp;
+
+	for (rp = &alerts->rules; *rp != NULL; rp = &(*rp)->next)
+		if (!strcmp((*rp)->name, name))
+			break;
+	return (rp);
+}
+
+/*
+ * A rule from its JSON definition. NULL and *err set (to free) if it is
+ * not valid.
+ */
+static struct alert_rule_t *
+alerts_rule_new(const char *name, const struct json_t *def, char **err)
+{
+	struct alert_rule_t *r;
+	struct alert_expr_t *code;
+	const struct json_t *m;
+	const char *expr;
+	double hold = 0, clear = 0;
+
+	*err = NULL;
+	expr = json_get_string(def, "expr");
+	if (expr == NULL) {
+		*err = strdup("expr must be a string");
+		return (NULL);
+	}
+	if ((m = json_get(def, "for")) != NULL) {
+		if (m->type != JSON_NUMBER || m->number < 0)
+			*err = strdup("for must be a number of seconds");
+		hold = m->number;
+	}
+	if ((m = json_get(def, "clear")) != NULL) {
+		if (m->type != JSON_NUMBER || m->number < 0)
+			*err = strdup("clear must be a number of seconds");
+		clear = m->number;
+	}
+	if ((m = json_get(def, "url")) != NULL && m->type != JSON_STRING)
+		*err = strdup("url must be a string");
+	if (*err != NULL)
+		return (NULL);
+	code = alert_expr_compile(expr, err);
+	if (code == NULL)
+		return (NULL);
+
+	ALLOC_OBJ(r);
+	r->name = strdup(name);
+	r->expr = strdup(expr);
+	AN(r->name);
+	AN(r->expr);
+	if (m != NULL && *m->string != '\0') {
+		r->url = strdup(m->string);
+		AN(r->url);
+	}
+	r->hold = hold;
+	r->clear = clear;
+	r->code = code;
+	return (r);
+}
+
+static void
+alerts_rule_def(struct vsb *vsb, const struct alert_rule_t *r)
+{
+	VSB_cat(vsb, "{\"name\": ");
+	json_quote(vsb, r->name, -1);
+	VSB_cat(vsb, ", \"expr\": ");
+	json_quote(vsb, r->expr, -1);
+	VSB_printf(vsb, ", \"for\": %u, \"clear\": %u", r->hold, r->clear);
+	if (r->url != NULL) {
+		VSB_cat(vsb, ", \"url\": ");
+		json_quote(vsb, r->url, -1);
+	}
+}
+
+/*
+ * Write the rules to ALERTS_FILE, one JSON object a line. With the lock
+ * held.
+ */
+static void
+alerts_save(struct alerts_priv_t *alerts)
+{
+	struct alert_rule_t *r;
+	struct vsb *vsb;
+	char *tmp;
+	FILE *f;
+
+	assert(asprintf(&tmp, "%s.tmp", alerts->path) > 0);
+	vsb = VSB_new_auto();
+	AN(vsb);
+	for (r = alerts->rules; r != NULL; r = r->next) {
+		alerts_rule_def(vsb, r);
+		VSB_cat(vsb, "}\n");
+	}
+	AZ(VSB_finish(vsb));
+	f = fopen(tmp, "w");
+	if (f == NULL)
+		warnlog(alerts->logger, "Cannot open %s: %s", tmp,
+		    strerror(errno));
+	else if (fputs(VSB_data(vsb), f) == EOF || fclose(f) ||
+	    rename(tmp, alerts->path))
+		warnlog(alerts->logger, "Cannot write %s: %s", alerts->path,
+		    strerror(errno));
+	VSB_delete(vsb);
+	free(tmp);
+}
+
+static void
+alerts_load(struct alerts_priv_t *alerts)
+{
+	struct alert_rule_t *r, **rp;
+	struct json_t *def;
+	const char *err, *name;
+	char *line = NULL, *cerr;
+	size_t l = 0;
+	FILE *f;
+
+	f = fopen(alerts->path, "r");
+	if (f == NULL)
+		return;
+	rp = &alerts->rules;
+	while (getline(&line, &l, f) > 0) {
+		if ((def = json_parse(line, &err)) == NULL ||
+		    (name = json_get_string(def, "name")) == NULL) {
+			warnlog(alerts->logger, "Bad rule in %s: %s",
+			    alerts->path, line);
+			json_free(def);
+			continue;
+		}
+		r = alerts_rule_new(name, def, &cerr);
+		if (r == NULL) {
+			warnlog(alerts->logger, "Bad rule %s in %s: %s", name,
+			    alerts->path, cerr);
+			free(cerr);
+		} else {
+			r->inst = calloc(alerts->ninstances, sizeof *r->inst);
+			AN(r->inst);
+			alerts_rule_arrays(r, alerts->ninstances);
+			*rp = r;
+			rp = &r->next;
+		}
+		json_free(def);
+	}
+	free(line);
+	fclose(f);
+}
+
+static int
+alerts_sample_cb(void *priv, const struct VSC_point * const pt)
+{
+	struct alerts_priv_t *alerts = priv;
+	const struct VSC_section *sec;
+	struct alert_rule_t *r;
+	char name[256];
+	unsigned j, n;
+	int i = instance_current();
+
+	if (pt == NULL)
+		return (0);
+	sec = pt->section;
+	snprintf(name, sizeof name, "%s%s%s%s%s", sec->fantom->type,
+	    sec->fantom->type[0] ? "." : "", sec->fantom->ident,
+	    sec->fantom->ident[0] ? "." : "", pt->desc->name);
+	for (r = alerts->rules; r != NULL; r = r->next) {
+		n = alert_expr_ncounters(r->code);
+		for (j = 0; j < n; j++)
+			if (!strcmp(alert_expr_counter(r->code, j), name))
+				r->inst[i].cur[j] =
+				    *(const volatile uint64_t *)pt->ptr;
+	}
+	return (0);
+}
+
+/*
+ * Sample the counters of the current instance into the rules. With the
+ * lock held.
+ */
+static int
+alerts_sample(struct agent_core_t *core, struct alerts_priv_t *alerts,
+    double *dt)
+{
+	struct alerts_vsm_t *v = &alerts->vsm[instance_current()];
+	struct alert_rule_t *r;
+	struct alert_inst_t *in;
+	unsigned j, n;
+	double now;
+
+	if (v->open && VSM_Abandoned(v->vsm)) {
+		VSM_Delete(v->vsm);
+		v->vsm = NULL;
+		v->open = 0;
+	}
+	if (!v->open) {
+		if (time(NULL) < v->retry)
+			return (0);
+		v->retry = time(NULL) + ALERTS_RETRY;
+		v->vsm = VSM_New();
+		AN(v->vsm);
+		if (VSM_n_Arg(v->vsm, instance_get(core)->n_arg) != 1 ||
+		    VSM_Open(v->vsm) != 0) {
+			VSM_Delete(v->vsm);
+			v->vsm = NULL;
+			return (0);
+		}
+		v->open = 1;
+		v->t = 0;
+	}
+
+	for (r = alerts->rules; r != NULL; r = r->next) {
+		in = &r->inst[instance_current()];
+		n = alert_expr_ncounters(r->code);
+		for (j = 0; j < n; j++) {
+			in->prev[j] = v->t > 0 ? in->cur[j] : NAN;
+			in->cur[j] = NAN;
+		}
+	}
+	(void)VSC_Iter(v->vsm, NULL, alerts_sample_cb, alerts);
+	now = alerts_now();
+	*dt = v->t > 0 ? now - v->t : 0;
+	v->t = now;
+	return (1);
+}
+
+static void
+alerts_note(struct alert_note_t *note, struct alerts_priv_t *alerts,
+    struct alert_rule_t *r, int i, const char *instance, time_t now)
+{
+	struct alert_inst_t *in = &r->inst[i];
+
+	note->rule = r;
+	note->name = strdup(r->name);
+	AN(note->name);
+	note->instance = i;
+	note->firing = !in->notified;
+	note->url = strdup(r->url ? r->url : alerts->push_url);
+	AN(note->url);
+	note->body = VSB_new_auto();
+	AN(note->body);
+	VSB_cat(note->body, "{\n\t\"rule\": ");
+	json_quote(note->body, r->name, -1);
+	VSB_cat(note->body, ",\n\t\"instance\": ");
+	json_quote(note->body, instance, -1);
+	VSB_printf(note->body, ",\n\t\"state\": \"%s\",\n\t\"expr\": ",
+	    note->firing ? "firing" : "resolved");
+	json_quote(note->body, r->expr, -1);
+	if (isnan(in->value) || isinf(in->value))
+		VSB_cat(note->body, ",\n\t\"value\": null");
+	else
+		VSB_printf(note->body, ",\n\t\"value\": %g", in->value);
+	VSB_printf(note->body, ",\n\t\"since\": %jd,\n\t\"time\": %jd\n}\n",
+	    (intmax_t)in->since, (intmax_t)now);
+	AZ(VSB_finish(note->body));
+	/* Assume it goes through, see alerts_deliver() */
+	in->notified = note->firing;
+}
+
+static void
+alerts_step(struct alert_rule_t *r, struct alert_inst_t *in, double dt,
+    time_t now)
+{
+	int holds;
+
+	in->value = alert_expr_eval(r->code, in->cur, in->prev, dt);
+	holds = alert_expr_true(in->value);
+	switch (in->state) {
+	case ALERT_OK:
+		if (holds) {
+			in->state = ALERT_PENDING;
+			in->since = now;
+		}
+		break;
+	case ALERT_PENDING:
+		if (!holds) {
+			in->state = ALERT_OK;
+			in->since = now;
+		}
+		break;
+	case ALERT_FIRING:
+		if (!holds) {
+			in->state = ALERT_RESOLVING;
+			in->since = now;
+		}
+		break;
+	case ALERT_RESOLVING:
+		if (holds)
+			in->state = ALERT_FIRING;
+		break;
+	}
+	if (in->state == ALERT_PENDING && now - in->since >= r->hold) {
+		in->state = ALERT_FIRING;
+		in->since = now;
+	} else if (in->state == ALERT_RESOLVING &&
+	    now - in->since >= r->clear) {
+		in->state = ALERT_OK;
+		in->since = now;
+	}
+}
+
+/*
+ * Send the notes outside of the lock, and put back those that failed.
+ */
+static void
+alerts_deliver(struct alerts_priv_t *alerts, struct alert_note_t *notes,
+    unsigned n)
+{
+	struct alert_rule_t *r;
+	struct ipc_ret_t vret;
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		/* POST, so that a webhook answering 4xx or 5xx fails too */
+		ipc_run(alerts->curl, &vret, "POST %s\n%s", notes[i].url,
+		    VSB_data(notes[i].body));
+		if (vret.status == 200) {
+			logger(alerts->tlogger, "Alert %s %s", notes[i].name,
+			    notes[i].firing ? "fired" : "resolved");
+			notes[i].rule = NULL;
+		} else
+			warnlog(alerts->tlogger, "Delivering an alert to %s "
+			    "failed (%d): %s", notes[i].url, vret.status,
+			    vret.answer);
+		free(vret.answer);
+		VSB_delete(notes[i].body);
+		free(notes[i].url);
+		free(notes[i].name);
+	}
+
+	AZ(pthread_mutex_lock(&alerts->lck));
+	for (i = 0; i < n; i++) {
+		/* The rule may be gone since */
+		for (r = alerts->rules; r != NULL; r = r->next)
+			if (r == notes[i].rule)
+				break;
+		if (r == NULL)
+			continue;
+		r->inst[notes[i].instance].notified = !notes[i].firing;
+		r->inst[notes[i].instance].retry = time(NULL) + ALERTS_RETRY;
+	}
+	AZ(pthread_mutex_unlock(&alerts->lck));
+}
+
+static void *
+alerts_run(void *data)
+{
+	struct agent_core_t *core = data;
+	struct alerts_priv_t *alerts;
+	struct alert_note_t *notes = NULL;
+	struct alert_rule_t *r;
+	struct alert_inst_t *in;
+	unsigned n, nrules;
+	double dt;
+	time_t now;
+	int i, firing;
+
+	GET_PRIV(core, alerts);
+	for (;;) {
+		/* Right after the second turns */
+		usleep(1000000 - (long)(alerts_now() * 1e6) % 1000000);
+		now = time(NULL);
+		n = 0;
+		AZ(pthread_mutex_lock(&alerts->lck));
+		for (nrules = 0, r = alerts->rules; r != NULL; r = r->next)
+			nrules++;
+		notes = realloc(notes, (nrules * alerts->ninstances + 1) *
+		    sizeof *notes);
+		AN(notes);
+		for (i = 0; i < alerts->ninstances; i++) {
+			instance_select(i);
+			if (alerts->rules == NULL ||
+			    !alerts_sample(core, alerts, &dt))
+				continue;
+			for (r = alerts->rules; r != NULL; r = r->next) {
+				in = &r->inst[i];
+				alerts_step(r, in, dt, now);
+				firing = in->state == ALERT_FIRING ||
+				    in->state == ALERT_RESOLVING;
+				if (firing == in->notified || now < in->retry ||
+				    (r->url == NULL && (alerts->push_url ==
+				    NULL || *alerts->push_url == '\0')))
+					continue;
+				alerts_note(&notes[n++], alerts, r, i,
+				    instance_get(core)->name, now);
+			}
+		}
+		AZ(pthread_mutex_unlock(&alerts->lck));
+		if (n > 0)
+			alerts_deliver(alerts, notes, n);
+	}
+	return (NULL);
+}
+
+static void *
+alerts_start(struct agent_core_t *core, const char *name)
+{
+	pthread_t *thread;
+
+	(void)name;
+
+	ALLOC_OBJ(thread);
+	AZ(pthread_create(thread, NULL, alerts_run, core));
+	return (thread);
+}
+
+static void
+alerts_rule_json(struct vsb *vsb, const struct alert_rule_t *r,
+    const struct alert_inst_t *in)
+{
+	alerts_rule_def(vsb, r);
+	VSB_printf(vsb, ", \"state\": \"%s\", \"since\": %jd",
+	    alert_states[in->state], (intmax_t)in->since);
+	if (isnan(in->value) || isinf(in->value))
+		VSB_cat(vsb, ", \"value\": null");
+	else
+		VSB_printf(vsb, ", \"value\": %g", in->value);
+	VSB_printf(vsb, ", \"notified\": %s}",
+	    in->notified ? "true" : "false");
+}
+
+static int
+alerts_name_ok(const char *name)
+{
+	size_t l = strlen(name);
+
+	if (l == 0 || l >= ALERTS_NAME)
+		return (0);
+	for (; *name != '\0'; name++)
+		if (!isalnum((unsigned char)*name) && *name != '_' &&
+		    *name != '-' && *name != '.')
+			return (0);
+	return (1);
+}
+
+/*
+ * Add or replace a rule. A replaced rule keeps its state.
+ */
+static void
+alerts_put(struct http_request *request, struct alerts_priv_t *alerts,
+    const char *name)
+{
+	struct alert_rule_t *r, **rp;
+	struct json_t *def;
+	const char *perr = NULL;
+	char *err;
+
+	if (!alerts_name_ok(name)) {
+		http_reply(request->connection, 400, "Rule names are "
+		    "letters, digits, '_', '-' and '.'");
+		return;
+	}
+	if ((def = json_parse(request->body, &perr)) == NULL) {
+		http_reply(request->connection, 400, perr);
+		return;
+	}
+	r = alerts_rule_new(name, def, &err);
+	json_free(def);
+	if (r == NULL) {
+		http_reply(request->connection, 400, err);
+		free(err);
+		return;
+	}
+
+	AZ(pthread_mutex_lock(&alerts->lck));
+	rp = alerts_find(alerts, name);
+	if (*rp != NULL) {
+		r->inst = (*rp)->inst;
+		(*rp)->inst = calloc(alerts->ninstances, sizeof *r->inst);
+		AN((*rp)->inst);
+		r->next = (*rp)->next;
+		alerts_rule_free(*rp, alerts->ninstances);
+	} else {
+		r->inst = calloc(alerts->ninstances, sizeof *r->inst);
+		AN(r->inst);
+	}
+	alerts_rule_arrays(r, alerts->ninstances);
+	*rp = r;
+	alerts_save(alerts);
+	AZ(pthread_mutex_unlock(&alerts->lck));
+	logger(alerts->logger, "Alert rule %s: %s", name, r->expr);
+	http_reply(request->connection, 200, "Rule stored");
+}
+
+static unsigned int
+alerts_reply(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct alerts_priv_t *alerts;
+	struct alert_rule_t *r, **rp;
+	struct http_response *resp;
+	struct vsb *vsb;
+	int i = instance_current();
+
+	GET_PRIV(core, alerts);
+	r = NULL;
+	if (request->method == M_PUT) {
+		if (arg == NULL)
+			http_reply(request->connection, 400, "Name the rule");
+		else
+			alerts_put(request, alerts, arg);
+		return (0);
+	}
+	if (request->method == M_DELETE) {
+		if (arg == NULL) {
+			http_reply(request->connection, 400, "Name the rule");
+			return (0);
+		}
+		AZ(pthread_mutex_lock(&alerts->lck));
+		rp = alerts_find(alerts, arg);
+		r = *rp;
+		if (r != NULL) {
+			*rp = r->next;
+			alerts_rule_free(r, alerts->ninstances);
+			alerts_save(alerts);
+		}
+		AZ(pthread_mutex_unlock(&alerts->lck));
+		if (r == NULL)
+			http_reply(request->connection, 404, "No such rule");
+		else
+			http_reply(request->connection, 200, "Rule removed");
+		return (0);
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	AZ(pthread_mutex_lock(&alerts->lck));
+	if (arg != NULL) {
+		r = *alerts_find(alerts, arg);
+		if (r != NULL) {
+			alerts_rule_json(vsb, r, &r->inst[i]);
+			VSB_cat(vsb, "\n");
+		}
+	} else {
+		VSB_cat(vsb, "{\n\t\"rules\": [");
+		for (r = alerts->rules; r != NULL; r = r->next) {
+			VSB_printf(vsb, "%s\n\t\t", r == alerts->rules ?
+			    "" : ",");
+			alerts_rule_json(vsb, r, &r->inst[i]);
+		}
+		VSB_cat(vsb, "\n\t]\n}\n");
+	}
+	AZ(pthread_mutex_unlock(&alerts->lck));
+	AZ(VSB_finish(vsb));
+	if (arg != NULL && r == NULL)
+		http_reply(request->connection, 404, "No such rule");
+	else {
+		resp = http_mkresp(request->connection, 200, NULL);
+		resp->data = VSB_data(vsb);
+		resp->ndata = VSB_len(vsb);
+		http_add_header(resp, "Content-Type", "application/json");
+		send_response(resp);
+		http_free_resp(resp);
+	}
+	VSB_delete(vsb);
+	return (0);
+}
+
+static unsigned int
+alerts_push_url(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct alerts_priv_t *alerts;
+
+	(void)arg;
+	GET_PRIV(core, alerts);
+	AZ(pthread_mutex_lock(&alerts->lck));
+	free(alerts->push_url);
+	DUP_OBJ(alerts->push_url, request->body, request->bodylen);
+	logger(alerts->logger, "Got url: \"%s\"", alerts->push_url);
+	AZ(pthread_mutex_unlock(&alerts->lck));
+	http_reply(request->connection, 200, "Url stored");
+	return (0);
+}
+
+void
+alerts_init(struct agent_core_t *core)
+{
+	struct agent_plugin_t *plug;
+	struct alerts_priv_t *priv;
+	char *path;
+
+	ALLOC_OBJ(priv);
+	plug = plugin_find(core, "alerts");
+	priv->logger = ipc_register(core, "logger");
+	priv->tlogger = ipc_register(core, "logger");
+	priv->curl = ipc_register(core, "curl");
+	AZ(pthread_mutex_init(&priv->lck, NULL));
+	priv->ninstances = core->config->ninstances;
+	priv->vsm = calloc(priv->ninstances, sizeof *priv->vsm);
+	AN(priv->vsm);
+	assert(asprintf(&path, "%s/" ALERTS_FILE, core->config->p_arg) > 0);
+	priv->path = path;
+	alerts_load(priv);
+	plug->data = (void *)priv;
+	plug->start = alerts_start;
+
+	http_register_path(core, "/alerts", M_GET | M_PUT | M_DELETE,
+	    alerts_reply, core);
+	http_register_path(core, "/push/url/alerts", M_PUT, alerts_push_url,
+	    core);
+	http_register_path(core, "/help/alerts", M_GET, help_reply,
+	    strdup(ALERTS_HELP));
+}
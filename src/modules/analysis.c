@@ -0,0 +1,494 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Runs the VSL analyzers, see analysis.h.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <vapi/vsl.h>
+#include <vapi/vsm.h>
+
+#include "common.h"
+#include "analysis.h"
+#include "http.h"
+#include "helpers.h"
+#include "instance.h"
+#include "ipc.h"
+#include "json.h"
+#include "plugins.h"
+#include "vsb.h"
+#include "vsl_tail.h"
+
+#define ANALYSIS_RETRY	5	// Seconds between attempts to open the VSM
+
+static const struct analyzer_t * const analyzers[] = {
+#define ANALYZER(name) &analyzer_##name,
+#include "analyzer-list.h"
+#undef ANALYZER
+};
+#define NANALYZERS (sizeof analyzers / sizeof *analyzers)
+
+static const char * const groupings[VSL_g__MAX] = {
+	[VSL_g_raw]	= "raw",
+	[VSL_g_vxid]	= "vxid",
+	[VSL_g_request]	= "request",
+	[VSL_g_session]	= "session",
+};
+
+struct analysis_inst_t {
+	struct vsl_tail_t tail;
+	void *priv[NANALYZERS];
+	uintmax_t groups[NANALYZERS];
+	time_t since[NANALYZERS];
+};
+
+struct analysis_priv_t {
+	unsigned char on[NANALYZERS];	// Enabled with -Y
+	unsigned groupings;
+	int logger;
+	int tlogger;		// The thread, as curl
+	int curl;
+	pthread_mutex_t lck;	// The state of the analyzers, push_url
+	char *push_url;
+	struct analysis_inst_t *inst;
+	int ninstances;
+};
+
+struct analysis_dispatch_t {
+	struct analysis_priv_t *analysis;
+	struct analysis_inst_t *in;
+};
+
+const char *
+analysis_header(const char *data, const char *name)
+{
+	size_t l = strlen(name);
+
+	if (strncasecmp(data, name, l) || data[l] != ':')
+		return (NULL);
+	for (data += l + 1; *data == ' ' || *data == '\t'; data++)
+		continue;
+	return (data);
+}
+
+/*
+ * All digits, or hex of 8 or more with a digit (and dashes, for UUIDs).
+ */
+static int
+analysis_is_id(const char *s, size_t l)
+{
+	size_t i, digits = 0, hex = 0;
+
+	for (i = 0; i < l; i++) {
+		if (isdigit((unsigned char)s[i]))
+			digits++;
+		else if (isxdigit((unsigned char)s[i]) || s[i] == '-')
+			hex++;
+		else
+			return (0);
+	}
+	return (l > 0 && (hex == 0 || (digits > 0 && l >= 8)));
+}
+
+void
+analysis_pattern(const char *url, char *buf, size_t len)
+{
+	const char *p, *e;
+	size_t l, o = 0;
+
+	assert(len > 1);
+	for (p = url; *p != '\0' && *p != '?' && o < len - 1; p = e) {
+		e = p + 1 + strcspn(p + 1, "/?");
+		if (*p == '/' && analysis_is_id(p + 1, e - p - 1)) {
+			p = "/*";
+			l = 2;
+		} else
+			l = e - p;
+		if (l > len - 1 - o)
+			l = len - 1 - o;
+		memcpy(buf + o, p, l);
+		o += l;
+	}
+	buf[o] = '\0';
+}
+
+int
+analysis_select(const char *list, unsigned char *on)
+{
+	const char *p, *e;
+	size_t l;
+	unsigned i;
+
+	for (p = list; *p != '\0'; p = *e == ',' ? e + 1 : e) {
+		e = p + strcspn(p, ",");
+		l = e - p;
+		if (l == 3 && !strncmp(p, "all", l)) {
+			for (i = 0; on != NULL && i < NANALYZERS; i++)
+				on[i] = 1;
+			continue;
+		}
+		for (i = 0; i < NANALYZERS; i++)
+			if (strlen(analyzers[i]->name) == l &&
+			    !strncmp(p, analyzers[i]->name, l))
+				break;
+		if (i == NANALYZERS)
+			return (-1);
+		if (on != NULL)
+			on[i] = 1;
+	}
+	return (0);
+}
+
+double
+analysis_timestamp(const char *data, const char *label)
+{
+	size_t l = strlen(label);
+	double abs, start;
+
+	if (strncmp(data, label, l) || data[l] != ':' ||
+	    sscanf(data + l + 1, "%lf %lf", &abs, &start) != 2)
+		return (-1);
+	return (start);
+}
+
+static int
+analysis_dispatch(struct VSL_data *vsl, struct VSL_transaction * const trans[],
+    void *priv)
+{
+	struct analysis_dispatch_t *d = priv;
+	unsigned i;
+
+	(void)vsl;
+	AZ(pthread_mutex_lock(&d->analysis->lck));
+	for (i = 0; i < NANALYZERS; i++) {
+		if (!d->analysis->on[i] || analyzers[i]->feed == NULL ||
+		    analyzers[i]->grouping != d->in->tail.g)
+			continue;
+		analyzers[i]->feed(d->in->priv[i], trans);
+		d->in->groups[i]++;
+	}
+	AZ(pthread_mutex_unlock(&d->analysis->lck));
+	return (0);
+}
+
+/*
+ * Returns 1 if there was anything to read.
+ */
+static int
+analysis_poll(struct agent_core_t *core, struct analysis_priv_t *analysis,
+    struct analysis_inst_t *in)
+{
+	struct analysis_dispatch_t d;
+
+	d.analysis = analysis;
+	d.in = in;
+	return (vsl_tail_poll(&in->tail, core, analysis->tlogger,
+	    analysis_dispatch, &d));
+}
+
+/*
+ * Sample the counters, and push what the analyzers have to tell outside
+ * of the lock.
+ */
+static void
+analysis_sample(struct agent_core_t *core, struct analysis_priv_t *analysis)
+{
+	struct analysis_inst_t *in;
+	struct vsb *alerts[NANALYZERS], *vsb;
+	struct ipc_ret_t vret;
+	char *url = NULL;
+	unsigned j, n;
+	int i;
+
+	for (i = 0; i < analysis->ninstances; i++) {
+		in = &analysis->inst[i];
+		n = 0;
+		AZ(pthread_mutex_lock(&analysis->lck));
+		for (j = 0; in->tail.open && j < NANALYZERS; j++) {
+			if (!analysis->on[j])
+				continue;
+			if (analyzers[j]->sample != NULL)
+				analyzers[j]->sample(in->priv[j],
+				    in->tail.vsm);
+			if (analyzers[j]->alert == NULL)
+				continue;
+			vsb = VSB_new_auto();
+			AN(vsb);
+			VSB_printf(vsb, "{\n\t\"analyzer\": \"%s\",\n\t"
+			    "\"instance\": ", analyzers[j]->name);
+			json_quote(vsb, core->config->instances[i].name, -1);
+			VSB_printf(vsb, ",\n\t\"time\": %jd",
+			    (intmax_t)time(NULL));
+			if (analyzers[j]->alert(in->priv[j], vsb) &&
+			    analysis->push_url != NULL &&
+			    *analysis->push_url != '\0') {
+				VSB_cat(vsb, "\n}\n");
+				AZ(VSB_finish(vsb));
+				alerts[n++] = vsb;
+			} else
+				VSB_delete(vsb);
+		}
+		if (n > 0)
+			url = strdup(analysis->push_url);
+		AZ(pthread_mutex_unlock(&analysis->lck));
+
+		for (j = 0; j < n; j++) {
+			ipc_run(analysis->curl, &vret, "%s\n%s", url,
+			    VSB_data(alerts[j]));
+			if (vret.status != 200)
+				warnlog(analysis->tlogger, "Pushing an alert "
+				    "failed (%d): %s", vret.status,
+				    vret.answer);
+			free(vret.answer);
+			VSB_delete(alerts[j]);
+		}
+		free(url);
+		url = NULL;
+	}
+}
+
+static void *
+analysis_run(void *data)
+{
+	struct agent_core_t *core = data;
+	struct analysis_priv_t *analysis;
+	time_t last = 0;
+	int i, busy;
+
+	GET_PRIV(core, analysis);
+	for (;;) {
+		busy = 0;
+		for (i = 0; i < analysis->ninstances; i++) {
+			instance_select(i);
+			busy |= analysis_poll(core, analysis,
+			    &analysis->inst[i]);
+		}
+		if (time(NULL) != last) {
+			last = time(NULL);
+			analysis_sample(core, analysis);
+		}
+		/* Analyzers of counters only need a sample every second */
+		if (!busy)
+			usleep(analysis->groupings ? 10000 : 250000);
+	}
+	return (NULL);
+}
+
+static void *
+analysis_start(struct agent_core_t *core, const char *name)
+{
+	pthread_t *thread;
+
+	(void)name;
+
+	ALLOC_OBJ(thread);
+	AZ(pthread_create(thread, NULL, analysis_run, core));
+	return (thread);
+}
+
+static void
+analysis_json_reply(struct http_request *request, struct vsb *vsb)
+{
+	struct http_response *resp;
+
+	AZ(VSB_finish(vsb));
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+}
+
+/*
+ * GET /analysis lists the analyzers, GET /analysis/<name> is the result
+ * of one and DELETE /analysis/<name> starts it over.
+ */
+static unsigned int
+analysis_reply(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct analysis_priv_t *analysis;
+	struct analysis_inst_t *in;
+	struct vsb *vsb;
+	unsigned i;
+
+	GET_PRIV(core, analysis);
+	in = &analysis->inst[instance_current()];
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	if (arg == NULL) {
+		if (request->method != M_GET) {
+			http_reply(request->connection, 405,
+			    "Name an analyzer to reset");
+			VSB_delete(vsb);
+			return (0);
+		}
+		AZ(pthread_mutex_lock(&analysis->lck));
+		VSB_printf(vsb, "{\n\t\"shmlog\": %s,\n\t\"analyzers\": [",
+		    in->tail.open ? "true" : "false");
+		for (i = 0; i < NANALYZERS; i++)
+			VSB_printf(vsb, "%s\n\t\t{\"name\": \"%s\", "
+			    "\"grouping\": \"%s\", \"enabled\": %s, "
+			    "\"since\": %jd, \"groups\": %ju}", i ? "," : "",
+			    analyzers[i]->name, analyzers[i]->feed == NULL ?
+			    "counters" : groupings[analyzers[i]->grouping],
+			    analysis->on[i] ? "true" : "false",
+			    (intmax_t)in->since[i], in->groups[i]);
+		AZ(pthread_mutex_unlock(&analysis->lck));
+		VSB_cat(vsb, "\n\t]\n}\n");
+		analysis_json_reply(request, vsb);
+		return (0);
+	}
+
+	for (i = 0; i < NANALYZERS; i++)
+		if (!strcmp(arg, analyzers[i]->name))
+			break;
+	if (i == NANALYZERS) {
+		http_reply(request->connection, 404, "No such analyzer");
+		VSB_delete(vsb);
+		return (0);
+	}
+	if (!analysis->on[i]) {
+		http_reply(request->connection, 404,
+		    "Analyzer not enabled, see -Y");
+		VSB_delete(vsb);
+		return (0);
+	}
+
+	AZ(pthread_mutex_lock(&analysis->lck));
+	if (request->method == M_DELETE) {
+		analyzers[i]->delete(in->priv[i]);
+		in->priv[i] = analyzers[i]->new();
+		in->groups[i] = 0;
+		in->since[i] = time(NULL);
+	}
+	VSB_printf(vsb, "{\n\t\"since\": %jd,\n\t\"groups\": %ju",
+	    (intmax_t)in->since[i], in->groups[i]);
+	analyzers[i]->json(in->priv[i], vsb);
+	AZ(pthread_mutex_unlock(&analysis->lck));
+	VSB_cat(vsb, "\n}\n");
+	analysis_json_reply(request, vsb);
+	return (0);
+}
+
+static unsigned int
+analysis_push_url(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct analysis_priv_t *analysis;
+
+	(void)arg;
+	GET_PRIV(core, analysis);
+	AZ(pthread_mutex_lock(&analysis->lck));
+	free(analysis->push_url);
+	DUP_OBJ(analysis->push_url, request->body, request->bodylen);
+	logger(analysis->logger, "Got url: \"%s\"", analysis->push_url);
+	AZ(pthread_mutex_unlock(&analysis->lck));
+	http_reply(request->connection, 200, "Url stored");
+	return (0);
+}
+
+void
+analysis_init(struct agent_core_t *core)
+{
+	struct agent_plugin_t *plug;
+	struct analysis_priv_t *priv;
+	struct vsb *help;
+	unsigned i;
+	int j;
+
+	ALLOC_OBJ(priv);
+	plug = plugin_find(core, "analysis");
+	priv->logger = ipc_register(core, "logger");
+	priv->tlogger = ipc_register(core, "logger");
+	priv->curl = ipc_register(core, "curl");
+	AZ(pthread_mutex_init(&priv->lck, NULL));
+	if (core->config->Y_arg != NULL)
+		AZ(analysis_select(core->config->Y_arg, priv->on));
+	for (i = 0; i < NANALYZERS; i++)
+		if (priv->on[i] && analyzers[i]->feed != NULL)
+			priv->groupings |= 1U << analyzers[i]->grouping;
+	priv->ninstances = core->config->ninstances;
+	priv->inst = calloc(priv->ninstances, sizeof *priv->inst);
+	AN(priv->inst);
+	for (j = 0; j < priv->ninstances; j++) {
+		priv->inst[j].tail.what = "analysis";
+		priv->inst[j].tail.interval = ANALYSIS_RETRY;
+		priv->inst[j].tail.groupings = priv->groupings;
+		for (i = 0; i < NANALYZERS; i++) {
+			if (!priv->on[i])
+				continue;
+			priv->inst[j].priv[i] = analyzers[i]->new();
+			priv->inst[j].since[i] = time(NULL);
+		}
+	}
+	plug->data = (void *)priv;
+	for (i = 0; i < NANALYZERS; i++)
+		if (priv->on[i])
+			plug->start = analysis_start;
+
+	help = VSB_new_auto();
+	AN(help);
+	VSB_cat(help,
+	    "GET /analysis - list the analyzers\n"
+	    "GET /analysis/<name> - what an analyzer found so far\n"
+	    "DELETE /analysis/<name> - start the analyzer over\n"
+	    "\n"
+	    "The analyzers named with -Y, or all of them with -Y all,\n"
+	    "follow the shmlog from the moment the agent starts and keep\n"
+	    "a bounded summary. Only the groupings they need are read.\n"
+	    "\"groups\" is the number of transaction groups they saw,\n"
+	    "\"since\" when they started.\n"
+	    "\n"
+	    "PUT /push/url/analysis - where to PUT alerts, as JSON\n"
+	    "\n");
+	for (i = 0; i < NANALYZERS; i++)
+		VSB_printf(help, "%s - %s\n", analyzers[i]->name,
+		    analyzers[i]->help);
+	AZ(VSB_finish(help));
+	http_register_path(core, "/analysis", M_GET | M_DELETE,
+	    analysis_reply, core);
+	http_register_path(core, "/push/url/analysis", M_PUT,
+	    analysis_push_url, core);
+	http_register_path(core, "/help/analysis", M_GET, help_reply,
+	    strdup(VSB_data(help)));
+	VSB_delete(help);
+}
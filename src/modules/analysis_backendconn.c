@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Backend connection reuse.
+ *
+ * Every fetch logs BackendOpen with the connection it got, and then
+ * BackendReuse when the connection goes back to the pool or
+ * BackendClose when it is closed. A BackendOpen on the file descriptor
+ * and local address of a connection we saw before is a reuse (newer
+ * varnishd say so in a seventh field). From that we get per backend
+ * reuse ratios, the rate of new connections, how long connections live
+ * and how long they sit idle between fetches. Fetches refused because
+ * of .max_connections log a "busy" FetchError.
+ *
+ * The MAIN.backend_* counters and the VBE.*.conn gauges are sampled
+ * every second, and the counters reported as increments since the
+ * analyzer started.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <vapi/vsc.h>
+#include <vapi/vsl.h>
+#include <vapi/vsm.h>
+
+#include "common.h"
+#include "analysis.h"
+#include "json.h"
+#include "sketch.h"
+#include "vsb.h"
+
+#define BC_BACKENDS	128
+#define BC_CONNS	1024	// Connections we keep track of
+#define BC_NAME		128
+#define BC_ADDR		64
+#define BC_MIN_FETCHES	20	// Before we recommend anything
+#define BC_IDLE_TIMEOUT	60	// Default backend_idle_timeout
+
+static const char * const bc_counters[] = {
+	"backend_conn", "backend_reuse", "backend_recycle", "backend_busy",
+	"backend_fail", "backend_retry", NULL
+};
+#define BC_NCOUNTERS	6
+
+struct bc_backend_t {
+	uint64_t opens;
+	uint64_t reuses;
+	uint64_t recycles;
+	uint64_t closes;
+	uint64_t busy;
+	uint64_t conn_close;	// Responses with Connection: close
+	uint64_t conn;		// VBE conn
+	uint64_t conn_peak;
+	double first;
+	double last;
+	struct loghist_t life;	// ms, from open to close
+	struct loghist_t idle;	// ms, in the pool between fetches
+	struct loghist_t uses;	// Fetches per connection
+};
+
+struct bc_conn_t {
+	int used;
+	int fd;
+	char backend[BC_NAME];
+	char local[BC_ADDR + 16];
+	double opened;
+	double recycled;	// Or 0 while busy
+	unsigned uses;
+};
+
+struct bc_priv_t {
+	uint64_t fetches;
+	struct topk_t *backends;	// priv is a bc_backend_t
+	struct bc_conn_t conns[BC_CONNS];
+	int sampled;
+	uint64_t base[BC_NCOUNTERS];
+	uint64_t cur[BC_NCOUNTERS];
+};
+
+static void *
+bc_new(void)
+{
+	struct bc_priv_t *bc;
+
+	ALLOC_OBJ(bc);
+	bc->backends = topk_new(BC_BACKENDS, free);
+	return (bc);
+}
+
+static void
+bc_delete(void *priv)
+{
+	struct bc_priv_t *bc = priv;
+
+	topk_delete(bc->backends);
+	free(bc);
+}
+
+/*
+ * Only a BackendOpen adds a backend, and can push the least used one
+ * out. Everything else updates the backends we have, see bc_find().
+ */
+static struct bc_backend_t *
+bc_backend(struct bc_priv_t *bc, const char *name)
+{
+	struct topk_item_t *it;
+	struct bc_backend_t *be;
+
+	it = topk_add(bc->backends, name, 1);
+	if (it->priv == NULL) {
+		ALLOC_OBJ(be);
+		it->priv = be;
+	}
+	return (it->priv);
+}
+
+static struct bc_backend_t *
+bc_find(struct bc_priv_t *bc, const char *name)
+{
+	struct topk_item_t *it;
+
+	it = topk_find(bc->backends, name);
+	return (it != NULL ? it->priv : NULL);
+}
+
+static struct bc_conn_t *
+bc_conn(struct bc_priv_t *bc, const char *name, int fd)
+{
+	uint32_t h = 2166136261U;
+	const char *p;
+
+	for (p = name; *p != '\0'; p++) {
+		h ^= (unsigned char)*p;
+		h *= 16777619U;
+	}
+	h ^= (uint32_t)fd;
+	h *= 16777619U;
+	return (&bc->conns[h % BC_CONNS]);
+}
+
+/*
+ * The connection is gone, at time t.
+ */
+static void
+bc_gone(struct bc_priv_t *bc, struct bc_conn_t *c, double t)
+{
+	struct bc_backend_t *be;
+
+	if (!c->used)
+		return;
+	be = bc_find(bc, c->backend);
+	if (be != NULL) {
+		loghist_add(&be->life, (t - c->opened) * 1000);
+		loghist_add(&be->uses, c->uses);
+	}
+	c->used = 0;
+}
+
+static void
+bc_open(struct bc_priv_t *bc, const char *data, double t,
+    const char **backend)
+{
+	char name[BC_NAME], raddr[BC_ADDR], rport[16], laddr[BC_ADDR];
+	char lport[16], how[16], local[BC_ADDR + 16];
+	struct bc_backend_t *be;
+	struct bc_conn_t *c;
+	int fd, n, reuse;
+
+	n = sscanf(data, "%d %127s %63s %15s %63s %15s %15s", &fd, name,
+	    raddr, rport, laddr, lport, how);
+	if (n < 6)
+		return;
+	snprintf(local, sizeof local, "%s:%s", laddr, lport);
+	c = bc_conn(bc, name, fd);
+	reuse = c->used && c->fd == fd && !strcmp(c->backend, name) &&
+	    !strcmp(c->local, local);
+	if (n == 7 && !strcmp(how, "connect"))
+		reuse = 0;
+	else if (n == 7 && !strcmp(how, "reuse") && !reuse) {
+		/* Opened before we looked */
+		bc_gone(bc, c, t);
+		reuse = -1;
+	}
+
+	bc->fetches++;
+	be = bc_backend(bc, name);
+	if (be->first == 0)
+		be->first = t;
+	be->last = t;
+	if (reuse) {
+		be->reuses++;
+		if (reuse > 0 && c->recycled > 0)
+			loghist_add(&be->idle, (t - c->recycled) * 1000);
+	} else
+		be->opens++;
+	if (reuse <= 0) {
+		/* A connection we did not see closing went away idle */
+		bc_gone(bc, c, c->recycled > 0 ? c->recycled : t);
+		c->used = 1;
+		c->fd = fd;
+		snprintf(c->backend, sizeof c->backend, "%s", name);
+		snprintf(c->local, sizeof c->local, "%s", local);
+		c->opened = t;
+		c->uses = 0;
+	}
+	c->uses++;
+	c->recycled = 0;
+	*backend = c->backend;
+}
+
+static void
+bc_done(struct bc_priv_t *bc, const char *data, double t, int closed)
+{
+	char name[BC_NAME];
+	struct bc_backend_t *be;
+	struct bc_conn_t *c;
+	int fd;
+
+	if (sscanf(data, "%d %127s", &fd, name) != 2)
+		return;
+	be = bc_find(bc, name);
+	c = bc_conn(bc, name, fd);
+	if (!c->used || c->fd != fd || strcmp(c->backend, name))
+		c = NULL;
+	if (closed) {
+		if (be != NULL)
+			be->closes++;
+		if (c != NULL)
+			bc_gone(bc, c, t);
+	} else {
+		if (be != NULL)
+			be->recycles++;
+		if (c != NULL)
+			c->recycled = t;
+	}
+}
+
+static void
+bc_feed(void *priv, struct VSL_transaction * const trans[])
+{
+	struct bc_priv_t *bc = priv;
+	struct bc_backend_t *be;
+	struct VSL_transaction *t;
+	const char *data, *v, *backend;
+	char name[BC_NAME];
+	double now;
+
+	for (t = trans[0]; t != NULL; t = *++trans) {
+		if (t->type != VSL_t_bereq)
+			continue;
+		now = 0;
+		backend = NULL;
+		while (VSL_Next(t->c) == 1) {
+			data = VSL_CDATA(t->c->rec.ptr);
+			switch (VSL_TAG(t->c->rec.ptr)) {
+			case SLT_Timestamp:
+				v = strchr(data, ':');
+				if (v != NULL)
+					now = strtod(v + 1, NULL);
+				break;
+			case SLT_BackendOpen:
+				bc_open(bc, data, now, &backend);
+				break;
+			case SLT_BackendReuse:
+				bc_done(bc, data, now, 0);
+				break;
+			case SLT_BackendClose:
+				bc_done(bc, data, now, 1);
+				break;
+			case SLT_BerespHeader:
+				v = analysis_header(data, "Connection");
+				if (backend != NULL && v != NULL &&
+				    !strncasecmp(v, "close", 5) &&
+				    (be = bc_find(bc, backend)) != NULL)
+					be->conn_close++;
+				break;
+			case SLT_FetchError:
+				if (sscanf(data, "backend %127s busy", name) == 1 &&
+				    strchr(name, ':') != NULL) {
+					*strchr(name, ':') = '\0';
+					if ((be = bc_find(bc, name)) != NULL)
+						be->busy++;
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+static int
+bc_sample_cb(void *priv, const struct VSC_point * const pt)
+{
+	struct bc_priv_t *bc = priv;
+	struct bc_backend_t *be;
+	char name[BC_NAME];
+	uint64_t val;
+	int i;
+
+	if (pt == NULL)
+		return (0);
+	val = *(const volatile uint64_t *)pt->ptr;
+	if (!strcmp(pt->section->fantom->type, "MAIN")) {
+		for (i = 0; bc_counters[i] != NULL; i++)
+			if (!strcmp(pt->desc->name, bc_counters[i]))
+				bc->cur[i] = val;
+	} else if (!strcmp(pt->section->fantom->type, "VBE") &&
+	    !strcmp(pt->desc->name, "conn")) {
+		/* 4.0 idents look like "default(127.0.0.1,,8080)" */
+		snprintf(name, sizeof name, "%s", pt->section->fantom->ident);
+		name[strcspn(name, "(")] = '\0';
+		if ((be = bc_find(bc, name)) == NULL)
+			return (0);
+		be->conn = val;
+		if (val > be->conn_peak)
+			be->conn_peak = val;
+	}
+	return (0);
+}
+
+static void
+bc_sample(void *priv, struct VSM_data *vsm)
+{
+	struct bc_priv_t *bc = priv;
+	int i;
+
+	(void)VSC_Iter(vsm, NULL, bc_sample_cb, bc);
+	for (i = 0; i < BC_NCOUNTERS; i++)
+		if (bc->cur[i] < bc->base[i])
+			break;
+	/* The first sample, or varnishd restarted */
+	if (!bc->sampled || i < BC_NCOUNTERS)
+		memcpy(bc->base, bc->cur, sizeof bc->base);
+	bc->sampled = 1;
+}
+
+static double
+bc_ratio(uint64_t a, uint64_t b)
+{
+	return (b ? (double)a / b : 0);
+}
+
+static void
+bc_recommend(struct vsb *vsb, int *n, const char *name,
+    const struct bc_backend_t *be)
+{
+	uint64_t fetches = be->opens + be->reuses;
+	double reuse = bc_ratio(be->reuses, fetches), rate, idle;
+	int k = 0;
+
+	VSB_printf(vsb, "%s\n\t\t", (*n)++ ? "," : "");
+	json_quote(vsb, name, -1);
+	VSB_cat(vsb, ": [");
+
+	if (be->busy > 0)
+		VSB_printf(vsb, "%s\n\t\t\t\"%ju fetches were refused "
+		    "because .max_connections was reached (peak of %ju "
+		    "connections): raise .max_connections or add capacity to "
+		    "the backend\"", k++ ? "," : "", (uintmax_t)be->busy,
+		    (uintmax_t)be->conn_peak);
+	if (fetches >= BC_MIN_FETCHES && be->conn_close * 10 > fetches)
+		VSB_printf(vsb, "%s\n\t\t\t\"%.0f%% of the responses carry "
+		    "Connection: close: enable keep-alive on the backend\"",
+		    k++ ? "," : "", 100 * bc_ratio(be->conn_close, fetches));
+	else if (fetches >= BC_MIN_FETCHES && reuse < 0.5) {
+		rate = be->last > be->first ?
+		    be->opens / (be->last - be->first) : 0;
+		VSB_printf(vsb, "%s\n\t\t\t\"only %.0f%% of the fetches "
+		    "reuse a connection (%.1f new connections per second): "
+		    "make the keep-alive timeout of the backend longer than "
+		    "backend_idle_timeout\"", k++ ? "," : "", 100 * reuse,
+		    rate);
+	}
+	idle = loghist_quantile(&be->idle, 0.9) / 1000;
+	if (be->idle.n >= BC_MIN_FETCHES && idle > BC_IDLE_TIMEOUT / 2)
+		VSB_printf(vsb, "%s\n\t\t\t\"10%% of the reused connections "
+		    "were idle for %.0fs or more: connections idle longer "
+		    "than backend_idle_timeout (%ds by default) are closed, "
+		    "consider raising it to %.0fs together with the keep-alive "
+		    "timeout of the backend\"", k++ ? "," : "", idle,
+		    BC_IDLE_TIMEOUT, idle * 2);
+	VSB_cat(vsb, "\n\t\t]");
+}
+
+static void
+bc_json(void *priv, struct vsb *vsb)
+{
+	struct bc_priv_t *bc = priv;
+	struct topk_item_t **v;
+	struct bc_backend_t *be;
+	uint64_t fetches;
+	unsigned i, n;
+	int r = 0;
+
+	VSB_printf(vsb, ",\n\t\"fetches\": %ju,\n\t\"counters\": {",
+	    (uintmax_t)bc->fetches);
+	for (i = 0; i < BC_NCOUNTERS; i++)
+		VSB_printf(vsb, "%s\n\t\t\"%s\": %ju", i ? "," : "",
+		    bc_counters[i], (uintmax_t)(bc->cur[i] - bc->base[i]));
+	/* backend_conn counts new connections, backend_reuse reuses */
+	VSB_printf(vsb, "\n\t},\n\t\"reuse_ratio\": %.3f",
+	    bc_ratio(bc->cur[1] - bc->base[1], bc->cur[0] - bc->base[0] +
+	    bc->cur[1] - bc->base[1]));
+
+	VSB_cat(vsb, ",\n\t\"backends\": [");
+	v = topk_sorted(bc->backends, -1, &n);
+	for (i = 0; i < n; i++) {
+		be = v[i]->priv;
+		fetches = be->opens + be->reuses;
+		VSB_printf(vsb, "%s\n\t\t{\"backend\": ", i ? "," : "");
+		json_quote(vsb, v[i]->key, -1);
+		VSB_printf(vsb, ", \"fetches\": %ju, \"opens\": %ju, "
+		    "\"reuses\": %ju, \"recycles\": %ju, \"closes\": %ju, "
+		    "\"busy\": %ju, \"connection_close\": %ju, "
+		    "\"reuse_ratio\": %.3f, \"opens_per_second\": %.3f, "
+		    "\"conn\": %ju, \"conn_peak\": %ju,\n\t\t\"lifetime_ms\": ",
+		    (uintmax_t)fetches, (uintmax_t)be->opens,
+		    (uintmax_t)be->reuses, (uintmax_t)be->recycles,
+		    (uintmax_t)be->closes, (uintmax_t)be->busy,
+		    (uintmax_t)be->conn_close, bc_ratio(be->reuses, fetches),
+		    be->last > be->first ?
+		    be->opens / (be->last - be->first) : 0,
+		    (uintmax_t)be->conn, (uintmax_t)be->conn_peak);
+		loghist_json(vsb, &be->life);
+		VSB_cat(vsb, ",\n\t\t\"idle_ms\": ");
+		loghist_json(vsb, &be->idle);
+		VSB_cat(vsb, ",\n\t\t\"uses\": ");
+		loghist_json(vsb, &be->uses);
+		VSB_cat(vsb, "}");
+	}
+
+	VSB_cat(vsb, "\n\t],\n\t\"recommendations\": {");
+	for (i = 0; i < n; i++)
+		bc_recommend(vsb, &r, v[i]->key, v[i]->priv);
+	VSB_cat(vsb, "\n\t}");
+	free(v);
+}
+
+const struct analyzer_t analyzer_backendconn = {
+	.name = "backendconn",
+	.help = "backend connection reuse, lifetime, idle time and pool "
+	    "exhaustion, with keep-alive recommendations",
+	.grouping = VSL_g_vxid,
+	.new = bc_new,
+	.delete = bc_delete,
+	.feed = bc_feed,
+	.sample = bc_sample,
+	.json = bc_json,
+};
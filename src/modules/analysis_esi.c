@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * ESI fragment costs.
+ *
+ * A request group of a page assembled with ESI holds the page request
+ * and a subrequest (reason esi) per include, nested as deep as the
+ * includes are. For every such page we build the tree of fragments with
+ * their time (the Resp timestamp, since the start of the subrequest),
+ * cache result and size, and add each fragment to the totals of its URL
+ * pattern (see analysis_pattern()), and the page to those of its own
+ * pattern. The slowest trees are kept whole.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vapi/vsl.h>
+
+#include "common.h"
+#include "analysis.h"
+#include "json.h"
+#include "sketch.h"
+#include "vsb.h"
+
+#define ESI_PATTERNS	512
+#define ESI_NODES	256	// Fragments per page we look at
+#define ESI_SLOWEST	5
+#define ESI_TOP		20
+#define ESI_URL		256
+
+/* Fragment patterns */
+#define V_MS		0
+#define V_HITS		1
+#define V_MISSES	2
+#define V_BYTES		3
+/* Page patterns */
+#define V_FRAG_MS	1
+#define V_FRAGS		2
+
+enum esi_cache {
+	ESI_UNKNOWN,
+	ESI_HIT,
+	ESI_MISS,
+	ESI_PASS,
+};
+
+static const char * const esi_cache_names[] = {
+	[ESI_UNKNOWN]	= "unknown",
+	[ESI_HIT]	= "hit",
+	[ESI_MISS]	= "miss",
+	[ESI_PASS]	= "pass",
+};
+
+struct esi_node_t {
+	char url[ESI_URL];
+	unsigned depth;
+	double ms;
+	enum esi_cache cache;
+	uintmax_t bytes;
+};
+
+struct esi_tree_t {
+	double ms;
+	unsigned n;
+	struct esi_node_t *nodes;	// nodes[0] is the page
+};
+
+struct esi_priv_t {
+	uint64_t pages;
+	uint64_t fragments;
+	struct topk_t *frags;		// priv is a loghist_t of ms
+	struct topk_t *parents;
+	struct esi_tree_t slowest[ESI_SLOWEST];
+};
+
+static void *
+esi_new(void)
+{
+	struct esi_priv_t *esi;
+
+	ALLOC_OBJ(esi);
+	esi->frags = topk_new(ESI_PATTERNS, free);
+	esi->parents = topk_new(ESI_PATTERNS, NULL);
+	return (esi);
+}
+
+static void
+esi_delete(void *priv)
+{
+	struct esi_priv_t *esi = priv;
+	int i;
+
+	topk_delete(esi->frags);
+	topk_delete(esi->parents);
+	for (i = 0; i < ESI_SLOWEST; i++)
+		free(esi->slowest[i].nodes);
+	free(esi);
+}
+
+/*
+ * One request of the group. *bytes from ReqAcct (body bytes sent).
+ */
+static void
+esi_node(struct VSL_transaction *t, struct esi_node_t *n)
+{
+	const char *data;
+	uintmax_t f[6];
+	double ms;
+
+	memset(n, 0, sizeof *n);
+	while (VSL_Next(t->c) == 1) {
+		data = VSL_CDATA(t->c->rec.ptr);
+		switch (VSL_TAG(t->c->rec.ptr)) {
+		case SLT_ReqURL:
+			if (n->url[0] == '\0')
+				snprintf(n->url, sizeof n->url, "%s", data);
+			break;
+		case SLT_Timestamp:
+			ms = analysis_timestamp(data, "Resp");
+			if (ms >= 0)
+				n->ms = ms * 1000.0;
+			break;
+		case SLT_VCL_call:
+			if (!strcmp(data, "HIT"))
+				n->cache = ESI_HIT;
+			else if (!strcmp(data, "MISS"))
+				n->cache = ESI_MISS;
+			else if (!strcmp(data, "PASS"))
+				n->cache = ESI_PASS;
+			break;
+		case SLT_ReqAcct:
+			if (sscanf(data, "%ju %ju %ju %ju %ju %ju", &f[0],
+			    &f[1], &f[2], &f[3], &f[4], &f[5]) == 6)
+				n->bytes = f[4];
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void
+esi_keep_slowest(struct esi_priv_t *esi, const struct esi_node_t *nodes,
+    unsigned n)
+{
+	struct esi_tree_t *tr;
+	int i, min = 0;
+
+	for (i = 1; i < ESI_SLOWEST; i++)
+		if (esi->slowest[i].ms < esi->slowest[min].ms)
+			min = i;
+	tr = &esi->slowest[min];
+	if (tr->nodes != NULL && tr->ms >= nodes[0].ms)
+		return;
+	free(tr->nodes);
+	tr->nodes = calloc(n, sizeof *tr->nodes);
+	AN(tr->nodes);
+	memcpy(tr->nodes, nodes, n * sizeof *nodes);
+	tr->n = n;
+	tr->ms = nodes[0].ms;
+}
+
+static void
+esi_feed(void *priv, struct VSL_transaction * const trans[])
+{
+	struct esi_priv_t *esi = priv;
+	struct esi_node_t *nodes;
+	struct topk_item_t *it;
+	struct loghist_t *h;
+	char pat[ESI_URL];
+	unsigned n = 0, i, level = 0;
+	double frag_ms = 0;
+	int has_esi = 0;
+
+	for (i = 0; trans[i] != NULL; i++)
+		if (trans[i]->type == VSL_t_req &&
+		    trans[i]->reason == VSL_r_esi)
+			has_esi = 1;
+	if (!has_esi)
+		return;
+
+	nodes = calloc(ESI_NODES, sizeof *nodes);
+	AN(nodes);
+	for (i = 0; trans[i] != NULL && n < ESI_NODES; i++) {
+		if (trans[i]->type != VSL_t_req)
+			continue;
+		if (n == 0)
+			level = trans[i]->level;
+		else if (trans[i]->reason != VSL_r_esi)
+			continue;
+		esi_node(trans[i], &nodes[n]);
+		nodes[n].depth = trans[i]->level - level;
+		n++;
+	}
+
+	esi->pages++;
+	for (i = 1; i < n; i++) {
+		esi->fragments++;
+		/* Nested fragments are part of their parent's time */
+		if (nodes[i].depth == 1)
+			frag_ms += nodes[i].ms;
+		analysis_pattern(nodes[i].url, pat, sizeof pat);
+		it = topk_add(esi->frags, pat, 1);
+		it->vals[V_MS] += nodes[i].ms;
+		it->vals[V_HITS] += nodes[i].cache == ESI_HIT;
+		it->vals[V_MISSES] += nodes[i].cache == ESI_MISS;
+		it->vals[V_BYTES] += nodes[i].bytes;
+		if (it->priv == NULL)
+			it->priv = calloc(1, sizeof(struct loghist_t));
+		AN(it->priv);
+		h = it->priv;
+		loghist_add(h, nodes[i].ms);
+	}
+	analysis_pattern(nodes[0].url, pat, sizeof pat);
+	it = topk_add(esi->parents, pat, 1);
+	it->vals[V_MS] += nodes[0].ms;
+	it->vals[V_FRAG_MS] += frag_ms;
+	it->vals[V_FRAGS] += n - 1;
+
+	esi_keep_slowest(esi, nodes, n);
+	free(nodes);
+}
+
+static void
+esi_json(void *priv, struct vsb *vsb)
+{
+	struct esi_priv_t *esi = priv;
+	struct topk_item_t **v;
+	struct esi_tree_t *tr;
+	struct esi_node_t *nd;
+	unsigned i, j, n;
+	uint64_t seen;
+	int first = 1;
+
+	VSB_printf(vsb, ",\n\t\"pages\": %ju,\n\t\"fragments\": %ju",
+	    (uintmax_t)esi->pages, (uintmax_t)esi->fragments);
+
+	VSB_cat(vsb, ",\n\t\"patterns\": [");
+	v = topk_sorted(esi->frags, V_MS, &n);
+	for (i = 0; i < n && i < ESI_TOP; i++) {
+		VSB_printf(vsb, "%s\n\t\t{\"pattern\": ", i ? "," : "");
+		json_quote(vsb, v[i]->key, -1);
+		VSB_printf(vsb, ", \"count\": %ju, \"ms_total\": %.3f, "
+		    "\"hits\": %.0f, \"misses\": %.0f, \"bytes\": %.0f, "
+		    "\"ms\": ", (uintmax_t)v[i]->count, v[i]->vals[V_MS],
+		    v[i]->vals[V_HITS], v[i]->vals[V_MISSES],
+		    v[i]->vals[V_BYTES]);
+		loghist_json(vsb, v[i]->priv);
+		VSB_cat(vsb, "}");
+	}
+	free(v);
+
+	VSB_cat(vsb, "\n\t],\n\t\"parents\": [");
+	v = topk_sorted(esi->parents, V_MS, &n);
+	for (i = 0; i < n && i < ESI_TOP; i++) {
+		VSB_printf(vsb, "%s\n\t\t{\"pattern\": ", i ? "," : "");
+		json_quote(vsb, v[i]->key, -1);
+		/* The sums start over when a pattern takes a slot */
+		seen = v[i]->count - v[i]->error;
+		VSB_printf(vsb, ", \"pages\": %ju, \"ms_avg\": %.3f, "
+		    "\"fragment_ms_avg\": %.3f, \"fragments_avg\": %.1f}",
+		    (uintmax_t)v[i]->count, v[i]->vals[V_MS] / seen,
+		    v[i]->vals[V_FRAG_MS] / seen,
+		    v[i]->vals[V_FRAGS] / seen);
+	}
+	free(v);
+
+	VSB_cat(vsb, "\n\t],\n\t\"slowest\": [");
+	for (i = 0; i < ESI_SLOWEST; i++) {
+		tr = &esi->slowest[i];
+		if (tr->nodes == NULL)
+			continue;
+		VSB_printf(vsb, "%s\n\t\t{\"ms\": %.3f, \"tree\": [",
+		    first ? "" : ",", tr->ms);
+		first = 0;
+		for (j = 0; j < tr->n; j++) {
+			nd = &tr->nodes[j];
+			VSB_printf(vsb, "%s\n\t\t\t{\"depth\": %u, \"url\": ",
+			    j ? "," : "", nd->depth);
+			json_quote(vsb, nd->url, -1);
+			VSB_printf(vsb, ", \"ms\": %.3f, \"cache\": \"%s\", "
+			    "\"bytes\": %ju}", nd->ms,
+			    esi_cache_names[nd->cache], nd->bytes);
+		}
+		VSB_cat(vsb, "\n\t\t]}");
+	}
+	VSB_cat(vsb, "\n\t]");
+}
+
+const struct analyzer_t analyzer_esi = {
+	.name = "esi",
+	.help = "time, cache result and size of ESI fragments, by URL "
+	    "pattern, and the slowest pages with their fragment trees",
+	.grouping = VSL_g_request,
+	.new = esi_new,
+	.delete = esi_delete,
+	.feed = esi_feed,
+	.json = esi_json,
+};
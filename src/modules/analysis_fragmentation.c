@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Cache fragmentation: the same resource cached under several keys.
+ *
+ * Every client request is reduced to a normalized key (lower case host,
+ * path and the query parameters sorted, without tracking parameters) and
+ * a fingerprint of what varnishd really hashed and varied on (host and
+ * URL after VCL, and the request headers named in Vary). A miss for a
+ * fingerprint we have not seen while the key has others is a miss that
+ * normalization would have turned into a hit. Those wasted misses are
+ * blamed on what made the request differ: parameter order, tracking
+ * parameters, Vary headers or the case of the host. Cookies are blamed
+ * for the requests passed while they were there.
+ *
+ * Hashing is not logged by default, so the fingerprint assumes the
+ * hash of the builtin VCL (URL and host).
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <vapi/vsl.h>
+
+#include "common.h"
+#include "analysis.h"
+#include "json.h"
+#include "sketch.h"
+#include "vsb.h"
+
+#define FRAG_KEYS	4096	// Normalized keys we keep track of
+#define FRAG_CAUSES	256
+#define FRAG_FPS	8	// Fingerprints remembered per key
+#define FRAG_PARAMS	64
+#define FRAG_HEADERS	64
+#define FRAG_TOP	20	// Keys and causes in the reply
+
+/* Index of the sums in topk_item_t vals */
+#define V_WASTED	0
+#define V_VARIANTS	1	// Keys
+#define V_PASSES	1	// Causes
+#define V_COST		2	// Causes: wasted misses + passes
+
+static const char * const frag_tracking[] = {
+	"utm_*", "gclid", "fbclid", "dclid", "msclkid", "yclid", "mc_cid",
+	"mc_eid", "_ga", "_gl", NULL
+};
+
+struct frag_key_t {
+	uint32_t fp[FRAG_FPS];
+	unsigned nfp;
+};
+
+struct frag_priv_t {
+	uint64_t requests;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t passes;
+	uint64_t wasted;
+	struct topk_t *keys;
+	struct topk_t *causes;
+};
+
+/* One client request, pointing into the VSL records */
+struct frag_req_t {
+	const char *url;	// As received
+	const char *final_url;	// What was hashed
+	const char *host;
+	const char *final_host;
+	const char *cookie;
+	const char *vary;
+	const char *hdr[FRAG_HEADERS];
+	unsigned nhdr;
+	int hit, miss, pass;
+};
+
+static void *
+frag_new(void)
+{
+	struct frag_priv_t *frag;
+
+	ALLOC_OBJ(frag);
+	frag->keys = topk_new(FRAG_KEYS, free);
+	frag->causes = topk_new(FRAG_CAUSES, NULL);
+	return (frag);
+}
+
+static void
+frag_delete(void *priv)
+{
+	struct frag_priv_t *frag = priv;
+
+	topk_delete(frag->keys);
+	topk_delete(frag->causes);
+	free(frag);
+}
+
+static uint32_t
+frag_fnv(uint32_t h, const char *s, size_t l)
+{
+	for (; l > 0 && *s != '\0'; l--, s++) {
+		h ^= (unsigned char)*s;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+static int
+frag_is_tracking(const char *name, size_t l)
+{
+	const char * const *t;
+	size_t tl;
+
+	for (t = frag_tracking; *t != NULL; t++) {
+		tl = strlen(*t);
+		if ((*t)[tl - 1] == '*') {
+			if (l >= tl - 1 && !strncasecmp(name, *t, tl - 1))
+				return (1);
+		} else if (l == tl && !strncasecmp(name, *t, l))
+			return (1);
+	}
+	return (0);
+}
+
+static int
+frag_param_cmp(const void *a, const void *b)
+{
+	const char *x = *(const char * const *)a;
+	const char *y = *(const char * const *)b;
+	size_t lx = strcspn(x, "&"), ly = strcspn(y, "&");
+	int r;
+
+	r = strncmp(x, y, lx < ly ? lx : ly);
+	return (r ? r : (lx > ly) - (lx < ly));
+}
+
+static void
+frag_cause(struct frag_priv_t *frag, const char *cause, size_t l,
+    const char *prefix, int wasted, int pass)
+{
+	struct topk_item_t *it;
+	char buf[128];
+
+	snprintf(buf, sizeof buf, "%s%.*s", prefix, (int)l, cause);
+	it = topk_add(frag->causes, buf, 1);
+	it->vals[V_WASTED] += wasted;
+	it->vals[V_PASSES] += pass;
+	it->vals[V_COST] += wasted + pass;
+}
+
+/*
+ * The final value of request header name, or NULL.
+ */
+static const char *
+frag_req_header(const struct frag_req_t *r, const char *name, size_t l)
+{
+	const char *v = NULL, *h;
+	unsigned i;
+
+	for (i = 0; i < r->nhdr; i++) {
+		h = r->hdr[i];
+		if (!strncasecmp(h, name, l) && h[l] == ':')
+			v = h[l + 1] == ' ' ? h + l + 2 : h + l + 1;
+	}
+	return (v);
+}
+
+static void
+frag_request(struct frag_priv_t *frag, const struct frag_req_t *r)
+{
+	const char *params[FRAG_PARAMS], *q, *p, *e;
+	struct vsb *key;
+	struct topk_item_t *it;
+	struct frag_key_t *fk;
+	uint32_t fp;
+	unsigned n = 0, i;
+	int reordered = 0, seen = 0, wasted, causes = 0;
+	size_t l;
+
+	if (r->url == NULL)
+		return;
+	frag->requests++;
+	frag->hits += r->hit;
+	frag->misses += r->miss;
+	frag->passes += r->pass;
+
+	/* The normalized key */
+	key = VSB_new_auto();
+	AN(key);
+	for (p = r->host ? r->host : ""; *p != '\0'; p++)
+		VSB_putc(key, tolower((unsigned char)*p));
+	q = strchr(r->url, '?');
+	VSB_bcat(key, r->url, q ? (size_t)(q - r->url) : strlen(r->url));
+	for (p = q ? q + 1 : NULL; p != NULL && *p != '\0' &&
+	    n < FRAG_PARAMS; p = *e ? e + 1 : e) {
+		e = p + strcspn(p, "&");
+		l = strcspn(p, "=&");
+		if (e == p || frag_is_tracking(p, l))
+			continue;
+		if (n > 0 && frag_param_cmp(&params[n - 1], &p) > 0)
+			reordered = 1;
+		params[n++] = p;
+	}
+	qsort(params, n, sizeof *params, frag_param_cmp);
+	for (i = 0; i < n; i++) {
+		VSB_putc(key, i ? '&' : '?');
+		VSB_bcat(key, params[i], strcspn(params[i], "&"));
+	}
+	AZ(VSB_finish(key));
+
+	/* What varnishd hashed and varied on */
+	fp = frag_fnv(2166136261U, r->final_host ? r->final_host : "", -1);
+	fp = frag_fnv(fp, "\n", 1);
+	fp = frag_fnv(fp, r->final_url ? r->final_url : r->url, -1);
+	for (p = r->vary; p != NULL && *p != '\0'; p = *e ? e + 1 : e) {
+		while (*p == ' ' || *p == ',')
+			p++;
+		e = p + strcspn(p, ",");
+		for (l = e - p; l > 0 && p[l - 1] == ' '; l--)
+			continue;
+		if (l == 0)
+			continue;
+		q = frag_req_header(r, p, l);
+		fp = frag_fnv(fp, "\n", 1);
+		fp = frag_fnv(fp, q ? q : "", -1);
+	}
+
+	it = topk_add(frag->keys, VSB_data(key), 1);
+	VSB_delete(key);
+	if (it->priv == NULL) {
+		ALLOC_OBJ(fk);
+		it->priv = fk;
+	}
+	fk = it->priv;
+	for (i = 0; i < fk->nfp && i < FRAG_FPS; i++)
+		if (fk->fp[i] == fp)
+			seen = 1;
+	wasted = r->miss && !seen && fk->nfp > 0;
+	if (!seen) {
+		fk->fp[fk->nfp++ % FRAG_FPS] = fp;
+		it->vals[V_VARIANTS]++;
+	}
+	if (wasted) {
+		frag->wasted++;
+		it->vals[V_WASTED]++;
+	}
+
+	/* What made this request differ */
+	if (reordered) {
+		frag_cause(frag, "param-order", 11, "", wasted, 0);
+		causes++;
+	}
+	for (p = strchr(r->url, '?'); p != NULL && *p != '\0';
+	    p = *e ? e + 1 : e) {
+		if (*p == '?')
+			p++;
+		e = p + strcspn(p, "&");
+		l = strcspn(p, "=&");
+		if (frag_is_tracking(p, l)) {
+			frag_cause(frag, p, l, "param:", wasted, 0);
+			causes++;
+		}
+	}
+	for (p = r->host; p != NULL && *p != '\0'; p++)
+		if (isupper((unsigned char)*p)) {
+			frag_cause(frag, "host-case", 9, "", wasted, 0);
+			causes++;
+			break;
+		}
+	for (p = r->vary; p != NULL && *p != '\0'; p = *e ? e + 1 : e) {
+		while (*p == ' ' || *p == ',')
+			p++;
+		e = p + strcspn(p, ",");
+		for (l = e - p; l > 0 && p[l - 1] == ' '; l--)
+			continue;
+		/* varnishd normalizes Accept-Encoding itself */
+		if (l == 0 || (l == 15 && !strncasecmp(p, "Accept-Encoding",
+		    15)))
+			continue;
+		frag_cause(frag, p, l, "vary:", wasted, 0);
+		causes++;
+	}
+	if (wasted && causes == 0)
+		frag_cause(frag, "other", 5, "", 1, 0);
+
+	/* Cookies that came along with a pass */
+	for (p = r->pass ? r->cookie : NULL; p != NULL && *p != '\0';
+	    p = *e ? e + 1 : e) {
+		while (*p == ' ' || *p == ';')
+			p++;
+		e = p + strcspn(p, ";");
+		l = strcspn(p, "=;");
+		if (l > 0)
+			frag_cause(frag, p, l, "cookie:", 0, 1);
+	}
+}
+
+static void
+frag_feed(void *priv, struct VSL_transaction * const trans[])
+{
+	struct frag_priv_t *frag = priv;
+	struct VSL_transaction *t;
+	struct frag_req_t r;
+	const char *data, *v;
+
+	for (t = trans[0]; t != NULL; t = *++trans) {
+		if (t->type != VSL_t_req)
+			continue;
+		memset(&r, 0, sizeof r);
+		while (VSL_Next(t->c) == 1) {
+			data = VSL_CDATA(t->c->rec.ptr);
+			switch (VSL_TAG(t->c->rec.ptr)) {
+			case SLT_ReqURL:
+				if (r.url == NULL)
+					r.url = data;
+				r.final_url = data;
+				break;
+			case SLT_ReqHeader:
+				if ((v = analysis_header(data, "Host")) != NULL) {
+					if (r.host == NULL)
+						r.host = v;
+					r.final_host = v;
+				}
+				if ((v = analysis_header(data, "Cookie")) != NULL)
+					r.cookie = v;
+				if (r.nhdr < FRAG_HEADERS)
+					r.hdr[r.nhdr++] = data;
+				break;
+			case SLT_ReqUnset:
+				if (analysis_header(data, "Cookie") != NULL)
+					r.cookie = NULL;
+				break;
+			case SLT_RespHeader:
+				if ((v = analysis_header(data, "Vary")) != NULL)
+					r.vary = v;
+				break;
+			case SLT_VCL_call:
+				if (!strcmp(data, "HIT"))
+					r.hit = 1;
+				else if (!strcmp(data, "MISS"))
+					r.miss = 1;
+				else if (!strcmp(data, "PASS"))
+					r.pass = 1;
+				break;
+			default:
+				break;
+			}
+		}
+		frag_request(frag, &r);
+	}
+}
+
+static void
+frag_json(void *priv, struct vsb *vsb)
+{
+	struct frag_priv_t *frag = priv;
+	struct topk_item_t **v;
+	unsigned i, n;
+
+	VSB_printf(vsb, ",\n\t\"requests\": %ju,\n\t\"hits\": %ju,\n"
+	    "\t\"misses\": %ju,\n\t\"passes\": %ju,\n"
+	    "\t\"wasted_misses\": %ju", (uintmax_t)frag->requests,
+	    (uintmax_t)frag->hits, (uintmax_t)frag->misses,
+	    (uintmax_t)frag->passes, (uintmax_t)frag->wasted);
+
+	VSB_cat(vsb, ",\n\t\"causes\": [");
+	v = topk_sorted(frag->causes, V_COST, &n);
+	for (i = 0; i < n && i < FRAG_TOP; i++) {
+		VSB_printf(vsb, "%s\n\t\t{\"cause\": ", i ? "," : "");
+		json_quote(vsb, v[i]->key, -1);
+		VSB_printf(vsb, ", \"requests\": %ju, \"wasted_misses\": %.0f"
+		    ", \"passes\": %.0f}", (uintmax_t)v[i]->count,
+		    v[i]->vals[V_WASTED], v[i]->vals[V_PASSES]);
+	}
+	free(v);
+	VSB_cat(vsb, "\n\t],\n\t\"keys\": [");
+	v = topk_sorted(frag->keys, V_WASTED, &n);
+	for (i = 0; i < n && i < FRAG_TOP; i++) {
+		VSB_printf(vsb, "%s\n\t\t{\"key\": ", i ? "," : "");
+		json_quote(vsb, v[i]->key, -1);
+		VSB_printf(vsb, ", \"requests\": %ju, \"error\": %ju, "
+		    "\"variants\": %.0f, \"wasted_misses\": %.0f}",
+		    (uintmax_t)v[i]->count, (uintmax_t)v[i]->error,
+		    v[i]->vals[V_VARIANTS], v[i]->vals[V_WASTED]);
+	}
+	free(v);
+	VSB_cat(vsb, "\n\t]");
+}
+
+const struct analyzer_t analyzer_fragmentation = {
+	.name = "fragmentation",
+	.help = "objects cached under several keys, by query parameters, "
+	    "Vary and cookies",
+	.grouping = VSL_g_request,
+	.new = frag_new,
+	.delete = frag_delete,
+	.feed = frag_feed,
+	.json = frag_json,
+};
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compression costs.
+ *
+ * varnishd logs a Gzip record for every gzip or gunzip it does:
+ * "G|U F|D E|- in out ...", fetch or delivery side, and whether it was
+ * for ESI. They are added up per content type, per backend (for
+ * fetches) and per URL pattern for gunzips, since content that is
+ * gunzipped over and over for ESI or for clients without gzip support
+ * is the cost worth going after.
+ *
+ * The CPU cost is an estimate from the bytes compressed or produced,
+ * using typical zlib throughput at the default gzip_level.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vapi/vsc.h>
+#include <vapi/vsl.h>
+#include <vapi/vsm.h>
+
+#include "common.h"
+#include "analysis.h"
+#include "json.h"
+#include "sketch.h"
+#include "vsb.h"
+
+#define GZ_TYPES	128
+#define GZ_BACKENDS	128
+#define GZ_PATTERNS	512
+#define GZ_TOP		20
+#define GZ_NAME		256
+#define GZ_NS_GZIP	20.0	// Per input byte
+#define GZ_NS_GUNZIP	4.0	// Per output byte
+
+/* Index of the sums in topk_item_t vals */
+#define V_COST		0	// ms, all of them
+#define V_ESI		1	// Patterns
+#define V_OUT		2	// Patterns
+
+enum gz_op {
+	GZ_GZIP,
+	GZ_GUNZIP,
+	GZ_NOPS
+};
+
+static const char * const gz_op_names[GZ_NOPS] = {
+	[GZ_GZIP]	= "gzip",
+	[GZ_GUNZIP]	= "gunzip",
+};
+
+static const char * const gz_counters[] = {
+	"n_gzip", "n_gunzip", NULL
+};
+#define GZ_NCOUNTERS	2
+
+struct gz_sum_t {
+	uint64_t ops[GZ_NOPS];
+	uint64_t in[GZ_NOPS];
+	uint64_t out[GZ_NOPS];
+};
+
+struct gz_priv_t {
+	struct gz_sum_t all;
+	double cost;			// ms
+	struct topk_t *types;		// priv is a gz_sum_t
+	struct topk_t *backends;	// priv is a gz_sum_t
+	struct topk_t *patterns;	// Gunzips
+	int sampled;
+	uint64_t base[GZ_NCOUNTERS];
+	uint64_t cur[GZ_NCOUNTERS];
+};
+
+static void *
+gz_new(void)
+{
+	struct gz_priv_t *gz;
+
+	ALLOC_OBJ(gz);
+	gz->types = topk_new(GZ_TYPES, free);
+	gz->backends = topk_new(GZ_BACKENDS, free);
+	gz->patterns = topk_new(GZ_PATTERNS, NULL);
+	return (gz);
+}
+
+static void
+gz_delete(void *priv)
+{
+	struct gz_priv_t *gz = priv;
+
+	topk_delete(gz->types);
+	topk_delete(gz->backends);
+	topk_delete(gz->patterns);
+	free(gz);
+}
+
+static void
+gz_add(struct gz_sum_t *sum, enum gz_op op, uint64_t in, uint64_t out)
+{
+	sum->ops[op]++;
+	sum->in[op] += in;
+	sum->out[op] += out;
+}
+
+static void
+gz_add_key(struct topk_t *tk, const char *key, enum gz_op op, uint64_t in,
+    uint64_t out, double cost)
+{
+	struct topk_item_t *it;
+	struct gz_sum_t *sum;
+
+	it = topk_add(tk, key, 1);
+	if (it->priv == NULL) {
+		ALLOC_OBJ(sum);
+		it->priv = sum;
+	}
+	gz_add(it->priv, op, in, out);
+	it->vals[V_COST] += cost;
+}
+
+/* One Gzip record, with what we know of its transaction */
+struct gz_rec_t {
+	enum gz_op op;
+	int esi;
+	uint64_t in;
+	uint64_t out;
+};
+
+#define GZ_RECS 16
+
+static void
+gz_feed(void *priv, struct VSL_transaction * const trans[])
+{
+	struct gz_priv_t *gz = priv;
+	struct VSL_transaction *t;
+	struct gz_rec_t recs[GZ_RECS], *r;
+	struct topk_item_t *it;
+	char type[GZ_NAME], backend[GZ_NAME], pat[GZ_NAME], g[2], w[2], e[2];
+	const char *data, *v, *url;
+	uintmax_t in, out;
+	double cost;
+	unsigned n, i;
+
+	for (t = trans[0]; t != NULL; t = *++trans) {
+		if (t->type != VSL_t_req && t->type != VSL_t_bereq)
+			continue;
+		n = 0;
+		url = NULL;
+		strcpy(type, "unknown");
+		backend[0] = '\0';
+		while (VSL_Next(t->c) == 1) {
+			data = VSL_CDATA(t->c->rec.ptr);
+			switch (VSL_TAG(t->c->rec.ptr)) {
+			case SLT_Gzip:
+				if (n == GZ_RECS || sscanf(data,
+				    "%1s %1s %1s %ju %ju", g, w, e, &in,
+				    &out) != 5 || (*g != 'G' && *g != 'U'))
+					break;
+				recs[n].op = *g == 'G' ? GZ_GZIP : GZ_GUNZIP;
+				recs[n].esi = *e == 'E';
+				recs[n].in = in;
+				recs[n].out = out;
+				n++;
+				break;
+			case SLT_ReqURL:
+			case SLT_BereqURL:
+				if (url == NULL)
+					url = data;
+				break;
+			case SLT_RespHeader:
+			case SLT_BerespHeader:
+				v = analysis_header(data, "Content-Type");
+				if (v != NULL)
+					snprintf(type, sizeof type, "%.*s",
+					    (int)strcspn(v, "; "), v);
+				break;
+			case SLT_BackendOpen:
+				if (sscanf(data, "%*d %255s", backend) != 1)
+					backend[0] = '\0';
+				break;
+			default:
+				break;
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			r = &recs[i];
+			cost = (r->op == GZ_GZIP ? r->in * GZ_NS_GZIP :
+			    r->out * GZ_NS_GUNZIP) / 1e6;
+			gz_add(&gz->all, r->op, r->in, r->out);
+			gz->cost += cost;
+			gz_add_key(gz->types, type, r->op, r->in, r->out, cost);
+			if (backend[0] != '\0')
+				gz_add_key(gz->backends, backend, r->op, r->in,
+				    r->out, cost);
+			if (r->op != GZ_GUNZIP || url == NULL)
+				continue;
+			analysis_pattern(url, pat, sizeof pat);
+			it = topk_add(gz->patterns, pat, 1);
+			it->vals[V_COST] += cost;
+			it->vals[V_ESI] += r->esi;
+			it->vals[V_OUT] += r->out;
+		}
+	}
+}
+
+static int
+gz_sample_cb(void *priv, const struct VSC_point * const pt)
+{
+	struct gz_priv_t *gz = priv;
+	int i;
+
+	if (pt == NULL || strcmp(pt->section->fantom->type, "MAIN"))
+		return (0);
+	for (i = 0; gz_counters[i] != NULL; i++)
+		if (!strcmp(pt->desc->name, gz_counters[i]))
+			gz->cur[i] = *(const volatile uint64_t *)pt->ptr;
+	return (0);
+}
+
+static void
+gz_sample(void *priv, struct VSM_data *vsm)
+{
+	struct gz_priv_t *gz = priv;
+	int i;
+
+	(void)VSC_Iter(vsm, NULL, gz_sample_cb, gz);
+	for (i = 0; i < GZ_NCOUNTERS; i++)
+		if (gz->cur[i] < gz->base[i])
+			break;
+	/* The first sample, or varnishd restarted */
+	if (!gz->sampled || i < GZ_NCOUNTERS)
+		memcpy(gz->base, gz->cur, sizeof gz->base);
+	gz->sampled = 1;
+}
+
+static void
+gz_sum_json(struct vsb *vsb, const struct gz_sum_t *sum)
+{
+	int op;
+
+	for (op = 0; op < GZ_NOPS; op++)
+		VSB_printf(vsb, "%s\"%s\": {\"ops\": %ju, \"bytes_in\": %ju, "
+		    "\"bytes_out\": %ju, \"ratio\": %.3f}", op ? ", " : "",
+		    gz_op_names[op], (uintmax_t)sum->ops[op],
+		    (uintmax_t)sum->in[op], (uintmax_t)sum->out[op],
+		    op == GZ_GZIP ?
+		    (sum->in[op] ? (double)sum->out[op] / sum->in[op] : 0) :
+		    (sum->out[op] ? (double)sum->in[op] / sum->out[op] : 0));
+}
+
+static void
+gz_top_json(struct vsb *vsb, const struct topk_t *tk, const char *name,
+    const char *key)
+{
+	struct topk_item_t **v;
+	unsigned i, n;
+
+	VSB_printf(vsb, ",\n\t\"%s\": [", name);
+	v = topk_sorted(tk, V_COST, &n);
+	for (i = 0; i < n && i < GZ_TOP; i++) {
+		VSB_printf(vsb, "%s\n\t\t{\"%s\": ", i ? "," : "", key);
+		json_quote(vsb, v[i]->key, -1);
+		VSB_cat(vsb, ", ");
+		gz_sum_json(vsb, v[i]->priv);
+		VSB_printf(vsb, ", \"cpu_ms\": %.3f}", v[i]->vals[V_COST]);
+	}
+	free(v);
+	VSB_cat(vsb, "\n\t]");
+}
+
+static void
+gz_json(void *priv, struct vsb *vsb)
+{
+	struct gz_priv_t *gz = priv;
+	struct topk_item_t **v;
+	unsigned i, n;
+
+	VSB_cat(vsb, ",\n\t");
+	gz_sum_json(vsb, &gz->all);
+	VSB_printf(vsb, ",\n\t\"cpu_ms\": %.3f,\n\t\"counters\": {", gz->cost);
+	for (i = 0; i < GZ_NCOUNTERS; i++)
+		VSB_printf(vsb, "%s\"%s\": %ju", i ? ", " : "",
+		    gz_counters[i], (uintmax_t)(gz->cur[i] - gz->base[i]));
+	VSB_cat(vsb, "}");
+
+	gz_top_json(vsb, gz->types, "content_types", "content_type");
+	gz_top_json(vsb, gz->backends, "backends", "backend");
+
+	/* Content gunzipped again and again, by CPU cost */
+	VSB_cat(vsb, ",\n\t\"gunzipped\": [");
+	v = topk_sorted(gz->patterns, V_COST, &n);
+	for (i = 0; i < n && i < GZ_TOP; i++) {
+		VSB_printf(vsb, "%s\n\t\t{\"pattern\": ", i ? "," : "");
+		json_quote(vsb, v[i]->key, -1);
+		VSB_printf(vsb, ", \"gunzips\": %ju, \"esi\": %.0f, "
+		    "\"bytes_out\": %.0f, \"cpu_ms\": %.3f}",
+		    (uintmax_t)v[i]->count, v[i]->vals[V_ESI],
+		    v[i]->vals[V_OUT], v[i]->vals[V_COST]);
+	}
+	free(v);
+	VSB_cat(vsb, "\n\t]");
+}
+
+const struct analyzer_t analyzer_gzip = {
+	.name = "gzip",
+	.help = "gzip and gunzip bytes, ratios and estimated CPU cost by "
+	    "content type, backend and URL pattern",
+	.grouping = VSL_g_vxid,
+	.new = gz_new,
+	.delete = gz_delete,
+	.feed = gz_feed,
+	.sample = gz_sample,
+	.json = gz_json,
+};
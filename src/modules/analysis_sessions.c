@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Client sessions.
+ *
+ * A session group holds the session (SessOpen, SessClose with the reason
+ * and duration) and the client requests it carried. For every session we
+ * count its requests, the time spent handling them (up to the Resp
+ * timestamp) and the gaps between them, which is what timeout_idle has
+ * to cover for keep-alive to work. Sessions are also broken down by
+ * listen address, which separates traffic coming through a TLS
+ * terminator or CDN with its own -a from the rest, and sessions that
+ * used the PROXY protocol are counted.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vapi/vsl.h>
+
+#include "common.h"
+#include "analysis.h"
+#include "json.h"
+#include "sketch.h"
+#include "vsb.h"
+
+#define SESS_REASONS	32
+#define SESS_LISTENS	32
+#define SESS_NAME	64
+#define SESS_MIN	20	// Sessions before we recommend anything
+#define SESS_TIMEOUT	5	// Default timeout_idle
+
+/* Index of the sums in topk_item_t vals */
+#define V_REQUESTS	0
+#define V_DURATION	1	// ms
+#define V_HANDLING	2	// ms
+#define V_PROXIED	3
+
+struct sess_priv_t {
+	uint64_t sessions;
+	uint64_t requests;
+	uint64_t single;	// Sessions with at most one request
+	struct loghist_t reqs;		// Requests per session
+	struct loghist_t duration;	// ms
+	struct loghist_t handling;	// ms per session
+	struct loghist_t gap;		// ms between requests
+	struct topk_t *reasons;
+	struct topk_t *listens;
+};
+
+static void *
+sess_new(void)
+{
+	struct sess_priv_t *sess;
+
+	ALLOC_OBJ(sess);
+	sess->reasons = topk_new(SESS_REASONS, NULL);
+	sess->listens = topk_new(SESS_LISTENS, NULL);
+	return (sess);
+}
+
+static void
+sess_delete(void *priv)
+{
+	struct sess_priv_t *sess = priv;
+
+	topk_delete(sess->reasons);
+	topk_delete(sess->listens);
+	free(sess);
+}
+
+/*
+ * The absolute time of a Timestamp record for label, or -1.
+ */
+static double
+sess_abs(const char *data, const char *label)
+{
+	size_t l = strlen(label);
+	double abs;
+
+	if (strncmp(data, label, l) || data[l] != ':' ||
+	    sscanf(data + l + 1, "%lf", &abs) != 1)
+		return (-1);
+	return (abs);
+}
+
+/*
+ * A client request of the session: its start and end, and the time to
+ * handle it.
+ */
+static void
+sess_request(struct VSL_transaction *t, double *start, double *end,
+    double *ms)
+{
+	const char *data;
+	double v;
+
+	*start = *end = -1;
+	*ms = 0;
+	while (VSL_Next(t->c) == 1) {
+		if (VSL_TAG(t->c->rec.ptr) != SLT_Timestamp)
+			continue;
+		data = VSL_CDATA(t->c->rec.ptr);
+		if ((v = sess_abs(data, "Start")) >= 0)
+			*start = v;
+		else if ((v = sess_abs(data, "Resp")) >= 0) {
+			*end = v;
+			*ms = analysis_timestamp(data, "Resp") * 1000.0;
+		}
+	}
+}
+
+static void
+sess_feed(void *priv, struct VSL_transaction * const trans[])
+{
+	struct sess_priv_t *sess = priv;
+	struct VSL_transaction *t;
+	struct topk_item_t *it;
+	char listen[SESS_NAME], reason[SESS_NAME], f[2][SESS_NAME];
+	const char *data;
+	double duration = -1, handling = 0, start, end, ms, last = -1;
+	unsigned requests = 0;
+	int proxied = 0;
+
+	listen[0] = reason[0] = '\0';
+	for (t = trans[0]; t != NULL; t = *++trans) {
+		if (t->type == VSL_t_req && t->reason != VSL_r_esi) {
+			sess_request(t, &start, &end, &ms);
+			requests++;
+			handling += ms;
+			if (last >= 0 && start >= last)
+				loghist_add(&sess->gap, (start - last) * 1000);
+			if (end >= 0)
+				last = end;
+			continue;
+		}
+		if (t->type != VSL_t_sess)
+			continue;
+		while (VSL_Next(t->c) == 1) {
+			data = VSL_CDATA(t->c->rec.ptr);
+			switch (VSL_TAG(t->c->rec.ptr)) {
+			case SLT_SessOpen:
+				/* ip port listen ip port time fd */
+				if (sscanf(data, "%63s %63s %63s", f[0], f[1],
+				    listen) != 3)
+					listen[0] = '\0';
+				break;
+			case SLT_Proxy:
+				proxied = 1;
+				break;
+			case SLT_SessClose:
+				if (sscanf(data, "%63s %lf", reason,
+				    &duration) != 2)
+					duration = -1;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	/* Sessions still open when we started, or not a session group */
+	if (duration < 0)
+		return;
+
+	sess->sessions++;
+	sess->requests += requests;
+	sess->single += requests <= 1;
+	loghist_add(&sess->reqs, requests);
+	loghist_add(&sess->duration, duration * 1000);
+	loghist_add(&sess->handling, handling);
+
+	(void)topk_add(sess->reasons, reason, 1);
+	it = topk_add(sess->listens, listen[0] ? listen : "unknown", 1);
+	it->vals[V_REQUESTS] += requests;
+	it->vals[V_DURATION] += duration * 1000;
+	it->vals[V_HANDLING] += handling;
+	it->vals[V_PROXIED] += proxied;
+}
+
+static uint64_t
+sess_reason(const struct sess_priv_t *sess, const char *reason)
+{
+	struct topk_item_t *it;
+
+	it = topk_find(sess->reasons, reason);
+	return (it ? it->count : 0);
+}
+
+static void
+sess_recommend(struct sess_priv_t *sess, struct vsb *vsb)
+{
+	uint64_t closed, timeout;
+	double gap;
+	int k = 0;
+
+	VSB_cat(vsb, ",\n\t\"recommendations\": [");
+	if (sess->sessions < SESS_MIN) {
+		VSB_cat(vsb, "]");
+		return;
+	}
+	closed = sess_reason(sess, "REM_CLOSE") +
+	    sess_reason(sess, "REQ_CLOSE");
+	timeout = sess_reason(sess, "RX_TIMEOUT");
+	gap = loghist_quantile(&sess->gap, 0.99) / 1000;
+
+	if (sess->single * 2 > sess->sessions && closed * 2 > sess->sessions)
+		VSB_printf(vsb, "%s\n\t\t\"%.0f%% of the sessions carry a "
+		    "single request and are closed by the client: check "
+		    "keep-alive on the clients or the tier in front\"",
+		    k++ ? "," : "", 100.0 * sess->single / sess->sessions);
+	if (timeout * 2 > sess->sessions && sess->gap.n > 0 &&
+	    gap < SESS_TIMEOUT / 2.0)
+		VSB_printf(vsb, "%s\n\t\t\"most sessions end idle on "
+		    "timeout_idle while 99%% of the gaps between requests are "
+		    "under %.1fs: timeout_idle could be lowered to %.0fs to "
+		    "free sessions sooner\"", k++ ? "," : "", gap,
+		    gap < 0.5 ? 1 : gap * 2);
+	if (sess->gap.n > 0 && gap > SESS_TIMEOUT * 0.8)
+		VSB_printf(vsb, "%s\n\t\t\"1%% of the gaps between requests "
+		    "are %.1fs or more, close to timeout_idle (%ds by "
+		    "default): raise timeout_idle to keep those sessions "
+		    "open\"", k++ ? "," : "", gap, SESS_TIMEOUT);
+	VSB_cat(vsb, "\n\t]");
+}
+
+static void
+sess_json(void *priv, struct vsb *vsb)
+{
+	struct sess_priv_t *sess = priv;
+	struct topk_item_t **v;
+	double n;
+	unsigned i, nv;
+
+	VSB_printf(vsb, ",\n\t\"sessions\": %ju,\n\t\"requests\": %ju",
+	    (uintmax_t)sess->sessions, (uintmax_t)sess->requests);
+	VSB_cat(vsb, ",\n\t\"requests_per_session\": ");
+	loghist_json(vsb, &sess->reqs);
+	VSB_cat(vsb, ",\n\t\"duration_ms\": ");
+	loghist_json(vsb, &sess->duration);
+	VSB_cat(vsb, ",\n\t\"handling_ms\": ");
+	loghist_json(vsb, &sess->handling);
+	VSB_cat(vsb, ",\n\t\"gap_ms\": ");
+	loghist_json(vsb, &sess->gap);
+
+	VSB_cat(vsb, ",\n\t\"close_reasons\": [");
+	v = topk_sorted(sess->reasons, -1, &nv);
+	for (i = 0; i < nv; i++) {
+		VSB_printf(vsb, "%s\n\t\t{\"reason\": ", i ? "," : "");
+		json_quote(vsb, v[i]->key, -1);
+		VSB_printf(vsb, ", \"count\": %ju, \"share\": %.3f}",
+		    (uintmax_t)v[i]->count,
+		    (double)v[i]->count / sess->sessions);
+	}
+	free(v);
+
+	VSB_cat(vsb, "\n\t],\n\t\"listens\": [");
+	v = topk_sorted(sess->listens, -1, &nv);
+	for (i = 0; i < nv; i++) {
+		/* The sums start over when a listen address takes a slot */
+		n = v[i]->count - v[i]->error;
+		VSB_printf(vsb, "%s\n\t\t{\"listen\": ", i ? "," : "");
+		json_quote(vsb, v[i]->key, -1);
+		VSB_printf(vsb, ", \"sessions\": %ju, \"requests\": %.0f, "
+		    "\"proxied\": %.0f, \"requests_avg\": %.2f, "
+		    "\"duration_ms_avg\": %.3f, \"handling_ms_avg\": %.3f}",
+		    (uintmax_t)v[i]->count, v[i]->vals[V_REQUESTS],
+		    v[i]->vals[V_PROXIED], v[i]->vals[V_REQUESTS] / n,
+		    v[i]->vals[V_DURATION] / n, v[i]->vals[V_HANDLING] / n);
+	}
+	free(v);
+	VSB_cat(vsb, "\n\t]");
+
+	sess_recommend(sess, vsb);
+}
+
+const struct analyzer_t analyzer_sessions = {
+	.name = "sessions",
+	.help = "client sessions: requests per session, duration, gaps "
+	    "between requests and close reasons, by listen address",
+	.grouping = VSL_g_session,
+	.new = sess_new,
+	.delete = sess_delete,
+	.feed = sess_feed,
+	.json = sess_json,
+};
@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Storage forecasting.
+ *
+ * The bytes used by each storage (SMA/SMF g_bytes and g_space), n_object
+ * and the rate of n_lru_nuked are sampled every second and kept as one
+ * point a minute for a week. Once a minute each series is fitted again:
+ * with a day of history, the average deviation from the overall trend
+ * for each hour of the day is taken as the daily cycle, and the trend
+ * is fitted on the last hours with that cycle taken out. The forecast
+ * is the trend plus the cycle.
+ *
+ * From that we project when a storage will be ST_FULL used, and how
+ * many objects will be nuked a minute an hour from now. Alerts fire,
+ * and resolve, when those cross ST_FULL_HOURS and ST_NUKES.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vapi/vsc.h>
+#include <vapi/vsm.h>
+
+#include "common.h"
+#include "analysis.h"
+#include "json.h"
+#include "vsb.h"
+
+#define ST_STORAGES	8
+#define ST_NAME		64
+#define ST_MINUTES	(7 * 1440)	// History, one point a minute
+#define ST_FIT		360		// Minutes the trend is fitted on
+#define ST_MIN		15		// Minutes before we forecast
+#define ST_STEP		5		// Minutes between forecast points
+#define ST_FULL		0.95		// Of g_bytes + g_space
+#define ST_FULL_HOURS	6		// Alert when full within
+#define ST_NUKES	60		// Alert above, a minute, in an hour
+
+struct st_series_t {
+	double v[ST_MINUTES];
+	unsigned head;		// Oldest point
+	unsigned n;
+	time_t last;		// Minute of the newest point
+	time_t minute;		// Being sampled
+	double sum;
+	unsigned nsum;
+	/* The fit */
+	int fitted;
+	int seasonal;
+	double season[24];	// By hour of the day (UTC)
+	double level;		// Now
+	double slope;		// Per minute
+};
+
+struct st_storage_t {
+	char name[ST_NAME];
+	int bounded;		// g_space was seen, it has a size
+	uint64_t bytes;
+	uint64_t space;
+	int firing;
+	int alerted;
+	struct st_series_t used;
+};
+
+struct st_priv_t {
+	struct st_storage_t storage[ST_STORAGES];
+	unsigned nstorage;
+	uint64_t nuked;
+	uint64_t objects;
+	uint64_t nuked_prev;
+	int sampled;
+	int firing;
+	int alerted;
+	struct st_series_t nukes;	// A minute
+	struct st_series_t object;
+};
+
+static void *
+st_new(void)
+{
+	struct st_priv_t *st;
+
+	ALLOC_OBJ(st);
+	return (st);
+}
+
+static void
+st_delete(void *priv)
+{
+	free(priv);
+}
+
+static unsigned
+st_hour(time_t t)
+{
+	return ((t % 86400) / 3600);
+}
+
+static double
+st_point(const struct st_series_t *s, unsigned i)
+{
+	return (s->v[(s->head + i) % ST_MINUTES]);
+}
+
+static time_t
+st_time(const struct st_series_t *s, unsigned i)
+{
+	return (s->last - (time_t)(s->n - 1 - i) * 60);
+}
+
+static void
+st_push(struct st_series_t *s, time_t t, double v)
+{
+	unsigned gap = 1;
+
+	/* Minutes we missed repeat the previous point */
+	if (s->n > 0 && t > s->last)
+		gap = (t - s->last) / 60;
+	if (gap > ST_MINUTES)
+		gap = ST_MINUTES;
+	for (; gap > 0; gap--) {
+		if (gap > 1 && s->n > 0)
+			v = st_point(s, s->n - 1);
+		if (s->n == ST_MINUTES) {
+			s->v[s->head] = v;
+			s->head = (s->head + 1) % ST_MINUTES;
+		} else
+			s->v[(s->head + s->n++) % ST_MINUTES] = v;
+	}
+	s->last = t;
+}
+
+/*
+ * The line a + b * x through the points, by least squares.
+ */
+static void
+st_line(double n, double sx, double sy, double sxx, double sxy, double *a,
+    double *b)
+{
+	double d = n * sxx - sx * sx;
+
+	*b = d != 0 ? (n * sxy - sx * sy) / d : 0;
+	*a = (sy - *b * sx) / n;
+}
+
+static void
+st_fit(struct st_series_t *s)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, a, b, x, y, mean = 0;
+	double cnt[24];
+	unsigned i, h, w;
+
+	s->fitted = 0;
+	s->seasonal = 0;
+	memset(s->season, 0, sizeof s->season);
+	if (s->n < ST_MIN)
+		return;
+
+	if (s->n >= 1440) {
+		for (i = 0; i < s->n; i++) {
+			y = st_point(s, i);
+			sx += i;
+			sy += y;
+			sxx += (double)i * i;
+			sxy += i * y;
+		}
+		st_line(s->n, sx, sy, sxx, sxy, &a, &b);
+		memset(cnt, 0, sizeof cnt);
+		for (i = 0; i < s->n; i++) {
+			h = st_hour(st_time(s, i));
+			s->season[h] += st_point(s, i) - (a + b * i);
+			cnt[h]++;
+		}
+		for (h = 0; h < 24; h++) {
+			if (cnt[h] > 0)
+				s->season[h] /= cnt[h];
+			mean += s->season[h] / 24;
+		}
+		for (h = 0; h < 24; h++)
+			s->season[h] -= mean;
+		s->seasonal = 1;
+	}
+
+	/* The recent trend, without the cycle, x in minutes from now */
+	sx = sy = sxx = sxy = 0;
+	w = s->n < ST_FIT ? s->n : ST_FIT;
+	for (i = s->n - w; i < s->n; i++) {
+		x = (double)i - (s->n - 1);
+		y = st_point(s, i) - s->season[st_hour(st_time(s, i))];
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	st_line(w, sx, sy, sxx, sxy, &s->level, &s->slope);
+	s->fitted = 1;
+}
+
+/*
+ * Add a sample at now. A new point is made, and the series fitted
+ * again, every minute.
+ */
+static void
+st_add(struct st_series_t *s, time_t now, double v)
+{
+	time_t minute = now - now % 60;
+
+	if (s->nsum > 0 && minute != s->minute) {
+		st_push(s, s->minute, s->sum / s->nsum);
+		st_fit(s);
+		s->sum = 0;
+		s->nsum = 0;
+	}
+	s->minute = minute;
+	s->sum += v;
+	s->nsum++;
+}
+
+static double
+st_forecast(const struct st_series_t *s, unsigned minutes)
+{
+	return (s->level + s->slope * minutes +
+	    s->season[st_hour(s->last + (time_t)minutes * 60)]);
+}
+
+/*
+ * Seconds until the forecast reaches v, or -1 if not within a week.
+ */
+static double
+st_time_to(const struct st_series_t *s, double v)
+{
+	unsigned m;
+
+	if (!s->fitted)
+		return (-1);
+	for (m = 0; m <= ST_MINUTES; m += ST_STEP)
+		if (st_forecast(s, m) >= v)
+			return (m * 60.0);
+	return (-1);
+}
+
+static struct st_storage_t *
+st_storage(struct st_priv_t *st, const char *type, const char *ident)
+{
+	char name[ST_NAME];
+	unsigned i;
+
+	snprintf(name, sizeof name, "%s.%s", type, ident);
+	for (i = 0; i < st->nstorage; i++)
+		if (!strcmp(st->storage[i].name, name))
+			return (&st->storage[i]);
+	if (st->nstorage == ST_STORAGES)
+		return (NULL);
+	snprintf(st->storage[i].name, ST_NAME, "%s", name);
+	return (&st->storage[st->nstorage++]);
+}
+
+static int
+st_sample_cb(void *priv, const struct VSC_point * const pt)
+{
+	struct st_priv_t *st = priv;
+	struct st_storage_t *sto;
+	const char *type, *name;
+	uint64_t val;
+
+	if (pt == NULL)
+		return (0);
+	type = pt->section->fantom->type;
+	name = pt->desc->name;
+	val = *(const volatile uint64_t *)pt->ptr;
+	if (!strcmp(type, "MAIN")) {
+		if (!strcmp(name, "n_lru_nuked"))
+			st->nuked = val;
+		else if (!strcmp(name, "n_object"))
+			st->objects = val;
+	} else if ((!strcmp(type, "SMA") || !strcmp(type, "SMF")) &&
+	    (!strcmp(name, "g_bytes") || !strcmp(name, "g_space"))) {
+		sto = st_storage(st, type, pt->section->fantom->ident);
+		if (sto == NULL)
+			return (0);
+		if (name[2] == 'b')
+			sto->bytes = val;
+		else {
+			sto->space = val;
+			if (val > 0)
+				sto->bounded = 1;
+		}
+	}
+	return (0);
+}
+
+static double
+st_time_to_full(const struct st_storage_t *sto)
+{
+	if (!sto->bounded)
+		return (-1);
+	return (st_time_to(&sto->used, (sto->bytes + sto->space) * ST_FULL));
+}
+
+static void
+st_sample(void *priv, struct VSM_data *vsm)
+{
+	struct st_priv_t *st = priv;
+	struct st_storage_t *sto;
+	time_t now = time(NULL);
+	double ttf;
+	unsigned i;
+
+	(void)VSC_Iter(vsm, NULL, st_sample_cb, st);
+	for (i = 0; i < st->nstorage; i++) {
+		sto = &st->storage[i];
+		st_add(&sto->used, now, sto->bytes);
+		ttf = st_time_to_full(sto);
+		sto->firing = ttf >= 0 && ttf <= ST_FULL_HOURS * 3600;
+	}
+	st_add(&st->object, now, st->objects);
+	/* A restart starts the counter over */
+	if (st->sampled && st->nuked >= st->nuked_prev)
+		st_add(&st->nukes, now, (st->nuked - st->nuked_prev) * 60.0);
+	st->nuked_prev = st->nuked;
+	st->sampled = 1;
+	st->firing = st->nukes.fitted && st_forecast(&st->nukes, 60) >= ST_NUKES;
+}
+
+static void
+st_series_json(struct vsb *vsb, const struct st_series_t *s)
+{
+	if (!s->fitted) {
+		VSB_cat(vsb, "\"trend_per_hour\": null, \"seasonal\": false, "
+		    "\"forecast_1h\": null, \"forecast_24h\": null");
+		return;
+	}
+	VSB_printf(vsb, "\"trend_per_hour\": %.0f, \"seasonal\": %s, "
+	    "\"forecast_1h\": %.0f, \"forecast_24h\": %.0f", s->slope * 60,
+	    s->seasonal ? "true" : "false", st_forecast(s, 60),
+	    st_forecast(s, 1440));
+}
+
+static void
+st_json(void *priv, struct vsb *vsb)
+{
+	struct st_priv_t *st = priv;
+	struct st_storage_t *sto;
+	double ttf;
+	unsigned i;
+
+	VSB_printf(vsb, ",\n\t\"minutes\": %u,\n\t\"storages\": [",
+	    st->object.n);
+	for (i = 0; i < st->nstorage; i++) {
+		sto = &st->storage[i];
+		VSB_printf(vsb, "%s\n\t\t{\"storage\": ", i ? "," : "");
+		json_quote(vsb, sto->name, -1);
+		VSB_printf(vsb, ", \"bytes\": %ju, \"space\": %ju, ",
+		    (uintmax_t)sto->bytes, (uintmax_t)sto->space);
+		if (sto->bounded)
+			VSB_printf(vsb, "\"capacity\": %ju, \"fill\": %.3f, ",
+			    (uintmax_t)(sto->bytes + sto->space),
+			    (double)sto->bytes / (sto->bytes + sto->space));
+		else
+			VSB_cat(vsb, "\"capacity\": null, \"fill\": null, ");
+		st_series_json(vsb, &sto->used);
+		ttf = st_time_to_full(sto);
+		if (ttf >= 0)
+			VSB_printf(vsb, ", \"time_to_full\": %.0f", ttf);
+		else
+			VSB_cat(vsb, ", \"time_to_full\": null");
+		VSB_printf(vsb, ", \"alert\": %s}",
+		    sto->firing ? "true" : "false");
+	}
+	VSB_printf(vsb, "\n\t],\n\t\"objects\": {\"n_object\": %ju, ",
+	    (uintmax_t)st->objects);
+	st_series_json(vsb, &st->object);
+	VSB_cat(vsb, "},\n\t\"nuked_per_minute\": {");
+	if (st->nukes.n > 0)
+		VSB_printf(vsb, "\"last\": %.0f, ",
+		    st_point(&st->nukes, st->nukes.n - 1));
+	else
+		VSB_cat(vsb, "\"last\": null, ");
+	st_series_json(vsb, &st->nukes);
+	VSB_printf(vsb, ", \"alert\": %s}", st->firing ? "true" : "false");
+}
+
+/*
+ * The alerts that fired or resolved since the last call.
+ */
+static int
+st_alert(void *priv, struct vsb *vsb)
+{
+	struct st_priv_t *st = priv;
+	struct st_storage_t *sto;
+	unsigned i;
+	int n = 0;
+
+	for (i = 0; i < st->nstorage; i++) {
+		sto = &st->storage[i];
+		if (sto->firing == sto->alerted)
+			continue;
+		sto->alerted = sto->firing;
+		VSB_printf(vsb, "%s\n\t\t{\"alert\": \"storage-full\", "
+		    "\"storage\": ", n++ ? "," : ",\n\t\"alerts\": [");
+		json_quote(vsb, sto->name, -1);
+		VSB_printf(vsb, ", \"state\": \"%s\", "
+		    "\"bytes\": %ju, \"space\": %ju",
+		    sto->firing ? "firing" : "resolved",
+		    (uintmax_t)sto->bytes, (uintmax_t)sto->space);
+		if (sto->firing)
+			VSB_printf(vsb, ", \"time_to_full\": %.0f",
+			    st_time_to_full(sto));
+		VSB_cat(vsb, "}");
+	}
+	if (st->firing != st->alerted) {
+		st->alerted = st->firing;
+		VSB_printf(vsb, "%s\n\t\t{\"alert\": \"eviction-pressure\", "
+		    "\"state\": \"%s\", \"nuked_per_minute_1h\": %.0f}",
+		    n++ ? "," : ",\n\t\"alerts\": [",
+		    st->firing ? "firing" : "resolved",
+		    st_forecast(&st->nukes, 60));
+	}
+	if (n > 0)
+		VSB_cat(vsb, "\n\t]");
+	return (n);
+}
+
+const struct analyzer_t analyzer_storage = {
+	.name = "storage",
+	.help = "storage use, objects and nuke rate trends, with the time "
+	    "until each storage is 95% full and alerts when that is less "
+	    "than 6 hours or more than 60 objects a minute will be nuked "
+	    "an hour from now",
+	.new = st_new,
+	.delete = st_delete,
+	.sample = st_sample,
+	.json = st_json,
+	.alert = st_alert,
+};
@@ -0,0 +1,827 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VSL archive.
+ *
+ * With -A, the shmlog of every instance is followed in request grouping
+ * and written to disk in compressed blocks, with a sparse index (see
+ * vsl_archive.h), so that GET /log/archive can look back further than
+ * the shmlog reaches. A segment is closed when it reaches an eighth of
+ * the size cap or is an hour old, and the oldest segments are removed
+ * to stay under the cap, which is per instance.
+ */
+
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vapi/vsl.h>
+#include <vapi/vsm.h>
+
+#include "common.h"
+#include "http.h"
+#include "instance.h"
+#include "ipc.h"
+#include "plugins.h"
+#include "vsb.h"
+#include "vsl_archive.h"
+#include "vsl_tail.h"
+
+#define ARCHIVE_RETRY	5	// Seconds between attempts to open the VSM
+#define ARCHIVE_BLOCK	(1024 * 1024)	// Uncompressed bytes in a block
+#define ARCHIVE_FLUSH	5	// Seconds before a block is written anyway
+#define ARCHIVE_AGE	3600	// Seconds before a segment is closed
+#define ARCHIVE_SPAN	300	// Seconds a query looks back by default
+#define ARCHIVE_LIMIT	10	// Groups in a reply, by default
+#define ARCHIVE_MAX	1000
+#define ARCHIVE_INFLATE	64	// Blocks a query inflates before it stops
+
+struct archive_inst_t {
+	char *dir;
+	struct vsl_tail_t tail;
+	int data_fd;		// -1 when no segment is open
+	int idx_fd;
+	uint64_t data_len;
+	time_t seg_start;
+	time_t block_start;
+	struct archive_block_t block;
+};
+
+struct archive_priv_t {
+	int logger;
+	uint64_t cap;		// Bytes per instance
+	uint64_t segment;
+	struct archive_inst_t *inst;
+	int ninstances;
+	pthread_mutex_t lck;	// The counters
+	uintmax_t groups;
+	uintmax_t blocks;
+	uintmax_t bytes_in;
+	uintmax_t bytes_out;
+	uintmax_t removed;	// Segments
+};
+
+struct archive_dispatch_t {
+	struct archive_priv_t *archive;
+	struct archive_inst_t *in;
+};
+
+static int
+archive_cmp(const void *a, const void *b)
+{
+	const intmax_t *x = a, *y = b;
+
+	return (*x < *y ? -1 : *x > *y);
+}
+
+/*
+ * The start times of the segments in dir, oldest first, in *starts.
+ */
+static unsigned
+archive_segments(const char *dir, intmax_t **starts)
+{
+	struct dirent *de;
+	unsigned n = 0, size = 0;
+	intmax_t t;
+	char c;
+	DIR *d;
+
+	*starts = NULL;
+	if ((d = opendir(dir)) == NULL)
+		return (0);
+	while ((de = readdir(d)) != NULL) {
+		if (sscanf(de->d_name, "vsl-%jd.id%c", &t, &c) != 2 ||
+		    c != 'x')
+			continue;
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			*starts = realloc(*starts, size * sizeof **starts);
+			AN(*starts);
+		}
+		(*starts)[n++] = t;
+	}
+	closedir(d);
+	if (n > 0)
+		qsort(*starts, n, sizeof **starts, archive_cmp);
+	return (n);
+}
+
+static void
+archive_path(char *buf, size_t len, const char *dir, intmax_t start,
+    const char *ext)
+{
+	assert(snprintf(buf, len, "%s/vsl-%010jd.%s", dir, start, ext) <
+	    (int)len);
+}
+
+/*
+ * Remove the oldest segments until the archive fits in the cap, never
+ * the one being written.
+ */
+static void
+archive_prune(struct archive_priv_t *archive, struct archive_inst_t *in)
+{
+	char path[PATH_MAX];
+	intmax_t *starts;
+	uint64_t *sizes, total = 0;
+	struct stat st;
+	unsigned i, n;
+
+	n = archive_segments(in->dir, &starts);
+	sizes = calloc(n + 1, sizeof *sizes);
+	AN(sizes);
+	for (i = 0; i < n; i++) {
+		archive_path(path, sizeof path, in->dir, starts[i], "data");
+		if (stat(path, &st) == 0)
+			sizes[i] += st.st_size;
+		archive_path(path, sizeof path, in->dir, starts[i], "idx");
+		if (stat(path, &st) == 0)
+			sizes[i] += st.st_size;
+		total += sizes[i];
+	}
+	for (i = 0; i < n && total > archive->cap; i++) {
+		if (in->data_fd >= 0 && starts[i] == in->seg_start)
+			break;
+		archive_path(path, sizeof path, in->dir, starts[i], "data");
+		(void)unlink(path);
+		archive_path(path, sizeof path, in->dir, starts[i], "idx");
+		(void)unlink(path);
+		total -= sizes[i];
+		AZ(pthread_mutex_lock(&archive->lck));
+		archive->removed++;
+		AZ(pthread_mutex_unlock(&archive->lck));
+		debuglog(archive->logger, "Removed archive segment %s/vsl-%jd",
+		    in->dir, starts[i]);
+	}
+	free(starts);
+	free(sizes);
+}
+
+static void
+archive_segment_close(struct archive_inst_t *in)
+{
+	if (in->data_fd < 0)
+		return;
+	close(in->data_fd);
+	close(in->idx_fd);
+	in->data_fd = in->idx_fd = -1;
+}
+
+static int
+archive_segment_open(struct archive_priv_t *archive,
+    struct archive_inst_t *in)
+{
+	char path[PATH_MAX];
+	time_t t = time(NULL);
+
+	/* A second segment in the same second starts a second later */
+	for (;; t++) {
+		archive_path(path, sizeof path, in->dir, t, "data");
+		in->data_fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0640);
+		if (in->data_fd >= 0 || errno != EEXIST)
+			break;
+	}
+	if (in->data_fd < 0) {
+		warnlog(archive->logger, "Can't create %s: %s", path,
+		    strerror(errno));
+		return (-1);
+	}
+	archive_path(path, sizeof path, in->dir, t, "idx");
+	in->idx_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (in->idx_fd < 0) {
+		warnlog(archive->logger, "Can't create %s: %s", path,
+		    strerror(errno));
+		close(in->data_fd);
+		in->data_fd = -1;
+		return (-1);
+	}
+	in->seg_start = t;
+	in->data_len = 0;
+	return (0);
+}
+
+static int
+archive_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t l;
+
+	while (len > 0) {
+		l = write(fd, p, len);
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l <= 0)
+			return (-1);
+		p += l;
+		len -= l;
+	}
+	return (0);
+}
+
+/*
+ * Write the block, then its index entry, to the current segment.
+ */
+static void
+archive_flush(struct archive_priv_t *archive, struct archive_inst_t *in)
+{
+	struct archive_block_t *b = &in->block;
+	char *out;
+
+	if (b->idx.groups == 0)
+		return;
+	if (in->data_fd >= 0 && (in->data_len >= archive->segment ||
+	    time(NULL) - in->seg_start >= ARCHIVE_AGE)) {
+		archive_segment_close(in);
+		archive_prune(archive, in);
+	}
+	if ((in->data_fd >= 0 || !archive_segment_open(archive, in)) &&
+	    !archive_block_compress(b, &out)) {
+		b->idx.offset = in->data_len;
+		if (archive_write(in->data_fd, out, b->idx.clen) ||
+		    archive_write(in->idx_fd, &b->idx, sizeof b->idx)) {
+			warnlog(archive->logger, "Can't write to the archive "
+			    "in %s: %s", in->dir, strerror(errno));
+			archive_segment_close(in);
+		} else {
+			in->data_len += b->idx.clen;
+			AZ(pthread_mutex_lock(&archive->lck));
+			archive->blocks++;
+			archive->bytes_in += b->idx.ulen;
+			archive->bytes_out += b->idx.clen;
+			AZ(pthread_mutex_unlock(&archive->lck));
+		}
+		free(out);
+	}
+	archive_block_reset(b);
+}
+
+/* The second field of a record, "fd name ..." */
+static void
+archive_field2(const char *data, char *buf, size_t len)
+{
+	size_t l;
+
+	data += strcspn(data, " ");
+	data += strspn(data, " ");
+	l = strcspn(data, " ");
+	if (l >= len)
+		l = len - 1;
+	memcpy(buf, data, l);
+	buf[l] = '\0';
+}
+
+/*
+ * Find what goes in the index of a group, then write it to the block.
+ */
+static int
+archive_dispatch(struct VSL_data *vsl, struct VSL_transaction * const trans[],
+    void *priv)
+{
+	struct archive_dispatch_t *d = priv;
+	struct archive_block_t *b = &d->in->block;
+	struct archive_group_t g;
+	struct VSL_transaction *t;
+	char url[1024] = "", backend[128] = "";
+	const char *data;
+	double abs, since;
+	size_t l;
+	int i, tag;
+
+	(void)vsl;
+	memset(&g, 0, sizeof g);
+	for (i = 0; (t = trans[i]) != NULL; i++) {
+		if (g.nvxid < sizeof g.vxid / sizeof *g.vxid)
+			g.vxid[g.nvxid++] = t->vxid;
+		while (VSL_Next(t->c) == 1) {
+			tag = VSL_TAG(t->c->rec.ptr);
+			data = VSL_CDATA(t->c->rec.ptr);
+			if (i == 0 && g.t == 0 && tag == SLT_Timestamp &&
+			    sscanf(data + strcspn(data, ":") + 1, "%lf %lf",
+			    &abs, &since) == 2)
+				g.t = abs - since;
+			else if (i == 0 && url[0] == '\0' &&
+			    (tag == SLT_ReqURL || tag == SLT_BereqURL))
+				snprintf(url, sizeof url, "%s", data);
+			else if (i == 0 && (tag == SLT_RespStatus ||
+			    (tag == SLT_BerespStatus &&
+			    t->type == VSL_t_bereq)))
+				g.status = strtoul(data, NULL, 10);
+			else if (backend[0] == '\0' &&
+			    (tag == SLT_BackendOpen ||
+			    tag == SLT_BackendReuse))
+				archive_field2(data, backend, sizeof backend);
+		}
+		(void)VSL_ResetCursor(t->c);
+	}
+	if (g.t == 0)
+		g.t = time(NULL);
+	g.url = url;
+	g.backend = backend;
+
+	if (b->idx.groups == 0)
+		d->in->block_start = time(NULL);
+	archive_block_group(b, &g);
+	for (i = 0; (t = trans[i]) != NULL; i++) {
+		archive_block_trans(b, t->vxid, t->vxid_parent, t->type,
+		    t->reason);
+		while (VSL_Next(t->c) == 1) {
+			data = VSL_CDATA(t->c->rec.ptr);
+			l = VSL_LEN(t->c->rec.ptr);
+			if (l > 0 && data[l - 1] == '\0')
+				l--;
+			archive_block_record(b, VSL_TAG(t->c->rec.ptr), data,
+			    l);
+		}
+	}
+	AZ(pthread_mutex_lock(&d->archive->lck));
+	d->archive->groups++;
+	AZ(pthread_mutex_unlock(&d->archive->lck));
+	if (b->len >= ARCHIVE_BLOCK || archive_block_full(b))
+		archive_flush(d->archive, d->in);
+	return (0);
+}
+
+/*
+ * Returns 1 if there was anything to read.
+ */
+static int
+archive_poll(struct agent_core_t *core, struct archive_priv_t *archive,
+    struct archive_inst_t *in)
+{
+	struct archive_dispatch_t d;
+
+	if (in->block.idx.groups > 0 &&
+	    time(NULL) - in->block_start >= ARCHIVE_FLUSH)
+		archive_flush(archive, in);
+	d.archive = archive;
+	d.in = in;
+	return (vsl_tail_poll(&in->tail, core, archive->logger,
+	    archive_dispatch, &d));
+}
+
+static void *
+archive_run(void *data)
+{
+	struct agent_core_t *core = data;
+	struct archive_priv_t *archive;
+	int i, busy;
+
+	GET_PRIV(core, archive);
+	for (i = 0; i < archive->ninstances; i++) {
+		if (mkdir(archive->inst[i].dir, 0750) && errno != EEXIST)
+			warnlog(archive->logger, "Can't create %s: %s",
+			    archive->inst[i].dir, strerror(errno));
+		archive_prune(archive, &archive->inst[i]);
+	}
+	for (;;) {
+		busy = 0;
+		for (i = 0; i < archive->ninstances; i++) {
+			instance_select(i);
+			busy |= archive_poll(core, archive,
+			    &archive->inst[i]);
+		}
+		if (!busy)
+			usleep(10000);
+	}
+	return (NULL);
+}
+
+static void *
+archive_start(struct agent_core_t *core, const char *name)
+{
+	pthread_t *thread;
+
+	(void)name;
+
+	ALLOC_OBJ(thread);
+	AZ(pthread_create(thread, NULL, archive_run, core));
+	return (thread);
+}
+
+/*
+ * Seconds since the epoch, or a local "YYYY-MM-DD HH:MM[:SS]" (or with
+ * a T), or "HH:MM[:SS]", the last time it was that time of day.
+ */
+static int
+archive_time(const char *s, double *t)
+{
+	static const char * const fmts[] = {
+		"%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M",
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M",
+		"%H:%M:%S", "%H:%M",
+	};
+	struct tm tm;
+	const char *e;
+	char *end;
+	time_t now = time(NULL);
+	unsigned i;
+
+	*t = strtod(s, &end);
+	if (end != s && *end == '\0')
+		return (0);
+	for (i = 0; i < sizeof fmts / sizeof *fmts; i++) {
+		AN(localtime_r(&now, &tm));
+		tm.tm_sec = 0;
+		if ((e = strptime(s, fmts[i], &tm)) == NULL || *e != '\0')
+			continue;
+		tm.tm_isdst = -1;
+		*t = mktime(&tm);
+		if (fmts[i][1] == 'H' && *t > now)
+			*t -= 86400;
+		return (0);
+	}
+	return (-1);
+}
+
+/*
+ * A query, run off the HTTP lock (see http_defer()). It starts at block
+ * blk of segment seg, and when it has inflated ARCHIVE_INFLATE blocks
+ * without reaching limit, stops and leaves there the block to go on
+ * from, with more set.
+ */
+struct archive_reply_t {
+	struct vsb *vsb;
+	struct archive_query_t q;
+	char *url;
+	char *backend;
+	const char *dir;
+	unsigned limit;
+	unsigned matched;
+	unsigned records;
+	unsigned segments;
+	unsigned blocks;	// In the time range
+	unsigned inflated;
+	intmax_t seg;
+	unsigned blk;
+	int more;
+};
+
+/*
+ * The matching groups of a block, as records in the format of /log.
+ */
+static void
+archive_scan(struct archive_reply_t *r, const char *buf, size_t len)
+{
+	struct archive_cursor_t *c;
+	int k, match = 0;
+
+	c = malloc(sizeof *c);
+	AN(c);
+	archive_cursor_init(c, buf, len);
+	while ((k = archive_next(c)) > 0) {
+		if (k == 'G') {
+			if (r->matched == r->limit)
+				break;
+			match = archive_group_match(&c->group, &r->q);
+			r->matched += match;
+		} else if (k == 'R' && match) {
+			VSB_printf(r->vsb, "%s\n{ \"vxid\": \"%u\", \"tag\": "
+			    "\"%s\", \"type\": \"%s\", \"reason\": \"%s\", "
+			    "\"value\": ", r->records++ ? "," : "", c->vxid,
+			    VSL_tags[c->tag] ? VSL_tags[c->tag] : "",
+			    c->type < VSL_t__MAX ? vsl_t_names[c->type] :
+			    "unknown", c->reason < VSL_r__MAX ?
+			    vsl_r_names[c->reason] : "unknown");
+			VSB_quote(r->vsb, c->data, c->len, 0);
+			VSB_cat(r->vsb, "}");
+		}
+	}
+	free(c);
+}
+
+/*
+ * Look through the index of a segment, and the blocks that may match,
+ * from block first on.
+ */
+static void
+archive_segment_query(struct archive_reply_t *r, const char *dir,
+    intmax_t start, unsigned first)
+{
+	struct archive_idx_t *idx;
+	char path[PATH_MAX], *data, *buf;
+	struct stat st;
+	unsigned i, n;
+	int fd, dfd;
+
+	archive_path(path, sizeof path, dir, start, "idx");
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof *idx) {
+		close(fd);
+		return;
+	}
+	n = st.st_size / sizeof *idx;
+	idx = malloc(n * sizeof *idx);
+	AN(idx);
+	if (read(fd, idx, n * sizeof *idx) != (ssize_t)(n * sizeof *idx))
+		n = 0;
+	close(fd);
+	archive_path(path, sizeof path, dir, start, "data");
+	dfd = n > 0 ? open(path, O_RDONLY) : -1;
+	for (i = first; dfd >= 0 && i < n && r->matched < r->limit; i++) {
+		if ((r->q.from > 0 && idx[i].t_max < r->q.from) ||
+		    (r->q.to > 0 && idx[i].t_min > r->q.to))
+			continue;
+		if (!archive_idx_match(&idx[i], &r->q)) {
+			r->blocks++;
+			continue;
+		}
+		if (r->inflated == ARCHIVE_INFLATE) {
+			r->seg = start;
+			r->blk = i;
+			r->more = 1;
+			break;
+		}
+		r->blocks++;
+		data = malloc(idx[i].clen);
+		AN(data);
+		if (pread(dfd, data, idx[i].clen, idx[i].offset) ==
+		    (ssize_t)idx[i].clen &&
+		    (buf = archive_block_inflate(&idx[i], data)) != NULL) {
+			r->inflated++;
+			archive_scan(r, buf, idx[i].ulen);
+			free(buf);
+		}
+		free(data);
+	}
+	if (dfd >= 0)
+		close(dfd);
+	free(idx);
+}
+
+static void
+archive_query_run(void *priv)
+{
+	struct archive_reply_t *r = priv;
+	intmax_t *starts, seg = r->seg;
+	unsigned i, blk = r->blk;
+
+	r->vsb = VSB_new_auto();
+	AN(r->vsb);
+	VSB_cat(r->vsb, "{ \"log\": [");
+	r->segments = archive_segments(r->dir, &starts);
+	for (i = 0; i < r->segments && r->matched < r->limit && !r->more;
+	    i++) {
+		if (starts[i] < seg)
+			continue;
+		archive_segment_query(r, r->dir, starts[i],
+		    starts[i] == seg ? blk : 0);
+	}
+	free(starts);
+	VSB_printf(r->vsb, "\n], \"from\": %.0f, \"to\": %.0f, "
+	    "\"groups\": %u, \"segments\": %u, \"blocks\": %u, "
+	    "\"inflated\": %u", r->q.from, r->q.to, r->matched,
+	    r->segments, r->blocks, r->inflated);
+	if (r->more)
+		VSB_printf(r->vsb, ", \"next\": \"%jd.%u\"", r->seg, r->blk);
+	VSB_cat(r->vsb, " }\n");
+	AZ(VSB_finish(r->vsb));
+}
+
+static void
+archive_query_free(void *priv)
+{
+	struct archive_reply_t *r = priv;
+
+	if (r->vsb != NULL)
+		VSB_delete(r->vsb);
+	free(r->url);
+	free(r->backend);
+	free(r);
+}
+
+/*
+ * The query in the arguments of request, or NULL after replying with
+ * what is wrong with it.
+ */
+static struct archive_reply_t *
+archive_query_parse(struct http_request *request, const char *dir)
+{
+	struct archive_reply_t *r;
+	const char *v;
+	char *e;
+
+	ALLOC_OBJ(r);
+	r->dir = dir;
+	r->limit = ARCHIVE_LIMIT;
+	if ((v = http_get_arg(request->connection, "to")) != NULL &&
+	    archive_time(v, &r->q.to)) {
+		http_reply(request->connection, 400, "Bad time in to");
+		goto bad;
+	}
+	if ((v = http_get_arg(request->connection, "from")) != NULL &&
+	    archive_time(v, &r->q.from)) {
+		http_reply(request->connection, 400, "Bad time in from");
+		goto bad;
+	}
+	if ((v = http_get_arg(request->connection, "vxid")) != NULL) {
+		r->q.vxid = strtoul(v, &e, 10);
+		if (*e != '\0' || r->q.vxid == 0) {
+			http_reply(request->connection, 400, "Bad vxid");
+			goto bad;
+		}
+	}
+	if ((v = http_get_arg(request->connection, "status")) != NULL) {
+		r->q.status = strtoul(v, &e, 10);
+		if (!strcmp(e, "xx") && r->q.status >= 1 && r->q.status <= 9)
+			;
+		else if (*e != '\0' || r->q.status < 100 ||
+		    r->q.status > 999) {
+			http_reply(request->connection, 400,
+			    "Bad status, must be like 503 or 5xx");
+			goto bad;
+		}
+	}
+	if ((v = http_get_arg(request->connection, "limit")) != NULL) {
+		r->limit = strtoul(v, &e, 10);
+		if (*e != '\0' || r->limit == 0 || r->limit > ARCHIVE_MAX) {
+			http_reply(request->connection, 400, "Bad limit");
+			goto bad;
+		}
+	}
+	if ((v = http_get_arg(request->connection, "next")) != NULL) {
+		r->seg = strtoimax(v, &e, 10);
+		if (*e++ != '.' || r->seg < 0) {
+			http_reply(request->connection, 400, "Bad next");
+			goto bad;
+		}
+		r->blk = strtoul(e, &e, 10);
+		if (*e != '\0') {
+			http_reply(request->connection, 400, "Bad next");
+			goto bad;
+		}
+	}
+	if ((v = http_get_arg(request->connection, "url")) != NULL) {
+		r->url = strdup(v);
+		AN(r->url);
+	}
+	if ((v = http_get_arg(request->connection, "backend")) != NULL) {
+		r->backend = strdup(v);
+		AN(r->backend);
+	}
+	r->q.url = r->url;
+	r->q.backend = r->backend;
+	if (r->q.to == 0)
+		r->q.to = time(NULL);
+	if (r->q.from == 0 && r->q.vxid == 0 &&
+	    http_get_arg(request->connection, "from") == NULL)
+		r->q.from = r->q.to - ARCHIVE_SPAN;
+	return (r);
+bad:
+	archive_query_free(r);
+	return (NULL);
+}
+
+/*
+ * GET /log/archive?from=&to=&status=&url=&backend=&vxid=&limit=&next=
+ */
+static unsigned int
+archive_reply(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct archive_priv_t *archive;
+	struct archive_reply_t *r;
+	struct http_response *resp;
+
+	(void)arg;
+	GET_PRIV(core, archive);
+	r = http_deferred(request);
+	if (r == NULL) {
+		if (archive->ninstances == 0) {
+			http_reply(request->connection, 404,
+			    "The log is not archived, see -A");
+			return (0);
+		}
+		r = archive_query_parse(request,
+		    archive->inst[instance_current()].dir);
+		if (r == NULL)
+			return (0);
+		if (http_defer(request, archive_query_run, archive_query_free,
+		    r))
+			return (0);
+		archive_query_run(r);
+	}
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(r->vsb);
+	resp->ndata = VSB_len(r->vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	archive_query_free(r);
+	return (0);
+}
+
+/*
+ * GET /log/archive/stats
+ */
+static unsigned int
+archive_stats(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct archive_priv_t *archive;
+	struct http_response *resp;
+	struct vsb *vsb;
+
+	(void)arg;
+	GET_PRIV(core, archive);
+	vsb = VSB_new_auto();
+	AN(vsb);
+	AZ(pthread_mutex_lock(&archive->lck));
+	VSB_printf(vsb, "{\n\t\"enabled\": %s,\n\t\"cap\": %ju,\n\t"
+	    "\"groups\": %ju,\n\t\"blocks\": %ju,\n\t\"bytes_in\": %ju,\n\t"
+	    "\"bytes_out\": %ju,\n\t\"segments_removed\": %ju\n}\n",
+	    archive->ninstances > 0 ? "true" : "false",
+	    (uintmax_t)archive->cap, archive->groups, archive->blocks,
+	    archive->bytes_in, archive->bytes_out, archive->removed);
+	AZ(pthread_mutex_unlock(&archive->lck));
+	AZ(VSB_finish(vsb));
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (0);
+}
+
+void
+archive_init(struct agent_core_t *core)
+{
+	struct agent_plugin_t *plug;
+	struct archive_priv_t *priv;
+	struct archive_inst_t *in;
+	int i;
+
+	ALLOC_OBJ(priv);
+	plug = plugin_find(core, "archive");
+	priv->logger = ipc_register(core, "logger");
+	AZ(pthread_mutex_init(&priv->lck, NULL));
+	plug->data = (void *)priv;
+	http_register_path(core, "/log/archive", M_GET, archive_reply, core);
+	http_register_path(core, "/log/archive/stats", M_GET, archive_stats,
+	    core);
+	if (core->config->A_arg == NULL)
+		return;
+
+	priv->cap = (uint64_t)core->config->M_arg * 1024 * 1024;
+	priv->segment = priv->cap / 8;
+	if (priv->segment > 64 * 1024 * 1024)
+		priv->segment = 64 * 1024 * 1024;
+	priv->ninstances = core->config->ninstances;
+	priv->inst = calloc(priv->ninstances, sizeof *priv->inst);
+	AN(priv->inst);
+	for (i = 0; i < priv->ninstances; i++) {
+		in = &priv->inst[i];
+		/* Like -p, the default instance gets the directory */
+		if (i == 0)
+			in->dir = strdup(core->config->A_arg);
+		else
+			assert(asprintf(&in->dir, "%s/%s",
+			    core->config->A_arg,
+			    core->config->instances[i].name) > 0);
+		AN(in->dir);
+		in->tail.what = "archiving";
+		in->tail.groupings = 1U << VSL_g_request;
+		in->tail.interval = ARCHIVE_RETRY;
+		in->data_fd = in->idx_fd = -1;
+	}
+	plug->start = archive_start;
+}
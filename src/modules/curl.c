@@ -77,6 +77,11 @@ senddata(void *ptr, size_t size, size_t nmemb, void *userdata)
 	return (len);
 }
 
+/*
+ * The message is the url, optionally followed by a newline and a body
+ * to PUT. "POST <url>" POSTs the body as JSON instead, and then an HTTP
+ * status other than 2xx is an error too.
+ */
 static void
 issue_curl(void *priv, char *url, struct ipc_ret_t *ret)
 {
@@ -86,7 +91,13 @@ issue_curl(void *priv, char *url, struct ipc_ret_t *ret)
 	CURLcode res;
 	char buf[100];
 	char *data;
+	long status = 0;
+	int post = 0;
 
+	if (url != NULL && !strncmp(url, "POST ", 5)) {
+		url += 5;
+		post = 1;
+	}
 	if (url == NULL || *url == '\0') {
 		ANSWER(ret, 500, "VAC url is not supplied. "
 		    "Please do so with the -z argument.");
@@ -104,6 +115,9 @@ issue_curl(void *priv, char *url, struct ipc_ret_t *ret)
 		slist = curl_slist_append(slist, "expect:");
 		slist = curl_slist_append(slist, buf);
 		slist = curl_slist_append(slist, "Transfer-Encoding:");
+		if (post)
+			slist = curl_slist_append(slist,
+			    "Content-Type: application/json");
 	}
 
 	logger(private->logger, "Issuing curl command with url=%s. %s",
@@ -122,7 +136,12 @@ issue_curl(void *priv, char *url, struct ipc_ret_t *ret)
 			curl_easy_setopt(curl, CURLOPT_CAINFO, private->cainfo);
 		if (private->skipsslverifypeer == 1)
 			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
-		if (data) {
+		if (data && post) {
+			curl_easy_setopt(curl, CURLOPT_POST, 1);
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, private->data);
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+			    (long)private->ndata);
+		} else if (data) {
 			curl_easy_setopt(curl, CURLOPT_NOBODY, 0);
 			curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
 			curl_easy_setopt(curl, CURLOPT_READFUNCTION, senddata);
@@ -135,6 +154,13 @@ issue_curl(void *priv, char *url, struct ipc_ret_t *ret)
 			    "Curl callback failed with status code %d", res);
 			ANSWER(ret, 500, buf);
 			warnlog(private->logger, "%s", ret->answer);
+		} else if (post && (curl_easy_getinfo(curl,
+		    CURLINFO_RESPONSE_CODE, &status) != CURLE_OK ||
+		    status / 100 != 2)) {
+			snprintf(buf, sizeof(buf),
+			    "The server replied with status %ld", status);
+			ANSWER(ret, 500, buf);
+			warnlog(private->logger, "%s", ret->answer);
 		} else {
 			ANSWER(ret, 200, "OK");
 		}
@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Event bus and /events.
+ *
+ * Events are kept in a ring of the last EVENTS_MAX. Clients ask for the
+ * events after a cursor (the seq of the last event they saw) and, if
+ * there are none, the request is parked until something is published or
+ * EVENTS_WAIT seconds pass. That way a client notices changes right away
+ * without polling for them.
+ *
+ * A background thread polls varnishd for state changes that don't go
+ * through the agent.
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "events.h"
+#include "http.h"
+#include "helpers.h"
+#include "ipc.h"
+#include "json.h"
+#include "plugins.h"
+#include "vsb.h"
+
+#define EVENTS_MAX	256
+#define EVENTS_WAIT	25
+#define EVENTS_HELP \
+	"GET /events - list the events we still remember, and the cursor\n" \
+	"GET /events/<cursor> - wait for events newer than cursor\n" \
+	"\n" \
+	"Events are published when the agent changes VCL, bans, parameters\n" \
+	"or backends, when the varnishd child changes state, panics or a\n" \
+	"backend changes health, and when the agent reconnects to a\n" \
+	"restarted varnishd (vadmin.reconnect) or replays bans (ban.replay).\n" \
+	"\n" \
+	"If no events newer than cursor are known, the request waits up\n" \
+	"to 25 seconds for one. The reply has the cursor to use for the\n" \
+	"next request. If \"missed\" is true, events were lost (or the\n" \
+	"agent was restarted) and the client should reload everything.\n"
+
+struct events_sub_t {
+	events_cb_f cb;
+	void *priv;
+	struct events_sub_t *next;
+};
+
+/*
+ * A parked /events request. Once resumed, the entry stays around so the
+ * callback can tell a timeout from a new request when it runs again.
+ */
+struct events_waiter_t {
+	struct MHD_Connection *conn;
+	time_t t;
+	int resumed;
+	struct events_waiter_t *next;
+};
+
+struct events_backend_t {
+	char *name;
+	char *state;
+	int seen;
+	struct events_backend_t *next;
+};
+
+struct events_priv_t {
+	int vadmin;
+	pthread_mutex_t lck;
+	struct event_t ring[EVENTS_MAX];
+	uintmax_t seq;
+	struct events_sub_t *subs;
+	struct events_waiter_t *waiters;
+
+	/* Only used by the watcher thread */
+	int primed;
+	char *child;
+	char *panic;
+	struct events_backend_t *backends;
+};
+
+/*
+ * Wake up parked requests. With all set, everyone. Otherwise just the
+ * ones that have waited long enough. Resumed entries are forgotten after
+ * a while, in case the client went away. Called with lck held.
+ */
+static void
+events_wake(struct events_priv_t *events, int all)
+{
+	struct events_waiter_t *w, **wp;
+	time_t now = time(NULL);
+
+	for (wp = &events->waiters; (w = *wp) != NULL; ) {
+		if (w->resumed && now - w->t > 2 * EVENTS_WAIT) {
+			*wp = w->next;
+			free(w);
+			continue;
+		}
+		if (!w->resumed && (all || now - w->t >= EVENTS_WAIT)) {
+			w->resumed = 1;
+			w->t = now;
+			http_resume(w->conn);
+		}
+		wp = &w->next;
+	}
+}
+
+void
+events_publish(struct agent_core_t *core, const char *type, ...)
+{
+	struct events_priv_t *events;
+	struct events_sub_t *sub;
+	struct event_t *ev;
+	struct vsb *vsb;
+	const char *key, *value;
+	va_list ap;
+
+	GET_PRIV(core, events);
+	AN(type);
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	VSB_cat(vsb, "{");
+	va_start(ap, type);
+	while ((key = va_arg(ap, const char *)) != NULL) {
+		value = va_arg(ap, const char *);
+		VSB_cat(vsb, VSB_len(vsb) > 1 ? ", " : "");
+		json_quote(vsb, key, -1);
+		VSB_cat(vsb, ": ");
+		if (value)
+			json_quote(vsb, value, -1);
+		else
+			VSB_cat(vsb, "null");
+	}
+	va_end(ap);
+	VSB_cat(vsb, "}");
+	AZ(VSB_finish(vsb));
+
+	AZ(pthread_mutex_lock(&events->lck));
+	ev = &events->ring[++events->seq % EVENTS_MAX];
+	free(ev->type);
+	free(ev->data);
+	ev->seq = events->seq;
+	ev->t = time(NULL);
+	ev->type = strdup(type);
+	AN(ev->type);
+	ev->data = strdup(VSB_data(vsb));
+	AN(ev->data);
+	for (sub = events->subs; sub != NULL; sub = sub->next)
+		sub->cb(ev, sub->priv);
+	events_wake(events, 1);
+	AZ(pthread_mutex_unlock(&events->lck));
+	VSB_delete(vsb);
+}
+
+void
+events_subscribe(struct agent_core_t *core, events_cb_f cb, void *priv)
+{
+	struct events_priv_t *events;
+	struct events_sub_t *sub;
+
+	GET_PRIV(core, events);
+	ALLOC_OBJ(sub);
+	sub->cb = cb;
+	sub->priv = priv;
+	sub->next = events->subs;
+	events->subs = sub;
+}
+
+/*
+ * Called with lck held.
+ */
+static void
+events_json(struct vsb *vsb, struct events_priv_t *events, uintmax_t cursor,
+    int missed)
+{
+	struct event_t *ev;
+	uintmax_t seq;
+	int first = 1;
+
+	VSB_printf(vsb, "{\n\t\"cursor\": %ju,\n\t\"missed\": %s,\n"
+	    "\t\"events\": [", events->seq, missed ? "true" : "false");
+	for (seq = cursor + 1; seq <= events->seq; seq++) {
+		ev = &events->ring[seq % EVENTS_MAX];
+		assert(ev->seq == seq);
+		VSB_printf(vsb, "%s\n\t\t{\"seq\": %ju, \"time\": %jd, "
+		    "\"type\": ", first ? "" : ",", ev->seq, (intmax_t)ev->t);
+		json_quote(vsb, ev->type, -1);
+		VSB_printf(vsb, ", \"data\": %s}", ev->data);
+		first = 0;
+	}
+	VSB_cat(vsb, first ? "]\n}\n" : "\n\t]\n}\n");
+}
+
+static unsigned int
+events_reply(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct events_priv_t *events;
+	struct events_waiter_t *w, **wp;
+	struct http_response *resp;
+	struct vsb *vsb;
+	uintmax_t cursor = 0, oldest;
+	char *end;
+	int missed, resumed = 0;
+
+	GET_PRIV(core, events);
+
+	if (arg) {
+		cursor = strtoumax(arg, &end, 10);
+		if (*end != '\0' && *end != '/') {
+			http_reply(request->connection, 400, "Bad cursor\n");
+			return (0);
+		}
+	}
+
+	AZ(pthread_mutex_lock(&events->lck));
+	oldest = events->seq > EVENTS_MAX ? events->seq - EVENTS_MAX : 0;
+	if (!arg) {
+		/* Everything we have, right away. */
+		cursor = oldest;
+		missed = 0;
+	} else
+		missed = cursor < oldest || cursor > events->seq;
+	if (missed)
+		cursor = oldest;
+
+	for (wp = &events->waiters; (w = *wp) != NULL; wp = &w->next) {
+		if (w->conn == request->connection) {
+			resumed = w->resumed;
+			*wp = w->next;
+			free(w);
+			break;
+		}
+	}
+
+	if (arg && !missed && !resumed && cursor == events->seq &&
+	    http_suspend(request->connection)) {
+		ALLOC_OBJ(w);
+		w->conn = request->connection;
+		w->t = time(NULL);
+		w->next = events->waiters;
+		events->waiters = w;
+		AZ(pthread_mutex_unlock(&events->lck));
+		return (0);
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	events_json(vsb, events, cursor, missed);
+	AZ(pthread_mutex_unlock(&events->lck));
+	AZ(VSB_finish(vsb));
+
+	resp = http_mkresp(request->connection, 200, VSB_data(vsb));
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (0);
+}
+
+/*
+ * "Child in state running" and friends.
+ */
+static void
+events_watch_child(struct agent_core_t *core, struct events_priv_t *events)
+{
+	struct ipc_ret_t vret;
+
+	ipc_run(events->vadmin, &vret, "status");
+	if (vret.status == 200) {
+		if (events->child && strcmp(events->child, vret.answer))
+			events_publish(core, "child", "state", vret.answer,
+			    "previous", events->child, NULL);
+		free(events->child);
+		events->child = vret.answer;
+	} else
+		free(vret.answer);
+}
+
+/*
+ * panic.show is 200 with the panic, or 300 if there is none. Only
+ * publish new panics, not the one that was there when we started.
+ */
+static void
+events_watch_panic(struct agent_core_t *core, struct events_priv_t *events)
+{
+	struct ipc_ret_t vret;
+
+	ipc_run(events->vadmin, &vret, "panic.show");
+	if (vret.status == 200) {
+		if (events->panic && strcmp(events->panic, vret.answer))
+			events_publish(core, "panic", "message", vret.answer,
+			    NULL);
+		free(events->panic);
+		events->panic = vret.answer;
+	} else if (vret.status == 300) {
+		free(events->panic);
+		events->panic = strdup("");
+		AN(events->panic);
+		free(vret.answer);
+	} else
+		free(vret.answer);
+}
+
+/*
+ * backend.list has a header line, then one line per backend:
+ *
+ *	name	admin	probe [details]
+ *
+ * The state we care about is admin plus the first word of probe
+ * (Healthy/Sick), the details change with every probe.
+ */
+static void
+events_watch_backends(struct agent_core_t *core, struct events_priv_t *events)
+{
+	struct events_backend_t *be, **bep;
+	struct ipc_ret_t vret;
+	char *line, *name, *admin, *probe, *state, *p, *last, *ptr;
+	int first = 1;
+
+	ipc_run(events->vadmin, &vret, "backend.list");
+	if (vret.status != 200) {
+		free(vret.answer);
+		return;
+	}
+	for (be = events->backends; be != NULL; be = be->next)
+		be->seen = 0;
+	for (p = vret.answer, last = NULL;
+	    (line = strtok_r(p, "\n", &last)) != NULL; p = NULL) {
+		if (first) {
+			first = 0;
+			continue;
+		}
+		name = strtok_r(line, " \t", &ptr);
+		admin = strtok_r(NULL, " \t", &ptr);
+		probe = strtok_r(NULL, " \t", &ptr);
+		if (!name || !admin || !probe)
+			continue;
+		AN(asprintf(&state, "%s %s", admin, probe));
+		for (be = events->backends; be != NULL; be = be->next)
+			if (!strcmp(be->name, name))
+				break;
+		if (be == NULL) {
+			ALLOC_OBJ(be);
+			be->name = strdup(name);
+			AN(be->name);
+			be->next = events->backends;
+			events->backends = be;
+			/* No events for what's there on startup. */
+			if (events->primed)
+				events_publish(core, "backend.health",
+				    "name", name, "admin", admin,
+				    "probe", probe, NULL);
+		} else if (strcmp(be->state, state))
+			events_publish(core, "backend.health", "name", name,
+			    "admin", admin, "probe", probe, NULL);
+		free(be->state);
+		be->state = state;
+		be->seen = 1;
+	}
+	for (bep = &events->backends; (be = *bep) != NULL; ) {
+		if (be->seen) {
+			bep = &be->next;
+			continue;
+		}
+		events_publish(core, "backend.removed", "name", be->name, NULL);
+		*bep = be->next;
+		free(be->name);
+		free(be->state);
+		free(be);
+	}
+	free(vret.answer);
+}
+
+static void *
+events_run(void *data)
+{
+	struct agent_core_t *core = data;
+	struct events_priv_t *events;
+
+	GET_PRIV(core, events);
+
+	for (;;) {
+		events_watch_panic(core, events);
+		events_watch_backends(core, events);
+		events_watch_child(core, events);
+		events->primed = 1;
+
+		AZ(pthread_mutex_lock(&events->lck));
+		events_wake(events, 0);
+		AZ(pthread_mutex_unlock(&events->lck));
+		sleep(1);
+	}
+	return (NULL);
+}
+
+static void *
+events_start(struct agent_core_t *core, const char *name)
+{
+	pthread_t *thread;
+
+	(void)name;
+
+	ALLOC_OBJ(thread);
+	AZ(pthread_create(thread, NULL, events_run, core));
+	return (thread);
+}
+
+void
+events_init(struct agent_core_t *core)
+{
+	struct agent_plugin_t *plug;
+	struct events_priv_t *priv;
+
+	ALLOC_OBJ(priv);
+	plug = plugin_find(core, "events");
+	priv->vadmin = ipc_register(core, "vadmin");
+	AZ(pthread_mutex_init(&priv->lck, NULL));
+	plug->data = (void *)priv;
+	plug->start = events_start;
+	http_register_path(core, "/events", M_GET, events_reply, core);
+	http_register_path(core, "/help/events", M_GET, help_reply,
+	    strdup(EVENTS_HELP));
+}
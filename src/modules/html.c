@@ -41,6 +41,7 @@
 #include "common.h"
 #include "http.h"
 #include <helpers.h>
+#include "instance.h"
 #include "ipc.h"
 #include "plugins.h"
 
@@ -67,12 +68,20 @@ html_reply(struct http_request *request, const char *arg, void *data)
 	if (!strcmp(request->url, "/html")) {
 		char *host_header = http_get_header(request->connection,"Host");
 		char *tmp = NULL;
+		char *loc = NULL;
+		/* Stay on the instance, the UI uses the URL as its prefix */
+		if (instance_current() != 0)
+			ret = asprintf(&loc, "/i/%s/html/",
+			    instance_get(core)->name);
+		else
+			ret = asprintf(&loc, "/html/");
+		assert(ret > 0);
 		resp = http_mkresp(request->connection, 301, NULL);
 		if (host_header == NULL) {
 			logger(html->logger, "Requested /html but no Host header found. Can't redirect correctly.");
-			http_add_header(resp, "Location", "/html/");
+			http_add_header(resp, "Location", loc);
 		} else {
-			ret = asprintf(&tmp, "http://%s/html/", host_header);
+			ret = asprintf(&tmp, "http://%s%s", host_header, loc);
 			assert(ret);
 			assert(tmp);
 			http_add_header(resp,"Location",tmp);
@@ -81,6 +90,7 @@ html_reply(struct http_request *request, const char *arg, void *data)
 		http_free_resp(resp);
 		if (tmp)
 			free(tmp);
+		free(loc);
 		return 0;
 	} else if (strstr(arg, "/../") ||
 			STARTS_WITH(arg, "../")) {
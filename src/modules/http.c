@@ -26,10 +26,17 @@
  * SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include "config.h"
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <errno.h>
+#include <sched.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -37,22 +44,49 @@
 #include <pthread.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 #include <microhttpd.h>
 
 #include "common.h"
 #include "plugins.h"
 #include "ipc.h"
 #include "http.h"
+#include "helpers.h"
+#include "instance.h"
+#include "json.h"
+#include "peers.h"
 #include "vsb.h"
 
 #define RCV_BUFFER	2 * 1000 * 1024
+#define FANOUT_TIMEOUT	60	// Seconds for the peers of a ?fanout=all
 #define HELP_TEXT							\
 	"This is the varnish agent.\n\n"				\
 	"GET requests never modify state\n"				\
 	"POST requests are not idempotent, and can modify state\n"	\
 	"PUT requests are idempotent, and can modify state\n"		\
 	"HEAD requests can be performed on all resources that support GET\n" \
+	"Prefix a URL with /i/<name> to use another instance, see /instances\n" \
 	"\nThe following URLs are bound:\n\n"
+#define BATCH_HELP_TEXT							\
+	"POST a JSON array of requests to /batch to run them all in one\n"	\
+	"round trip. Each request is an object like:\n\n"		\
+	"  {\"method\": \"GET\", \"path\": \"/status\", \"body\": \"\"}\n\n"	\
+	"method defaults to GET and body to empty. The path can have a\n"	\
+	"query string, of up to 32 arguments. The requests are run\n"	\
+	"in order, and the reply is a JSON array with one\n"		\
+	"{\"status\", \"content_type\", \"body\"} object per request.\n"
+
+/*
+ * Suspending connections needs a wakeup pipe in the daemons, and an
+ * explicit flag since 0.9.42.
+ */
+#if MHD_VERSION >= 0x00094200
+#define HTTP_SUSPEND_FLAG	MHD_USE_SUSPEND_RESUME
+#elif MHD_VERSION >= 0x00093400
+#define HTTP_SUSPEND_FLAG	MHD_USE_PIPE_FOR_SHUTDOWN
+#else
+#define HTTP_SUSPEND_FLAG	0
+#endif
 
 struct http_listener {
 	char *url;
@@ -62,6 +96,26 @@ struct http_listener {
 	struct http_listener *next;
 };
 
+/*
+ * A listening socket and the MHD daemon serving it.
+ *
+ * With -l, every bind address gets several sockets sharing the port
+ * through SO_REUSEPORT. The kernel spreads new connections across them,
+ * so each daemon thread has its own accept queue and its own CPU.
+ *
+ * local is set for the -U unix domain socket, where clients are
+ * authenticated by their peer credentials instead of a password.
+ */
+struct http_listen_t {
+	struct agent_core_t *core;
+	struct MHD_Daemon *d;
+	const char *address;
+	int sock;
+	int cpu;
+	int local;
+	struct http_listen_t *next;
+};
+
 struct http_priv_t {
 	int logger;
 	/*
@@ -72,13 +126,59 @@ struct http_priv_t {
 	int logger2;
 	char *help_page;
 	struct http_listener *listener;
+	struct http_listen_t *listens;
+	/*
+	 * The daemons run in separate threads, but the plugins only have
+	 * one IPC handle each. Callbacks are serialized on lck, and all
+	 * daemon threads borrow the handles of the first one (owner).
+	 */
+	pthread_mutex_t lck;
+	pthread_t owner;
+	int owned;
+};
+
+/*
+ * Work a callback handed to http_defer(), running in a thread of its
+ * own while the connection is suspended. done is set under http->lck.
+ */
+struct http_job_t {
+	struct MHD_Connection *conn;
+	pthread_mutex_t *lck;
+	http_defer_f *func;
+	http_defer_f *fini;
+	void *priv;
+	int done;
 };
 
 struct connection_info_struct {
 	struct vsb *req_body;
 	int authed;
+	pthread_mutex_t *lck;	// http->lck
+	struct http_job_t *job;
 };
 
+#define HTTP_BATCH_ARGS	32	// Query arguments of a /batch sub-request
+
+/*
+ * While /batch runs a sub-request, send_response() stores the reply here
+ * instead of queueing it on the connection. Only the first reply counts.
+ * The query arguments of the sub-request are here too, for
+ * http_get_arg().
+ */
+struct http_capture {
+	int status;
+	char *content_type;
+	struct vsb *body;
+	int batch;
+	unsigned nargs;
+	const char *args[2 * HTTP_BATCH_ARGS];	// Key, value
+};
+
+static __thread struct http_capture *http_capture;
+
+/* The connection being dispatched, for http_defer() */
+static __thread struct connection_info_struct *http_con_info;
+
 struct header_finder_t {
 	const char *header;
 	char *value;
@@ -184,6 +284,21 @@ http_get_header(struct MHD_Connection *connection, const char *key)
 	return (finder.value);
 }
 
+const char *
+http_get_arg(struct MHD_Connection *connection, const char *key)
+{
+	unsigned i;
+
+	if (http_capture != NULL && http_capture->batch) {
+		for (i = 0; i < http_capture->nargs; i++)
+			if (!strcmp(http_capture->args[2 * i], key))
+				return (http_capture->args[2 * i + 1]);
+		return (NULL);
+	}
+	return (MHD_lookup_connection_value(connection,
+	    MHD_GET_ARGUMENT_KIND, key));
+}
+
 void
 http_free_resp(struct http_response *resp)
 {
@@ -221,6 +336,19 @@ send_response(struct http_response *resp)
 	char *origin;
 	int ret;
 
+	if (http_capture) {
+		if (http_capture->status)
+			return (MHD_YES);
+		http_capture->status = resp->status;
+		for (hdr = resp->headers; hdr; hdr = hdr->next)
+			if (!strcasecmp(hdr->key, "Content-Type"))
+				http_capture->content_type = strdup(hdr->value);
+		if (resp->ndata)
+			AZ(VSB_bcat(http_capture->body, resp->data,
+			    resp->ndata));
+		return (MHD_YES);
+	}
+
 #if (MHD_VERSION >= 0x00090500)
 	response = MHD_create_response_from_buffer(resp->ndata,
 	    (void *)resp->data, MHD_RESPMEM_MUST_COPY);
@@ -258,6 +386,87 @@ http_reply_len(struct MHD_Connection *conn, int status, const char *data,
 	return (send_response(&resp));
 }
 
+int
+http_suspend(struct MHD_Connection *conn)
+{
+#if MHD_VERSION >= 0x00093400
+	if (http_capture)
+		return (0);
+	MHD_suspend_connection(conn);
+	return (1);
+#else
+	(void)conn;
+	return (0);
+#endif
+}
+
+void
+http_resume(struct MHD_Connection *conn)
+{
+#if MHD_VERSION >= 0x00093400
+	MHD_resume_connection(conn);
+#else
+	(void)conn;
+	assert(!"http_resume without suspend support");
+#endif
+}
+
+static void *
+http_job_run(void *data)
+{
+	struct http_job_t *job = data;
+
+	job->func(job->priv);
+	AZ(pthread_mutex_lock(job->lck));
+	job->done = 1;
+	AZ(pthread_mutex_unlock(job->lck));
+	http_resume(job->conn);
+	return (NULL);
+}
+
+int
+http_defer(struct http_request *request, http_defer_f *func,
+    http_defer_f *fini, void *priv)
+{
+	struct connection_info_struct *con_info = http_con_info;
+	struct http_job_t *job;
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	if (con_info == NULL || con_info->job != NULL ||
+	    !http_suspend(request->connection))
+		return (0);
+	ALLOC_OBJ(job);
+	job->conn = request->connection;
+	job->lck = con_info->lck;
+	job->func = func;
+	job->fini = fini;
+	job->priv = priv;
+	con_info->job = job;
+	AZ(pthread_attr_init(&attr));
+	AZ(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
+	AZ(pthread_create(&thread, &attr, http_job_run, job));
+	AZ(pthread_attr_destroy(&attr));
+	return (1);
+}
+
+void *
+http_deferred(struct http_request *request)
+{
+	struct connection_info_struct *con_info = http_con_info;
+	struct http_job_t *job;
+	void *priv;
+
+	(void)request;
+	if (con_info == NULL || (job = con_info->job) == NULL)
+		return (NULL);
+	AN(job->done);
+	priv = job->priv;
+	con_info->job = NULL;
+	free(job);
+	return (priv);
+}
+
 static void
 request_completed(void *cls, struct MHD_Connection *connection,
     void **con_cls, enum MHD_RequestTerminationCode code)
@@ -270,6 +479,12 @@ request_completed(void *cls, struct MHD_Connection *connection,
 	(void)code;
 
 	if (con_info) {
+		/* Resumed, but the client went away before the reply */
+		if (con_info->job != NULL) {
+			AN(con_info->job->done);
+			con_info->job->fini(con_info->job->priv);
+			free(con_info->job);
+		}
 		if (con_info->req_body)
 			VSB_delete(con_info->req_body);
 		free(con_info);
@@ -327,6 +542,32 @@ log_request(struct MHD_Connection *connection,
 #endif
 }
 
+/*
+ * Connections on the unix socket are let in without a password if the
+ * peer runs as root, or as our own user or group. Everybody else who
+ * got past the file permissions still has to use Basic auth.
+ */
+static int
+check_peer(struct MHD_Connection *connection)
+{
+#if defined(SO_PEERCRED) && MHD_VERSION >= 0x00093400
+	const union MHD_ConnectionInfo *info;
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+
+	info = MHD_get_connection_info(connection,
+	    MHD_CONNECTION_INFO_CONNECTION_FD);
+	if (info == NULL ||
+	    getsockopt(info->connect_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+		return (0);
+	return (cred.uid == 0 || cred.uid == geteuid() ||
+	    cred.gid == getegid());
+#else
+	(void)connection;
+	return (0);
+#endif
+}
+
 static int
 check_auth(struct MHD_Connection *connection, struct agent_core_t *core,
     struct connection_info_struct *con_info)
@@ -376,18 +617,460 @@ parse_method(const char *method)
 	return (M_UNKNOWN);
 }
 
+/*
+ * Run once in every daemon thread, with http->lck held.
+ */
+static void
+http_thread_prepare(struct http_listen_t *ls, struct http_priv_t *http)
+{
+	static __thread int ready = 0;
+#ifdef __linux__
+	cpu_set_t set;
+#endif
+
+	if (ready)
+		return;
+	ready = 1;
+
+	if (!http->owned) {
+		http->owner = pthread_self();
+		http->owned = 1;
+	} else
+		ipc_thread_alias(http->owner);
+
+	if (ls->cpu < 0)
+		return;
+#ifdef __linux__
+	CPU_ZERO(&set);
+	CPU_SET(ls->cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof set, &set))
+		warnlog(http->logger, "Failed to pin listener on %s to CPU %d",
+		    ls->address, ls->cpu);
+#endif
+}
+
+/* /batch, possibly for an instance. */
 static int
-answer_to_connection(void *cls, struct MHD_Connection *connection,
-    const char *url, const char *method,
-    const char *version, const char *upload_data,
+is_batch(const char *url)
+{
+	const char *p;
+
+	if (STARTS_WITH(url, "/i/") && (p = strchr(url + 3, '/')) != NULL)
+		url = p;
+	return (STARTS_WITH(url, "/batch") &&
+	    (url[6] == '\0' || url[6] == '/' || url[6] == '?'));
+}
+
+static int
+http_route_local(struct http_request *request, struct http_priv_t *http)
+{
+
+	if (find_listener(request, http))
+		return (MHD_YES);
+
+	if (request->method == M_GET && !strcmp(request->url, "/")) {
+		if (http->help_page == NULL)
+			http->help_page = make_help(http);
+		assert(http->help_page);
+		return (http_reply(request->connection, 200, http->help_page));
+	}
+
+	return (http_reply(request->connection, 500, "Failed"));
+}
+
+/*
+ * /i/<name>/<url> - run <url> against the instance <name>. The instance
+ * is thread-local state and travels with every IPC call made while
+ * routing, so the modules pick the right varnishd without knowing. That
+ * includes the requests of /i/<name>/batch.
+ */
+static int
+http_route_instance(struct http_request *request, struct agent_core_t *core,
+    struct http_priv_t *http)
+{
+	struct http_request sub;
+	const char *name, *rest;
+	int idx, prev, ret;
+
+	name = request->url + 3;
+	rest = strchr(name, '/');
+	if (rest == NULL)
+		rest = name + strlen(name);
+	idx = instance_find(core, name, rest - name);
+	if (idx < 0)
+		return (http_reply(request->connection, 404,
+		    "No such instance"));
+	if (STARTS_WITH(rest, "/i/"))
+		return (http_reply(request->connection, 400,
+		    "Nested instance"));
+
+	sub = *request;
+	sub.url = *rest == '\0' ? "/" : rest;
+	prev = instance_current();
+	instance_select(idx);
+	ret = http_route_local(&sub, http);
+	instance_select(prev);
+	return (ret);
+}
+
+static int
+http_route(struct agent_core_t *core, struct http_request *request)
+{
+	struct http_priv_t *http;
+
+	GET_PRIV(core, http);
+	if (STARTS_WITH(request->url, "/i/"))
+		return (http_route_instance(request, core, http));
+	return (http_route_local(request, http));
+}
+
+/*
+ * ?fanout=all runs these on every peer as well, see http_fanout().
+ */
+static const char * const fanout_urls[] = {
+	"/ban", "/vcl", "/vcldeploy", "/param", NULL
+};
+
+static const char *
+method_name(enum http_method method)
+{
+
+	switch (method) {
+	case M_GET:	return ("GET");
+	case M_POST:	return ("POST");
+	case M_PUT:	return ("PUT");
+	case M_DELETE:	return ("DELETE");
+	default:	return (NULL);
+	}
+}
+
+static int
+is_fanout(const struct http_request *request)
+{
+	const char * const *u;
+	const char *url = request->url, *p, *arg;
+
+	/* /batch requests share the connection, and its arguments. */
+	if (http_capture != NULL || method_name(request->method) == NULL)
+		return (0);
+	arg = http_get_arg(request->connection, "fanout");
+	if (arg == NULL || strcmp(arg, "all"))
+		return (0);
+	if (STARTS_WITH(url, "/i/") && (p = strchr(url + 3, '/')) != NULL)
+		url = p;
+	for (u = fanout_urls; *u != NULL; u++)
+		if (STARTS_WITH(url, *u) && (url[strlen(*u)] == '\0' ||
+		    url[strlen(*u)] == '/'))
+			return (1);
+	return (0);
+}
+
+static void
+fanout_json(struct vsb *vsb, const char *peer, long status, double ms,
+    struct vsb *body, const char *error)
+{
+
+	if (peer != NULL) {
+		VSB_cat(vsb, "\"peer\": ");
+		json_quote(vsb, peer, -1);
+		VSB_cat(vsb, ", ");
+	}
+	VSB_printf(vsb, "\"status\": %ld, \"ms\": %.1f, ", status, ms);
+	if (error != NULL) {
+		VSB_cat(vsb, "\"error\": ");
+		json_quote(vsb, error, -1);
+	} else {
+		VSB_cat(vsb, "\"body\": ");
+		json_quote(vsb, VSB_data(body), VSB_len(body));
+	}
+}
+
+/*
+ * A fan-out while the peers are asked, see http_defer(). The local
+ * reply is in cap.
+ */
+struct http_fanout_t {
+	struct agent_core_t *core;
+	const char *method;
+	char *url;
+	char *body;
+	struct http_capture cap;
+	double ms;
+	struct peer_reply_t *replies;
+	int n;
+};
+
+static void
+http_fanout_run(void *priv)
+{
+	struct http_fanout_t *fo = priv;
+
+	fo->replies = peers_run(fo->core, fo->method, fo->url, fo->body,
+	    FANOUT_TIMEOUT * 1000L);
+}
+
+static void
+http_fanout_free(void *priv)
+{
+	struct http_fanout_t *fo = priv;
+
+	peers_free(fo->replies, fo->n);
+	VSB_delete(fo->cap.body);
+	free(fo->cap.content_type);
+	free(fo->url);
+	free(fo->body);
+	free(fo);
+}
+
+/*
+ * Run the request here, then on all peers in parallel, and reply with
+ * all the results and how long they took. The peers get the URL without
+ * ?fanout, so it doesn't go any further. They are asked off the lock,
+ * see http_defer(), and get FANOUT_TIMEOUT seconds, as a vcl.load on a
+ * busy peer takes a while.
+ *
+ * The reply is 200 if everybody answered with a 2xx, 502 otherwise.
+ */
+static int
+http_fanout(struct agent_core_t *core, struct http_request *request)
+{
+	struct http_priv_t *http;
+	struct http_response *resp;
+	struct http_fanout_t *fo;
+	struct timespec t0, t1;
+	struct vsb *vsb;
+	int i, ok, ret;
+
+	GET_PRIV(core, http);
+	fo = http_deferred(request);
+	if (fo == NULL) {
+		ALLOC_OBJ(fo);
+		fo->core = core;
+		fo->method = method_name(request->method);
+		fo->url = strdup(request->url);
+		AN(fo->url);
+		fo->body = request->body ? strdup(request->body) : NULL;
+		fo->cap.body = VSB_new_auto();
+		AN(fo->cap.body);
+		AZ(clock_gettime(CLOCK_MONOTONIC, &t0));
+		http_capture = &fo->cap;
+		http_route(core, request);
+		http_capture = NULL;
+		AZ(clock_gettime(CLOCK_MONOTONIC, &t1));
+		AZ(VSB_finish(fo->cap.body));
+		fo->ms = (t1.tv_sec - t0.tv_sec) * 1e3 +
+		    (t1.tv_nsec - t0.tv_nsec) / 1e6;
+
+		fo->n = peers_count(core);
+		logger(http->logger, "fanout: %s %s to %d peers",
+		    fo->method, fo->url, fo->n);
+		if (http_defer(request, http_fanout_run, http_fanout_free, fo))
+			return (MHD_YES);
+		http_fanout_run(fo);
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	VSB_cat(vsb, "{\n  \"local\": {");
+	fanout_json(vsb, NULL, fo->cap.status ? fo->cap.status : 500, fo->ms,
+	    fo->cap.body, NULL);
+	VSB_cat(vsb, "},\n  \"peers\": [");
+	ok = fo->cap.status >= 200 && fo->cap.status < 300;
+	for (i = 0; i < fo->n; i++) {
+		VSB_cat(vsb, i ? ",\n    {" : "\n    {");
+		fanout_json(vsb, fo->replies[i].peer, fo->replies[i].status,
+		    fo->replies[i].ms, fo->replies[i].body,
+		    fo->replies[i].status ? NULL : fo->replies[i].error);
+		VSB_cat(vsb, "}");
+		if (fo->replies[i].status < 200 || fo->replies[i].status >= 300)
+			ok = 0;
+	}
+	VSB_cat(vsb, "\n  ]\n}\n");
+	AZ(VSB_finish(vsb));
+	http_fanout_free(fo);
+
+	resp = http_mkresp(request->connection, ok ? 200 : 502, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	ret = send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (ret);
+}
+
+/*
+ * Run one element of a /batch array through the router, with the reply
+ * captured in cap.
+ */
+/*
+ * Split the query string q of a sub-request in place into the key and
+ * value pairs of cap, the way MHD does it for a connection.
+ */
+static int
+http_batch_args(struct http_capture *cap, char *q)
+{
+	char *p, *v;
+
+	for (p = strsep(&q, "&"); p != NULL; p = strsep(&q, "&")) {
+		if (*p == '\0')
+			continue;
+		if (cap->nargs == HTTP_BATCH_ARGS)
+			return (-1);
+		v = strchr(p, '=');
+		if (v != NULL) {
+			*v++ = '\0';
+			(void)MHD_http_unescape(v);
+		} else
+			v = p + strlen(p);
+		(void)MHD_http_unescape(p);
+		cap->args[2 * cap->nargs] = p;
+		cap->args[2 * cap->nargs + 1] = v;
+		cap->nargs++;
+	}
+	return (0);
+}
+
+static void
+http_batch_one(struct http_request *request, struct agent_core_t *core,
+    const struct json_t *req)
+{
+	struct http_priv_t *http;
+	struct http_request sub;
+	const char *method, *path, *body;
+	char *url, *q;
+
+	GET_PRIV(core, http);
+	method = json_get_string(req, "method");
+	path = json_get_string(req, "path");
+	body = json_get_string(req, "body");
+
+	memset(&sub, 0, sizeof sub);
+	sub.connection = request->connection;
+	sub.method = parse_method(method ? method : "GET");
+
+	if (path == NULL || *path != '/') {
+		http_reply(sub.connection, 400, "Missing or relative path");
+		return;
+	}
+	if (sub.method == M_UNKNOWN || sub.method == M_OPTIONS) {
+		http_reply(sub.connection, 405, "Unsupported method");
+		return;
+	}
+	if (is_batch(path)) {
+		http_reply(sub.connection, 400, "Nested batch");
+		return;
+	}
+	if (core->config->r_arg && sub.method != M_GET) {
+		http_reply(sub.connection, 405, "Read-only mode");
+		return;
+	}
+
+	url = strdup(path);
+	AN(url);
+	q = strchr(url, '?');
+	if (q) {
+		*q++ = '\0';
+		if (http_batch_args(http_capture, q)) {
+			http_reply(sub.connection, 400,
+			    "Too many query arguments");
+			free(url);
+			return;
+		}
+	}
+	sub.url = url;
+	sub.body = strdup(body ? body : "");
+	AN(sub.body);
+	sub.bodylen = strlen(sub.body);
+	logger(http->logger, "batch: %s %s", method ? method : "GET", url);
+	http_route(core, &sub);
+	free(sub.body);
+	free(url);
+}
+
+/*
+ * POST /batch - run a JSON array of requests and reply with a JSON array
+ * of their responses.
+ *
+ * The sub-requests go through the same router as everything else, one
+ * after the other: they share the IPC handles of the daemon thread and
+ * the single management connection to varnishd.
+ */
+static unsigned int
+http_batch(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct http_response *resp;
+	struct http_capture cap;
+	struct json_t *root, *req;
+	struct vsb *vsb;
+	const char *err = NULL;
+
+	(void)arg;
+
+	root = request->body ? json_parse(request->body, &err) : NULL;
+	if (root == NULL || root->type != JSON_ARRAY) {
+		vsb = VSB_new_auto();
+		AN(vsb);
+		VSB_printf(vsb, "Expected a JSON array of requests: %s\n",
+		    root ? "Not an array" : err ? err : "No body");
+		AZ(VSB_finish(vsb));
+		http_reply(request->connection, 400, VSB_data(vsb));
+		VSB_delete(vsb);
+		json_free(root);
+		return (0);
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	VSB_cat(vsb, "[");
+	for (req = root->child; req != NULL; req = req->next) {
+		memset(&cap, 0, sizeof cap);
+		cap.body = VSB_new_auto();
+		AN(cap.body);
+		cap.batch = 1;
+		http_capture = &cap;
+		http_batch_one(request, core, req);
+		http_capture = NULL;
+		AZ(VSB_finish(cap.body));
+
+		VSB_printf(vsb, "%s\n  {\"status\": %d, \"content_type\": ",
+		    req == root->child ? "" : ",",
+		    cap.status ? cap.status : 500);
+		if (cap.content_type)
+			json_quote(vsb, cap.content_type, -1);
+		else
+			VSB_cat(vsb, "null");
+		VSB_cat(vsb, ", \"body\": ");
+		json_quote(vsb, VSB_data(cap.body), VSB_len(cap.body));
+		VSB_cat(vsb, "}");
+		VSB_delete(cap.body);
+		free(cap.content_type);
+	}
+	VSB_cat(vsb, "\n]\n");
+	AZ(VSB_finish(vsb));
+	json_free(root);
+
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (0);
+}
+
+static int
+http_dispatch(struct http_listen_t *ls, struct MHD_Connection *connection,
+    const char *url, const char *method, const char *upload_data,
     size_t * upload_data_size, void **con_cls)
 {
-	struct agent_core_t *core = (struct agent_core_t *)cls;
+	struct agent_core_t *core = ls->core;
 	struct http_priv_t *http;
 	struct http_request request;
 	struct connection_info_struct *con_info;
-
-	(void)version;
+	int ret;
 
 	GET_PRIV(core, http);
 
@@ -396,6 +1079,9 @@ answer_to_connection(void *cls, struct MHD_Connection *connection,
 
 	if (*con_cls == NULL) {
 		ALLOC_OBJ(con_info);
+		con_info->lck = &http->lck;
+		if (ls->local && check_peer(connection))
+			con_info->authed = 1;
 		if (!check_auth(connection, core, con_info)) {
 			con_info->req_body = VSB_new_auto();
 			AN(con_info->req_body);
@@ -406,8 +1092,10 @@ answer_to_connection(void *cls, struct MHD_Connection *connection,
 	con_info = *con_cls;
 	AN(core->config->auth_token);
 
+	/* /batch checks each of its requests instead. */
 	if (core->config->r_arg && request.method != M_GET &&
-	    request.method != M_OPTIONS) {
+	    request.method != M_OPTIONS &&
+	    !(request.method == M_POST && is_batch(url))) {
 		logger(http->logger,
 		    "Read-only mode and not a GET, HEAD or OPTIONS request");
 		return (http_reply(connection, 405, "Read-only mode"));
@@ -425,8 +1113,11 @@ answer_to_connection(void *cls, struct MHD_Connection *connection,
 	request.url = url;
 
 	if (con_info->req_body) {
-		AZ(VSB_putc(con_info->req_body, '\0'));
-		AZ(VSB_finish(con_info->req_body));
+		/* Already done if we were suspended and then resumed. */
+		if (!VSB_done(con_info->req_body)) {
+			AZ(VSB_putc(con_info->req_body, '\0'));
+			AZ(VSB_finish(con_info->req_body));
+		}
 		request.body = VSB_data(con_info->req_body);
 		request.bodylen = VSB_len(con_info->req_body) - 1;
 	} else {
@@ -443,35 +1134,53 @@ answer_to_connection(void *cls, struct MHD_Connection *connection,
 		return (MHD_YES);
 	}
 
-	if (find_listener(&request, http))
-		return (MHD_YES);
-
-	if (request.method == M_GET && !strcmp(url, "/")) {
-		if (http->help_page == NULL)
-			http->help_page = make_help(http);
-		assert(http->help_page);
-		return (http_reply(connection, 200, http->help_page));
-	}
-
-	return (http_reply(connection, 500, "Failed"));
+	http_con_info = con_info;
+	if (is_fanout(&request))
+		ret = http_fanout(core, &request);
+	else
+		ret = http_route(core, &request);
+	http_con_info = NULL;
+	return (ret);
 }
 
-static void *
-http_run(void *data)
+static int
+answer_to_connection(void *cls, struct MHD_Connection *connection,
+    const char *url, const char *method,
+    const char *version, const char *upload_data,
+    size_t * upload_data_size, void **con_cls)
 {
-	struct agent_core_t *core = (struct agent_core_t *)data;
+	struct http_listen_t *ls = cls;
 	struct http_priv_t *http;
-	struct MHD_Daemon *d;
-	int port;
-	bool is_ipv6 = false;
+	struct agent_core_t *core = ls->core;
+	int ret;
 
-	struct sockaddr_in6 v6;
-	struct sockaddr_in v4;
+	(void)version;
 
-	port = atoi(core->config->local_port);
-	const char* addr = core->config->bind_address;
+	GET_PRIV(core, http);
 
-	assert(port > 0);
+	AZ(pthread_mutex_lock(&http->lck));
+	http_thread_prepare(ls, http);
+	ret = http_dispatch(ls, connection, url, method, upload_data,
+	    upload_data_size, con_cls);
+	AZ(pthread_mutex_unlock(&http->lck));
+	return (ret);
+}
+
+/*
+ * Create a bound and listening socket for addr:port. With reuseport set,
+ * several sockets can share the same address.
+ *
+ * Returns the socket, or -1 on failure.
+ */
+static int
+http_listen_sock(struct http_priv_t *http, const char *addr, int port,
+    int reuseport, bool *is_ipv6)
+{
+	struct sockaddr_in6 v6;
+	struct sockaddr_in v4;
+	struct sockaddr *sa;
+	socklen_t salen;
+	int addr_ok, sock, one = 1, zero = 0;
 
 	memset(&v4, 0, sizeof(struct sockaddr_in));
 	memset(&v6, 0, sizeof(struct sockaddr_in6));
@@ -482,13 +1191,12 @@ http_run(void *data)
 	v6.sin6_family = AF_INET6;
 	v6.sin6_port = htons(port);
 
-	GET_PRIV(core, http);
-
-	int addr_ok = inet_pton(AF_INET, addr, &v4.sin_addr);
+	*is_ipv6 = false;
+	addr_ok = inet_pton(AF_INET, addr, &v4.sin_addr);
 
 	if (!addr_ok) {
 		addr_ok = inet_pton(AF_INET6, addr, &v6.sin6_addr);
-		is_ipv6 = true;
+		*is_ipv6 = true;
 	}
 
 	assert(addr_ok >= 0);
@@ -497,32 +1205,189 @@ http_run(void *data)
 		warnlog(http->logger2,
 		    "Could not extract network address out of %s, Inet returned %d.",
 		    addr, addr_ok);
-		exit(1);
+		return (-1);
 	}
 
-	logger(http->logger2, "HTTP starting on %s:%i", addr, port);
-
-	// passing an invalid port nr just for spite, mhd should ignore
-	// the port arg and just use agent_daemon_addr..
-	if (is_ipv6) {
-		warnlog(http->logger2, "running ipv6");
-		d = MHD_start_daemon(
-		    MHD_USE_SELECT_INTERNALLY | MHD_USE_DUAL_STACK, 0, NULL, NULL,
-		    &answer_to_connection, data, MHD_OPTION_SOCK_ADDR, &v6,
-		    MHD_OPTION_NOTIFY_COMPLETED, request_completed, NULL,
-		    MHD_OPTION_END);
+	if (*is_ipv6) {
+		sa = (struct sockaddr *)&v6;
+		salen = sizeof v6;
 	} else {
-		d = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, 0, NULL, NULL,
-		    &answer_to_connection, data, MHD_OPTION_SOCK_ADDR,
-		    &v4, MHD_OPTION_NOTIFY_COMPLETED,
-		    request_completed, NULL, MHD_OPTION_END);
+		sa = (struct sockaddr *)&v4;
+		salen = sizeof v4;
+	}
+
+	sock = socket(sa->sa_family, SOCK_STREAM, 0);
+	if (sock < 0) {
+		warnlog(http->logger2, "socket() failed: %s", strerror(errno));
+		return (-1);
+	}
+	(void)setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one,
+		    sizeof one)) {
+			warnlog(http->logger2, "SO_REUSEPORT failed: %s",
+			    strerror(errno));
+			AZ(close(sock));
+			return (-1);
+		}
+#else
+		warnlog(http->logger2,
+		    "SO_REUSEPORT is not supported on this platform");
+		AZ(close(sock));
+		return (-1);
+#endif
+	}
+	if (*is_ipv6)
+		(void)setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &zero,
+		    sizeof zero);
+
+	if (bind(sock, sa, salen) || listen(sock, 128)) {
+		warnlog(http->logger2, "Failed to listen on %s:%i: %s",
+		    addr, port, strerror(errno));
+		AZ(close(sock));
+		return (-1);
+	}
+	return (sock);
+}
+
+/*
+ * Listen on a unix domain socket at path. Only the owner and group of the
+ * agent get to connect.
+ */
+static int
+http_listen_unix(struct http_priv_t *http, const char *path)
+{
+	struct sockaddr_un sun;
+	struct stat st;
+	int sock;
+
+	memset(&sun, 0, sizeof sun);
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof sun.sun_path) {
+		warnlog(http->logger2, "Socket path too long: %s", path);
+		return (-1);
+	}
+	strcpy(sun.sun_path, path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		warnlog(http->logger2, "socket() failed: %s", strerror(errno));
+		return (-1);
+	}
+	/* Only ever remove a stale socket, not whatever -U points at */
+	if (lstat(path, &st) == 0 && !S_ISSOCK(st.st_mode)) {
+		warnlog(http->logger2, "%s exists and is not a socket", path);
+		AZ(close(sock));
+		return (-1);
+	}
+	if (unlink(path) && errno != ENOENT) {
+		warnlog(http->logger2, "Failed to remove stale %s: %s", path,
+		    strerror(errno));
+		AZ(close(sock));
+		return (-1);
+	}
+	/*
+	 * bind() creates the node with the mode of the socket less the
+	 * umask, so it is never open to everyone, and the umask of the
+	 * other threads is left alone. The chmod() then lifts a tighter
+	 * umask to 0660.
+	 */
+	if (fchmod(sock, 0660) ||
+	    bind(sock, (struct sockaddr *)&sun, sizeof sun) ||
+	    chmod(path, 0660) || listen(sock, 128)) {
+		warnlog(http->logger2, "Failed to listen on %s: %s", path,
+		    strerror(errno));
+		AZ(close(sock));
+		return (-1);
+	}
+	return (sock);
+}
+
+static void *
+http_run(void *data)
+{
+	struct agent_core_t *core = (struct agent_core_t *)data;
+	struct http_priv_t *http;
+	struct http_listen_t *ls;
+	unsigned flags;
+	int port, i, j, cpu, ncpu;
+	bool is_ipv6;
+
+	port = atoi(core->config->local_port);
+	assert(port > 0);
+
+	GET_PRIV(core, http);
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1)
+		ncpu = 1;
+
+	cpu = 0;
+	for (i = 0; i < core->config->nbind_address; i++) {
+		for (j = 0; j < core->config->l_arg; j++) {
+			ALLOC_OBJ(ls);
+			ls->core = core;
+			ls->address = core->config->bind_address[i];
+			ls->cpu = -1;
+			if (core->config->l_arg > 1)
+				ls->cpu = cpu++ % ncpu;
+
+			logger(http->logger2, "HTTP starting on %s:%i (%d/%d)",
+			    ls->address, port, j + 1, core->config->l_arg);
+			ls->sock = http_listen_sock(http, ls->address, port,
+			    core->config->l_arg > 1, &is_ipv6);
+			if (ls->sock < 0) {
+				warnlog(http->logger2,
+				    "HTTP failed to start on %s:%i. "
+				    "Agent already running?", ls->address, port);
+				sleep(1);
+				exit(1);
+			}
+
+			flags = MHD_USE_SELECT_INTERNALLY | HTTP_SUSPEND_FLAG;
+			if (is_ipv6)
+				flags |= MHD_USE_DUAL_STACK;
+			ls->d = MHD_start_daemon(flags, 0, NULL, NULL,
+			    &answer_to_connection, ls,
+			    MHD_OPTION_LISTEN_SOCKET, ls->sock,
+			    MHD_OPTION_NOTIFY_COMPLETED, request_completed, NULL,
+			    MHD_OPTION_END);
+			if (!ls->d) {
+				warnlog(http->logger2,
+				    "HTTP failed to start on %s:%i.",
+				    ls->address, port);
+				sleep(1);
+				exit(1);
+			}
+			ls->next = http->listens;
+			http->listens = ls;
+		}
 	}
 
-	if (!d) {
-		warnlog(http->logger2, "HTTP failed to start on %s:%i. "
-		    "Agent already running?", addr, port);
-		sleep(1);
-		exit(1);
+	if (core->config->U_arg) {
+		ALLOC_OBJ(ls);
+		ls->core = core;
+		ls->address = core->config->U_arg;
+		ls->cpu = -1;
+		ls->local = 1;
+		logger(http->logger2, "HTTP starting on %s", ls->address);
+		ls->sock = http_listen_unix(http, ls->address);
+		if (ls->sock >= 0)
+			ls->d = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY |
+			    HTTP_SUSPEND_FLAG, 0, NULL, NULL,
+			    &answer_to_connection, ls,
+			    MHD_OPTION_LISTEN_SOCKET, ls->sock,
+			    MHD_OPTION_NOTIFY_COMPLETED, request_completed, NULL,
+			    MHD_OPTION_END);
+		if (!ls->d) {
+			warnlog(http->logger2, "HTTP failed to start on %s.",
+			    ls->address);
+			sleep(1);
+			exit(1);
+		}
+		ls->next = http->listens;
+		http->listens = ls;
 	}
 
 	/*
@@ -530,7 +1395,8 @@ http_run(void *data)
 	 */
 	for (;;)
 		sleep(100);
-	MHD_stop_daemon(d);
+	for (ls = http->listens; ls != NULL; ls = ls->next)
+		MHD_stop_daemon(ls->d);
 	return (NULL);
 }
 
@@ -594,6 +1460,10 @@ http_init(struct agent_core_t *core)
 	plug = plugin_find(core, "http");
 	priv->logger = ipc_register(core, "logger");
 	priv->logger2 = ipc_register(core, "logger");
+	AZ(pthread_mutex_init(&priv->lck, NULL));
 	plug->data = (void *)priv;
 	plug->start = http_start;
+	http_register_path(core, "/batch", M_POST, http_batch, core);
+	http_register_path(core, "/help/batch", M_GET, help_reply,
+	    strdup(BATCH_HELP_TEXT));
 }
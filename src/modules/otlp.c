@@ -0,0 +1,837 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * OpenTelemetry span export.
+ *
+ * While an endpoint is set, the shmlog of every instance is followed in
+ * request grouping, and each group is either dropped or turned into a
+ * trace: a span for the client request, one for each backend request
+ * and subrequest (ESI, restarts) under it, with the Timestamp records
+ * as span events. Sampling is decided once per group, at the head: a
+ * request with a valid traceparent header keeps the trace id and the
+ * sampled flag of the caller and becomes a child of its span, anything
+ * else is sampled at the configured ratio. Spans are batched per
+ * instance and POSTed as OTLP/HTTP JSON through the curl plugin.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vapi/vsl.h>
+#include <vapi/vsm.h>
+
+#include "common.h"
+#include "analysis.h"
+#include "http.h"
+#include "helpers.h"
+#include "instance.h"
+#include "ipc.h"
+#include "json.h"
+#include "plugins.h"
+#include "vsb.h"
+#include "vsl_tail.h"
+
+#define OTLP_RETRY	5	// Seconds between attempts to open the VSM
+#define OTLP_RATIO	0.01
+#define OTLP_BATCH	512	// Spans to a request
+#define OTLP_INTERVAL	5	// Seconds a span may wait for a batch
+#define OTLP_SPANS	64	// Transactions of a group we look at
+#define OTLP_EVENTS	16	// Timestamps of a transaction
+#define OTLP_STR	256
+
+#define OTLP_HELP \
+"GET /push/otlp/traces - the exporter and its counters\n" \
+"PUT /push/otlp/traces - start exporting, with a JSON object like\n" \
+"  {\"endpoint\": \"http://collector:4318/v1/traces\", \"sample\": 0.01,\n" \
+"   \"service\": \"varnish\", \"batch\": 512, \"interval\": 5}\n" \
+"DELETE /push/otlp/traces - stop, dropping what is not sent yet\n" \
+"\n" \
+"Each client request becomes a trace of a SERVER span, a CLIENT span\n" \
+"for every backend request and an INTERNAL span for every ESI or\n" \
+"restart subrequest, with the Timestamp records as span events. A\n" \
+"request with a traceparent header joins the trace of the caller,\n" \
+"sampled if the caller sampled it. Other requests are sampled at the\n" \
+"\"sample\" ratio (0.01). Spans are POSTed in batches of \"batch\"\n" \
+"(512), or after \"interval\" seconds (5), as OTLP/HTTP JSON.\n"
+
+struct otlp_event_t {
+	char label[16];
+	uint64_t t;
+};
+
+/* One transaction of a group, about to be a span */
+struct otlp_txn_t {
+	unsigned vxid;
+	unsigned parent;
+	enum VSL_transaction_e type;
+	enum VSL_reason_e reason;
+	unsigned char id[8];
+	uint64_t start;		// Nanoseconds since the epoch
+	uint64_t end;
+	char method[16];
+	char url[OTLP_STR];
+	char host[OTLP_STR];
+	char client[64];
+	char backend[64];
+	char addr[64];
+	unsigned port;
+	char handling[8];
+	unsigned status;
+	char error[OTLP_STR];	// FetchError
+	uintmax_t bytes;	// Body bytes sent or received
+	struct otlp_event_t ev[OTLP_EVENTS];
+	unsigned nev;
+};
+
+struct otlp_inst_t {
+	struct vsl_tail_t tail;
+	struct vsb *spans;	// Span objects, separated by ","
+	unsigned nspans;
+	time_t last;		// Of the last export
+};
+
+struct otlp_priv_t {
+	int logger;
+	int tlogger;		// The thread, as curl
+	int curl;
+	pthread_mutex_t lck;	// Everything below
+	char *endpoint;		// NULL when not exporting
+	char *service;
+	double ratio;
+	unsigned batch;
+	unsigned interval;
+	struct otlp_inst_t *inst;
+	int ninstances;
+	char host[256];
+	uint64_t rnd;
+	struct otlp_txn_t txn[OTLP_SPANS];
+	uintmax_t traces;
+	uintmax_t sampled;
+	uintmax_t spans;
+	uintmax_t exported;
+	uintmax_t failed;	// Spans in batches that did not go through
+};
+
+struct otlp_dispatch_t {
+	struct otlp_priv_t *otlp;
+	struct otlp_inst_t *in;
+};
+
+/* xorshift64*, good enough for ids and sampling */
+static uint64_t
+otlp_random(struct otlp_priv_t *otlp)
+{
+	otlp->rnd ^= otlp->rnd >> 12;
+	otlp->rnd ^= otlp->rnd << 25;
+	otlp->rnd ^= otlp->rnd >> 27;
+	return (otlp->rnd * 0x2545F4914F6CDD1DULL);
+}
+
+/* Lower case hex only, like traceparent */
+static int
+otlp_unhex(const char *s, unsigned char *id, size_t len)
+{
+	unsigned i, v;
+
+	for (i = 0; i < len * 2; i++) {
+		if (isdigit((unsigned char)s[i]))
+			v = s[i] - '0';
+		else if (s[i] >= 'a' && s[i] <= 'f')
+			v = s[i] - 'a' + 10;
+		else
+			return (-1);
+		if (i % 2 == 0)
+			id[i / 2] = v << 4;
+		else
+			id[i / 2] |= v;
+	}
+	return (0);
+}
+
+static int
+otlp_zero(const unsigned char *id, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (id[i] != 0)
+			return (0);
+	return (1);
+}
+
+/*
+ * A W3C traceparent, "00-<trace id>-<parent id>-<flags>". Versions
+ * after 00 may add fields, ff is invalid, and so are all zero ids.
+ */
+static int
+otlp_traceparent(const char *s, unsigned char *trace, unsigned char *span,
+    unsigned char *flags)
+{
+	unsigned char version;
+
+	if (strlen(s) < 55 || s[2] != '-' || s[35] != '-' || s[52] != '-' ||
+	    otlp_unhex(s, &version, 1) || version == 0xff ||
+	    (version == 0 && s[55] != '\0') ||
+	    (s[55] != '\0' && s[55] != '-') ||
+	    otlp_unhex(s + 3, trace, 16) || otlp_zero(trace, 16) ||
+	    otlp_unhex(s + 36, span, 8) || otlp_zero(span, 8) ||
+	    otlp_unhex(s + 53, flags, 1))
+		return (-1);
+	return (0);
+}
+
+static void
+otlp_id(struct otlp_priv_t *otlp, unsigned char *id, size_t len)
+{
+	uint64_t r;
+	size_t i;
+
+	do {
+		for (i = 0; i < len; i++) {
+			if (i % 8 == 0)
+				r = otlp_random(otlp);
+			id[i] = r >> (8 * (i % 8));
+		}
+	} while (otlp_zero(id, len));
+}
+
+/*
+ * "1700000000.123456" in nanoseconds, without going through a double.
+ */
+static uint64_t
+otlp_ns(const char *s, char **end)
+{
+	uint64_t ns, scale = 100000000;
+
+	ns = strtoull(s, end, 10) * 1000000000ULL;
+	s = *end;
+	if (*s == '.')
+		for (s++; isdigit((unsigned char)*s); s++, scale /= 10)
+			ns += (*s - '0') * scale;
+	*end = (char *)(uintptr_t)s;
+	return (ns);
+}
+
+/* "Label: abs since_start since_last" */
+static void
+otlp_timestamp(struct otlp_txn_t *x, const char *data)
+{
+	struct otlp_event_t *ev;
+	const char *p;
+	char *e;
+	uint64_t t;
+	double since;
+	size_t l;
+
+	if ((p = strchr(data, ':')) == NULL)
+		return;
+	l = p - data;
+	t = otlp_ns(p + 1, &e);
+	if (e == p + 1)
+		return;
+	since = strtod(e, NULL);
+	if (x->start == 0)
+		x->start = t - (uint64_t)(since * 1e9 + 0.5);
+	if (t > x->end)
+		x->end = t;
+	if (x->nev == OTLP_EVENTS)
+		return;
+	ev = &x->ev[x->nev++];
+	if (l >= sizeof ev->label)
+		l = sizeof ev->label - 1;
+	memcpy(ev->label, data, l);
+	ev->label[l] = '\0';
+	ev->t = t;
+}
+
+static void
+otlp_copy(char *dst, size_t len, const char *src, size_t n)
+{
+	if (n >= len)
+		n = len - 1;
+	memcpy(dst, src, n);
+	dst[n] = '\0';
+}
+
+static void
+otlp_parse(struct VSL_transaction *t, struct otlp_txn_t *x)
+{
+	const char *data, *v;
+	uintmax_t f[6];
+	int tag;
+
+	memset(x, 0, sizeof *x);
+	x->vxid = t->vxid;
+	x->parent = t->vxid_parent;
+	x->type = t->type;
+	x->reason = t->reason;
+	while (VSL_Next(t->c) == 1) {
+		data = VSL_CDATA(t->c->rec.ptr);
+		tag = VSL_TAG(t->c->rec.ptr);
+		switch (tag) {
+		case SLT_ReqMethod:
+		case SLT_BereqMethod:
+			if (x->method[0] == '\0')
+				otlp_copy(x->method, sizeof x->method, data,
+				    strlen(data));
+			break;
+		case SLT_ReqURL:
+		case SLT_BereqURL:
+			/* The query string may hold anything, leave it out */
+			if (x->url[0] == '\0')
+				otlp_copy(x->url, sizeof x->url, data,
+				    strcspn(data, "?"));
+			break;
+		case SLT_ReqHeader:
+		case SLT_BereqHeader:
+			if (x->host[0] == '\0' &&
+			    (v = analysis_header(data, "Host")) != NULL)
+				otlp_copy(x->host, sizeof x->host, v,
+				    strlen(v));
+			break;
+		case SLT_ReqStart:
+			otlp_copy(x->client, sizeof x->client, data,
+			    strcspn(data, " "));
+			break;
+		case SLT_BackendOpen:
+			/* fd name addr port ... */
+			if (sscanf(data, "%*s %63s %63s %u", x->backend,
+			    x->addr, &x->port) != 3)
+				x->addr[0] = '\0';
+			break;
+		case SLT_RespStatus:
+		case SLT_BerespStatus:
+			x->status = strtoul(data, NULL, 10);
+			break;
+		case SLT_Hit:
+			snprintf(x->handling, sizeof x->handling, "hit");
+			break;
+		case SLT_VCL_call:
+			if (x->handling[0] == '\0' && (!strcmp(data, "MISS") ||
+			    !strcmp(data, "PASS") || !strcmp(data, "PIPE") ||
+			    !strcmp(data, "SYNTH")))
+				for (v = data; *v != '\0'; v++)
+					x->handling[v - data] =
+					    tolower((unsigned char)*v);
+			break;
+		case SLT_FetchError:
+			if (x->error[0] == '\0')
+				otlp_copy(x->error, sizeof x->error, data,
+				    strlen(data));
+			break;
+		case SLT_Timestamp:
+			otlp_timestamp(x, data);
+			break;
+		case SLT_ReqAcct:
+		case SLT_BereqAcct:
+			/* Response body sent, or backend response body read */
+			if (sscanf(data, "%ju %ju %ju %ju %ju %ju", &f[0],
+			    &f[1], &f[2], &f[3], &f[4], &f[5]) == 6)
+				x->bytes = f[4];
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void
+otlp_hex(struct vsb *vsb, const unsigned char *id, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		VSB_printf(vsb, "%02x", id[i]);
+}
+
+static void
+otlp_attr(struct vsb *vsb, unsigned *n, const char *key, const char *val)
+{
+	if (val[0] == '\0')
+		return;
+	VSB_printf(vsb, "%s{\"key\":\"%s\",\"value\":{\"stringValue\":",
+	    (*n)++ ? "," : "", key);
+	json_quote(vsb, val, -1);
+	VSB_cat(vsb, "}}");
+}
+
+/* OTLP JSON has 64 bit integers as strings */
+static void
+otlp_attr_int(struct vsb *vsb, unsigned *n, const char *key, uintmax_t val)
+{
+	VSB_printf(vsb, "%s{\"key\":\"%s\",\"value\":{\"intValue\":\"%ju\"}}",
+	    (*n)++ ? "," : "", key, val);
+}
+
+/*
+ * The span of x. The root is the client request, the SERVER span, and
+ * carries the tracestate of the caller.
+ */
+static void
+otlp_span(struct vsb *vsb, const struct otlp_txn_t *x,
+    const unsigned char *trace, const unsigned char *parent, int root,
+    const char *tracestate)
+{
+	const char *name;
+	unsigned i, n = 0, kind;
+	int error;
+
+	if (x->type == VSL_t_bereq) {
+		kind = 3;	// CLIENT
+		name = x->method[0] ? x->method : "fetch";
+		error = x->error[0] != '\0' || x->status >= 500 ||
+		    (x->status == 0 && x->reason != VSL_r_pipe);
+	} else if (root) {
+		kind = 2;	// SERVER
+		name = x->method[0] ? x->method : "request";
+		error = x->status >= 500;
+	} else {
+		kind = 1;	// INTERNAL
+		name = x->reason == VSL_r_esi ? "esi" :
+		    x->reason == VSL_r_restart ? "restart" : "request";
+		error = x->status >= 500;
+	}
+
+	VSB_cat(vsb, "{\"traceId\":\"");
+	otlp_hex(vsb, trace, 16);
+	VSB_cat(vsb, "\",\"spanId\":\"");
+	otlp_hex(vsb, x->id, 8);
+	VSB_cat(vsb, "\"");
+	if (parent != NULL) {
+		VSB_cat(vsb, ",\"parentSpanId\":\"");
+		otlp_hex(vsb, parent, 8);
+		VSB_cat(vsb, "\"");
+	}
+	if (root && tracestate[0] != '\0') {
+		VSB_cat(vsb, ",\"traceState\":");
+		json_quote(vsb, tracestate, -1);
+	}
+	VSB_printf(vsb, ",\"name\":\"%s\",\"kind\":%u,\"startTimeUnixNano\":"
+	    "\"%" PRIu64 "\",\"endTimeUnixNano\":\"%" PRIu64 "\","
+	    "\"attributes\":[", name, kind, x->start,
+	    x->end > x->start ? x->end : x->start);
+	otlp_attr(vsb, &n, "http.request.method", x->method);
+	otlp_attr(vsb, &n, "url.path", x->url);
+	otlp_attr(vsb, &n, "server.address", x->addr[0] ? x->addr : x->host);
+	if (x->port > 0)
+		otlp_attr_int(vsb, &n, "server.port", x->port);
+	otlp_attr(vsb, &n, "client.address", x->client);
+	if (x->status > 0)
+		otlp_attr_int(vsb, &n, "http.response.status_code",
+		    x->status);
+	otlp_attr_int(vsb, &n, "varnish.vxid", x->vxid);
+	otlp_attr(vsb, &n, "varnish.handling", x->handling);
+	otlp_attr(vsb, &n, "varnish.backend", x->backend);
+	otlp_attr_int(vsb, &n, "varnish.body_bytes", x->bytes);
+	VSB_cat(vsb, "],\"events\":[");
+	for (i = 0; i < x->nev; i++) {
+		VSB_printf(vsb, "%s{\"timeUnixNano\":\"%" PRIu64 "\","
+		    "\"name\":", i ? "," : "", x->ev[i].t);
+		json_quote(vsb, x->ev[i].label, -1);
+		VSB_cat(vsb, "}");
+	}
+	VSB_cat(vsb, "]");
+	if (error) {
+		VSB_cat(vsb, ",\"status\":{\"code\":2");
+		if (x->error[0] != '\0') {
+			VSB_cat(vsb, ",\"message\":");
+			json_quote(vsb, x->error, -1);
+		}
+		VSB_cat(vsb, "}");
+	}
+	VSB_cat(vsb, "}");
+}
+
+/*
+ * Decide on the group at its head, from the client request, and if it
+ * is sampled queue its spans.
+ */
+static int
+otlp_dispatch(struct VSL_data *vsl, struct VSL_transaction * const trans[],
+    void *priv)
+{
+	struct otlp_dispatch_t *d = priv;
+	struct otlp_priv_t *otlp = d->otlp;
+	struct otlp_inst_t *in = d->in;
+	struct otlp_txn_t *x = otlp->txn;
+	unsigned char trace[16], parent[8], flags;
+	char tracestate[OTLP_STR] = "";
+	const unsigned char *p;
+	const char *v;
+	unsigned i, j, n;
+	int remote = 0, sampled;
+
+	(void)vsl;
+	if (trans[0] == NULL || trans[0]->type != VSL_t_req)
+		return (0);
+	AZ(pthread_mutex_lock(&otlp->lck));
+	if (otlp->endpoint == NULL) {
+		AZ(pthread_mutex_unlock(&otlp->lck));
+		return (0);
+	}
+	otlp->traces++;
+
+	/* The headers as the client sent them, before VCL had a go */
+	while (VSL_Next(trans[0]->c) == 1) {
+		if (VSL_TAG(trans[0]->c->rec.ptr) == SLT_VCL_call)
+			break;
+		if (VSL_TAG(trans[0]->c->rec.ptr) != SLT_ReqHeader)
+			continue;
+		v = VSL_CDATA(trans[0]->c->rec.ptr);
+		if ((v = analysis_header(v, "traceparent")) != NULL) {
+			if (!remote)
+				remote = !otlp_traceparent(v, trace, parent,
+				    &flags);
+		} else if ((v = analysis_header(VSL_CDATA(
+		    trans[0]->c->rec.ptr), "tracestate")) != NULL)
+			otlp_copy(tracestate, sizeof tracestate, v,
+			    strlen(v));
+	}
+	if (remote)
+		sampled = flags & 1;
+	else
+		sampled = (otlp_random(otlp) >> 11) / 9007199254740992.0 <
+		    otlp->ratio;
+	if (!sampled || in->nspans >= 4 * otlp->batch) {
+		/* Far behind on exporting counts as not sampled */
+		AZ(pthread_mutex_unlock(&otlp->lck));
+		return (0);
+	}
+	if (!remote) {
+		otlp_id(otlp, trace, sizeof trace);
+		tracestate[0] = '\0';
+	}
+	(void)VSL_ResetCursor(trans[0]->c);
+
+	for (n = 0; trans[n] != NULL && n < OTLP_SPANS; n++) {
+		otlp_parse(trans[n], &x[n]);
+		otlp_id(otlp, x[n].id, sizeof x[n].id);
+	}
+	for (i = 0; i < n; i++) {
+		if (i == 0)
+			p = remote ? parent : NULL;
+		else {
+			for (j = 0; j < n && x[j].vxid != x[i].parent; j++)
+				continue;
+			p = j < n ? x[j].id : x[0].id;
+		}
+		if (in->nspans++ > 0)
+			VSB_cat(in->spans, ",");
+		otlp_span(in->spans, &x[i], trace, p, i == 0, tracestate);
+	}
+	otlp->sampled++;
+	otlp->spans += n;
+	AZ(pthread_mutex_unlock(&otlp->lck));
+	return (0);
+}
+
+/*
+ * Returns 1 if there was anything to read.
+ */
+static int
+otlp_poll(struct agent_core_t *core, struct otlp_priv_t *otlp,
+    struct otlp_inst_t *in)
+{
+	struct otlp_dispatch_t d;
+	int enabled;
+
+	AZ(pthread_mutex_lock(&otlp->lck));
+	enabled = otlp->endpoint != NULL;
+	AZ(pthread_mutex_unlock(&otlp->lck));
+	if (!enabled) {
+		if (in->tail.open)
+			vsl_tail_close(&in->tail);
+		return (0);
+	}
+	d.otlp = otlp;
+	d.in = in;
+	return (vsl_tail_poll(&in->tail, core, otlp->tlogger, otlp_dispatch,
+	    &d));
+}
+
+/*
+ * POST the spans of every instance that has a full batch, or has had
+ * spans waiting for long enough, outside of the lock.
+ */
+static void
+otlp_export(struct agent_core_t *core, struct otlp_priv_t *otlp)
+{
+	struct otlp_inst_t *in;
+	struct ipc_ret_t vret;
+	struct vsb *spans, *body;
+	char *url;
+	unsigned n, a = 0;
+	time_t now;
+	int i;
+
+	for (i = 0; i < otlp->ninstances; i++) {
+		in = &otlp->inst[i];
+		now = time(NULL);
+		AZ(pthread_mutex_lock(&otlp->lck));
+		if (in->nspans == 0)
+			in->last = now;
+		if (otlp->endpoint == NULL || (in->nspans < otlp->batch &&
+		    now - in->last < (time_t)otlp->interval)) {
+			AZ(pthread_mutex_unlock(&otlp->lck));
+			continue;
+		}
+		spans = in->spans;
+		n = in->nspans;
+		in->spans = VSB_new_auto();
+		AN(in->spans);
+		in->nspans = 0;
+		in->last = now;
+		url = strdup(otlp->endpoint);
+		AN(url);
+		body = VSB_new_auto();
+		AN(body);
+		VSB_cat(body, "{\"resourceSpans\":[{\"resource\":{"
+		    "\"attributes\":[");
+		a = 0;
+		otlp_attr(body, &a, "service.name", otlp->service);
+		otlp_attr(body, &a, "service.instance.id",
+		    core->config->instances[i].name);
+		otlp_attr(body, &a, "host.name", otlp->host);
+		AZ(pthread_mutex_unlock(&otlp->lck));
+
+		AZ(VSB_finish(spans));
+		VSB_cat(body, "]},\"scopeSpans\":[{\"scope\":{\"name\":"
+		    "\"varnish-agent\"},\"spans\":[");
+		VSB_cat(body, VSB_data(spans));
+		VSB_cat(body, "]}]}]}\n");
+		AZ(VSB_finish(body));
+		ipc_run(otlp->curl, &vret, "POST %s\n%s", url, VSB_data(body));
+		AZ(pthread_mutex_lock(&otlp->lck));
+		if (vret.status == 200)
+			otlp->exported += n;
+		else
+			otlp->failed += n;
+		AZ(pthread_mutex_unlock(&otlp->lck));
+		if (vret.status != 200)
+			warnlog(otlp->tlogger, "Exporting %u spans failed (%d): "
+			    "%s", n, vret.status, vret.answer);
+		free(vret.answer);
+		free(url);
+		VSB_delete(body);
+		VSB_delete(spans);
+	}
+}
+
+static void *
+otlp_run(void *data)
+{
+	struct agent_core_t *core = data;
+	struct otlp_priv_t *otlp;
+	int i, busy;
+
+	GET_PRIV(core, otlp);
+	for (;;) {
+		busy = 0;
+		for (i = 0; i < otlp->ninstances; i++) {
+			instance_select(i);
+			busy |= otlp_poll(core, otlp, &otlp->inst[i]);
+		}
+		otlp_export(core, otlp);
+		if (!busy)
+			usleep(10000);
+	}
+	return (NULL);
+}
+
+static void *
+otlp_start(struct agent_core_t *core, const char *name)
+{
+	pthread_t *thread;
+
+	(void)name;
+
+	ALLOC_OBJ(thread);
+	AZ(pthread_create(thread, NULL, otlp_run, core));
+	return (thread);
+}
+
+static const char *
+otlp_config(struct otlp_priv_t *otlp, const struct json_t *root)
+{
+	const struct json_t *m;
+	const char *endpoint;
+
+	endpoint = json_get_string(root, "endpoint");
+	if (endpoint == NULL || (strncmp(endpoint, "http://", 7) &&
+	    strncmp(endpoint, "https://", 8)))
+		return ("endpoint must be an http:// or https:// url");
+	if ((m = json_get(root, "sample")) != NULL &&
+	    (m->type != JSON_NUMBER || m->number < 0 || m->number > 1))
+		return ("sample must be between 0 and 1");
+	if ((m = json_get(root, "service")) != NULL &&
+	    (m->type != JSON_STRING || m->string[0] == '\0'))
+		return ("service must be a string");
+	if ((m = json_get(root, "batch")) != NULL &&
+	    (m->type != JSON_NUMBER || m->number < 1 || m->number > 65536))
+		return ("batch must be between 1 and 65536");
+	if ((m = json_get(root, "interval")) != NULL &&
+	    (m->type != JSON_NUMBER || m->number < 1 || m->number > 3600))
+		return ("interval must be between 1 and 3600");
+
+	free(otlp->endpoint);
+	free(otlp->service);
+	otlp->endpoint = strdup(endpoint);
+	AN(otlp->endpoint);
+	otlp->service = strdup(json_get_string(root, "service") ?
+	    json_get_string(root, "service") : "varnish");
+	AN(otlp->service);
+	m = json_get(root, "sample");
+	otlp->ratio = m != NULL ? m->number : OTLP_RATIO;
+	m = json_get(root, "batch");
+	otlp->batch = m != NULL ? m->number : OTLP_BATCH;
+	m = json_get(root, "interval");
+	otlp->interval = m != NULL ? m->number : OTLP_INTERVAL;
+	return (NULL);
+}
+
+static unsigned int
+otlp_reply(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct otlp_priv_t *otlp;
+	struct http_response *resp;
+	struct json_t *root;
+	struct vsb *vsb;
+	const char *err;
+	int i;
+
+	(void)arg;
+	GET_PRIV(core, otlp);
+
+	if (request->method == M_PUT) {
+		if ((root = json_parse(request->body, &err)) == NULL) {
+			http_reply(request->connection, 400, err);
+			return (0);
+		}
+		AZ(pthread_mutex_lock(&otlp->lck));
+		err = otlp_config(otlp, root);
+		if (err == NULL)
+			logger(otlp->logger, "Exporting spans to %s",
+			    otlp->endpoint);
+		AZ(pthread_mutex_unlock(&otlp->lck));
+		json_free(root);
+		if (err != NULL) {
+			http_reply(request->connection, 400, err);
+			return (0);
+		}
+	} else if (request->method == M_DELETE) {
+		AZ(pthread_mutex_lock(&otlp->lck));
+		free(otlp->endpoint);
+		otlp->endpoint = NULL;
+		for (i = 0; i < otlp->ninstances; i++) {
+			VSB_clear(otlp->inst[i].spans);
+			otlp->inst[i].nspans = 0;
+		}
+		AZ(pthread_mutex_unlock(&otlp->lck));
+		logger(otlp->logger, "Stopped exporting spans");
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	AZ(pthread_mutex_lock(&otlp->lck));
+	VSB_printf(vsb, "{\n\t\"enabled\": %s",
+	    otlp->endpoint != NULL ? "true" : "false");
+	if (otlp->endpoint != NULL) {
+		VSB_cat(vsb, ",\n\t\"endpoint\": ");
+		json_quote(vsb, otlp->endpoint, -1);
+		VSB_cat(vsb, ",\n\t\"service\": ");
+		json_quote(vsb, otlp->service, -1);
+		VSB_printf(vsb, ",\n\t\"sample\": %g,\n\t\"batch\": %u,\n\t"
+		    "\"interval\": %u", otlp->ratio, otlp->batch,
+		    otlp->interval);
+	}
+	VSB_printf(vsb, ",\n\t\"traces\": %ju,\n\t\"sampled\": %ju,\n\t"
+	    "\"spans\": %ju,\n\t\"exported\": %ju,\n\t\"failed\": %ju\n}\n",
+	    otlp->traces, otlp->sampled, otlp->spans, otlp->exported,
+	    otlp->failed);
+	AZ(pthread_mutex_unlock(&otlp->lck));
+	AZ(VSB_finish(vsb));
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (0);
+}
+
+void
+otlp_init(struct agent_core_t *core)
+{
+	struct agent_plugin_t *plug;
+	struct otlp_priv_t *priv;
+	int fd, i;
+
+	ALLOC_OBJ(priv);
+	plug = plugin_find(core, "otlp");
+	priv->logger = ipc_register(core, "logger");
+	priv->tlogger = ipc_register(core, "logger");
+	priv->curl = ipc_register(core, "curl");
+	AZ(pthread_mutex_init(&priv->lck, NULL));
+	priv->ninstances = core->config->ninstances;
+	priv->inst = calloc(priv->ninstances, sizeof *priv->inst);
+	AN(priv->inst);
+	for (i = 0; i < priv->ninstances; i++) {
+		priv->inst[i].tail.what = "tracing";
+		priv->inst[i].tail.groupings = 1U << VSL_g_request;
+		priv->inst[i].tail.interval = OTLP_RETRY;
+		priv->inst[i].spans = VSB_new_auto();
+		AN(priv->inst[i].spans);
+	}
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0 || read(fd, &priv->rnd, sizeof priv->rnd) !=
+	    sizeof priv->rnd)
+		priv->rnd = (uint64_t)time(NULL) << 20 ^ getpid();
+	if (fd >= 0)
+		close(fd);
+	priv->rnd |= 1;
+	if (gethostname(priv->host, sizeof priv->host - 1) != 0)
+		priv->host[0] = '\0';
+	plug->data = (void *)priv;
+	plug->start = otlp_start;
+
+	http_register_path(core, "/push/otlp/traces", M_GET | M_PUT | M_DELETE,
+	    otlp_reply, core);
+	http_register_path(core, "/help/otlp", M_GET, help_reply,
+	    strdup(OTLP_HELP));
+}
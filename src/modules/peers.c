@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Peer agents, for fanning requests out to a fleet. See peers.h.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <ctype.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+
+#include "common.h"
+#include "peers.h"
+#include "plugins.h"
+#include "vsb.h"
+
+struct peer_t {
+	char *name;
+	char *url;
+	int authed;		// Credentials in url
+};
+
+struct peers_priv_t {
+	struct peer_t *peers;
+	int npeers;
+};
+
+static size_t
+peers_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	struct peer_reply_t *r = userdata;
+
+	AZ(VSB_bcat(r->body, ptr, size * nmemb));
+	return (size * nmemb);
+}
+
+static CURL *
+peers_easy(struct agent_core_t *core, const struct peer_t *peer,
+    struct peer_reply_t *r, const char *method, const char *url,
+    const char *body, long timeout_ms, struct curl_slist *slist)
+{
+	CURL *curl;
+	char *full;
+
+	curl = curl_easy_init();
+	AN(curl);
+	assert(0 < asprintf(&full, "%s%s", peer->url, url));
+	curl_easy_setopt(curl, CURLOPT_URL, full);
+	free(full);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slist);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, peers_write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, r);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, r->error);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, r);
+	if (!peer->authed && core->config->user) {
+		curl_easy_setopt(curl, CURLOPT_USERNAME, core->config->user);
+		curl_easy_setopt(curl, CURLOPT_PASSWORD,
+		    core->config->password);
+	}
+	if (core->config->C_arg)
+		curl_easy_setopt(curl, CURLOPT_CAINFO, core->config->C_arg);
+	if (core->config->k_arg)
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
+
+	if (strcmp(method, "GET")) {
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body ? body : "");
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+		    (long)(body ? strlen(body) : 0));
+	} else
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+	return (curl);
+}
+
+int
+peers_count(struct agent_core_t *core)
+{
+	struct peers_priv_t *peers;
+
+	GET_PRIV(core, peers);
+	return (peers->npeers);
+}
+
+struct peer_reply_t *
+peers_run(struct agent_core_t *core, const char *method, const char *url,
+    const char *body, long timeout_ms)
+{
+	struct peers_priv_t *peers;
+	struct peer_reply_t *replies, *r;
+	struct curl_slist *slist;
+	CURLM *multi;
+	CURLMsg *msg;
+	CURL *curl;
+	int i, next = 0, active = 0, running, left;
+	double t;
+
+	GET_PRIV(core, peers);
+	replies = calloc(peers->npeers ? peers->npeers : 1, sizeof *replies);
+	AN(replies);
+	for (i = 0; i < peers->npeers; i++) {
+		replies[i].peer = peers->peers[i].name;
+		replies[i].body = VSB_new_auto();
+		AN(replies[i].body);
+	}
+
+	/* No waiting for 100 Continue, the body is small. */
+	slist = curl_slist_append(NULL, "Expect:");
+	multi = curl_multi_init();
+	AN(multi);
+	while (next < peers->npeers || active > 0) {
+		while (next < peers->npeers && active < PEERS_PARALLEL) {
+			curl = peers_easy(core, &peers->peers[next],
+			    &replies[next], method, url, body, timeout_ms,
+			    slist);
+			curl_multi_add_handle(multi, curl);
+			next++;
+			active++;
+		}
+		curl_multi_perform(multi, &running);
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			curl = msg->easy_handle;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&r);
+			curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &t);
+			r->ms = t * 1000.0;
+			if (msg->data.result == CURLE_OK)
+				curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE,
+				    &r->status);
+			else if (r->error[0] == '\0')
+				snprintf(r->error, sizeof r->error, "%s",
+				    curl_easy_strerror(msg->data.result));
+			curl_multi_remove_handle(multi, curl);
+			curl_easy_cleanup(curl);
+			active--;
+		}
+		if (active > 0)
+			curl_multi_wait(multi, NULL, 0, 100, NULL);
+	}
+	curl_multi_cleanup(multi);
+	curl_slist_free_all(slist);
+
+	for (i = 0; i < peers->npeers; i++)
+		AZ(VSB_finish(replies[i].body));
+	return (replies);
+}
+
+void
+peers_free(struct peer_reply_t *replies, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		VSB_delete(replies[i].body);
+	free(replies);
+}
+
+/*
+ * One peer per line, # starts a comment.
+ */
+static void
+peers_read(struct peers_priv_t *peers, const char *path)
+{
+	FILE *fp;
+	char line[1024];
+	char *p, *e;
+	struct peer_t *peer;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		err(1, "Cannot open peers file %s", path);
+	while (fgets(line, sizeof line, fp) != NULL) {
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		for (p = line; isspace((unsigned char)*p); p++)
+			continue;
+		for (e = p + strlen(p); e > p && isspace((unsigned char)e[-1]); e--)
+			continue;
+		*e = '\0';
+		if (*p == '\0')
+			continue;
+		while (e > p && e[-1] == '/')
+			*--e = '\0';
+
+		peers->peers = realloc(peers->peers,
+		    (peers->npeers + 1) * sizeof *peers->peers);
+		AN(peers->peers);
+		peer = &peers->peers[peers->npeers++];
+		peer->name = strdup(p);
+		AN(peer->name);
+		if (strstr(p, "://"))
+			peer->url = strdup(p);
+		else
+			assert(0 < asprintf(&peer->url, "http://%s", p));
+		AN(peer->url);
+		e = strstr(peer->url, "://") + 3;
+		peer->authed = memchr(e, '@', strcspn(e, "/")) != NULL;
+		/* Don't show the credentials in replies. */
+		if ((e = strchr(peer->name, '@')) != NULL)
+			memmove(peer->name, e + 1, strlen(e + 1) + 1);
+	}
+	if (ferror(fp))
+		err(1, "Cannot read peers file %s", path);
+	AZ(fclose(fp));
+}
+
+void
+peers_init(struct agent_core_t *core)
+{
+	struct agent_plugin_t *plug;
+	struct peers_priv_t *priv;
+
+	ALLOC_OBJ(priv);
+	plug = plugin_find(core, "peers");
+	plug->data = priv;
+	if (core->config->f_arg)
+		peers_read(priv, core->config->f_arg);
+}
@@ -163,7 +163,7 @@ vac_register_init(struct agent_core_t *core)
 	 * XXX: construct the URL based on varnish name, cli setup and vagent's own api location.
          *	pending vac api changes.
 	 *
-	 *	T_arg or T_arg_orig resides in core-config->T_arg for example. name is n_arg
+	 *	T_arg_orig resides in core->config, the computed -T in vadmin. name is n_arg
          */
 	priv->vac_url = core->config->vac_arg;
 	//chuck the private ds to the plugin so it lives on
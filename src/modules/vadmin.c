@@ -43,17 +43,31 @@
 #include <vcli.h>
 
 #include "common.h"
+#include "events.h"
 #include "http.h"
+#include "instance.h"
 #include "ipc.h"
 #include "plugins.h"
 #include "vss-hack.h"
 
 
-struct vadmin_config_t {
+/*
+ * One management connection per instance. T_arg and S_arg are what we
+ * ended up using for it, from -T/-S for the default instance or from
+ * the shmlog.
+ */
+struct vadmin_conn_t {
 	int sock;
 	int state;
-	int logger;
 	int s_arg_fd;
+	char *T_arg;
+	char *S_arg;
+	unsigned connects;
+};
+
+struct vadmin_config_t {
+	struct vadmin_conn_t *conns;
+	int logger;
 };
 
 /*
@@ -86,28 +100,37 @@ cli_write(int sock, const char *s)
  *
  * Run on every connect, must do some cleanup.
  *
+ * -T and -S only apply to the default instance. The others always find
+ * theirs in the shmlog.
  */
 static int
-n_arg_sock(struct agent_core_t *core)
+n_arg_sock(struct agent_core_t *core, struct vadmin_conn_t *conn)
 {
 	struct VSM_data *vsm;
 	struct vadmin_config_t *vadmin;
 	char *p;
 	struct VSM_fantom vt;
+	const char *T_arg_orig = NULL;
 	GET_PRIV(core, vadmin);
 
+	if (instance_current() == 0) {
+		T_arg_orig = core->config->T_arg_orig;
+		if (conn->S_arg == NULL && core->config->S_arg)
+			conn->S_arg = strdup(core->config->S_arg);
+	}
+
 	vsm = VSM_New();
-	assert(VSM_n_Arg(vsm, core->config->n_arg) == 1);
+	assert(VSM_n_Arg(vsm, instance_get(core)->n_arg) == 1);
 	if (VSM_Open(vsm)) {
 		warnlog(vadmin->logger,"Couldn't open VSM: %s", VSM_Error(vsm));
 		VSM_Delete(vsm);
 		vsm = NULL;
 	}
 
-	if (core->config->T_arg_orig) {
-		if (core->config->T_arg)
-			free(core->config->T_arg);
-		core->config->T_arg = strdup(core->config->T_arg_orig);
+	if (T_arg_orig) {
+		if (conn->T_arg)
+			free(conn->T_arg);
+		conn->T_arg = strdup(T_arg_orig);
 	} else {
 		if (vsm == NULL) {
 			warnlog(vadmin->logger,"No -T arg and no shmlog readable.");
@@ -121,27 +144,30 @@ n_arg_sock(struct agent_core_t *core)
 		}
 
 		assert(vt.b);
-		core->config->T_arg = strdup(vt.b);
+		if (conn->T_arg)
+			free(conn->T_arg);
+		conn->T_arg = strdup(vt.b);
 	}
 
-	if (core->config->S_arg == NULL && !vsm) {
+	if (conn->S_arg == NULL && !vsm) {
 		warnlog(vadmin->logger, "No shmlog and no -S arg. Unknown if authentication will work.");
 	}
-	if (vsm && core->config->S_arg == NULL) {
+	if (vsm && conn->S_arg == NULL) {
 		if (VSM_Get(vsm, &vt, "Arg", "-S", "")) {
 			assert(vt.b);
-			core->config->S_arg = strdup(vt.b);
+			conn->S_arg = strdup(vt.b);
 		}
 	}
 
 	if (vsm)
 		VSM_Delete(vsm);
 	
-	p = strchr(core->config->T_arg, '\n');
+	p = strchr(conn->T_arg, '\n');
 	if (p) {
 		*p = '\0';
 	}
-	logger(vadmin->logger, "-T argument computed to: %s", core->config->T_arg ? core->config->T_arg : "(null)");
+	logger(vadmin->logger, "-T argument for %s computed to: %s",
+	    instance_get(core)->name, conn->T_arg ? conn->T_arg : "(null)");
 	return (1);
 }
 
@@ -152,85 +178,88 @@ n_arg_sock(struct agent_core_t *core)
  * returned
  */
 static int
-cli_sock(struct vadmin_config_t *vadmin, struct agent_core_t *core)
+cli_sock(struct vadmin_config_t *vadmin, struct vadmin_conn_t *conn,
+    struct agent_core_t *core)
 {
 	unsigned status;
 	char *answer = NULL;
 	char buf[CLI_AUTH_RESPONSE_LEN + 1];
-	n_arg_sock(core);
-	if (core->config->T_arg == NULL) {
+	n_arg_sock(core, conn);
+	if (conn->T_arg == NULL) {
 		warnlog(vadmin->logger, "No T-arg (Administration port) available. Varnishadm-commands wont work.");
 		return (-1);
 	}
-	vadmin->sock = VSS_open(vadmin->logger, core->config->T_arg, core->config->timeout);
-	if (vadmin->sock < 0) {
-		warnlog(vadmin->logger, "Connection failed (%s)", core->config->T_arg);
+	conn->sock = VSS_open(vadmin->logger, conn->T_arg, core->config->timeout);
+	if (conn->sock < 0) {
+		warnlog(vadmin->logger, "Connection failed (%s)", conn->T_arg);
 		return (-1);
 	}
 
-	(void)VCLI_ReadResult(vadmin->sock, &status, &answer, core->config->timeout);
+	(void)VCLI_ReadResult(conn->sock, &status, &answer, core->config->timeout);
 	if (status == CLIS_AUTH) {
-		if (core->config->S_arg == NULL) {
+		if (conn->S_arg == NULL) {
 			warnlog(vadmin->logger, "Authentication required and no -S arg found");
-			assert(close(vadmin->sock) == 0);
-			vadmin->sock = -1;
+			assert(close(conn->sock) == 0);
+			conn->sock = -1;
 			return(-1);
 		}
-		if (vadmin->s_arg_fd < 0) {
-			vadmin->s_arg_fd = open(core->config->S_arg, O_RDONLY);
+		if (conn->s_arg_fd < 0) {
+			conn->s_arg_fd = open(conn->S_arg, O_RDONLY);
 		} else {
-			lseek(vadmin->s_arg_fd, 0, SEEK_SET);
+			lseek(conn->s_arg_fd, 0, SEEK_SET);
 		}
-		if (vadmin->s_arg_fd < 0) {
+		if (conn->s_arg_fd < 0) {
 			warnlog(vadmin->logger, "Cannot open \"%s\": %s",
-			    core->config->S_arg, strerror(errno));
-			assert(close(vadmin->sock) == 0);
-			vadmin->sock = -1;
+			    conn->S_arg, strerror(errno));
+			assert(close(conn->sock) == 0);
+			conn->sock = -1;
 			return (-1);
 		}
-		VCLI_AuthResponse(vadmin->s_arg_fd, answer, buf);
+		VCLI_AuthResponse(conn->s_arg_fd, answer, buf);
 		free(answer);
 
-		cli_write(vadmin->sock, "auth ");
-		cli_write(vadmin->sock, buf);
-		cli_write(vadmin->sock, "\n");
-		(void)VCLI_ReadResult(vadmin->sock, &status, &answer, core->config->timeout);
+		cli_write(conn->sock, "auth ");
+		cli_write(conn->sock, buf);
+		cli_write(conn->sock, "\n");
+		(void)VCLI_ReadResult(conn->sock, &status, &answer, core->config->timeout);
 		if (status != CLIS_OK) {
 			warnlog(vadmin->logger, "Failed authentication.");
-			assert(close(vadmin->s_arg_fd) == 0);
-			vadmin->sock = -1;
-			vadmin->s_arg_fd = -1;
+			assert(close(conn->s_arg_fd) == 0);
+			conn->sock = -1;
+			conn->s_arg_fd = -1;
 		}
 
 	}
 	if (status != CLIS_OK) {
 		warnlog(vadmin->logger, "Rejected %u\n%s", status, answer);
-		if (vadmin->sock >= 0) {
-			assert(close(vadmin->sock) == 0);
-			vadmin->sock = -1;
+		if (conn->sock >= 0) {
+			assert(close(conn->sock) == 0);
+			conn->sock = -1;
 		}
 		return (-1);
 	}
 	free(answer);
 
-	cli_write(vadmin->sock, "ping\n");
-	(void)VCLI_ReadResult(vadmin->sock, &status, &answer, core->config->timeout);
+	cli_write(conn->sock, "ping\n");
+	(void)VCLI_ReadResult(conn->sock, &status, &answer, core->config->timeout);
 	if (status != CLIS_OK || strstr(answer, "PONG") == NULL) {
 		warnlog(vadmin->logger, "No pong received from server");
-		assert(close(vadmin->sock) == 0);
-		vadmin->sock = -1;
+		assert(close(conn->sock) == 0);
+		conn->sock = -1;
 		return(-1);
 	}
 	free(answer);
-	vadmin->state = 1;
+	conn->state = 1;
+	conn->connects++;
 
-	return (vadmin->sock);
+	return (conn->sock);
 }
 
 static void
-vadmin_run(struct vadmin_config_t *vadmin, char *cmd, struct ipc_ret_t *ret)
+vadmin_run(struct vadmin_config_t *vadmin, struct vadmin_conn_t *conn,
+    char *cmd, struct ipc_ret_t *ret)
 {
-	int sock = vadmin->sock;
+	int sock = conn->sock;
 	char *p;
 	int nret;
 	assert(cmd);
@@ -248,21 +277,21 @@ vadmin_run(struct vadmin_config_t *vadmin, char *cmd, struct ipc_ret_t *ret)
 	
 	if (sock < 0) {
 		ANSWER(ret,400, "Varnishd disconnected");
-		vadmin->state = 0;
+		conn->state = 0;
 		return;
 	}
 	nret = cli_write(sock, cmd);
 	if (!nret) {
 		warnlog(vadmin->logger, "Communication error with varnishd.");
 		ANSWER(ret, 400, "Varnishd disconnected");
-		vadmin->state = 0;
+		conn->state = 0;
 		return;
 	}
 	nret = cli_write(sock, "\n");
 	if (!nret) {
 		warnlog(vadmin->logger, "Communication error with varnishd.");
 		ANSWER(ret, 400, "Varnishd disconnected");
-		vadmin->state = 0;
+		conn->state = 0;
 		return;
 	}
 	debuglog(vadmin->logger, "Running '%s'",cmd);
@@ -275,16 +304,24 @@ read_cmd(void *private, char *msg, struct ipc_ret_t *ret)
 {
 	struct agent_core_t *core = private;
 	struct vadmin_config_t *vadmin;
+	struct vadmin_conn_t *conn;
 
 	GET_PRIV(core, vadmin);
+	assert(instance_current() < core->config->ninstances);
+	conn = &vadmin->conns[instance_current()];
 
-	if (vadmin->state == 0)
-		cli_sock(vadmin, core);
-	if (vadmin->state == 0) {
+	if (conn->state == 0) {
+		cli_sock(vadmin, conn, core);
+		/* Bans are gone if varnishd restarted, see vban.c */
+		if (conn->state == 1 && conn->connects > 1)
+			events_publish(core, "vadmin.reconnect", "instance",
+			    instance_get(core)->name, NULL);
+	}
+	if (conn->state == 0) {
 		ANSWER(ret,400, "Varnishd disconnected");
 		return;
 	}
-	vadmin_run(vadmin, msg, ret);
+	vadmin_run(vadmin, conn, msg, ret);
 }
 
 
@@ -293,6 +330,7 @@ vadmin_init(struct agent_core_t *core)
 {
 	struct vadmin_config_t *vadmin;
 	struct agent_plugin_t *v;
+	int i;
 
 	ALLOC_OBJ(vadmin);
 	v  = plugin_find(core, "vadmin");
@@ -300,22 +338,24 @@ vadmin_init(struct agent_core_t *core)
 	v->data = vadmin;
 	v->ipc->priv = core;
 	v->start = ipc_start;
-	vadmin->sock = -1;
-	vadmin->state = 0;
-	vadmin->s_arg_fd = core->config->S_arg_fd;
+	vadmin->conns = calloc(core->config->ninstances,
+	    sizeof *vadmin->conns);
+	AN(vadmin->conns);
+	for (i = 0; i < core->config->ninstances; i++) {
+		vadmin->conns[i].sock = -1;
+		vadmin->conns[i].s_arg_fd = -1;
+	}
+	vadmin->conns[0].s_arg_fd = core->config->S_arg_fd;
 	vadmin->logger = ipc_register(core, "logger");
 
-	if (core->config->n_arg != NULL) {
-		if (core->config->T_arg != NULL || core->config->S_arg != NULL) {
-			return ;
-		}
-	} else if (core->config->T_arg == NULL) {
-		core->config->n_arg = strdup("");
-	} else {
-		assert(core->config->T_arg != NULL);
-	}
+	AN(core->config->n_arg);
+	if (core->config->S_arg != NULL)
+		return ;
 	signal(SIGPIPE, SIG_IGN);
-	if (vadmin->state == 0)
-		cli_sock(vadmin, core);
+	for (i = 0; i < core->config->ninstances; i++) {
+		instance_select(i);
+		cli_sock(vadmin, &vadmin->conns[i], core);
+	}
+	instance_select(0);
 	return ;
 }
@@ -28,14 +28,21 @@
 
 #define _GNU_SOURCE
 #include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <curl/curl.h>
 
 #include "common.h"
+#include "events.h"
 #include "http.h"
 #include "helpers.h"
 #include "ipc.h"
+#include "json.h"
 #include "plugins.h"
 #include "vsb.h"
 
@@ -43,11 +50,77 @@
 "GET /backendsjson/ - fetches a list of backends and values\n" \
 "PUT /backend/foo - Takes a single value as input (e.g: sick)" \
 " and let you change the admin health value\n" \
-"For more tricks go to the HTML backend page\n"
+"For more tricks go to the HTML backend page\n" \
+"\n" \
+"GET /backendprobe - latency and errors of our own probes\n" \
+"PUT /backendprobe - start probing, with a JSON object like\n" \
+"  {\"interval\": 5, \"path\": \"/\", \"timeout_ms\": 2000, \"expect\": 200}\n" \
+"DELETE /backendprobe - stop probing and forget the results\n" \
+"\n" \
+"The agent probes the backends of the active VCL itself, all in\n" \
+"parallel, every interval seconds. Latency is kept in a histogram\n" \
+"with power of two buckets in milliseconds, and failures are counted\n" \
+"as connect, timeout, status (not expect) or other errors.\n"
 
+/*
+ * The agent-side prober. Addresses come from the backend names of
+ * Varnish 4.0 (name(ip,,port)), or from the backend declarations of the
+ * active VCL.
+ */
+#define PROBE_BUCKETS	14	// < 1ms, < 2ms, ... < 4096ms, more
+
+enum probe_error {
+	PROBE_E_CONNECT,
+	PROBE_E_TIMEOUT,
+	PROBE_E_STATUS,
+	PROBE_E_OTHER,
+	PROBE_E_MAX
+};
+
+static const char * const probe_errors[PROBE_E_MAX] = {
+	[PROBE_E_CONNECT]	= "connect",
+	[PROBE_E_TIMEOUT]	= "timeout",
+	[PROBE_E_STATUS]	= "status",
+	[PROBE_E_OTHER]		= "other",
+};
+
+struct probe_backend_t {
+	char *name;
+	char *address;		// host:port
+	unsigned gen;
+	uint64_t checks;
+	uint64_t ok;
+	uint64_t errors[PROBE_E_MAX];
+	uint64_t hist[PROBE_BUCKETS];
+	double last_ms, min_ms, max_ms, sum_ms;
+	char *last_error;
+	time_t last;
+	/* While a check runs */
+	CURL *curl;
+	char error[CURL_ERROR_SIZE];
+	struct probe_backend_t *next;
+};
+
+struct probe_config_t {
+	int enabled;
+	unsigned interval;
+	char *path;
+	long timeout_ms;
+	long expect;
+};
+
+/*
+ * vadmin and logger are for the HTTP callbacks, tvadmin for the probe
+ * thread. lck covers config and probes.
+ */
 struct vbackends_priv_t {
 	int logger;
 	int vadmin;
+	int tvadmin;
+	pthread_mutex_t lck;
+	struct probe_config_t config;
+	struct probe_backend_t *probes;
+	unsigned gen;
 };
 
 struct backend_opt {
@@ -84,20 +157,20 @@ format_line(char *line)
 static void
 vbackends_show_json(struct vsb *json, char *raw)
 {
-	char *tokens = NULL, *ptr = NULL;
+	char *tokens = NULL, *ptr = NULL, *last = NULL;
 	char tmp[1000];
 	int raw_len = 0;
 	int cont = 0;
 	int sum = 0;
 
 	raw_len = strlen(raw);
-	tokens = strtok(raw, "\n");
+	tokens = strtok_r(raw, "\n", &last);
 	sum = sum + strlen(tokens);
 
 	VSB_cat(json, "{\n \"backends\" : [\n");
 	while(tokens != NULL){
 		strcpy(tmp, (tokens));
-		tokens = strtok(NULL, "\n");
+		tokens = strtok_r(NULL, "\n", &last);
 		sum = sum + strlen(tmp);
 		if(cont > 0){
 			ptr = format_line(tmp);
@@ -175,12 +248,571 @@ vbackends_reply(struct http_request *request, const char *arg, void *data)
 	mark = strchr(body,'\n');
 	if (mark)
 		*mark = '\0';
-	run_and_respond(vbackends->vadmin, request->connection,
-			"backend.set_health %s %s", arg, body);
+	if (run_and_respond(vbackends->vadmin, request->connection,
+	    "backend.set_health %s %s", arg, body) == 200)
+		events_publish(core, "backend.admin", "name", arg,
+		    "admin", body, NULL);
 	free(body);
 	return (1);
 }
 
+/*
+ * Value of a field like .host = "foo"; between b and e, or NULL.
+ */
+static char *
+probe_vcl_field(const char *b, const char *e, const char *field)
+{
+	const char *p, *q;
+	size_t l = strlen(field);
+
+	for (p = b; (p = strstr(p, field)) != NULL && p < e; p += l) {
+		for (q = p + l; isspace((unsigned char)*q); q++)
+			continue;
+		if (*q++ != '=')
+			continue;
+		while (isspace((unsigned char)*q))
+			q++;
+		if (*q++ != '"')
+			continue;
+		p = strchr(q, '"');
+		if (p == NULL || p > e)
+			return (NULL);
+		return (strndup(q, p - q));
+	}
+	return (NULL);
+}
+
+/*
+ * host:port of the backend called name in VCL source, or NULL.
+ */
+static char *
+probe_vcl_address(const char *vcl, const char *name)
+{
+	const char *p, *b, *e;
+	char *host, *port, *address = NULL;
+	size_t l = strlen(name);
+	int depth;
+
+	for (p = vcl; (p = strstr(p, "backend")) != NULL; ) {
+		if (p > vcl && (isalnum((unsigned char)p[-1]) || p[-1] == '_')) {
+			p += 7;
+			continue;
+		}
+		p += 7;
+		if (!isspace((unsigned char)*p))
+			continue;
+		while (isspace((unsigned char)*p))
+			p++;
+		if (strncmp(p, name, l) || (p[l] != '{' &&
+		    !isspace((unsigned char)p[l])))
+			continue;
+		b = strchr(p, '{');
+		if (b == NULL)
+			break;
+		for (e = b, depth = 0; *e != '\0'; e++) {
+			if (*e == '{')
+				depth++;
+			else if (*e == '}' && --depth == 0)
+				break;
+		}
+		host = probe_vcl_field(b, e, ".host");
+		port = probe_vcl_field(b, e, ".port");
+		if (host != NULL && port != NULL)
+			assert(0 < asprintf(&address, strchr(host, ':') ?
+			    "[%s]:%s" : "%s:%s", host, port));
+		else if (host != NULL)
+			assert(0 < asprintf(&address, strchr(host, ':') ?
+			    "%s" : "%s:80", host));
+		free(host);
+		free(port);
+		break;
+	}
+	return (address);
+}
+
+/*
+ * Note that name is probed at address, in discovery gen. Called with the
+ * lock held.
+ */
+static void
+probe_seen(struct vbackends_priv_t *vbackends, const char *name,
+    const char *address, unsigned gen)
+{
+	struct probe_backend_t *pb;
+
+	for (pb = vbackends->probes; pb != NULL; pb = pb->next)
+		if (!strcmp(pb->name, name))
+			break;
+	if (pb == NULL) {
+		ALLOC_OBJ(pb);
+		pb->name = strdup(name);
+		AN(pb->name);
+		pb->next = vbackends->probes;
+		vbackends->probes = pb;
+	}
+	if (pb->address == NULL || strcmp(pb->address, address)) {
+		free(pb->address);
+		pb->address = strdup(address);
+		AN(pb->address);
+	}
+	pb->gen = gen;
+}
+
+/*
+ * Name and source of the active VCL, the source in vcl->answer.
+ */
+static char *
+probe_active_vcl(struct vbackends_priv_t *vbackends, struct ipc_ret_t *vcl)
+{
+	struct ipc_ret_t vret;
+	char *line, *last = NULL, *p, *name = NULL;
+
+	ipc_run(vbackends->tvadmin, &vret, "vcl.list");
+	if (vret.status == 200)
+		for (p = vret.answer; (line = strtok_r(p, "\n", &last));
+		    p = NULL)
+			if (STARTS_WITH(line, "active")) {
+				p = strrchr(line, ' ');
+				name = strdup(p ? p + 1 : line);
+				break;
+			}
+	free(vret.answer);
+	if (name == NULL)
+		return (NULL);
+	ipc_run(vbackends->tvadmin, vcl, "vcl.show %s", name);
+	if (vcl->status != 200) {
+		free(vcl->answer);
+		vcl->answer = NULL;
+		free(name);
+		return (NULL);
+	}
+	return (name);
+}
+
+static size_t
+probe_drop(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	(void)ptr;
+	(void)userdata;
+	return (size * nmemb);
+}
+
+/*
+ * Find the backends and their addresses, as discovery gen. Varnish 4.0
+ * has the address in the name in backend.list, later versions need the
+ * VCL.
+ *
+ * Returns -1 if backend.list or the VCL could not be had, and so some
+ * backends may not have been seen.
+ */
+static int
+probe_discover(struct vbackends_priv_t *vbackends, unsigned gen)
+{
+	struct ipc_ret_t vret, vcl;
+	char *line, *last = NULL, *p, *q, *name, *address, *vclname = NULL;
+	char *ip4, *ip6, *port;
+	int ret = 0;
+
+	vcl.answer = NULL;
+	ipc_run(vbackends->tvadmin, &vret, "backend.list");
+	if (vret.status != 200) {
+		free(vret.answer);
+		return (-1);
+	}
+	for (p = vret.answer; (line = strtok_r(p, "\n", &last)) != NULL;
+	    p = NULL) {
+		if (p != NULL)		// The header
+			continue;
+		name = strtok_r(line, " ", &q);
+		if (name == NULL)
+			continue;
+		address = NULL;
+		if ((q = strchr(name, '(')) != NULL) {
+			*q++ = '\0';
+			ip4 = q;
+			ip6 = strchr(ip4, ',');
+			port = ip6 ? strchr(ip6 + 1, ',') : NULL;
+			if (port == NULL)
+				continue;
+			*ip6++ = *port++ = '\0';
+			port[strcspn(port, ")")] = '\0';
+			assert(0 < asprintf(&address, *ip4 ? "%s:%s" :
+			    "[%s]:%s", *ip4 ? ip4 : ip6, port));
+		} else {
+			if (vcl.answer == NULL && ret == 0)
+				vclname = probe_active_vcl(vbackends, &vcl);
+			if (vclname == NULL) {
+				ret = -1;
+				continue;
+			}
+			q = strrchr(name, '.');
+			address = probe_vcl_address(vcl.answer,
+			    q ? q + 1 : name);
+		}
+		if (address == NULL)
+			continue;
+		AZ(pthread_mutex_lock(&vbackends->lck));
+		probe_seen(vbackends, name, address, gen);
+		AZ(pthread_mutex_unlock(&vbackends->lck));
+		free(address);
+	}
+	free(vclname);
+	free(vcl.answer);
+	free(vret.answer);
+	return (ret);
+}
+
+static void
+probe_hist(struct probe_backend_t *pb, double ms)
+{
+	double limit = 1;
+	int i;
+
+	for (i = 0; i < PROBE_BUCKETS - 1 && ms >= limit; i++)
+		limit *= 2;
+	pb->hist[i]++;
+}
+
+/*
+ * Probe all backends in parallel and record the results.
+ */
+static void
+probe_run(struct vbackends_priv_t *vbackends)
+{
+	struct probe_backend_t *pb, **pbp;
+	struct probe_config_t config;
+	CURLM *multi;
+	CURLMsg *msg;
+	CURL *curl;
+	char *url;
+	long status;
+	double t;
+	int running, left, active = 0;
+	enum probe_error err;
+	int discovered;
+
+	discovered = !probe_discover(vbackends, vbackends->gen + 1);
+
+	multi = curl_multi_init();
+	AN(multi);
+	AZ(pthread_mutex_lock(&vbackends->lck));
+	/*
+	 * Forget the backends that went away, if we know. A failed
+	 * backend.list or vcl.show doesn't mean they did.
+	 */
+	if (discovered)
+		vbackends->gen++;
+	for (pbp = &vbackends->probes; (pb = *pbp) != NULL; ) {
+		if (!discovered || pb->gen == vbackends->gen) {
+			pbp = &pb->next;
+			continue;
+		}
+		*pbp = pb->next;
+		free(pb->name);
+		free(pb->address);
+		free(pb->last_error);
+		free(pb);
+	}
+	config = vbackends->config;
+	for (pb = vbackends->probes; pb != NULL; pb = pb->next) {
+		pb->curl = curl = curl_easy_init();
+		AN(curl);
+		assert(0 < asprintf(&url, "http://%s%s", pb->address,
+		    config.path));
+		curl_easy_setopt(curl, CURLOPT_URL, url);
+		free(url);
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 0);
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, config.timeout_ms);
+		curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1);
+		curl_easy_setopt(curl, CURLOPT_USERAGENT,
+		    "varnish-agent probe");
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, probe_drop);
+		curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, pb->error);
+		curl_easy_setopt(curl, CURLOPT_PRIVATE, pb);
+		pb->error[0] = '\0';
+		curl_multi_add_handle(multi, curl);
+		active++;
+	}
+	AZ(pthread_mutex_unlock(&vbackends->lck));
+
+	while (active > 0) {
+		curl_multi_perform(multi, &running);
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			curl = msg->easy_handle;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&pb);
+			curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &t);
+			status = 0;
+			if (msg->data.result == CURLE_OK)
+				curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE,
+				    &status);
+			if (msg->data.result == CURLE_COULDNT_CONNECT ||
+			    msg->data.result == CURLE_COULDNT_RESOLVE_HOST)
+				err = PROBE_E_CONNECT;
+			else if (msg->data.result == CURLE_OPERATION_TIMEDOUT)
+				err = PROBE_E_TIMEOUT;
+			else if (msg->data.result != CURLE_OK)
+				err = PROBE_E_OTHER;
+			else if (status != config.expect) {
+				err = PROBE_E_STATUS;
+				snprintf(pb->error, sizeof pb->error,
+				    "Status %ld, expected %ld", status,
+				    config.expect);
+			} else
+				err = PROBE_E_MAX;
+
+			AZ(pthread_mutex_lock(&vbackends->lck));
+			pb->checks++;
+			pb->last = time(NULL);
+			if (err == PROBE_E_MAX) {
+				t *= 1000.0;
+				pb->ok++;
+				pb->last_ms = t;
+				pb->sum_ms += t;
+				if (pb->ok == 1 || t < pb->min_ms)
+					pb->min_ms = t;
+				if (t > pb->max_ms)
+					pb->max_ms = t;
+				probe_hist(pb, t);
+			} else {
+				pb->errors[err]++;
+				free(pb->last_error);
+				if (pb->error[0] == '\0')
+					snprintf(pb->error, sizeof pb->error,
+					    "%s", curl_easy_strerror(
+					    msg->data.result));
+				pb->last_error = strdup(pb->error);
+			}
+			AZ(pthread_mutex_unlock(&vbackends->lck));
+			curl_multi_remove_handle(multi, curl);
+			curl_easy_cleanup(curl);
+			active--;
+		}
+		if (active > 0)
+			curl_multi_wait(multi, NULL, 0, 100, NULL);
+	}
+	curl_multi_cleanup(multi);
+}
+
+static void *
+vbackends_run(void *data)
+{
+	struct agent_core_t *core = data;
+	struct vbackends_priv_t *vbackends;
+	struct probe_backend_t *pb;
+	time_t last = 0;
+	int enabled;
+	unsigned interval;
+
+	GET_PRIV(core, vbackends);
+	for (;;) {
+		AZ(pthread_mutex_lock(&vbackends->lck));
+		enabled = vbackends->config.enabled;
+		interval = vbackends->config.interval;
+		if (!enabled) {
+			while ((pb = vbackends->probes) != NULL) {
+				vbackends->probes = pb->next;
+				free(pb->name);
+				free(pb->address);
+				free(pb->last_error);
+				free(pb);
+			}
+		}
+		AZ(pthread_mutex_unlock(&vbackends->lck));
+		if (enabled && time(NULL) - last >= interval) {
+			last = time(NULL);
+			probe_run(vbackends);
+		}
+		sleep(1);
+	}
+	return (NULL);
+}
+
+static void *
+vbackends_start(struct agent_core_t *core, const char *name)
+{
+	pthread_t *thread;
+
+	(void)name;
+
+	ALLOC_OBJ(thread);
+	AZ(pthread_create(thread, NULL, vbackends_run, core));
+	return (thread);
+}
+
+/*
+ * Upper bound of the bucket holding the p-th fraction of the checks.
+ */
+static double
+probe_percentile(const struct probe_backend_t *pb, double p)
+{
+	uint64_t n = 0;
+	double limit = 1;
+	int i;
+
+	for (i = 0; i < PROBE_BUCKETS - 1; i++, limit *= 2) {
+		n += pb->hist[i];
+		if (n >= p * pb->ok)
+			return (limit < pb->max_ms ? limit : pb->max_ms);
+	}
+	return (pb->max_ms);
+}
+
+static void
+probe_json(struct vsb *vsb, struct vbackends_priv_t *vbackends)
+{
+	struct probe_config_t *c = &vbackends->config;
+	struct probe_backend_t *pb;
+	double limit;
+	int i;
+
+	VSB_printf(vsb, "{\n\t\"enabled\": %s", c->enabled ? "true" : "false");
+	if (c->enabled) {
+		VSB_printf(vsb, ",\n\t\"interval\": %u,\n\t\"path\": ",
+		    c->interval);
+		json_quote(vsb, c->path, -1);
+		VSB_printf(vsb, ",\n\t\"timeout_ms\": %ld,\n\t\"expect\": %ld",
+		    c->timeout_ms, c->expect);
+	}
+	VSB_cat(vsb, ",\n\t\"backends\": [");
+	for (pb = vbackends->probes; pb != NULL; pb = pb->next) {
+		VSB_cat(vsb, pb == vbackends->probes ? "\n\t\t{" : ",\n\t\t{");
+		VSB_cat(vsb, "\"name\": ");
+		json_quote(vsb, pb->name, -1);
+		VSB_cat(vsb, ", \"address\": ");
+		json_quote(vsb, pb->address, -1);
+		VSB_printf(vsb, ", \"checks\": %" PRIu64 ", \"ok\": %" PRIu64
+		    ", \"errors\": {", pb->checks, pb->ok);
+		for (i = 0; i < PROBE_E_MAX; i++)
+			VSB_printf(vsb, "%s\"%s\": %" PRIu64, i ? ", " : "",
+			    probe_errors[i], pb->errors[i]);
+		VSB_cat(vsb, "}");
+		if (pb->ok > 0) {
+			VSB_printf(vsb, ", \"last_ms\": %.1f, \"min_ms\": %.1f, "
+			    "\"avg_ms\": %.1f, \"max_ms\": %.1f, "
+			    "\"p50_ms\": %.1f, \"p90_ms\": %.1f, "
+			    "\"p99_ms\": %.1f", pb->last_ms, pb->min_ms,
+			    pb->sum_ms / pb->ok, pb->max_ms,
+			    probe_percentile(pb, 0.5),
+			    probe_percentile(pb, 0.9),
+			    probe_percentile(pb, 0.99));
+			VSB_cat(vsb, ", \"histogram\": [");
+			for (i = 0, limit = 1; i < PROBE_BUCKETS; i++,
+			    limit *= 2) {
+				if (i < PROBE_BUCKETS - 1)
+					VSB_printf(vsb, "%s{\"lt_ms\": %.0f, "
+					    "\"count\": %" PRIu64 "}",
+					    i ? ", " : "", limit, pb->hist[i]);
+				else
+					VSB_printf(vsb, ", {\"lt_ms\": null, "
+					    "\"count\": %" PRIu64 "}",
+					    pb->hist[i]);
+			}
+			VSB_cat(vsb, "]");
+		}
+		if (pb->last_error) {
+			VSB_cat(vsb, ", \"last_error\": ");
+			json_quote(vsb, pb->last_error, -1);
+		}
+		VSB_cat(vsb, "}");
+	}
+	VSB_cat(vsb, "\n\t]\n}\n");
+}
+
+/*
+ * PUT a JSON config to start the prober, DELETE to stop it.
+ */
+static unsigned int
+vbackends_probe_reply(struct http_request *request, const char *arg,
+    void *data)
+{
+	struct vbackends_priv_t *vbackends;
+	struct agent_core_t *core = data;
+	struct probe_config_t c;
+	struct http_response *resp;
+	struct json_t *root = NULL, *m;
+	struct vsb *vsb;
+	const char *err = NULL, *p;
+
+	(void)arg;
+	GET_PRIV(core, vbackends);
+
+	if (request->method == M_PUT) {
+		memset(&c, 0, sizeof c);
+		c.enabled = 1;
+		c.interval = 5;
+		c.timeout_ms = 2000;
+		c.expect = 200;
+		p = "/";
+		if (request->bodylen > 0 &&
+		    (root = json_parse(request->body, &err)) == NULL) {
+			http_reply(request->connection, 400, err);
+			return (0);
+		}
+		if ((m = json_get(root, "interval")) != NULL) {
+			if (m->type != JSON_NUMBER || m->number < 1)
+				err = "interval must be at least 1";
+			else
+				c.interval = m->number;
+		}
+		if ((m = json_get(root, "timeout_ms")) != NULL) {
+			if (m->type != JSON_NUMBER || m->number < 1)
+				err = "timeout_ms must be at least 1";
+			else
+				c.timeout_ms = m->number;
+		}
+		if ((m = json_get(root, "expect")) != NULL) {
+			if (m->type != JSON_NUMBER || m->number < 100 ||
+			    m->number > 599)
+				err = "expect must be an HTTP status";
+			else
+				c.expect = m->number;
+		}
+		if ((m = json_get(root, "path")) != NULL) {
+			if (m->type != JSON_STRING || *m->string != '/')
+				err = "path must start with /";
+			else
+				p = m->string;
+		}
+		if (err != NULL) {
+			json_free(root);
+			http_reply(request->connection, 400, err);
+			return (0);
+		}
+		c.path = strdup(p);
+		AN(c.path);
+		json_free(root);
+		AZ(pthread_mutex_lock(&vbackends->lck));
+		free(vbackends->config.path);
+		vbackends->config = c;
+		AZ(pthread_mutex_unlock(&vbackends->lck));
+		logger(vbackends->logger, "Probing backends every %us",
+		    c.interval);
+	} else if (request->method == M_DELETE) {
+		AZ(pthread_mutex_lock(&vbackends->lck));
+		vbackends->config.enabled = 0;
+		AZ(pthread_mutex_unlock(&vbackends->lck));
+		logger(vbackends->logger, "Stopped probing backends");
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	AZ(pthread_mutex_lock(&vbackends->lck));
+	probe_json(vsb, vbackends);
+	AZ(pthread_mutex_unlock(&vbackends->lck));
+	AZ(VSB_finish(vsb));
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (0);
+}
+
 void
 vbackends_init(struct agent_core_t *core)
 {
@@ -192,10 +824,15 @@ vbackends_init(struct agent_core_t *core)
 
 	priv->logger = ipc_register(core,"logger");
 	priv->vadmin = ipc_register(core,"vadmin");
+	priv->tvadmin = ipc_register(core,"vadmin");
+	AZ(pthread_mutex_init(&priv->lck, NULL));
 	plug->data = (void *)priv;
+	plug->start = vbackends_start;
 	http_register_path(core, "/backend", M_PUT, vbackends_reply, core);
 	http_register_path(core, "/backendjson", M_GET,
 			vbackends_json_reply, core);
+	http_register_path(core, "/backendprobe", M_GET | M_PUT | M_DELETE,
+	    vbackends_probe_reply, core);
 	http_register_path(core, "/help/backend", M_GET,
 	    help_reply, strdup(BACKENDS_HELP));
 }
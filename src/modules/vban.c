@@ -26,16 +26,31 @@
  * SUCH DAMAGE.
  */
 
-
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <vapi/vsm.h>
+#include <vapi/vsc.h>
 
 #include "common.h"
+#include "events.h"
 #include "http.h"
 #include "helpers.h"
+#include "instance.h"
 #include "ipc.h"
+#include "json.h"
 #include "plugins.h"
+#include "vsb.h"
 
 
 /*
@@ -49,19 +64,670 @@
 	"POST /ban - with request body. Uses request body for a literal ban\n" \
 	"POST /ban/foo - without request body. Uses the url-part after \"/ban\" to\n" \
 	"                ban using " BAN_SHORTHAND " url. E.g: POST /ban/foo: \n" \
-	"                ban " BAN_SHORTHAND "/foo\n"
+	"                ban " BAN_SHORTHAND "/foo\n" \
+	"\n" \
+	"With -L, bans on req.url and req.http.host are rewritten to\n" \
+	"obj.http.x-url and obj.http.x-host, which the ban lurker can test\n" \
+	"in the background, as long as the active VCL sets those headers.\n" \
+	"GET /banlurker - is the active VCL ready for it?\n" \
+	"GET /banlurker/vcl - a VCL snippet that sets the headers\n" \
+	"\n" \
+	"With -j, bans are kept in a journal, " BAN_JOURNAL " in the\n" \
+	"persistence directory, and the ones younger than default_ttl +\n" \
+	"default_grace + default_keep are banned again when the varnishd\n" \
+	"child restarts. A ban identical to one added less than\n" \
+	"BAN_RETRY seconds ago and still active is taken for a retry and\n" \
+	"not added again.\n"
+
+/*
+ * The ban journal. Every ban we add is appended as
+ *
+ *	<time> <hash> <expression>
+ *
+ * and when varnishd comes back after a restart (we see the vadmin
+ * connection come back, or the child state go to running), the thread
+ * replays the bans that can still match a cached object, newest copy of
+ * each expression only. Objects fetched after the original ban but
+ * before the restart are banned as well; that errs on the safe side.
+ *
+ * Either can happen without the child restarting, or both for the same
+ * restart, so the thread only replays when MAIN.uptime says the child
+ * started since it last looked. Without a shmlog to tell, it replays
+ * what isn't in ban.list already.
+ */
+#define BAN_JOURNAL "ban.journal"
+
+/*
+ * With -j, the hashes of the last BAN_RECENT bans we added. A new ban
+ * with the hash of one of them is checked against ban.list, and only
+ * dropped if the same expression is active there and was added less
+ * than BAN_RETRY seconds ago: a client retrying. Any later repeat is
+ * added, as the older ban does not cover objects fetched since.
+ */
+#define BAN_RECENT	64
+#define BAN_RETRY	5
+
+struct vban_recent_t {
+	uint64_t hash;
+	double t;
+};
+
+struct vban_entry_t {
+	intmax_t t;
+	uint64_t hash;
+	char *expr;
+	size_t idx;
+};
+
+/*
+ * Lurker-friendly bans. The lurker can only test bans that look at the
+ * object, so with -L we ban on copies of the URL and host stored with the
+ * object. BAN_LURKER_VCL stores them; it only bans correctly if the
+ * active VCL includes it, which we check with vcl.show.
+ */
+#define BAN_LURKER_SHORTHAND "obj.http.x-url ~ "
+#define BAN_LURKER_VCL \
+	"sub vcl_backend_response {\n" \
+	"\tset beresp.http.x-url = bereq.url;\n" \
+	"\tset beresp.http.x-host = bereq.http.host;\n" \
+	"}\n" \
+	"\n" \
+	"sub vcl_deliver {\n" \
+	"\tunset resp.http.x-url;\n" \
+	"\tunset resp.http.x-host;\n" \
+	"}\n"
 
 struct vban_priv_t {
 	int logger;
+	int tlogger;		// The thread
 	int vadmin;
+	/* The VCL we last checked for BAN_LURKER_VCL */
+	int lurker_instance;
+	char *lurker_vcl;
+	int lurker_ready;
+	/* Journal */
+	int tvadmin;
+	pthread_mutex_t lck;	// The file and replay
+	int *replay;		// Per instance
+	double *started;	// Per instance, the child, thread only
+	int ninstances;
+	/* Retries, HTTP callbacks only */
+	struct vban_recent_t recent[BAN_RECENT];
+	unsigned nrecent;
 };
 
+/*
+ * FNV-1a.
+ */
+static double
+vban_now(void)
+{
+	struct timeval tv;
+
+	AZ(gettimeofday(&tv, NULL));
+	return (tv.tv_sec + tv.tv_usec * 1e-6);
+}
+
+static uint64_t
+vban_hash(const char *expr)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (; *expr != '\0'; expr++) {
+		h ^= (unsigned char)*expr;
+		h *= 0x100000001b3ULL;
+	}
+	return (h);
+}
+
+/*
+ * Is expr in list, the answer to ban.list, and not completed? ban.list
+ * has a header, then one line per ban, with the time it was added, a
+ * flag ("C" for completed, else "-") and the expression, with or without
+ * the address in front:
+ *
+ * 0x7f1f2e01c0c0 1389450012.474542     2 -  req.url ~ /foo
+ *
+ * Returns the time of the newest match, 0 if none.
+ */
+static double
+vban_listed(const char *list, const char *expr)
+{
+	const char *line, *e, *end;
+	size_t l = strlen(expr);
+	double t, found = 0;
+	char *p;
+
+	for (line = strchr(list, '\n'); line != NULL; line = end) {
+		line++;
+		end = strchr(line, '\n');
+		if (end == NULL)
+			end = line + strlen(line);
+		for (e = line; e < end; e++)
+			if ((*e == 'C' || *e == '-') && e > line &&
+			    e[-1] == ' ' && (e + 1 == end || e[1] == ' '))
+				break;
+		if (e < end && *e++ == '-') {
+			while (e < end && *e == ' ')
+				e++;
+			if (end - e == l && !strncmp(e, expr, l)) {
+				p = (char *)line;
+				if (!strncmp(p, "0x", 2))
+					p += strcspn(p, " ");
+				t = strtod(p, NULL);
+				if (t <= 0)
+					t = 1;	// Listed, at no time we know
+				if (t > found)
+					found = t;
+			}
+		}
+		if (*end == '\0')
+			break;
+	}
+	return (found);
+}
+
+/*
+ * Is expr a retry of a ban we added less than BAN_RETRY seconds ago?
+ * Only asks ban.list when the hash says it might be.
+ */
+static int
+vban_retry(struct vban_priv_t *vban, const char *expr)
+{
+	struct ipc_ret_t vret;
+	uint64_t h = vban_hash(expr);
+	double now = vban_now(), t = 0;
+	unsigned u;
+
+	for (u = 0; u < BAN_RECENT; u++)
+		if (vban->recent[u].t > 0 && vban->recent[u].hash == h &&
+		    now - vban->recent[u].t <= BAN_RETRY)
+			break;
+	if (u == BAN_RECENT)
+		return (0);
+	ipc_run(vban->vadmin, &vret, "ban.list");
+	if (vret.status == 200)
+		t = vban_listed(vret.answer, expr);
+	free(vret.answer);
+	return (t > 0 && now - t <= BAN_RETRY);
+}
+
+static void
+vban_recent(struct vban_priv_t *vban, const char *expr)
+{
+	struct vban_recent_t *r;
+
+	r = &vban->recent[vban->nrecent++ % BAN_RECENT];
+	r->hash = vban_hash(expr);
+	r->t = vban_now();
+}
+
+static char *
+vban_journal_path(struct agent_core_t *core)
+{
+	char *path;
+
+	assert(0 < asprintf(&path, "%s/" BAN_JOURNAL,
+	    instance_get(core)->p_arg));
+	return (path);
+}
+
+static void
+vban_journal(struct agent_core_t *core, struct vban_priv_t *vban,
+    const char *expr)
+{
+	char *path;
+	FILE *f;
+
+	path = vban_journal_path(core);
+	AZ(pthread_mutex_lock(&vban->lck));
+	f = fopen(path, "a");
+	if (f == NULL)
+		warnlog(vban->logger, "Cannot open %s: %s", path,
+		    strerror(errno));
+	else {
+		fprintf(f, "%jd %016" PRIx64 " %s\n", (intmax_t)time(NULL),
+		    vban_hash(expr), expr);
+		if (fclose(f))
+			warnlog(vban->logger, "Cannot write %s: %s", path,
+			    strerror(errno));
+	}
+	AZ(pthread_mutex_unlock(&vban->lck));
+	free(path);
+}
+
+/*
+ * How long an object can stay in cache unless VCL says otherwise.
+ */
+static double
+vban_max_ttl(struct vban_priv_t *vban)
+{
+	static const char * const params[] = {
+		"default_ttl", "default_grace", "default_keep", NULL };
+	struct ipc_ret_t vret;
+	const char * const *pp;
+	double ttl = 0, v;
+	char *p;
+
+	for (pp = params; *pp != NULL; pp++) {
+		ipc_run(vban->tvadmin, &vret, "param.show %s", *pp);
+		if (vret.status == 200 &&
+		    (p = strstr(vret.answer, "Value is: ")) != NULL &&
+		    sscanf(p + 10, "%lf", &v) == 1)
+			ttl += v;
+		free(vret.answer);
+	}
+	return (ttl);
+}
+
+static int
+vban_entry_cmp(const void *a, const void *b)
+{
+	const struct vban_entry_t *x = a, *y = b;
+
+	if (x->hash != y->hash)
+		return (x->hash < y->hash ? -1 : 1);
+	return (x->idx < y->idx ? -1 : x->idx > y->idx);
+}
+
+static int
+vban_entry_idx_cmp(const void *a, const void *b)
+{
+	const struct vban_entry_t *x = a, *y = b;
+
+	return (x->idx < y->idx ? -1 : x->idx > y->idx);
+}
+
+/*
+ * Drop the bans that are too old or repeated later from the journal,
+ * then ban what is left and not in ban.list again.
+ */
+static void
+vban_replay(struct agent_core_t *core, struct vban_priv_t *vban)
+{
+	struct vban_entry_t *ents = NULL;
+	struct ipc_ret_t vret, list;
+	size_t n = 0, space = 0, i, j, l = 0;
+	char *path, *tmp, *line = NULL, *p, nbuf[32];
+	intmax_t now = time(NULL), max;
+	unsigned replayed = 0;
+	FILE *f;
+
+	max = vban_max_ttl(vban);
+	path = vban_journal_path(core);
+	assert(0 < asprintf(&tmp, "%s.tmp", path));
+	AZ(pthread_mutex_lock(&vban->lck));
+	f = fopen(path, "r");
+	if (f != NULL) {
+		while (getline(&line, &l, f) > 0) {
+			line[strcspn(line, "\n")] = '\0';
+			if (n == space) {
+				space = space ? 2 * space : 16;
+				ents = realloc(ents, space * sizeof *ents);
+				AN(ents);
+			}
+			ents[n].t = strtoimax(line, &p, 10);
+			ents[n].hash = strtoull(p, &p, 16);
+			if (*p++ != ' ' || now - ents[n].t > max)
+				continue;
+			ents[n].expr = strdup(p);
+			AN(ents[n].expr);
+			ents[n].idx = n;
+			n++;
+		}
+		free(line);
+		fclose(f);
+	}
+
+	/* Keep the last copy of each expression */
+	qsort(ents, n, sizeof *ents, vban_entry_cmp);
+	for (i = j = 0; i < n; i++) {
+		if (i + 1 < n && ents[i + 1].hash == ents[i].hash &&
+		    !strcmp(ents[i + 1].expr, ents[i].expr)) {
+			free(ents[i].expr);
+			continue;
+		}
+		ents[j++] = ents[i];
+	}
+	n = j;
+	qsort(ents, n, sizeof *ents, vban_entry_idx_cmp);
+
+	f = fopen(tmp, "w");
+	if (f != NULL) {
+		for (i = 0; i < n; i++)
+			fprintf(f, "%jd %016" PRIx64 " %s\n", ents[i].t,
+			    ents[i].hash, ents[i].expr);
+		if (fclose(f) || rename(tmp, path))
+			warnlog(vban->tlogger, "Cannot write %s: %s", path,
+			    strerror(errno));
+	} else
+		warnlog(vban->tlogger, "Cannot open %s: %s", tmp,
+		    strerror(errno));
+	AZ(pthread_mutex_unlock(&vban->lck));
+
+	ipc_run(vban->tvadmin, &list, "ban.list");
+	for (i = 0; i < n; i++) {
+		if (list.status == 200 && vban_listed(list.answer,
+		    ents[i].expr) > 0) {
+			free(ents[i].expr);
+			continue;
+		}
+		ipc_run(vban->tvadmin, &vret, "ban %s", ents[i].expr);
+		if (vret.status == 200)
+			replayed++;
+		else
+			warnlog(vban->tlogger, "Replaying ban %s failed: %s",
+			    ents[i].expr, vret.answer);
+		free(vret.answer);
+		free(ents[i].expr);
+	}
+	free(list.answer);
+	free(ents);
+	free(tmp);
+	free(path);
+	if (n > 0) {
+		logger(vban->tlogger, "Replayed %u of %zu bans for %s",
+		    replayed, n, instance_get(core)->name);
+		snprintf(nbuf, sizeof nbuf, "%u", replayed);
+		events_publish(core, "ban.replay", "instance",
+		    instance_get(core)->name, "bans", nbuf, NULL);
+	}
+}
+
+/*
+ * Runs with the bus locked: only take note, the thread does the work.
+ */
+static void
+vban_event(const struct event_t *ev, void *priv)
+{
+	struct agent_core_t *core = priv;
+	struct vban_priv_t *vban;
+	struct json_t *root;
+	const char *err, *name;
+	int i = -1;
+
+	GET_PRIV(core, vban);
+	if (!strcmp(ev->type, "child")) {
+		if (strstr(ev->data, "\"state\": \"Child in state running"))
+			i = 0;
+	} else if (!strcmp(ev->type, "vadmin.reconnect")) {
+		root = json_parse(ev->data, &err);
+		name = json_get_string(root, "instance");
+		if (name != NULL)
+			i = instance_find(core, name, strlen(name));
+		json_free(root);
+	}
+	if (i >= 0 && i < vban->ninstances) {
+		AZ(pthread_mutex_lock(&vban->lck));
+		vban->replay[i] = 1;
+		AZ(pthread_mutex_unlock(&vban->lck));
+	}
+}
+
+static int
+vban_uptime_cb(void *priv, const struct VSC_point * const pt)
+{
+	double *uptime = priv;
+
+	if (pt == NULL || strcmp(pt->section->fantom->type, "MAIN") ||
+	    strcmp(pt->desc->name, "uptime"))
+		return (0);
+	*uptime = *(const volatile uint64_t *)pt->ptr;
+	return (1);
+}
+
+/*
+ * When the child of the current instance started, or 0 if the shmlog
+ * can't tell.
+ */
+static double
+vban_child_started(struct agent_core_t *core)
+{
+	struct VSM_data *vsm;
+	double uptime = -1;
+
+	vsm = VSM_New();
+	AN(vsm);
+	if (VSM_n_Arg(vsm, instance_get(core)->n_arg) == 1 &&
+	    !VSM_Open(vsm))
+		(void)VSC_Iter(vsm, NULL, vban_uptime_cb, &uptime);
+	VSM_Delete(vsm);
+	return (uptime < 0 ? 0 : time(NULL) - uptime);
+}
+
+/*
+ * The ping makes vadmin notice when a varnishd went away, so we replay
+ * the bans soon after it comes back. MAIN.uptime is only updated every
+ * second or so, hence the slack.
+ */
+static void *
+vban_run(void *data)
+{
+	struct agent_core_t *core = data;
+	struct vban_priv_t *vban;
+	struct ipc_ret_t vret;
+	double started;
+	int i, replay;
+
+	GET_PRIV(core, vban);
+	for (i = 0; i < vban->ninstances; i++) {
+		instance_select(i);
+		vban->started[i] = vban_child_started(core);
+	}
+	for (;;) {
+		sleep(1);
+		for (i = 0; i < vban->ninstances; i++) {
+			instance_select(i);
+			ipc_run(vban->tvadmin, &vret, "ping");
+			free(vret.answer);
+			AZ(pthread_mutex_lock(&vban->lck));
+			replay = vban->replay[i];
+			vban->replay[i] = 0;
+			AZ(pthread_mutex_unlock(&vban->lck));
+			if (!replay)
+				continue;
+			started = vban_child_started(core);
+			if (started == 0 ||
+			    fabs(started - vban->started[i]) > 2) {
+				vban_replay(core, vban);
+				vban->started[i] = started;
+			} else
+				debuglog(vban->tlogger, "%s: child did not "
+				    "restart, no bans replayed",
+				    instance_get(core)->name);
+		}
+	}
+	return (NULL);
+}
+
+static void *
+vban_start(struct agent_core_t *core, const char *name)
+{
+	pthread_t *thread;
+
+	(void)name;
+
+	ALLOC_OBJ(thread);
+	AZ(pthread_create(thread, NULL, vban_run, core));
+	return (thread);
+}
+
+/*
+ * Does the active VCL set x-url and x-host? Sets *vcl to its name.
+ */
+static int
+vban_lurker_ready(struct vban_priv_t *vban, char **vcl)
+{
+	struct ipc_ret_t vret;
+	char *line, *last = NULL, *p, *name = NULL;
+
+	*vcl = NULL;
+	ipc_run(vban->vadmin, &vret, "vcl.list");
+	if (vret.status == 200)
+		for (p = vret.answer; (line = strtok_r(p, "\n", &last));
+		    p = NULL)
+			if (STARTS_WITH(line, "active")) {
+				p = strrchr(line, ' ');
+				name = strdup(p ? p + 1 : line);
+				break;
+			}
+	free(vret.answer);
+	if (name == NULL)
+		return (0);
+	*vcl = name;
+	if (vban->lurker_vcl != NULL &&
+	    vban->lurker_instance == instance_current() &&
+	    !strcmp(vban->lurker_vcl, name))
+		return (vban->lurker_ready);
+
+	ipc_run(vban->vadmin, &vret, "vcl.show %s", name);
+	if (vret.status != 200) {
+		free(vret.answer);
+		return (0);
+	}
+	free(vban->lurker_vcl);
+	vban->lurker_vcl = strdup(name);
+	AN(vban->lurker_vcl);
+	vban->lurker_instance = instance_current();
+	vban->lurker_ready =
+	    strcasestr(vret.answer, "beresp.http.x-url") != NULL &&
+	    strcasestr(vret.answer, "beresp.http.x-host") != NULL;
+	free(vret.answer);
+	if (!vban->lurker_ready)
+		warnlog(vban->logger, "VCL %s does not set x-url and x-host,"
+		    " bans will use req.url. See /banlurker/vcl.", name);
+	return (vban->lurker_ready);
+}
+
+/*
+ * The end of the ban word at p: a quoted string, escapes and all, or up
+ * to the next space. NULL if a quote isn't closed.
+ */
+static const char *
+vban_word(const char *p)
+{
+
+	if (*p == '"') {
+		for (p++; *p != '"'; p++) {
+			if (*p == '\0')
+				return (NULL);
+			if (*p == '\\' && p[1] != '\0')
+				p++;
+		}
+		return (p + 1);
+	}
+	while (*p != '\0' && !isspace((unsigned char)*p))
+		p++;
+	return (p);
+}
+
+/*
+ * Rewrite the req.url and req.http.host fields of the conditions in
+ * expr, "field op arg [&& field op arg ...]", to their obj.http copies.
+ * Arguments are copied as they are, even if they mention req.
+ *
+ * Returns NULL if another field of req is left, since the lurker could
+ * not test that anyway, or if expr doesn't parse; varnishd gets it as it
+ * is then.
+ */
+static char *
+vban_lurker_expr(const char *expr)
+{
+	struct vsb *vsb;
+	const char *p = expr, *q;
+	char *ret = NULL;
+	int i;
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	for (;;) {
+		for (i = 0; i < 3; i++) {
+			for (q = p; isspace((unsigned char)*q); q++)
+				continue;
+			VSB_bcat(vsb, p, q - p);
+			p = q;
+			if (*p == '\0' || (q = vban_word(p)) == NULL)
+				goto out;
+			if (i > 0)
+				VSB_bcat(vsb, p, q - p);
+			else if (q - p == 7 && !strncmp(p, "req.url", 7))
+				VSB_cat(vsb, "obj.http.x-url");
+			else if (q - p == 13 &&
+			    !strncasecmp(p, "req.http.host", 13))
+				VSB_cat(vsb, "obj.http.x-host");
+			else if (!strncmp(p, "req.", 4) || *p == '"')
+				goto out;
+			else
+				VSB_bcat(vsb, p, q - p);
+			p = q;
+		}
+		for (q = p; isspace((unsigned char)*q); q++)
+			continue;
+		VSB_bcat(vsb, p, q - p);
+		p = q;
+		if (*p == '\0')
+			break;
+		if (strncmp(p, "&&", 2) || !isspace((unsigned char)p[2]))
+			goto out;
+		VSB_cat(vsb, "&&");
+		p += 2;
+	}
+	AZ(VSB_finish(vsb));
+	ret = strdup(VSB_data(vsb));
+	AN(ret);
+out:
+	VSB_delete(vsb);
+	return (ret);
+}
+
+static unsigned int
+vban_lurker_reply(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct vban_priv_t *vban;
+	struct http_response *resp;
+	struct vsb *vsb;
+	char *vcl;
+	int ready;
+
+	GET_PRIV(core, vban);
+	if (arg != NULL) {
+		if (strcmp(arg, "vcl")) {
+			http_reply(request->connection, 404, "Not found");
+			return (0);
+		}
+		http_reply(request->connection, 200, BAN_LURKER_VCL);
+		return (0);
+	}
+	ready = vban_lurker_ready(vban, &vcl);
+	vsb = VSB_new_auto();
+	AN(vsb);
+	VSB_printf(vsb, "{\n\t\"enabled\": %s,\n\t\"vcl\": ",
+	    core->config->L_arg ? "true" : "false");
+	if (vcl != NULL)
+		json_quote(vsb, vcl, -1);
+	else
+		VSB_cat(vsb, "null");
+	VSB_printf(vsb, ",\n\t\"ready\": %s\n}\n",
+	    ready ? "true" : "false");
+	AZ(VSB_finish(vsb));
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	free(vcl);
+	return (0);
+}
+
 static unsigned int
 vban_reply(struct http_request *request, const char *arg, void *data)
 {
 	struct agent_core_t *core = data;
 	struct vban_priv_t *vban;
-	char *body;
+	char *body, *expr = NULL, *lurker = NULL, *vcl;
 	char *mark;
 
 	GET_PRIV(core, vban);
@@ -76,17 +742,38 @@ vban_reply(struct http_request *request, const char *arg, void *data)
 	mark = strchr(body,'\n');
 	if (mark)
 		*mark = '\0';
-	if (!arg)
-		run_and_respond(vban->vadmin, request->connection, "ban %s", body);
-	else {
+	if (core->config->L_arg && vban_lurker_ready(vban, &vcl))
+		lurker = arg ? strdup(BAN_LURKER_SHORTHAND) :
+		    vban_lurker_expr(body);
+	else
+		vcl = NULL;
+	free(vcl);
+	if (!arg) {
+		expr = lurker ? lurker : strdup(body);
+		lurker = NULL;
+	} else {
 		const char *path = request->url + strlen("/ban");
 		if (request->bodylen != 0) {
 			http_reply(request->connection, 500, "Banning with both a url and request body? Pick one or the other please.");
 		} else {
 			assert(request->bodylen == 0);
-			run_and_respond(vban->vadmin, request->connection, "ban " BAN_SHORTHAND "/%s",path);
+			AN(asprintf(&expr, "%s/%s",
+			    lurker ? lurker : BAN_SHORTHAND, path));
 		}
 	}
+	free(lurker);
+	if (expr && core->config->j_arg && vban_retry(vban, expr))
+		http_reply(request->connection, 200,
+		    "Retry of a ban just added, not added again");
+	else if (expr && run_and_respond(vban->vadmin, request->connection,
+	    "ban %s", expr) == 200) {
+		if (core->config->j_arg) {
+			vban_journal(core, vban, expr);
+			vban_recent(vban, expr);
+		}
+		events_publish(core, "ban", "expression", expr, NULL);
+	}
+	free(expr);
 	free(body);
 
 	return 0;
@@ -101,8 +788,21 @@ vban_init(struct agent_core_t *core)
 	ALLOC_OBJ(priv);
 	plug = plugin_find(core,"vban");
 	priv->logger = ipc_register(core,"logger");
+	priv->tlogger = ipc_register(core,"logger");
 	priv->vadmin = ipc_register(core,"vadmin");
+	priv->tvadmin = ipc_register(core,"vadmin");
+	AZ(pthread_mutex_init(&priv->lck, NULL));
+	priv->ninstances = core->config->ninstances;
+	priv->replay = calloc(priv->ninstances, sizeof *priv->replay);
+	AN(priv->replay);
+	priv->started = calloc(priv->ninstances, sizeof *priv->started);
+	AN(priv->started);
 	plug->data = (void *)priv;
+	if (core->config->j_arg) {
+		plug->start = vban_start;
+		events_subscribe(core, vban_event, core);
+	}
 	http_register_path(core, "/ban", M_GET | M_POST, vban_reply, core);
+	http_register_path(core, "/banlurker", M_GET, vban_lurker_reply, core);
 	http_register_path(core, "/help/ban", M_GET, help_reply, strdup(BAN_HELP_TEXT));
 }
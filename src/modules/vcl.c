@@ -41,10 +41,13 @@
 #include <fcntl.h>
 
 #include "common.h"
+#include "events.h"
 #include "ipc.h"
 #include "http.h"
 #include "helpers.h"
+#include "instance.h"
 #include "plugins.h"
+#include "vcl_lint.h"
 #include "vsb.h"
 
 #define ID_LEN	256
@@ -72,14 +75,19 @@ mk_help(struct agent_core_t *core, struct vcl_priv_t *vcl)
 		"PUT /vcl/vclname - Upload a new VCL with the specified name.\n"
 		"DELETE /vcl/vclname - Discard a named VCL (vcl.discard)\n"
 		"GET /vclactive/ - Get the name of the active vcl config\n"
-		"PUT /vcldeploy/vclname - Deploy the vcl (e.g: vcl.use)\n\n"
+		"PUT /vcldeploy/vclname - Deploy the vcl (e.g: vcl.use)\n"
+		"POST /vcl/lint - Check a VCL for patterns that hurt hit ratio\n"
+		"                 or CPU, without storing it\n\n"
 		"VCL is saved to '%s/<name>.auto.vcl'.\n"
 		"A successful vcl.deploy through the agent will update\n"
 		"'%s/boot.vcl'\n"
 		"That way, you can start varnishd with the most recent VCL\n"
 		"by using:\n"
-		"\"varnishd (...) -f %s/boot.vcl\"\n",
-		core->config->p_arg, core->config->p_arg, core->config->p_arg));
+		"\"varnishd (...) -f %s/boot.vcl\"\n\n"
+		"Instances other than the default one use\n"
+		"'%s/<instance>/' instead.\n",
+		core->config->p_arg, core->config->p_arg, core->config->p_arg,
+		core->config->p_arg));
 }
 
 /*
@@ -91,12 +99,20 @@ vcl_persist(int logfd, const char *id, const char *vcl, struct agent_core_t *cor
 {
 	char tempfile[PATH_MAX];
 	char target[PATH_MAX];
+	const char *dir = instance_get(core)->p_arg;
 	int fd = -1;
 
-	snprintf(target, sizeof(target), "%s/%s.auto.vcl",
-	    core->config->p_arg, id);
-	snprintf(tempfile, sizeof(tempfile), "%s/.tmp.%s.auto.vcl",
-	    core->config->p_arg, id);
+	snprintf(target, sizeof(target), "%s/%s.auto.vcl", dir, id);
+	snprintf(tempfile, sizeof(tempfile), "%s/.tmp.%s.auto.vcl", dir, id);
+
+	/* The directories of the other instances are ours to create. */
+	errno = 0;
+	if (instance_current() != 0 && mkdir(dir, S_IRWXU) < 0 &&
+	    errno != EEXIST) {
+		warnlog(logfd, "Creating directory '%s' failed: %s",
+		    dir, strerror(errno));
+		return (-1);
+	}
 
 	errno = 0;
 	if (unlink(tempfile) < 0 && errno != ENOENT) {
@@ -137,15 +153,15 @@ vcl_persist_active(int logfd, const char *id, struct agent_core_t *core)
 	char active[1024];
 	char active_tmp[1024];
 	struct stat sbuf;
+	const char *dir = instance_get(core)->p_arg;
 	/*
 	 * FIXME: need to move things into place to avoid disaster if we
 	 * crash during update, leaving no active vcl in place.
 	 */
 	errno = 0;
-	snprintf(buf, sizeof buf, "%s/%s.auto.vcl", core->config->p_arg, id);
-	snprintf(active_tmp, sizeof active_tmp, "%s/boot.vcl.tmp",
-	    core->config->p_arg);
-	snprintf(active, sizeof active, "%s/boot.vcl", core->config->p_arg);
+	snprintf(buf, sizeof buf, "%s/%s.auto.vcl", dir, id);
+	snprintf(active_tmp, sizeof active_tmp, "%s/boot.vcl.tmp", dir);
+	snprintf(active, sizeof active, "%s/boot.vcl", dir);
 
 	ret = stat(buf, &sbuf);
 	if (ret < 0) {
@@ -201,7 +217,10 @@ static int
 vcl_store(struct http_request *request, struct vcl_priv_t *vcl,
 	struct ipc_ret_t *vret, struct agent_core_t *core, const char *id)
 {
-	int ret;
+	struct vcl_lint_t *lint;
+	struct vsb *vsb = NULL;
+	char *p;
+	int ret, worst;
 	assert(request->body);
 	if (request->bodylen == 0) {
 		warnlog(vcl->logger, "vcl.inline with ndata == 0");
@@ -218,9 +237,40 @@ vcl_store(struct http_request *request, struct vcl_priv_t *vcl,
 	}
 	const char *end = (((char*)request->body)[request->bodylen-1] == '\n') ? "" : "\n";
 
+	lint = vcl_lint(request->body);
+	if (lint != NULL) {
+		vsb = VSB_new_auto();
+		AN(vsb);
+		worst = vcl_lint_worst(lint);
+		if (core->config->B_arg >= 0 && worst >= core->config->B_arg)
+			VSB_printf(vsb, "VCL refused, lint findings of severity"
+			    " %s or worse:\n", vcl_lint_severity_name(
+			    core->config->B_arg));
+		else
+			VSB_cat(vsb, "\nLint:\n");
+		vcl_lint_text(vsb, lint);
+		AZ(VSB_finish(vsb));
+		vcl_lint_free(lint);
+		if (core->config->B_arg >= 0 &&
+		    worst >= core->config->B_arg) {
+			warnlog(vcl->logger, "VCL %s refused by lint", id);
+			ANSWER(vret, 400, VSB_data(vsb));
+			VSB_delete(vsb);
+			return (400);
+		}
+	}
+
 	ipc_run(vcl->vadmin, vret,
 	    "vcl.inline %s << __EOF_%s__\n%s%s__EOF_%s__",
 	    id, id, (char *)request->body, end, id);
+	if (vret->status == 200 && vsb != NULL) {
+		/* vcl.inline says "VCL compiled.", add the findings */
+		assert(0 < asprintf(&p, "%s%s", vret->answer, VSB_data(vsb)));
+		free(vret->answer);
+		vret->answer = p;
+	}
+	if (vsb != NULL)
+		VSB_delete(vsb);
 	if (vret->status == 200) {
 		logger(vcl->logger, "VCL stored OK");
 		ret = vcl_persist(vcl->logger, id, request->body, core);
@@ -386,12 +436,44 @@ vcl_push(struct http_request *request, const char *arg, void *data)
 		http_reply(request->connection, 400, "Bad URL?");
 	else {
 		status = vcl_store(request, vcl, &vret, core, id);
+		if (status == 201)
+			events_publish(core, "vcl.store", "name", id, NULL);
 		http_reply(request->connection, status, vret.answer);
 		free(vret.answer);
 	}
 	return (0);
 }
 
+static unsigned int
+vcl_lint_reply(struct http_request *request, const char *arg, void *data)
+{
+	struct http_response *resp;
+	struct vcl_lint_t *lint;
+	struct vsb *vsb;
+
+	(void)arg;
+	(void)data;
+
+	if (request->bodylen == 0) {
+		http_reply(request->connection, 400, "No VCL found");
+		return (0);
+	}
+	lint = vcl_lint(request->body);
+	vsb = VSB_new_auto();
+	AN(vsb);
+	vcl_lint_json(vsb, lint);
+	AZ(VSB_finish(vsb));
+	vcl_lint_free(lint);
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (0);
+}
+
 static unsigned int
 vcl_delete(struct http_request *request, const char *arg, void *data)
 {
@@ -407,8 +489,10 @@ vcl_delete(struct http_request *request, const char *arg, void *data)
 	ipc_run(vcl->vadmin, &vret, "vcl.discard %s", arg);
 	if (vret.status == 400 || vret.status == 106)
 		http_reply(request->connection, 500, vret.answer);
-	else
+	else {
+		events_publish(core, "vcl.discard", "name", arg, NULL);
 		http_reply(request->connection, 200, vret.answer);
+	}
 	free(vret.answer);
 	return (0);
 }
@@ -478,8 +562,10 @@ vcl_deploy(struct http_request *request, const char *arg, void *data)
 	assert(request->method == M_PUT);
 
 	ipc_run(vcl->vadmin, &vret, "vcl.use %s", arg);
-	if (vret.status == 200)
+	if (vret.status == 200) {
 		ret = vcl_persist_active(vcl->logger, arg, core);
+		events_publish(core, "vcl.deploy", "name", arg, NULL);
+	}
 	if (vret.status == 200 && ret)
 		http_reply(request->connection, 500,
 		    "Deployed ok, but NOT PERSISTED.");
@@ -507,6 +593,7 @@ vcl_init(struct agent_core_t *core)
 	http_register_path(core, "/vcl", M_GET, vcl_listshow, core);
 	http_register_path(core, "/vcl", M_PUT | M_POST, vcl_push, core);
 	http_register_path(core, "/vcl", M_DELETE, vcl_delete, core);
+	http_register_path(core, "/vcl/lint", M_POST, vcl_lint_reply, core);
 	http_register_path(core, "/vclactive", M_GET , vcl_active, core);
 	http_register_path(core, "/vcldeploy", M_PUT , vcl_deploy, core);
 	http_register_path(core, "/help/vcl", M_GET, help_reply, priv->help);
@@ -51,34 +51,15 @@
 
 #include "common.h"
 #include "http.h"
+#include "instance.h"
 #include "ipc.h"
 #include "plugins.h"
 #include "vsb.h"
+#include "vsl_tail.h"
 
 #include <vapi/vsm.h>
 #include <vapi/vsl.h>
 
-
-/* Borrow these from vsl_dispatch.c */
-static const char * const vsl_t_names[VSL_t__MAX] = {
-	[VSL_t_unknown]	= "unknown",
-	[VSL_t_sess]	= "sess",
-	[VSL_t_req]	= "req",
-	[VSL_t_bereq]	= "bereq",
-	[VSL_t_raw]	= "raw",
-};
-
-static const char * const vsl_r_names[VSL_r__MAX] = {
-	[VSL_r_unknown]	= "unknown",
-	[VSL_r_http_1]	= "HTTP/1",
-	[VSL_r_rxreq]	= "rxreq",
-	[VSL_r_esi]	= "esi",
-	[VSL_r_restart]	= "restart",
-	[VSL_r_pass]	= "pass",
-	[VSL_r_fetch]	= "fetch",
-	[VSL_r_bgfetch]	= "bgfetch",
-};
-
 struct vlog_priv_t {
 	int logger;
 };
@@ -184,7 +165,7 @@ vlog_reply(struct http_request *request, const char *arg, void *data)
 
 	vrp.vsm = VSM_New();
 	assert(vrp.vsm);
-	if (!VSM_n_Arg(vrp.vsm, core->config->n_arg)) {
+	if (!VSM_n_Arg(vrp.vsm, instance_get(core)->n_arg)) {
 		VSB_printf(vrp.answer, "Error in creating shmlog: %s",
 		    VSM_Error(vrp.vsm));
 		VSB_finish(vrp.answer);
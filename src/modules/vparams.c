@@ -43,6 +43,7 @@
 #include <vsb.h>
 
 #include "common.h"
+#include "events.h"
 #include "http.h"
 #include "helpers.h"
 #include "ipc.h"
@@ -417,12 +418,17 @@ vparams_reply(struct http_request *request, const char *arg, void *data)
 		mark = strchr(body,'\n');
 		if (mark)
 			*mark = '\0';
-		if (!strcmp(request->url, "/param/"))
-			run_and_respond(vparams->vadmin, request->connection,
-			    "param.set %s", body);
-		else {
-			run_and_respond(vparams->vadmin, request->connection,
-			    "param.set %s %s", arg, body);
+		if (!strcmp(request->url, "/param/")) {
+			if (run_and_respond(vparams->vadmin,
+			    request->connection, "param.set %s", body) == 200)
+				events_publish(core, "param", "set", body,
+				    NULL);
+		} else {
+			if (run_and_respond(vparams->vadmin,
+			    request->connection, "param.set %s %s", arg,
+			    body) == 200)
+				events_publish(core, "param", "name", arg,
+				    "value", body, NULL);
 		}
 		free(body);
 		return (1);
@@ -32,8 +32,13 @@
  */
 
 #define _GNU_SOURCE
+#include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/types.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fnmatch.h>
+#include <netdb.h>
 #include <stdio.h>
 #include <inttypes.h>
 #include <stdlib.h>
@@ -45,9 +50,14 @@
 #include <vapi/vsc.h>
 #include <pthread.h>
 
+#include "config.h"
+
 #include "common.h"
 #include "http.h"
+#include "instance.h"
 #include "ipc.h"
+#include "json.h"
+#include "peers.h"
 #include "plugins.h"
 #include "vsb.h"
 int cont = 0;
@@ -61,24 +71,142 @@ int creepy_math(void *priv, const struct VSC_point *const pt);
  * pushing. Duplicating curl- and logger- fd's is a no-brainer: That's what
  * it's for. Duplicating *vd and *vsb considerably simplifies things, and
  * will only cause a slight memory-increase.
+ *
+ * There is a *vd per instance, indexed by instance_current().
  */
 struct vstat_thread_ctx_t {
-	struct VSM_data *vd;
+	struct VSM_data **vd;
 	struct vsb *vsb;
 	int curl;
 	int logger;
 };
 
 /*
- * push_url is the only thing requiring a lock.
+ * /cluster/stats: node 0 is us, the others are the peers. last is the
+ * last good /stats/compact of a peer, used when it doesn't answer in
+ * time.
+ */
+struct vstat_node_t {
+	const char *name;
+	char *last;
+	time_t t;
+};
+
+/*
+ * A counter summed over the cluster. prev is the sum of the previous
+ * request, for rates.
+ */
+struct vstat_ctr_t {
+	char *key;
+	int gauge;
+	uint64_t value;
+	uint64_t prev;
+	uint64_t *nodes;
+	struct vstat_ctr_t *next;
+};
+
+struct vstat_cluster_t {
+	struct vstat_node_t *nodes;
+	int nnodes;
+	struct vstat_ctr_t *head;
+	struct vstat_ctr_t **tail;
+	struct vstat_ctr_t *hint;
+	int node;		// Being added
+	double prev_t;
+};
+
+/*
+ * The UDP emitter: StatsD or Graphite plaintext lines, sent by the timer
+ * thread every second, as many lines to a datagram as fit in mtu.
+ * Counters are sent as the change since the previous second, gauges as
+ * they are. prev is the previous value of each counter of an instance,
+ * in the order VSC_Iter() gives them.
+ */
+#define VSTAT_UDP_MTU		1400
+#define VSTAT_UDP_BATCH		64	// Datagrams to a sendmmsg()
+#define VSTAT_UDP_RETRIES	3	// Tries for a datagram before dropping it
+
+struct vstat_udp_prev_t {
+	char *name;
+	uint64_t val;
+};
+
+struct vstat_udp_inst_t {
+	struct vstat_udp_prev_t *prev;
+	unsigned n;
+	unsigned size;
+	double t;
+};
+
+struct vstat_udp_t {
+	pthread_mutex_t lck;
+	int fd;			// -1 when not emitting
+	char *address;
+	int graphite;
+	char *prefix;
+	char **filter;
+	unsigned nfilter;
+	unsigned mtu;
+	struct sockaddr_storage sa;
+	socklen_t salen;
+	struct vstat_udp_inst_t *inst;
+	int ninstances;
+	uint64_t lines;
+	uint64_t packets;
+	uint64_t errors;
+	/* While emitting */
+	struct vstat_udp_inst_t *in;
+	const char *iname;	// Instance name, with more than one
+	unsigned k;
+	time_t now;
+	double dt;
+	struct vsb *buf;
+	size_t *start;		// Of each datagram in buf
+	unsigned npkt;
+	unsigned pktsize;
+};
+
+/*
+ * push_url is the only thing requiring a lock. cluster is only used by
+ * HTTP callbacks, which are serialized. udp has a lock of its own.
  */
 struct vstat_priv_t {
 	struct vstat_thread_ctx_t http;
 	struct vstat_thread_ctx_t timer;
 	char *push_url;
 	pthread_rwlock_t lck;
+	struct vstat_cluster_t cluster;
+	struct vstat_udp_t udp;
+};
+
+/*
+ * A counter summed over all instances for /instances/stats. The
+ * instances list their counters in the same order, so hint is where we
+ * expect the next one to be.
+ */
+struct vstat_sum_t {
+	char *key;
+	char *type;
+	char *ident;
+	char flag;
+	const char *description;
+	uint64_t value;
+	struct vstat_sum_t *next;
+};
+
+struct vstat_sum_ctx_t {
+	struct vstat_sum_t *head;
+	struct vstat_sum_t **tail;
+	struct vstat_sum_t *hint;
 };
 
+static struct VSM_data *
+vstat_vd(struct vstat_thread_ctx_t *ctx)
+{
+
+	return (ctx->vd[instance_current()]);
+}
+
 static int
 do_json_cb(void *priv, const struct VSC_point * const pt)
 {
@@ -185,9 +313,9 @@ static int
 check_reopen(struct vstat_thread_ctx_t *ctx)
 {
 	int ret = 0;
-	if (VSM_Abandoned(ctx->vd)) {
-		VSM_Close(ctx->vd);
-		ret = VSM_Open(ctx->vd) != 0;
+	if (VSM_Abandoned(vstat_vd(ctx))) {
+		VSM_Close(vstat_vd(ctx));
+		ret = VSM_Open(vstat_vd(ctx)) != 0;
 	}
 	if (ret) {
 		logger(ctx->logger, "Failed to open the shmlog");
@@ -195,6 +323,68 @@ check_reopen(struct vstat_thread_ctx_t *ctx)
 	return ret;
 }
 
+static void
+vstat_name(struct vsb *vsb, const struct VSC_point * const pt)
+{
+	const struct VSC_section *sec = pt->section;
+
+	if (sec->fantom->type[0])
+		VSB_printf(vsb, "%s.", sec->fantom->type);
+	if (sec->fantom->ident[0])
+		VSB_printf(vsb, "%s.", sec->fantom->ident);
+	VSB_cat(vsb, pt->desc->name);
+}
+
+struct vstat_compact_t {
+	struct vsb *vsb;
+	int gauges;
+	int n;
+};
+
+static int
+compact_cb(void *priv, const struct VSC_point * const pt)
+{
+	struct vstat_compact_t *c = priv;
+
+	if (pt == NULL)
+		return (0);
+
+	assert(!strcmp(pt->desc->ctype, "uint64_t"));
+	if ((pt->desc->semantics != 'c') != c->gauges)
+		return (0);
+	VSB_printf(c->vsb, "%s\n\t\t\"", c->n++ ? "," : "");
+	vstat_name(c->vsb, pt);
+	VSB_printf(c->vsb, "\": %" PRIu64, *(const volatile uint64_t*)pt->ptr);
+	return (0);
+}
+
+/*
+ * /stats/compact - just the values, counters (that only go up) apart
+ * from gauges. This is what /cluster/stats gets from the peers.
+ */
+static void
+do_compact(struct VSM_data *vd, struct vsb *out_vsb)
+{
+	struct vstat_compact_t c;
+	char time_stamp[20];
+	time_t now;
+
+	now = time(NULL);
+	(void)strftime(time_stamp, 20, "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	VSB_printf(out_vsb, "{\n\t\"timestamp\": \"%s\",\n\t\"counters\": {",
+	    time_stamp);
+	c.vsb = out_vsb;
+	c.gauges = 0;
+	c.n = 0;
+	(void)VSC_Iter(vd, NULL, compact_cb, &c);
+	VSB_cat(out_vsb, "\n\t},\n\t\"gauges\": {");
+	c.gauges = 1;
+	c.n = 0;
+	(void)VSC_Iter(vd, NULL, compact_cb, &c);
+	VSB_cat(out_vsb, "\n\t}\n}\n");
+	assert(VSB_finish(out_vsb) == 0);
+}
+
 static unsigned int
 vstat_reply(struct http_request *request, const char *arg, void *data)
 {
@@ -202,7 +392,6 @@ vstat_reply(struct http_request *request, const char *arg, void *data)
 	struct agent_core_t *core = data;
 	struct http_response *resp;
 
-	(void)arg;
 	GET_PRIV(core, vstat);
 
 	if (check_reopen(&vstat->http)) {
@@ -210,7 +399,10 @@ vstat_reply(struct http_request *request, const char *arg, void *data)
 		return 0;
 	}
 
-	do_json(vstat->http.vd, vstat->http.vsb);
+	if (arg && !strcmp(arg, "compact"))
+		do_compact(vstat_vd(&vstat->http), vstat->http.vsb);
+	else
+		do_json(vstat_vd(&vstat->http), vstat->http.vsb);
 
 	resp = http_mkresp(request->connection, 200, NULL);
 	resp->data = VSB_data(vstat->http.vsb);
@@ -238,7 +430,7 @@ push_stats(struct vstat_priv_t *vstat, struct vstat_thread_ctx_t *ctx)
 		return -1;
 	}
 
-	do_json(ctx->vd, ctx->vsb);
+	do_json(vstat_vd(ctx), ctx->vsb);
 	ipc_run(ctx->curl, &vret, "%s\n%s",vstat->push_url, VSB_data(ctx->vsb));
 	pthread_rwlock_unlock(&vstat->lck);
 	VSB_clear(ctx->vsb);
@@ -251,6 +443,438 @@ push_stats(struct vstat_priv_t *vstat, struct vstat_thread_ctx_t *ctx)
 	return ret;
 }
 
+static int
+sum_cb(void *priv, const struct VSC_point * const pt)
+{
+	struct vstat_sum_ctx_t *sum = priv;
+	const struct VSC_section *sec;
+	struct vstat_sum_t *s;
+	char *key;
+
+	if (pt == NULL)
+		return (0);
+
+	assert(!strcmp(pt->desc->ctype, "uint64_t"));
+	sec = pt->section;
+	assert(0 < asprintf(&key, "%s%s%s%s%s", sec->fantom->type,
+	    sec->fantom->type[0] ? "." : "", sec->fantom->ident,
+	    sec->fantom->ident[0] ? "." : "", pt->desc->name));
+
+	s = sum->hint;
+	if (s == NULL || strcmp(s->key, key))
+		for (s = sum->head; s != NULL; s = s->next)
+			if (!strcmp(s->key, key))
+				break;
+	if (s == NULL) {
+		ALLOC_OBJ(s);
+		s->key = key;
+		s->type = strdup(sec->fantom->type);
+		s->ident = strdup(sec->fantom->ident);
+		AN(s->type);
+		AN(s->ident);
+		s->flag = pt->desc->semantics;
+		s->description = pt->desc->sdesc;
+		*sum->tail = s;
+		sum->tail = &s->next;
+	} else
+		free(key);
+	s->value += *(const volatile uint64_t*)pt->ptr;
+	sum->hint = s->next;
+	return (0);
+}
+
+/*
+ * GET /instances/stats - the counters of all instances added up, in the
+ * format of /stats. Instances without a readable shmlog are skipped and
+ * listed in "missing".
+ */
+static void
+vstat_sum(struct agent_core_t *core, struct vstat_priv_t *vstat,
+    struct vsb *vsb)
+{
+	struct vstat_sum_ctx_t sum;
+	struct vstat_sum_t *s, *next;
+	char time_stamp[20];
+	time_t now;
+	int i, prev, n = 0, missing = 0;
+
+	memset(&sum, 0, sizeof sum);
+	sum.tail = &sum.head;
+	now = time(NULL);
+	(void)strftime(time_stamp, 20, "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	VSB_printf(vsb, "{\n\t\"timestamp\": \"%s\",\n\t\"missing\": [",
+	    time_stamp);
+
+	prev = instance_current();
+	for (i = 0; i < core->config->ninstances; i++) {
+		instance_select(i);
+		if (check_reopen(&vstat->http)) {
+			VSB_printf(vsb, "%s\"%s\"", missing++ ? ", " : "",
+			    core->config->instances[i].name);
+			continue;
+		}
+		sum.hint = sum.head;
+		(void)VSC_Iter(vstat_vd(&vstat->http), NULL, sum_cb, &sum);
+		n++;
+	}
+	instance_select(prev);
+	VSB_printf(vsb, "],\n\t\"instances\": %d", n);
+
+	for (s = sum.head; s != NULL; s = next) {
+		next = s->next;
+		VSB_printf(vsb, ",\n\t\"%s\": {", s->key);
+		if (s->type[0])
+			VSB_printf(vsb, "\"type\": \"%s\", ", s->type);
+		if (s->ident[0])
+			VSB_printf(vsb, "\"ident\": \"%s\", ", s->ident);
+		VSB_printf(vsb, "\"value\": %" PRIu64 ", ", s->value);
+		VSB_printf(vsb, "\"flag\": \"%c\", ", s->flag);
+		VSB_printf(vsb, "\"description\": \"%s\" }", s->description);
+		free(s->key);
+		free(s->type);
+		free(s->ident);
+		free(s);
+	}
+	VSB_printf(vsb, "\n}\n");
+}
+
+/*
+ * GET /instances lists the instances, /instances/stats sums their
+ * counters.
+ */
+static unsigned int
+vstat_instances(struct http_request *request, const char *arg, void *data)
+{
+	struct vstat_priv_t *vstat;
+	struct agent_core_t *core = data;
+	struct http_response *resp;
+	struct agent_instance_t *inst;
+	struct vsb *vsb;
+	int i;
+
+	GET_PRIV(core, vstat);
+	if (arg != NULL && strcmp(arg, "stats")) {
+		http_reply(request->connection, 404, "No such resource");
+		return (0);
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	if (arg != NULL)
+		vstat_sum(core, vstat, vsb);
+	else {
+		VSB_cat(vsb, "[");
+		for (i = 0; i < core->config->ninstances; i++) {
+			inst = &core->config->instances[i];
+			VSB_printf(vsb, "%s\n  {\"name\": \"%s\", "
+			    "\"default\": %s, \"url\": \"/i/%s/\", "
+			    "\"n\": \"%s\"}",
+			    i ? "," : "", inst->name, i ? "false" : "true",
+			    inst->name, inst->n_arg);
+		}
+		VSB_cat(vsb, "\n]\n");
+	}
+	AZ(VSB_finish(vsb));
+
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (0);
+}
+
+/*
+ * Add value to the counter key of the node being added.
+ */
+static void
+cluster_add(struct vstat_cluster_t *cl, const char *key, int gauge,
+    uint64_t value)
+{
+	struct vstat_ctr_t *c;
+
+	c = cl->hint;
+	if (c == NULL || strcmp(c->key, key))
+		for (c = cl->head; c != NULL; c = c->next)
+			if (!strcmp(c->key, key))
+				break;
+	if (c == NULL) {
+		ALLOC_OBJ(c);
+		c->key = strdup(key);
+		AN(c->key);
+		c->nodes = calloc(cl->nnodes, sizeof *c->nodes);
+		AN(c->nodes);
+		*cl->tail = c;
+		cl->tail = &c->next;
+	}
+	c->gauge = gauge;
+	c->value += value;
+	c->nodes[cl->node] += value;
+	cl->hint = c->next;
+}
+
+static int
+cluster_cb(void *priv, const struct VSC_point * const pt)
+{
+	struct vstat_cluster_t *cl = priv;
+	struct vsb *vsb;
+
+	if (pt == NULL)
+		return (0);
+
+	assert(!strcmp(pt->desc->ctype, "uint64_t"));
+	vsb = VSB_new_auto();
+	AN(vsb);
+	vstat_name(vsb, pt);
+	AZ(VSB_finish(vsb));
+	cluster_add(cl, VSB_data(vsb), pt->desc->semantics != 'c',
+	    *(const volatile uint64_t*)pt->ptr);
+	VSB_delete(vsb);
+	return (0);
+}
+
+/*
+ * Add a /stats/compact reply. Returns -1 if it doesn't look like one.
+ */
+static int
+cluster_parse(struct vstat_cluster_t *cl, const char *body)
+{
+	struct json_t *root, *m;
+	uintmax_t v;
+	char *end;
+	int gauge;
+
+	root = json_parse(body, NULL);
+	if (root == NULL || root->type != JSON_OBJECT ||
+	    json_get(root, "counters") == NULL) {
+		json_free(root);
+		return (-1);
+	}
+	cl->hint = cl->head;
+	for (gauge = 0; gauge < 2; gauge++) {
+		m = json_get(root, gauge ? "gauges" : "counters");
+		if (m == NULL || m->type != JSON_OBJECT)
+			continue;
+		for (m = m->child; m != NULL; m = m->next) {
+			/* Not through the double, counters go past 2^53. */
+			if (m->type != JSON_NUMBER ||
+			    !isdigit((unsigned char)*m->string))
+				continue;
+			v = strtoumax(m->string, &end, 10);
+			if (*end == '\0')
+				cluster_add(cl, m->key, gauge, v);
+		}
+	}
+	json_free(root);
+	return (0);
+}
+
+static void
+cluster_node_json(struct vsb *vsb, const struct vstat_node_t *node,
+    const char *state, double ms, const char *error, time_t now)
+{
+
+	VSB_cat(vsb, "\n\t\t{\"node\": ");
+	json_quote(vsb, node->name, -1);
+	VSB_printf(vsb, ", \"state\": \"%s\", \"ms\": %.1f", state, ms);
+	if (node->t)
+		VSB_printf(vsb, ", \"age\": %ld", (long)(now - node->t));
+	if (error) {
+		VSB_cat(vsb, ", \"error\": ");
+		json_quote(vsb, error, -1);
+	}
+	VSB_cat(vsb, "}");
+}
+
+/*
+ * Asking the peers for /cluster/stats, off the HTTP lock.
+ */
+struct vstat_cluster_job_t {
+	struct agent_core_t *core;
+	long timeout;
+	struct peer_reply_t *replies;
+};
+
+static void
+vstat_cluster_run(void *priv)
+{
+	struct vstat_cluster_job_t *job = priv;
+
+	job->replies = peers_run(job->core, "GET", "/stats/compact", NULL,
+	    job->timeout);
+}
+
+static void
+vstat_cluster_free(void *priv)
+{
+	struct vstat_cluster_job_t *job = priv;
+
+	peers_free(job->replies, peers_count(job->core));
+	free(job);
+}
+
+/*
+ * GET /cluster/stats - the counters of this agent and its peers, summed,
+ * per node and with rates since the previous request.
+ *
+ * The peers have ?timeout=<ms> (default: -w) to send their
+ * /stats/compact, asked without holding up other requests, see
+ * http_defer(). For those that don't, the last good reply is used and
+ * the node is "stale", or "missing" if there is none. Either way, the
+ * reply is marked partial and no rates are computed.
+ */
+static unsigned int
+vstat_cluster(struct http_request *request, const char *arg, void *data)
+{
+	struct vstat_priv_t *vstat;
+	struct agent_core_t *core = data;
+	struct vstat_cluster_t *cl;
+	struct vstat_ctr_t *c;
+	struct vstat_cluster_job_t *job;
+	struct peer_reply_t *replies;
+	struct http_response *resp;
+	struct timespec ts;
+	struct vsb *vsb;
+	const char *p, **state;
+	char time_stamp[20];
+	long timeout = core->config->w_arg * 1000;
+	time_t now;
+	double t;
+	int i, j, partial = 0, gauge;
+
+	(void)arg;
+	GET_PRIV(core, vstat);
+	cl = &vstat->cluster;
+	job = http_deferred(request);
+	if (job == NULL) {
+		p = http_get_arg(request->connection, "timeout");
+		if (p != NULL && atol(p) > 0)
+			timeout = atol(p);
+		ALLOC_OBJ(job);
+		job->core = core;
+		job->timeout = timeout;
+		if (http_defer(request, vstat_cluster_run, vstat_cluster_free,
+		    job))
+			return (0);
+		vstat_cluster_run(job);
+	}
+	replies = job->replies;
+
+	if (cl->nodes == NULL) {
+		cl->nnodes = 1 + peers_count(core);
+		cl->nodes = calloc(cl->nnodes, sizeof *cl->nodes);
+		AN(cl->nodes);
+		cl->nodes[0].name = "local";
+		cl->tail = &cl->head;
+	}
+	state = calloc(cl->nnodes, sizeof *state);
+	AN(state);
+	for (c = cl->head; c != NULL; c = c->next) {
+		c->value = 0;
+		memset(c->nodes, 0, cl->nnodes * sizeof *c->nodes);
+	}
+
+	now = time(NULL);
+	AZ(clock_gettime(CLOCK_MONOTONIC, &ts));
+	t = ts.tv_sec + ts.tv_nsec / 1e9;
+
+	cl->node = 0;
+	cl->hint = cl->head;
+	if (check_reopen(&vstat->http)) {
+		state[0] = "missing";
+		partial = 1;
+	} else {
+		(void)VSC_Iter(vstat_vd(&vstat->http), NULL, cluster_cb, cl);
+		state[0] = "ok";
+	}
+
+	for (i = 1; i < cl->nnodes; i++) {
+		cl->nodes[i].name = replies[i - 1].peer;
+		cl->node = i;
+		if (replies[i - 1].status == 200 &&
+		    !cluster_parse(cl, VSB_data(replies[i - 1].body))) {
+			free(cl->nodes[i].last);
+			cl->nodes[i].last = strdup(VSB_data(replies[i - 1].body));
+			AN(cl->nodes[i].last);
+			cl->nodes[i].t = now;
+			state[i] = "ok";
+			continue;
+		}
+		partial = 1;
+		if (cl->nodes[i].last != NULL &&
+		    !cluster_parse(cl, cl->nodes[i].last))
+			state[i] = "stale";
+		else
+			state[i] = "missing";
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	(void)strftime(time_stamp, 20, "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	VSB_printf(vsb, "{\n\t\"timestamp\": \"%s\",\n\t\"partial\": %s,"
+	    "\n\t\"nodes\": [", time_stamp, partial ? "true" : "false");
+	for (i = 0; i < cl->nnodes; i++) {
+		if (i > 0)
+			VSB_cat(vsb, ",");
+		if (i == 0)
+			cluster_node_json(vsb, &cl->nodes[0], state[0], 0.0,
+			    NULL, now);
+		else
+			cluster_node_json(vsb, &cl->nodes[i], state[i],
+			    replies[i - 1].ms, replies[i - 1].status ?
+			    NULL : replies[i - 1].error, now);
+	}
+	VSB_cat(vsb, "\n\t]");
+
+	for (gauge = 0; gauge < 2; gauge++) {
+		VSB_printf(vsb, ",\n\t\"%s\": {", gauge ? "gauges" : "counters");
+		j = 0;
+		for (c = cl->head; c != NULL; c = c->next) {
+			if (c->gauge != gauge)
+				continue;
+			VSB_printf(vsb, "%s\n\t\t", j++ ? "," : "");
+			json_quote(vsb, c->key, -1);
+			VSB_printf(vsb, ": {\"value\": %" PRIu64, c->value);
+			if (!gauge && !partial && cl->prev_t > 0 &&
+			    c->value >= c->prev && t > cl->prev_t)
+				VSB_printf(vsb, ", \"rate\": %.2f",
+				    (c->value - c->prev) / (t - cl->prev_t));
+			VSB_cat(vsb, ", \"nodes\": [");
+			for (i = 0; i < cl->nnodes; i++) {
+				if (!strcmp(state[i], "missing"))
+					VSB_printf(vsb, "%snull",
+					    i ? ", " : "");
+				else
+					VSB_printf(vsb, "%s%" PRIu64,
+					    i ? ", " : "", c->nodes[i]);
+			}
+			VSB_cat(vsb, "]}");
+		}
+		VSB_cat(vsb, "\n\t}");
+	}
+	VSB_cat(vsb, "\n}\n");
+	AZ(VSB_finish(vsb));
+
+	/* Rates only make sense between two complete samples. */
+	for (c = cl->head; c != NULL; c = c->next)
+		c->prev = c->value;
+	cl->prev_t = partial ? 0 : t;
+
+	vstat_cluster_free(job);
+	free(state);
+
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (0);
+}
+
 static unsigned int
 vstat_push_test(struct http_request *request, const char *arg, void *data)
 {
@@ -284,20 +908,425 @@ vstat_push_url(struct http_request *request, const char *arg, void *data)
 	return (0);
 }
 
+/*
+ * Whether the filters let name through. The first that matches decides,
+ * "!" excludes, and what none matches goes through only if they all
+ * exclude.
+ */
+static int
+vstat_udp_filter(const struct vstat_udp_t *udp, const char *name)
+{
+	unsigned i;
+	int neg, pos = 0;
+
+	for (i = 0; i < udp->nfilter; i++) {
+		neg = udp->filter[i][0] == '!';
+		if (!fnmatch(udp->filter[i] + neg, name, 0))
+			return (!neg);
+		pos |= !neg;
+	}
+	return (!pos);
+}
+
+static void
+vstat_udp_line(struct vstat_udp_t *udp, const char *line, size_t l)
+{
+	if (l > udp->mtu)
+		return;
+	if (udp->npkt == 0 ||
+	    VSB_len(udp->buf) - udp->start[udp->npkt - 1] + l > udp->mtu) {
+		if (udp->npkt == udp->pktsize) {
+			udp->pktsize = udp->pktsize ? udp->pktsize * 2 : 16;
+			udp->start = realloc(udp->start,
+			    udp->pktsize * sizeof *udp->start);
+			AN(udp->start);
+		}
+		udp->start[udp->npkt++] = VSB_len(udp->buf);
+	}
+	VSB_bcat(udp->buf, line, l);
+	udp->lines++;
+}
+
+static int
+vstat_udp_cb(void *priv, const struct VSC_point * const pt)
+{
+	struct vstat_udp_t *udp = priv;
+	struct vstat_udp_inst_t *in = udp->in;
+	struct vstat_udp_prev_t *p;
+	const struct VSC_section *sec;
+	char name[256], metric[512], line[600], *s;
+	uint64_t val;
+	int l, have = 0;
+
+	if (pt == NULL)
+		return (0);
+	sec = pt->section;
+	val = *(const volatile uint64_t *)pt->ptr;
+	snprintf(name, sizeof name, "%s%s%s%s%s", sec->fantom->type,
+	    sec->fantom->type[0] ? "." : "", sec->fantom->ident,
+	    sec->fantom->ident[0] ? "." : "", pt->desc->name);
+
+	/* The previous value, if the counters are still in that order */
+	if (in->n > udp->k && !strcmp(in->prev[udp->k].name, name))
+		have = 1;
+	else {
+		if (udp->k == in->size) {
+			in->size = in->size ? in->size * 2 : 256;
+			in->prev = realloc(in->prev,
+			    in->size * sizeof *in->prev);
+			AN(in->prev);
+		}
+		while (in->n > udp->k)
+			free(in->prev[--in->n].name);
+		in->prev[udp->k].name = strdup(name);
+		AN(in->prev[udp->k].name);
+		in->n = udp->k + 1;
+	}
+	p = &in->prev[udp->k++];
+
+	if (vstat_udp_filter(udp, name)) {
+		snprintf(metric, sizeof metric, "%s%s%s%s%s", udp->prefix,
+		    udp->prefix[0] ? "." : "", udp->iname ? udp->iname : "",
+		    udp->iname ? "." : "", name);
+		/* Both protocols use ' ', ':' and '|' as separators */
+		for (s = metric; *s != '\0'; s++)
+			if (!isalnum((unsigned char)*s) && *s != '.' &&
+			    *s != '_' && *s != '-')
+				*s = '_';
+		l = 0;
+		if (pt->desc->semantics != 'c') {
+			if (udp->graphite)
+				l = snprintf(line, sizeof line, "%s %" PRIu64
+				    " %jd\n", metric, val,
+				    (intmax_t)udp->now);
+			else
+				l = snprintf(line, sizeof line, "%s:%" PRIu64
+				    "|g\n", metric, val);
+		} else if (have && val >= p->val && udp->dt > 0) {
+			/* A counter going back is varnishd restarting */
+			if (udp->graphite)
+				l = snprintf(line, sizeof line, "%s %.3f %jd\n",
+				    metric, (val - p->val) / udp->dt,
+				    (intmax_t)udp->now);
+			else
+				l = snprintf(line, sizeof line, "%s:%" PRIu64
+				    "|c\n", metric, val - p->val);
+		}
+		if (l > 0 && (size_t)l < sizeof line)
+			vstat_udp_line(udp, line, l);
+	}
+	p->val = val;
+	return (0);
+}
+
+static void
+vstat_udp_send(struct vstat_udp_t *udp)
+{
+	const char *data = VSB_data(udp->buf);
+	size_t end;
+	unsigned i, n, tries = 0;
+
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msg[VSTAT_UDP_BATCH];
+	struct iovec iov[VSTAT_UDP_BATCH];
+	int r;
+
+	for (i = 0; i < udp->npkt; i += n) {
+		memset(msg, 0, sizeof msg);
+		for (n = 0; n < VSTAT_UDP_BATCH && i + n < udp->npkt; n++) {
+			end = i + n + 1 < udp->npkt ? udp->start[i + n + 1] :
+			    (size_t)VSB_len(udp->buf);
+			iov[n].iov_base = (void *)(uintptr_t)
+			    (data + udp->start[i + n]);
+			iov[n].iov_len = end - udp->start[i + n];
+			msg[n].msg_hdr.msg_iov = &iov[n];
+			msg[n].msg_hdr.msg_iovlen = 1;
+		}
+		r = sendmmsg(udp->fd, msg, n, 0);
+		if (r < 0 && errno != EINTR && errno != EAGAIN) {
+			udp->errors += udp->npkt - i;
+			return;
+		}
+		if (r > 0) {
+			udp->packets += r;
+			n = r;
+			tries = 0;
+			continue;
+		}
+		/* Nothing sent: try the first one again, then drop it */
+		n = 0;
+		if (++tries == VSTAT_UDP_RETRIES) {
+			udp->errors++;
+			n = 1;
+			tries = 0;
+		}
+	}
+#else
+	ssize_t r;
+
+	for (i = 0; i < udp->npkt; i++) {
+		end = i + 1 < udp->npkt ? udp->start[i + 1] :
+		    (size_t)VSB_len(udp->buf);
+		n = end - udp->start[i];
+		tries = 0;
+		do
+			r = send(udp->fd, data + udp->start[i], n, 0);
+		while (r < 0 && (errno == EINTR || errno == EAGAIN) &&
+		    ++tries < VSTAT_UDP_RETRIES);
+		if (r < 0)
+			udp->errors++;
+		else
+			udp->packets++;
+	}
+#endif
+}
+
+/*
+ * Emit the counters of every instance.
+ */
+static void
+vstat_udp_emit(struct agent_core_t *core, struct vstat_priv_t *vstat)
+{
+	struct vstat_udp_t *udp = &vstat->udp;
+	struct vstat_thread_ctx_t *ctx = &vstat->timer;
+	struct timeval tv;
+	double now;
+	int i, cur = instance_current();
+
+	AZ(pthread_mutex_lock(&udp->lck));
+	for (i = 0; udp->fd >= 0 && i < udp->ninstances; i++) {
+		instance_select(i);
+		if (check_reopen(ctx))
+			continue;
+		AZ(gettimeofday(&tv, NULL));
+		now = tv.tv_sec + tv.tv_usec * 1e-6;
+		udp->in = &udp->inst[i];
+		udp->iname = udp->ninstances > 1 ? instance_get(core)->name :
+		    NULL;
+		udp->k = 0;
+		udp->now = tv.tv_sec;
+		udp->dt = udp->in->t > 0 ? now - udp->in->t : 0;
+		udp->in->t = now;
+		udp->npkt = 0;
+		VSB_clear(udp->buf);
+		(void)VSC_Iter(vstat_vd(ctx), NULL, vstat_udp_cb, udp);
+		AZ(VSB_finish(udp->buf));
+		vstat_udp_send(udp);
+	}
+	AZ(pthread_mutex_unlock(&udp->lck));
+	instance_select(cur);
+}
+
+static void
+vstat_udp_stop(struct vstat_udp_t *udp)
+{
+	unsigned u;
+	int i;
+
+	if (udp->fd >= 0)
+		close(udp->fd);
+	udp->fd = -1;
+	free(udp->address);
+	free(udp->prefix);
+	for (u = 0; u < udp->nfilter; u++)
+		free(udp->filter[u]);
+	free(udp->filter);
+	udp->address = udp->prefix = NULL;
+	udp->filter = NULL;
+	udp->nfilter = 0;
+	for (i = 0; i < udp->ninstances; i++) {
+		while (udp->inst[i].n > 0)
+			free(udp->inst[i].prev[--udp->inst[i].n].name);
+		udp->inst[i].t = 0;
+	}
+}
+
+/*
+ * A socket connected to address, "host:port" or "[v6]:port".
+ */
+static int
+vstat_udp_socket(const char *address, const char **err)
+{
+	struct addrinfo hints, *res;
+	char *host, *port;
+	int fd;
+
+	host = strdup(address);
+	AN(host);
+	port = strrchr(host, ':');
+	if (port == NULL) {
+		free(host);
+		*err = "address must be host:port";
+		return (-1);
+	}
+	*port++ = '\0';
+	if (*host == '[' && port[-2] == ']') {
+		port[-2] = '\0';
+		memmove(host, host + 1, strlen(host));
+	}
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		free(host);
+		*err = "Cannot resolve the address";
+		return (-1);
+	}
+	free(host);
+	fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0)
+		*err = "Cannot open a socket to the address";
+	return (fd);
+}
+
+static void
+vstat_udp_json(struct vsb *vsb, const struct vstat_udp_t *udp)
+{
+	unsigned i;
+
+	VSB_printf(vsb, "{\n\t\"enabled\": %s", udp->fd >= 0 ?
+	    "true" : "false");
+	if (udp->fd >= 0) {
+		VSB_cat(vsb, ",\n\t\"address\": ");
+		json_quote(vsb, udp->address, -1);
+		VSB_printf(vsb, ",\n\t\"format\": \"%s\",\n\t\"prefix\": ",
+		    udp->graphite ? "graphite" : "statsd");
+		json_quote(vsb, udp->prefix, -1);
+		VSB_cat(vsb, ",\n\t\"filter\": [");
+		for (i = 0; i < udp->nfilter; i++) {
+			VSB_cat(vsb, i ? ", " : "");
+			json_quote(vsb, udp->filter[i], -1);
+		}
+		VSB_printf(vsb, "],\n\t\"mtu\": %u", udp->mtu);
+	}
+	VSB_printf(vsb, ",\n\t\"lines\": %" PRIu64 ",\n\t\"packets\": %"
+	    PRIu64 ",\n\t\"errors\": %" PRIu64 "\n}\n", udp->lines,
+	    udp->packets, udp->errors);
+}
+
+/*
+ * PUT a JSON config to start emitting, DELETE to stop.
+ */
+static unsigned int
+vstat_push_udp(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct vstat_priv_t *vstat;
+	struct vstat_udp_t *udp;
+	struct http_response *resp;
+	struct json_t *root = NULL, *m, *f;
+	const char *err = NULL, *address, *format;
+	struct vsb *vsb;
+	int fd = -1;
+
+	(void)arg;
+	GET_PRIV(core, vstat);
+	udp = &vstat->udp;
+
+	if (request->method == M_PUT) {
+		if ((root = json_parse(request->body, &err)) == NULL) {
+			http_reply(request->connection, 400, err);
+			return (0);
+		}
+		format = json_get_string(root, "format");
+		if ((address = json_get_string(root, "address")) == NULL)
+			err = "address must be a string";
+		else if (format != NULL && strcmp(format, "statsd") &&
+		    strcmp(format, "graphite"))
+			err = "format must be statsd or graphite";
+		else if ((m = json_get(root, "prefix")) != NULL &&
+		    m->type != JSON_STRING)
+			err = "prefix must be a string";
+		else if ((m = json_get(root, "mtu")) != NULL &&
+		    (m->type != JSON_NUMBER || m->number < 64 ||
+		    m->number > 65507))
+			err = "mtu must be between 64 and 65507";
+		else if ((m = json_get(root, "filter")) != NULL) {
+			if (m->type != JSON_ARRAY)
+				err = "filter must be an array of strings";
+			for (f = m->child; err == NULL && f != NULL;
+			    f = f->next)
+				if (f->type != JSON_STRING)
+					err = "filter must be an array of "
+					    "strings";
+		}
+		if (err == NULL)
+			fd = vstat_udp_socket(address, &err);
+		if (err != NULL) {
+			http_reply(request->connection, 400, err);
+			json_free(root);
+			return (0);
+		}
+
+		AZ(pthread_mutex_lock(&udp->lck));
+		vstat_udp_stop(udp);
+		udp->fd = fd;
+		udp->address = strdup(address);
+		udp->graphite = format != NULL && !strcmp(format, "graphite");
+		udp->prefix = strdup(json_get_string(root, "prefix") ?
+		    json_get_string(root, "prefix") : "varnish");
+		m = json_get(root, "mtu");
+		udp->mtu = m != NULL ? m->number : VSTAT_UDP_MTU;
+		m = json_get(root, "filter");
+		for (f = m != NULL ? m->child : NULL; f != NULL; f = f->next) {
+			udp->filter = realloc(udp->filter,
+			    (udp->nfilter + 1) * sizeof *udp->filter);
+			AN(udp->filter);
+			udp->filter[udp->nfilter] = strdup(f->string);
+			AN(udp->filter[udp->nfilter++]);
+		}
+		AN(udp->address);
+		AN(udp->prefix);
+		AZ(pthread_mutex_unlock(&udp->lck));
+		json_free(root);
+		logger(vstat->http.logger, "Emitting %s to %s",
+		    udp->graphite ? "graphite" : "statsd", address);
+	} else if (request->method == M_DELETE) {
+		AZ(pthread_mutex_lock(&udp->lck));
+		vstat_udp_stop(udp);
+		AZ(pthread_mutex_unlock(&udp->lck));
+		logger(vstat->http.logger, "Stopped emitting over UDP");
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	AZ(pthread_mutex_lock(&udp->lck));
+	vstat_udp_json(vsb, udp);
+	AZ(pthread_mutex_unlock(&udp->lck));
+	AZ(VSB_finish(vsb));
+	resp = http_mkresp(request->connection, 200, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+	return (0);
+}
+
 static void *
 vstat_run(void *data)
 {
 	struct vstat_priv_t *vstat;
 	struct agent_core_t *core = data;
+	time_t retry = 0;
 
 	GET_PRIV(core, vstat);
 	while (1) {
 		sleep(1);
+		vstat_udp_emit(core, vstat);
+		if (time(NULL) < retry)
+			continue;
 		/*
 		 * FIXME: This whole thing is bonkers.
 		 */
 		if (push_stats(vstat, &vstat->timer) < 0)
-			sleep(10);
+			retry = time(NULL) + 10;
 	}
 	return NULL;
 }
@@ -317,12 +1346,18 @@ vstat_start(struct agent_core_t *core, const char *name)
 static void
 vstat_init_ctx(struct agent_core_t *core, struct vstat_thread_ctx_t *t_ctx)
 {
-	t_ctx->vd = VSM_New();
+	int i;
+
+	t_ctx->vd = calloc(core->config->ninstances, sizeof *t_ctx->vd);
+	AN(t_ctx->vd);
+	for (i = 0; i < core->config->ninstances; i++) {
+		t_ctx->vd[i] = VSM_New();
+		AN(t_ctx->vd[i]);
+		VSC_Arg(t_ctx->vd[i], 'n', core->config->instances[i].n_arg);
+	}
 	t_ctx->vsb = VSB_new_auto();
 	t_ctx->curl = ipc_register(core,"curl");
 	t_ctx->logger = ipc_register(core,"logger");
-	if (core->config->n_arg)
-		VSC_Arg(t_ctx->vd, 'n', core->config->n_arg);
 }
 
 void
@@ -340,8 +1375,19 @@ vstat_init(struct agent_core_t *core)
 	plug->start = vstat_start;
 
 	pthread_rwlock_init(&priv->lck, NULL);
+	AZ(pthread_mutex_init(&priv->udp.lck, NULL));
+	priv->udp.fd = -1;
+	priv->udp.ninstances = core->config->ninstances;
+	priv->udp.inst = calloc(priv->udp.ninstances, sizeof *priv->udp.inst);
+	AN(priv->udp.inst);
+	priv->udp.buf = VSB_new_auto();
+	AN(priv->udp.buf);
 
 	http_register_path(core, "/stats", M_GET, vstat_reply, core);
+	http_register_path(core, "/instances", M_GET, vstat_instances, core);
+	http_register_path(core, "/cluster/stats", M_GET, vstat_cluster, core);
 	http_register_path(core, "/push/test/stats", M_PUT, vstat_push_test, core);
 	http_register_path(core, "/push/url/stats", M_PUT, vstat_push_url, core);
+	http_register_path(core, "/push/udp/stats", M_GET | M_PUT | M_DELETE,
+	    vstat_push_udp, core);
 }
@@ -0,0 +1,911 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Cache warming.
+ *
+ * POST /warm queues a job: a list of URLs, or the N most requested URLs
+ * still in the shmlog, to fetch from the local varnishd. A background
+ * thread runs the jobs one at a time, through a curl multi handle with
+ * a bounded number of kept-alive connections and an optional rate
+ * limit, and stops early if the cache fills up or the backends start
+ * failing. GET /warm/<id> shows the progress.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include <vapi/vsm.h>
+#include <vapi/vsc.h>
+#include <vapi/vsl.h>
+
+#include "common.h"
+#include "http.h"
+#include "helpers.h"
+#include "instance.h"
+#include "ipc.h"
+#include "json.h"
+#include "plugins.h"
+#include "vsb.h"
+
+#define WARM_JOBS		16	// Finished jobs we remember
+#define WARM_MAX_PARALLEL	64
+#define WARM_TOP_BUCKETS	4096
+#define WARM_MIN_SAMPLE		20	// Requests before checking errors
+#define WARM_HELP \
+	"POST /warm - start warming the cache. The body is either a list of\n" \
+	"  URLs, one per line, or a JSON object:\n" \
+	"\n" \
+	"  {\"urls\": [\"/a\", \"http://example.com/b\"],  URLs to fetch, or\n" \
+	"   \"top\": 1000,              the 1000 most requested in the shmlog\n" \
+	"   \"host\": \"example.com\",    Host header for URLs without one\n" \
+	"   \"concurrency\": 4,         parallel requests (default: 4)\n" \
+	"   \"rate\": 100,              requests per second (default: no limit)\n" \
+	"   \"max_objects\": 100000,    stop when MAIN.n_object reaches this\n" \
+	"   \"max_error_rate\": 0.1,    stop when this share of requests fail\n" \
+	"   \"target\": \"http://127.0.0.1:80\"}  default: varnishd -a\n" \
+	"\n" \
+	"GET /warm - list the jobs\n" \
+	"GET /warm/<id> - progress of a job, with hits and misses\n" \
+	"DELETE /warm/<id> - stop a job\n" \
+	"\n" \
+	"A request is a hit if varnishd answers with two XIDs in X-Varnish.\n" \
+	"Failed requests and 5xx answers are errors.\n"
+
+enum warm_state {
+	WARM_QUEUED,
+	WARM_RUNNING,
+	WARM_DONE,
+	WARM_STOPPED,
+};
+
+static const char * const warm_states[] = {
+	[WARM_QUEUED]	= "queued",
+	[WARM_RUNNING]	= "running",
+	[WARM_DONE]	= "done",
+	[WARM_STOPPED]	= "stopped",
+};
+
+struct warm_url_t {
+	char *host;		// NULL for the default
+	char *path;
+};
+
+/*
+ * Everything but the counters and state is set before the job is
+ * queued. The counters and state are written by the warm thread and
+ * read by HTTP callbacks, under warm->lck.
+ */
+struct warm_job_t {
+	unsigned id;
+	int instance;
+	struct warm_url_t *urls;
+	unsigned nurls;
+	unsigned top;
+	char *host;
+	char *target;
+	unsigned concurrency;
+	double rate;
+	uint64_t max_objects;
+	double max_error_rate;
+
+	enum warm_state state;
+	char *reason;
+	int cancel;
+	time_t started;
+	time_t finished;
+	unsigned done;
+	unsigned hit;
+	unsigned miss;
+	unsigned errors;
+	uint64_t n_object;
+	struct warm_job_t *next;
+};
+
+struct warm_priv_t {
+	int logger;		// HTTP callbacks
+	int tlogger;		// The warm thread
+	int vadmin;		// The warm thread
+	pthread_mutex_t lck;
+	pthread_cond_t cond;
+	unsigned next_id;
+	struct warm_job_t *jobs;	// Newest first
+};
+
+/* One transfer */
+struct warm_req_t {
+	CURL *curl;
+	int hit;
+	char *url;
+	struct curl_slist *slist;
+	struct warm_req_t *next;
+};
+
+static void
+warm_free_job(struct warm_job_t *job)
+{
+	unsigned i;
+
+	for (i = 0; i < job->nurls; i++) {
+		free(job->urls[i].host);
+		free(job->urls[i].path);
+	}
+	free(job->urls);
+	free(job->host);
+	free(job->target);
+	free(job->reason);
+	free(job);
+}
+
+static void
+warm_add_url(struct warm_job_t *job, const char *url, size_t len)
+{
+	struct warm_url_t *u;
+	const char *p, *e = url + len;
+
+	job->urls = realloc(job->urls, (job->nurls + 1) * sizeof *job->urls);
+	AN(job->urls);
+	u = &job->urls[job->nurls++];
+	u->host = NULL;
+	if (len > 7 && !strncasecmp(url, "http://", 7)) {
+		url += 7;
+		p = memchr(url, '/', e - url);
+		if (p == NULL)
+			p = e;
+		u->host = strndup(url, p - url);
+		AN(u->host);
+		url = p;
+	}
+	assert(0 < asprintf(&u->path, "%s%.*s", *url == '/' ? "" : "/",
+	    (int)(e - url), url));
+}
+
+/*
+ * Build a job out of a POST /warm body. Returns NULL and sets *err if
+ * it doesn't make sense.
+ */
+static struct warm_job_t *
+warm_parse(const char *body, const char **err)
+{
+	struct warm_job_t *job;
+	struct json_t *root, *m;
+	const char *p, *e;
+	size_t len;
+
+	ALLOC_OBJ(job);
+	job->concurrency = 4;
+	*err = NULL;
+
+	if (body == NULL)
+		body = "";
+	while (*body == ' ' || *body == '\t' || *body == '\n' || *body == '\r')
+		body++;
+	if (*body != '{') {
+		for (p = body; *p != '\0'; p = e) {
+			e = p + strcspn(p, "\r\n");
+			if (e > p && *p != '#')
+				warm_add_url(job, p, e - p);
+			e += strspn(e, "\r\n");
+		}
+		if (job->nurls == 0)
+			*err = "No URLs";
+	} else if ((root = json_parse(body, err)) != NULL) {
+		if ((m = json_get(root, "urls")) != NULL) {
+			if (m->type != JSON_ARRAY)
+				*err = "urls is not an array";
+			else
+				for (m = m->child; m != NULL; m = m->next)
+					if (m->type == JSON_STRING)
+						warm_add_url(job, m->string,
+						    strlen(m->string));
+		}
+#define WARM_NUM(name, field, min, max)					\
+		if ((m = json_get(root, name)) != NULL) {		\
+			if (m->type != JSON_NUMBER || m->number < (min) ||\
+			    m->number > (max))				\
+				*err = name " is out of range";		\
+			else						\
+				job->field = m->number;			\
+		}
+		WARM_NUM("top", top, 1, 1000000)
+		WARM_NUM("concurrency", concurrency, 1, WARM_MAX_PARALLEL)
+		WARM_NUM("rate", rate, 0, 1000000)
+		WARM_NUM("max_objects", max_objects, 0, 1e15)
+		WARM_NUM("max_error_rate", max_error_rate, 0, 1)
+#undef WARM_NUM
+		if ((p = json_get_string(root, "host")) != NULL)
+			job->host = strdup(p);
+		if ((p = json_get_string(root, "target")) != NULL) {
+			job->target = strdup(p);
+			AN(job->target);
+			while ((len = strlen(job->target)) > 0 &&
+			    job->target[len - 1] == '/')
+				job->target[len - 1] = '\0';
+		}
+		if (*err == NULL && job->nurls == 0 && job->top == 0)
+			*err = "Need urls or top";
+		json_free(root);
+	}
+	if (*err != NULL) {
+		warm_free_job(job);
+		return (NULL);
+	}
+	return (job);
+}
+
+/*
+ * The most requested URLs still in the shmlog: count the GETs of every
+ * client request, keyed on Host and URL as first received.
+ */
+struct warm_top_t {
+	char *key;		// host \n path
+	unsigned count;
+	struct warm_top_t *next;
+};
+
+struct warm_top_ctx_t {
+	struct warm_top_t *buckets[WARM_TOP_BUCKETS];
+	unsigned n;
+};
+
+static unsigned
+warm_hash(const char *s)
+{
+	unsigned h = 5381;
+
+	while (*s != '\0')
+		h = h * 33 + (unsigned char)*s++;
+	return (h % WARM_TOP_BUCKETS);
+}
+
+static int
+warm_top_cb(struct VSL_data *vsl, struct VSL_transaction * const trans[],
+    void *priv)
+{
+	struct warm_top_ctx_t *ctx = priv;
+	struct VSL_transaction *t;
+	struct warm_top_t *e;
+	const char *data, *url, *host, *method;
+	char *key;
+	unsigned h;
+	int i;
+
+	(void)vsl;
+	for (i = 0; (t = trans[i]) != NULL; i++) {
+		if (t->type != VSL_t_req)
+			continue;
+		url = host = method = NULL;
+		while (VSL_Next(t->c) == 1) {
+			data = VSL_CDATA(t->c->rec.ptr);
+			switch (VSL_TAG(t->c->rec.ptr)) {
+			case SLT_ReqMethod:
+				if (method == NULL)
+					method = data;
+				break;
+			case SLT_ReqURL:
+				if (url == NULL)
+					url = data;
+				break;
+			case SLT_ReqHeader:
+				if (host == NULL && !strncasecmp(data, "Host:", 5))
+					for (host = data + 5; *host == ' ';)
+						host++;
+				break;
+			default:
+				break;
+			}
+		}
+		if (url == NULL || method == NULL || strcmp(method, "GET"))
+			continue;
+		assert(0 < asprintf(&key, "%s\n%s", host ? host : "", url));
+		h = warm_hash(key);
+		for (e = ctx->buckets[h]; e != NULL; e = e->next)
+			if (!strcmp(e->key, key))
+				break;
+		if (e == NULL) {
+			ALLOC_OBJ(e);
+			e->key = key;
+			e->next = ctx->buckets[h];
+			ctx->buckets[h] = e;
+			ctx->n++;
+		} else
+			free(key);
+		e->count++;
+	}
+	return (0);
+}
+
+static int
+warm_top_cmp(const void *a, const void *b)
+{
+	const struct warm_top_t * const *x = a, * const *y = b;
+
+	if ((*x)->count != (*y)->count)
+		return ((*x)->count > (*y)->count ? -1 : 1);
+	return (strcmp((*x)->key, (*y)->key));
+}
+
+static int
+warm_top(struct agent_core_t *core, struct warm_job_t *job, char **reason)
+{
+	struct warm_top_ctx_t *ctx;
+	struct warm_top_t **all, *e, *next;
+	struct warm_url_t *u;
+	struct VSM_data *vsm;
+	struct VSL_data *vsl;
+	struct VSL_cursor *c;
+	struct VSLQ *vslq;
+	unsigned i, j;
+	char *nl;
+	int ret = -1;
+
+	vsm = VSM_New();
+	AN(vsm);
+	vsl = VSL_New();
+	AN(vsl);
+	if (VSM_n_Arg(vsm, instance_get(core)->n_arg) != 1 ||
+	    VSM_Open(vsm) != 0) {
+		assert(0 < asprintf(reason, "Can't open the shmlog: %s",
+		    VSM_Error(vsm)));
+		goto out;
+	}
+	c = VSL_CursorVSM(vsl, vsm, VSL_COPT_BATCH | VSL_COPT_TAILSTOP);
+	if (c == NULL) {
+		assert(0 < asprintf(reason, "Can't open the log: %s",
+		    VSL_Error(vsl)));
+		goto out;
+	}
+	vslq = VSLQ_New(vsl, &c, VSL_g_request, NULL);
+	AN(vslq);
+
+	ctx = calloc(1, sizeof *ctx);
+	AN(ctx);
+	while (VSLQ_Dispatch(vslq, warm_top_cb, ctx) == 1)
+		continue;
+	VSLQ_Delete(&vslq);
+
+	all = calloc(ctx->n ? ctx->n : 1, sizeof *all);
+	AN(all);
+	for (i = j = 0; i < WARM_TOP_BUCKETS; i++)
+		for (e = ctx->buckets[i]; e != NULL; e = e->next)
+			all[j++] = e;
+	assert(j == ctx->n);
+	qsort(all, ctx->n, sizeof *all, warm_top_cmp);
+
+	for (i = 0; i < ctx->n && i < job->top; i++) {
+		nl = strchr(all[i]->key, '\n');
+		AN(nl);
+		*nl = '\0';
+		job->urls = realloc(job->urls,
+		    (job->nurls + 1) * sizeof *job->urls);
+		AN(job->urls);
+		u = &job->urls[job->nurls++];
+		u->host = *all[i]->key ? strdup(all[i]->key) : NULL;
+		u->path = strdup(nl + 1);
+		AN(u->path);
+	}
+	for (i = 0; i < WARM_TOP_BUCKETS; i++)
+		for (e = ctx->buckets[i]; e != NULL; e = next) {
+			next = e->next;
+			free(e->key);
+			free(e);
+		}
+	free(all);
+	free(ctx);
+	ret = 0;
+ out:
+	VSL_Delete(vsl);
+	VSM_Delete(vsm);
+	return (ret);
+}
+
+/*
+ * Where varnishd listens, from the first line of debug.listen_address,
+ * which is "address port".
+ */
+static char *
+warm_target(struct warm_priv_t *warm)
+{
+	struct ipc_ret_t vret;
+	char *target = NULL, *p;
+
+	ipc_run(warm->vadmin, &vret, "debug.listen_address");
+	if (vret.status == 200) {
+		p = strchr(vret.answer, '\n');
+		if (p)
+			*p = '\0';
+		p = strrchr(vret.answer, ' ');
+		if (p != NULL) {
+			*p++ = '\0';
+			assert(0 < asprintf(&target, "http://%s%s%s:%s",
+			    strchr(vret.answer, ':') ? "[" : "", vret.answer,
+			    strchr(vret.answer, ':') ? "]" : "", p));
+		}
+	}
+	free(vret.answer);
+	return (target);
+}
+
+static int
+warm_n_object_cb(void *priv, const struct VSC_point * const pt)
+{
+	uint64_t *val = priv;
+
+	if (pt == NULL)
+		return (0);
+	if (!strcmp(pt->section->fantom->type, "MAIN") &&
+	    !strcmp(pt->desc->name, "n_object")) {
+		*val = *(const volatile uint64_t *)pt->ptr;
+		return (1);
+	}
+	return (0);
+}
+
+static size_t
+warm_header(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	struct warm_req_t *r = userdata;
+	size_t len = size * nmemb;
+	const char *p;
+
+	if (len > 10 && !strncasecmp(ptr, "X-Varnish:", 10)) {
+		for (p = ptr + 10; p < ptr + len && *p == ' '; p++)
+			continue;
+		for (; p < ptr + len && *p != ' ' && *p != '\r'; p++)
+			continue;
+		r->hit = p < ptr + len && *p == ' ';
+	}
+	return (len);
+}
+
+static size_t
+warm_drop(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	(void)ptr;
+	(void)userdata;
+	return (size * nmemb);
+}
+
+static void
+warm_add(CURLM *multi, struct warm_req_t **active,
+    const struct warm_job_t *job, const char *target,
+    const struct warm_url_t *u)
+{
+	struct warm_req_t *r;
+	const char *host;
+	char *hdr;
+	CURL *curl;
+
+	ALLOC_OBJ(r);
+	assert(0 < asprintf(&r->url, "%s%s", target, u->path));
+	host = u->host ? u->host : job->host;
+	if (host != NULL) {
+		assert(0 < asprintf(&hdr, "Host: %s", host));
+		r->slist = curl_slist_append(NULL, hdr);
+		free(hdr);
+	}
+	curl = curl_easy_init();
+	AN(curl);
+	curl_easy_setopt(curl, CURLOPT_URL, r->url);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, r->slist);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, warm_header);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, r);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, warm_drop);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, r);
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, "varnish-agent warm");
+	curl_multi_add_handle(multi, curl);
+	r->curl = curl;
+	r->next = *active;
+	*active = r;
+}
+
+static void
+warm_done(CURLM *multi, struct warm_req_t **active, struct warm_req_t *r)
+{
+
+	while (*active != r)
+		active = &(*active)->next;
+	*active = r->next;
+	curl_multi_remove_handle(multi, r->curl);
+	curl_easy_cleanup(r->curl);
+	curl_slist_free_all(r->slist);
+	free(r->url);
+	free(r);
+}
+
+static double
+warm_now(void)
+{
+	struct timespec ts;
+
+	AZ(clock_gettime(CLOCK_MONOTONIC, &ts));
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Stop the job with a reason, called with the lock held.
+ */
+static void
+warm_stop(struct warm_job_t *job, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (job->reason != NULL)
+		return;
+	va_start(ap, fmt);
+	assert(0 < vasprintf(&job->reason, fmt, ap));
+	va_end(ap);
+}
+
+static void
+warm_run_job(struct agent_core_t *core, struct warm_priv_t *warm,
+    struct warm_job_t *job)
+{
+	struct VSM_data *vsm;
+	struct warm_req_t *r, *reqs = NULL;
+	CURLM *multi;
+	CURLMsg *msg;
+	CURL *curl;
+	char *target, *reason = NULL;
+	unsigned next = 0, active = 0;
+	long status;
+	int running, left, stop = 0, wait;
+	double t0, checked = 0;
+	uint64_t n_object;
+
+	instance_select(job->instance);
+	if (job->top && warm_top(core, job, &reason)) {
+		AZ(pthread_mutex_lock(&warm->lck));
+		warm_stop(job, "%s", reason);
+		AZ(pthread_mutex_unlock(&warm->lck));
+		free(reason);
+		instance_select(0);
+		return;
+	}
+	target = job->target ? strdup(job->target) : warm_target(warm);
+	if (target == NULL) {
+		AZ(pthread_mutex_lock(&warm->lck));
+		warm_stop(job, "Don't know where varnishd listens, "
+		    "set target");
+		AZ(pthread_mutex_unlock(&warm->lck));
+		instance_select(0);
+		return;
+	}
+	logger(warm->tlogger, "Warming %u URLs from %s, job %u",
+	    job->nurls, target, job->id);
+
+	vsm = VSM_New();
+	AN(vsm);
+	if (job->max_objects && (VSM_n_Arg(vsm,
+	    instance_get(core)->n_arg) != 1 || VSM_Open(vsm) != 0)) {
+		AZ(pthread_mutex_lock(&warm->lck));
+		warm_stop(job, "Can't open the shmlog for max_objects");
+		AZ(pthread_mutex_unlock(&warm->lck));
+		stop = 1;
+	}
+
+	multi = curl_multi_init();
+	AN(multi);
+	curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)job->concurrency);
+	t0 = warm_now();
+	while (!stop && (next < job->nurls || active > 0)) {
+		while (next < job->nurls && active < job->concurrency &&
+		    (job->rate == 0 || next <= (warm_now() - t0) * job->rate)) {
+			warm_add(multi, &reqs, job, target,
+			    &job->urls[next++]);
+			active++;
+		}
+		curl_multi_perform(multi, &running);
+
+		AZ(pthread_mutex_lock(&warm->lck));
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			curl = msg->easy_handle;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&r);
+			status = 0;
+			if (msg->data.result == CURLE_OK)
+				curl_easy_getinfo(curl,
+				    CURLINFO_RESPONSE_CODE, &status);
+			job->done++;
+			if (status == 0 || status >= 500)
+				job->errors++;
+			else if (r->hit)
+				job->hit++;
+			else
+				job->miss++;
+			warm_done(multi, &reqs, r);
+			active--;
+		}
+		if (job->cancel)
+			warm_stop(job, "Cancelled");
+		if (job->max_error_rate > 0 && job->done >= WARM_MIN_SAMPLE &&
+		    job->errors > job->max_error_rate * job->done)
+			warm_stop(job, "Error rate %.2f above %.2f",
+			    (double)job->errors / job->done,
+			    job->max_error_rate);
+		stop = job->reason != NULL;
+		AZ(pthread_mutex_unlock(&warm->lck));
+
+		if (!stop && job->max_objects && warm_now() - checked >= 1) {
+			checked = warm_now();
+			n_object = 0;
+			if (VSM_Abandoned(vsm)) {
+				VSM_Close(vsm);
+				(void)VSM_Open(vsm);
+			}
+			(void)VSC_Iter(vsm, NULL, warm_n_object_cb, &n_object);
+			AZ(pthread_mutex_lock(&warm->lck));
+			job->n_object = n_object;
+			if (n_object >= job->max_objects)
+				warm_stop(job, "MAIN.n_object reached %"
+				    PRIu64, n_object);
+			stop = job->reason != NULL;
+			AZ(pthread_mutex_unlock(&warm->lck));
+		}
+		/* Until something happens, or the next request is due. */
+		wait = 100;
+		if (job->rate > 0 && next < job->nurls && active <
+		    job->concurrency)
+			wait = 1 + 1000 * (t0 + next / job->rate - warm_now());
+		if (wait > 100)
+			wait = 100;
+		if (!stop && active > 0)
+			curl_multi_wait(multi, NULL, 0, wait > 0 ? wait : 0,
+			    NULL);
+		else if (!stop && next < job->nurls && wait > 0)
+			usleep(wait * 1000);
+	}
+
+	/* Whatever is still running when we stop is not counted. */
+	while (reqs != NULL)
+		warm_done(multi, &reqs, reqs);
+	logger(warm->tlogger, "Warming job %u: %u requests, %u hits, "
+	    "%u misses, %u errors", job->id, job->done, job->hit, job->miss,
+	    job->errors);
+	curl_multi_cleanup(multi);
+	VSM_Delete(vsm);
+	free(target);
+	instance_select(0);
+}
+
+static void *
+warm_run(void *data)
+{
+	struct agent_core_t *core = data;
+	struct warm_priv_t *warm;
+	struct warm_job_t *job, *j;
+
+	GET_PRIV(core, warm);
+	AZ(pthread_mutex_lock(&warm->lck));
+	for (;;) {
+		/* The oldest queued job */
+		job = NULL;
+		for (j = warm->jobs; j != NULL; j = j->next)
+			if (j->state == WARM_QUEUED)
+				job = j;
+		if (job == NULL) {
+			AZ(pthread_cond_wait(&warm->cond, &warm->lck));
+			continue;
+		}
+		job->state = WARM_RUNNING;
+		job->started = time(NULL);
+		AZ(pthread_mutex_unlock(&warm->lck));
+
+		warm_run_job(core, warm, job);
+
+		AZ(pthread_mutex_lock(&warm->lck));
+		job->state = job->reason ? WARM_STOPPED : WARM_DONE;
+		job->finished = time(NULL);
+	}
+	return (NULL);
+}
+
+static void *
+warm_start(struct agent_core_t *core, const char *name)
+{
+	pthread_t *thread;
+
+	(void)name;
+
+	ALLOC_OBJ(thread);
+	AZ(pthread_create(thread, NULL, warm_run, core));
+	return (thread);
+}
+
+static void
+warm_job_json(struct vsb *vsb, const struct warm_job_t *job)
+{
+
+	VSB_printf(vsb, "{\"id\": %u, \"state\": \"%s\", \"urls\": %u, "
+	    "\"done\": %u, \"hit\": %u, \"miss\": %u, \"errors\": %u",
+	    job->id, warm_states[job->state],
+	    job->top && job->state == WARM_QUEUED ? job->top : job->nurls,
+	    job->done, job->hit, job->miss, job->errors);
+	if (job->max_objects)
+		VSB_printf(vsb, ", \"n_object\": %" PRIu64, job->n_object);
+	if (job->started)
+		VSB_printf(vsb, ", \"seconds\": %ld", (long)((job->finished ?
+		    job->finished : time(NULL)) - job->started));
+	if (job->reason) {
+		VSB_cat(vsb, ", \"reason\": ");
+		json_quote(vsb, job->reason, -1);
+	}
+	VSB_cat(vsb, "}");
+}
+
+static void
+warm_send(struct http_request *request, int status, struct vsb *vsb)
+{
+	struct http_response *resp;
+
+	AZ(VSB_finish(vsb));
+	resp = http_mkresp(request->connection, status, NULL);
+	resp->data = VSB_data(vsb);
+	resp->ndata = VSB_len(vsb);
+	http_add_header(resp, "Content-Type", "application/json");
+	send_response(resp);
+	http_free_resp(resp);
+	VSB_delete(vsb);
+}
+
+/*
+ * Forget the oldest finished jobs. Called with the lock held.
+ */
+static void
+warm_prune(struct warm_priv_t *warm)
+{
+	struct warm_job_t **jp, *job;
+	unsigned n = 0;
+
+	for (jp = &warm->jobs; (job = *jp) != NULL; ) {
+		if (job->state >= WARM_DONE && ++n > WARM_JOBS) {
+			*jp = job->next;
+			warm_free_job(job);
+		} else
+			jp = &job->next;
+	}
+}
+
+static unsigned int
+warm_reply(struct http_request *request, const char *arg, void *data)
+{
+	struct agent_core_t *core = data;
+	struct warm_priv_t *warm;
+	struct warm_job_t *job;
+	struct vsb *vsb;
+	const char *err;
+	char *end;
+	unsigned long id = 0;
+
+	GET_PRIV(core, warm);
+
+	if (request->method == M_POST) {
+		if (arg) {
+			http_reply(request->connection, 404,
+			    "POST to /warm, not /warm/<id>");
+			return (0);
+		}
+		job = warm_parse(request->body, &err);
+		if (job == NULL) {
+			http_reply(request->connection, 400, err);
+			return (0);
+		}
+		job->instance = instance_current();
+		vsb = VSB_new_auto();
+		AN(vsb);
+		AZ(pthread_mutex_lock(&warm->lck));
+		job->id = ++warm->next_id;
+		job->next = warm->jobs;
+		warm->jobs = job;
+		warm_prune(warm);
+		warm_job_json(vsb, job);
+		AZ(pthread_cond_signal(&warm->cond));
+		AZ(pthread_mutex_unlock(&warm->lck));
+		logger(warm->logger, "Queued warming job %u", job->id);
+		VSB_cat(vsb, "\n");
+		warm_send(request, 202, vsb);
+		return (0);
+	}
+
+	if (arg) {
+		id = strtoul(arg, &end, 10);
+		if (*end != '\0' || id == 0) {
+			http_reply(request->connection, 404, "No such job");
+			return (0);
+		}
+	}
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	AZ(pthread_mutex_lock(&warm->lck));
+	if (arg == NULL && request->method == M_GET) {
+		VSB_cat(vsb, "[");
+		for (job = warm->jobs; job != NULL; job = job->next) {
+			VSB_cat(vsb, job == warm->jobs ? "\n  " : ",\n  ");
+			warm_job_json(vsb, job);
+		}
+		VSB_cat(vsb, "\n]\n");
+		AZ(pthread_mutex_unlock(&warm->lck));
+		warm_send(request, 200, vsb);
+		return (0);
+	}
+	for (job = warm->jobs; job != NULL; job = job->next)
+		if (job->id == id)
+			break;
+	if (job == NULL) {
+		AZ(pthread_mutex_unlock(&warm->lck));
+		VSB_delete(vsb);
+		http_reply(request->connection, 404, "No such job");
+		return (0);
+	}
+	if (request->method == M_DELETE) {
+		if (job->state == WARM_QUEUED) {
+			job->state = WARM_STOPPED;
+			warm_stop(job, "Cancelled");
+		} else
+			job->cancel = 1;
+	}
+	warm_job_json(vsb, job);
+	AZ(pthread_mutex_unlock(&warm->lck));
+	VSB_cat(vsb, "\n");
+	warm_send(request, 200, vsb);
+	return (0);
+}
+
+void
+warm_init(struct agent_core_t *core)
+{
+	struct agent_plugin_t *plug;
+	struct warm_priv_t *priv;
+
+	ALLOC_OBJ(priv);
+	plug = plugin_find(core, "warm");
+	priv->logger = ipc_register(core, "logger");
+	priv->tlogger = ipc_register(core, "logger");
+	priv->vadmin = ipc_register(core, "vadmin");
+	AZ(pthread_mutex_init(&priv->lck, NULL));
+	AZ(pthread_cond_init(&priv->cond, NULL));
+	plug->data = (void *)priv;
+	plug->start = warm_start;
+	http_register_path(core, "/warm", M_GET | M_POST | M_DELETE,
+	    warm_reply, core);
+	http_register_path(core, "/help/warm", M_GET, help_reply,
+	    strdup(WARM_HELP));
+}
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Sketches for the analyzers, see sketch.h.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "sketch.h"
+#include "vsb.h"
+
+static unsigned
+topk_hash(const struct topk_t *tk, const char *key)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *key != '\0'; key++) {
+		h ^= (unsigned char)*key;
+		h *= 16777619U;
+	}
+	return (h % (2 * tk->size));
+}
+
+struct topk_t *
+topk_new(unsigned size, void (*free_priv)(void *))
+{
+	struct topk_t *tk;
+
+	assert(size > 0);
+	ALLOC_OBJ(tk);
+	tk->size = size;
+	tk->free_priv = free_priv;
+	tk->items = calloc(size, sizeof *tk->items);
+	AN(tk->items);
+	tk->hash = calloc(2 * size, sizeof *tk->hash);
+	AN(tk->hash);
+	tk->heap = calloc(size, sizeof *tk->heap);
+	AN(tk->heap);
+	return (tk);
+}
+
+void
+topk_delete(struct topk_t *tk)
+{
+	unsigned i;
+
+	if (tk == NULL)
+		return;
+	for (i = 0; i < tk->n; i++) {
+		free(tk->items[i].key);
+		if (tk->free_priv != NULL && tk->items[i].priv != NULL)
+			tk->free_priv(tk->items[i].priv);
+	}
+	free(tk->items);
+	free(tk->hash);
+	free(tk->heap);
+	free(tk);
+}
+
+struct topk_item_t *
+topk_find(const struct topk_t *tk, const char *key)
+{
+	unsigned i;
+
+	for (i = tk->hash[topk_hash(tk, key)]; i != 0;
+	    i = tk->items[i - 1].hnext)
+		if (!strcmp(tk->items[i - 1].key, key))
+			return (&tk->items[i - 1]);
+	return (NULL);
+}
+
+static void
+topk_unhash(struct topk_t *tk, unsigned idx)
+{
+	unsigned *ip;
+
+	for (ip = &tk->hash[topk_hash(tk, tk->items[idx].key)];
+	    *ip != idx + 1; ip = &tk->items[*ip - 1].hnext)
+		assert(*ip != 0);
+	*ip = tk->items[idx].hnext;
+}
+
+static void
+topk_heap_set(struct topk_t *tk, unsigned pos, unsigned idx)
+{
+
+	tk->heap[pos] = idx;
+	tk->items[idx].heap = pos;
+}
+
+static void
+topk_heap_up(struct topk_t *tk, unsigned pos)
+{
+	unsigned idx = tk->heap[pos], parent;
+
+	for (; pos > 0; pos = parent) {
+		parent = (pos - 1) / 2;
+		if (tk->items[tk->heap[parent]].count <= tk->items[idx].count)
+			break;
+		topk_heap_set(tk, pos, tk->heap[parent]);
+	}
+	topk_heap_set(tk, pos, idx);
+}
+
+/*
+ * Counts only go up, so an item only ever sinks.
+ */
+static void
+topk_heap_down(struct topk_t *tk, unsigned pos)
+{
+	unsigned idx = tk->heap[pos], child;
+
+	for (; (child = 2 * pos + 1) < tk->n; pos = child) {
+		if (child + 1 < tk->n &&
+		    tk->items[tk->heap[child + 1]].count <
+		    tk->items[tk->heap[child]].count)
+			child++;
+		if (tk->items[idx].count <= tk->items[tk->heap[child]].count)
+			break;
+		topk_heap_set(tk, pos, tk->heap[child]);
+	}
+	topk_heap_set(tk, pos, idx);
+}
+
+struct topk_item_t *
+topk_add(struct topk_t *tk, const char *key, uint64_t n)
+{
+	struct topk_item_t *it;
+	unsigned i, h;
+
+	tk->total += n;
+	it = topk_find(tk, key);
+	if (it != NULL) {
+		it->count += n;
+		topk_heap_down(tk, it->heap);
+		return (it);
+	}
+	if (tk->n < tk->size) {
+		i = tk->n++;
+		it = &tk->items[i];
+		it->error = 0;
+		it->count = n;
+		topk_heap_set(tk, i, i);
+		topk_heap_up(tk, i);
+	} else {
+		/* Replace the smallest */
+		i = tk->heap[0];
+		it = &tk->items[i];
+		topk_unhash(tk, i);
+		free(it->key);
+		if (tk->free_priv != NULL && it->priv != NULL)
+			tk->free_priv(it->priv);
+		it->error = it->count;
+		it->count += n;
+		topk_heap_down(tk, 0);
+	}
+	it->key = strdup(key);
+	AN(it->key);
+	memset(it->vals, 0, sizeof it->vals);
+	it->priv = NULL;
+	h = topk_hash(tk, key);
+	it->hnext = tk->hash[h];
+	tk->hash[h] = i + 1;
+	return (it);
+}
+
+/*
+ * Sort key and item, so qsort() needs no state of its own.
+ */
+struct topk_sort_t {
+	double v;
+	struct topk_item_t *it;
+};
+
+static int
+topk_cmp(const void *a, const void *b)
+{
+	const struct topk_sort_t *x = a, *y = b;
+
+	return (x->v < y->v ? 1 : x->v > y->v ? -1 : 0);
+}
+
+struct topk_item_t **
+topk_sorted(const struct topk_t *tk, int val, unsigned *n)
+{
+	struct topk_sort_t *s;
+	struct topk_item_t **v;
+	unsigned i;
+
+	assert(val >= -1 && val < TOPK_VALS);
+	s = calloc(tk->n + 1, sizeof *s);
+	AN(s);
+	for (i = 0; i < tk->n; i++) {
+		s[i].it = &tk->items[i];
+		s[i].v = val < 0 ? tk->items[i].count : tk->items[i].vals[val];
+	}
+	qsort(s, tk->n, sizeof *s, topk_cmp);
+	v = calloc(tk->n + 1, sizeof *v);
+	AN(v);
+	for (i = 0; i < tk->n; i++)
+		v[i] = s[i].it;
+	free(s);
+	*n = tk->n;
+	return (v);
+}
+
+void
+loghist_add(struct loghist_t *h, double v)
+{
+	double limit = 1;
+	int i;
+
+	for (i = 0; i < LOGHIST_BUCKETS - 1 && v >= limit; i++)
+		limit *= 2;
+	h->bucket[i]++;
+	if (h->n == 0 || v < h->min)
+		h->min = v;
+	if (h->n == 0 || v > h->max)
+		h->max = v;
+	h->n++;
+	h->sum += v;
+}
+
+double
+loghist_quantile(const struct loghist_t *h, double q)
+{
+	uint64_t n = 0;
+	double limit = 1;
+	int i;
+
+	for (i = 0; i < LOGHIST_BUCKETS - 1; i++, limit *= 2) {
+		n += h->bucket[i];
+		if (n > 0 && n >= q * h->n)
+			return (limit < h->max ? limit : h->max);
+	}
+	return (h->max);
+}
+
+void
+loghist_json(struct vsb *vsb, const struct loghist_t *h)
+{
+	double limit = 1;
+	int i, first = 1;
+
+	VSB_printf(vsb, "{\"n\": %ju", (uintmax_t)h->n);
+	if (h->n > 0)
+		VSB_printf(vsb, ", \"min\": %.3f, \"avg\": %.3f, "
+		    "\"max\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+		    "\"p99\": %.3f", h->min, h->sum / h->n, h->max,
+		    loghist_quantile(h, 0.5), loghist_quantile(h, 0.9),
+		    loghist_quantile(h, 0.99));
+	VSB_cat(vsb, ", \"buckets\": [");
+	for (i = 0; i < LOGHIST_BUCKETS; i++, limit *= 2) {
+		if (h->bucket[i] == 0)
+			continue;
+		VSB_cat(vsb, first ? "" : ", ");
+		first = 0;
+		if (i < LOGHIST_BUCKETS - 1)
+			VSB_printf(vsb, "{\"lt\": %.0f, \"count\": %ju}", limit,
+			    (uintmax_t)h->bucket[i]);
+		else
+			VSB_printf(vsb, "{\"lt\": null, \"count\": %ju}",
+			    (uintmax_t)h->bucket[i]);
+	}
+	VSB_cat(vsb, "]}");
+}
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VCL performance lint, see vcl_lint.h.
+ *
+ * A tokenizer that knows enough VCL to skip comments and strings, and a
+ * single pass over the tokens that keeps track of the sub we are in, the
+ * brace depth and whether the enclosing if conditions look at static
+ * files. The rules are checked inline as the tokens go by.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "common.h"
+#include "vcl_lint.h"
+#include "json.h"
+#include "vsb.h"
+
+#define LINT_MAX_DEPTH 64
+
+enum lint_tok_type {
+	TOK_EOF,
+	TOK_ID,		// Identifiers and numbers
+	TOK_STR,
+	TOK_OP,
+};
+
+struct lint_tok {
+	enum lint_tok_type type;
+	const char *b;
+	const char *e;
+	unsigned line;
+};
+
+struct lint_lexer {
+	const char *p;
+	unsigned line;
+};
+
+struct lint_state {
+	struct vcl_lint_t *first;
+	struct vcl_lint_t **last;
+	int depth;
+	int in_recv;
+	unsigned recv_line;
+	int normalizes_url;
+	/* Set for the blocks of if conditions on static files */
+	int static_cond[LINT_MAX_DEPTH];
+};
+
+static const char * const severities[] = {
+	[VCL_LINT_INFO]		= "info",
+	[VCL_LINT_WARNING]	= "warning",
+	[VCL_LINT_ERROR]	= "error",
+};
+
+/*
+ * File extensions that are cacheable about everywhere.
+ */
+static const char * const static_exts[] = {
+	"css", "js", "png", "jpg", "jpeg", "gif", "ico", "svg", "woff",
+	"ttf", NULL
+};
+
+static void
+lint_count(struct lint_lexer *lx, const char *b, const char *e)
+{
+	for (; b < e; b++)
+		if (*b == '\n')
+			lx->line++;
+}
+
+static void
+lint_next(struct lint_lexer *lx, struct lint_tok *t)
+{
+	const char *p, *q;
+	static const char * const ops[] = {
+		"==", "!=", "!~", "&&", "||", "+=", "-=", "*=", "/=", "<=",
+		">=", NULL
+	};
+	const char * const *op;
+
+	for (;;) {
+		p = lx->p;
+		while (isspace((unsigned char)*p)) {
+			if (*p == '\n')
+				lx->line++;
+			p++;
+		}
+		if (*p == '#' || (p[0] == '/' && p[1] == '/')) {
+			p += strcspn(p, "\n");
+		} else if (p[0] == '/' && p[1] == '*') {
+			q = strstr(p + 2, "*/");
+			q = q ? q + 2 : p + strlen(p);
+			lint_count(lx, p, q);
+			p = q;
+		} else {
+			lx->p = p;
+			break;
+		}
+		lx->p = p;
+	}
+
+	t->line = lx->line;
+	t->b = p;
+	if (*p == '\0') {
+		t->type = TOK_EOF;
+		t->e = p;
+		return;
+	}
+	if (p[0] == '{' && p[1] == '"') {
+		t->type = TOK_STR;
+		t->b = p + 2;
+		q = strstr(t->b, "\"}");
+		t->e = q ? q : t->b + strlen(t->b);
+		lint_count(lx, p, t->e);
+		lx->p = q ? q + 2 : t->e;
+		return;
+	}
+	if (*p == '"') {
+		t->type = TOK_STR;
+		t->b = p + 1;
+		t->e = t->b + strcspn(t->b, "\"\n");
+		lx->p = *t->e == '"' ? t->e + 1 : t->e;
+		return;
+	}
+	if (isalnum((unsigned char)*p) || *p == '_') {
+		t->type = TOK_ID;
+		for (q = p; isalnum((unsigned char)*q) || *q == '_' ||
+		    *q == '.' || *q == '-'; q++)
+			continue;
+		t->e = lx->p = q;
+		return;
+	}
+	t->type = TOK_OP;
+	for (op = ops; *op != NULL; op++)
+		if (!strncmp(p, *op, 2))
+			break;
+	t->e = lx->p = p + (*op != NULL ? 2 : 1);
+}
+
+static int
+tok_is(const struct lint_tok *t, const char *s)
+{
+	size_t l = strlen(s);
+
+	return (t->type != TOK_EOF && t->e - t->b == (ssize_t)l &&
+	    !strncasecmp(t->b, s, l));
+}
+
+static int
+tok_has(const struct lint_tok *t, const char *s)
+{
+	const char *p;
+	size_t l = strlen(s);
+
+	for (p = t->b; p + l <= t->e; p++)
+		if (!strncasecmp(p, s, l))
+			return (1);
+	return (0);
+}
+
+/*
+ * Does a regex mention a static file extension, like \.(css|js)$ ?
+ */
+static int
+tok_static(const struct lint_tok *t)
+{
+	const char * const *ext;
+	const char *p;
+	size_t l;
+
+	if (t->type != TOK_STR)
+		return (0);
+	for (ext = static_exts; *ext != NULL; ext++) {
+		l = strlen(*ext);
+		for (p = t->b; p + l <= t->e; p++)
+			if (!strncasecmp(p, *ext, l) && p > t->b &&
+			    (p[-1] == '.' || p[-1] == '(' || p[-1] == '|') &&
+			    (p + l == t->e || !isalnum((unsigned char)p[l])))
+				return (1);
+	}
+	return (0);
+}
+
+static void
+lint_add(struct lint_state *st, unsigned line,
+    enum vcl_lint_severity severity, const char *rule, const char *message)
+{
+	struct vcl_lint_t *l;
+
+	ALLOC_OBJ(l);
+	l->line = line;
+	l->severity = severity;
+	l->rule = rule;
+	l->message = message;
+	*st->last = l;
+	st->last = &l->next;
+}
+
+static int
+lint_in_static(const struct lint_state *st)
+{
+	int i;
+
+	for (i = 1; i <= st->depth && i < LINT_MAX_DEPTH; i++)
+		if (st->static_cond[i])
+			return (1);
+	return (0);
+}
+
+struct vcl_lint_t *
+vcl_lint(const char *vcl)
+{
+	struct lint_state st;
+	struct lint_lexer lx;
+	struct lint_tok t, prev;
+	int cond = 0, cond_static = 0, want_sub = 0, set;
+	unsigned line;
+
+	AN(vcl);
+	memset(&st, 0, sizeof st);
+	st.last = &st.first;
+	lx.p = vcl;
+	lx.line = 1;
+	memset(&prev, 0, sizeof prev);
+
+	for (lint_next(&lx, &t); t.type != TOK_EOF; prev = t,
+	    lint_next(&lx, &t)) {
+		if (t.type == TOK_OP && *t.b == '{') {
+			st.depth++;
+			if (st.depth < LINT_MAX_DEPTH)
+				st.static_cond[st.depth] = cond && cond_static;
+			cond = cond_static = 0;
+			continue;
+		}
+		if (t.type == TOK_OP && *t.b == '}') {
+			if (st.depth > 0)
+				st.depth--;
+			if (st.depth == 0)
+				st.in_recv = 0;
+			continue;
+		}
+		if (st.depth == 0) {
+			if (want_sub && t.type == TOK_ID) {
+				st.in_recv = tok_is(&t, "vcl_recv");
+				if (st.in_recv && st.recv_line == 0)
+					st.recv_line = t.line;
+			}
+			want_sub = tok_is(&t, "sub");
+			continue;
+		}
+
+		if (tok_is(&t, "if") || tok_is(&t, "elsif") ||
+		    tok_is(&t, "elseif") || tok_is(&t, "elif")) {
+			cond = 1;
+			cond_static = 0;
+			continue;
+		}
+		if (cond && tok_static(&t))
+			cond_static = 1;
+
+		if (tok_has(&t, "querysort"))
+			st.normalizes_url = 1;
+
+		if (tok_is(&t, "set") || tok_is(&t, "unset")) {
+			set = tok_is(&t, "set");
+			line = t.line;
+			lint_next(&lx, &t);
+			if (set && st.in_recv && tok_is(&t, "req.url"))
+				st.normalizes_url = 1;
+			if (!set || (!tok_is(&t, "beresp.http.vary") &&
+			    !tok_is(&t, "resp.http.vary")))
+				continue;
+			/* set beresp.http.Vary = ... ; */
+			while (t.type != TOK_EOF &&
+			    !(t.type == TOK_OP && *t.b == ';')) {
+				if (t.type == TOK_STR &&
+				    (tok_has(&t, "user-agent") ||
+				    tok_has(&t, "cookie"))) {
+					lint_add(&st, line, VCL_LINT_WARNING,
+					    "vary-unbounded", "Vary on "
+					    "User-Agent or Cookie makes a "
+					    "variant for about every client");
+					break;
+				}
+				lint_next(&lx, &t);
+			}
+			continue;
+		}
+
+		if (!st.in_recv)
+			continue;
+
+		if (tok_is(&prev, "req.http.cookie") && (tok_is(&t, "~") ||
+		    tok_is(&t, "!~")))
+			lint_add(&st, t.line, VCL_LINT_WARNING, "cookie-regex",
+			    "Regex on req.http.Cookie in vcl_recv runs for "
+			    "every request, prefer cookie.* from vmod cookie or "
+			    "a cheaper condition first");
+
+		if (tok_is(&prev, "return") && tok_is(&t, "(")) {
+			lint_next(&lx, &t);
+			if (!tok_is(&t, "pass"))
+				continue;
+			if (st.depth == 1)
+				lint_add(&st, t.line, VCL_LINT_ERROR,
+				    "pass-all", "Unconditional return (pass) "
+				    "in vcl_recv, nothing is cached");
+			else if (lint_in_static(&st))
+				lint_add(&st, t.line, VCL_LINT_WARNING,
+				    "pass-cacheable", "return (pass) for "
+				    "static files, which are usually "
+				    "cacheable");
+		}
+	}
+
+	if (!st.normalizes_url)
+		lint_add(&st, st.recv_line ? st.recv_line : 1, VCL_LINT_INFO,
+		    "querystring", "req.url is never normalized in vcl_recv,"
+		    " so the same object is cached once per order of query"
+		    " parameters (see std.querysort)");
+	return (st.first);
+}
+
+void
+vcl_lint_free(struct vcl_lint_t *lint)
+{
+	struct vcl_lint_t *next;
+
+	for (; lint != NULL; lint = next) {
+		next = lint->next;
+		free(lint);
+	}
+}
+
+int
+vcl_lint_worst(const struct vcl_lint_t *lint)
+{
+	int worst = -1;
+
+	for (; lint != NULL; lint = lint->next)
+		if ((int)lint->severity > worst)
+			worst = lint->severity;
+	return (worst);
+}
+
+const char *
+vcl_lint_severity_name(enum vcl_lint_severity severity)
+{
+	assert(severity <= VCL_LINT_ERROR);
+	return (severities[severity]);
+}
+
+int
+vcl_lint_severity(const char *name)
+{
+	int i;
+
+	for (i = VCL_LINT_INFO; i <= VCL_LINT_ERROR; i++)
+		if (!strcmp(name, severities[i]))
+			return (i);
+	return (-1);
+}
+
+void
+vcl_lint_text(struct vsb *vsb, const struct vcl_lint_t *lint)
+{
+	for (; lint != NULL; lint = lint->next)
+		VSB_printf(vsb, "line %u: %s: %s (%s)\n", lint->line,
+		    severities[lint->severity], lint->message, lint->rule);
+}
+
+void
+vcl_lint_json(struct vsb *vsb, const struct vcl_lint_t *lint)
+{
+	int worst = vcl_lint_worst(lint);
+
+	VSB_printf(vsb, "{\n\t\"worst\": ");
+	if (worst >= 0)
+		VSB_printf(vsb, "\"%s\"", severities[worst]);
+	else
+		VSB_cat(vsb, "null");
+	VSB_cat(vsb, ",\n\t\"findings\": [");
+	for (; lint != NULL; lint = lint->next) {
+		VSB_printf(vsb, "\n\t\t{\"line\": %u, \"severity\": \"%s\", "
+		    "\"rule\": \"%s\", \"message\": ", lint->line,
+		    severities[lint->severity], lint->rule);
+		json_quote(vsb, lint->message, -1);
+		VSB_cat(vsb, lint->next ? "}," : "}\n\t");
+	}
+	VSB_cat(vsb, "]\n}\n");
+}
@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The block and index format of the VSL archive, see vsl_archive.h.
+ *
+ * A block is a sequence of items, each starting with a byte:
+ *
+ *   'G' t:double status:u16 nvxid:u16 vxid:u32[nvxid]
+ *       urllen:u16 url backendlen:u16 backend
+ *   'T' vxid:u32 parent:u32 type:u8 reason:u8
+ *   'R' tag:u8 len:u32 data
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "common.h"
+#include "vsl_archive.h"
+
+static void
+archive_put(struct archive_block_t *b, const void *p, size_t len)
+{
+	if (b->len + len > b->size) {
+		b->size = b->size ? b->size * 2 : 65536;
+		while (b->len + len > b->size)
+			b->size *= 2;
+		b->buf = realloc(b->buf, b->size);
+		AN(b->buf);
+	}
+	memcpy(b->buf + b->len, p, len);
+	b->len += len;
+}
+
+static void
+archive_put8(struct archive_block_t *b, unsigned v)
+{
+	uint8_t u = v;
+
+	archive_put(b, &u, sizeof u);
+}
+
+static void
+archive_put16(struct archive_block_t *b, unsigned v)
+{
+	uint16_t u = v;
+
+	archive_put(b, &u, sizeof u);
+}
+
+static void
+archive_put32(struct archive_block_t *b, uint32_t v)
+{
+	archive_put(b, &v, sizeof v);
+}
+
+static uint64_t
+archive_hash(const char *s, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;	// FNV-1a
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 0x100000001b3ULL;
+	}
+	/* Mix, the low bits alone are too alike for similar URLs */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (h);
+}
+
+#define ARCHIVE_BLOOM_BIT(h)	((h) & (ARCHIVE_BLOOM * 64 - 1))
+
+/*
+ * Three bits from one hash. Returns 1 if one of them was not set yet,
+ * that is, for a new key.
+ */
+static int
+archive_bloom_add(uint64_t *bloom, const char *s, size_t len)
+{
+	uint64_t h = archive_hash(s, len), bit;
+	int i, new = 0;
+
+	for (i = 0; i < 3; i++, h >>= 16) {
+		bit = ARCHIVE_BLOOM_BIT(h);
+		if (!(bloom[bit >> 6] & (1ULL << (bit & 0x3f))))
+			new = 1;
+		bloom[bit >> 6] |= 1ULL << (bit & 0x3f);
+	}
+	return (new);
+}
+
+static int
+archive_bloom_has(const uint64_t *bloom, const char *s, size_t len)
+{
+	uint64_t h = archive_hash(s, len), bit;
+	int i;
+
+	for (i = 0; i < 3; i++, h >>= 16) {
+		bit = ARCHIVE_BLOOM_BIT(h);
+		if (!(bloom[bit >> 6] & (1ULL << (bit & 0x3f))))
+			return (0);
+	}
+	return (1);
+}
+
+size_t
+archive_url_prefix(const char *url, unsigned nseg)
+{
+	const char *p = url, *e;
+	unsigned i;
+
+	for (i = 0; i < nseg; i++) {
+		if (*p != '/')
+			return (0);
+		e = p + 1 + strcspn(p + 1, "/?");
+		if (e == p + 1)
+			return (0);
+		p = e;
+	}
+	return (p - url);
+}
+
+/* The name without the VCL in front, "default" for "boot.default" */
+static const char *
+archive_backend_short(const char *backend)
+{
+	const char *p = strrchr(backend, '.');
+
+	return (p != NULL ? p + 1 : backend);
+}
+
+void
+archive_block_group(struct archive_block_t *b,
+    const struct archive_group_t *g)
+{
+	struct archive_idx_t *idx = &b->idx;
+	size_t l, ul = strlen(g->url), bl = strlen(g->backend);
+	unsigned i;
+
+	if (ul > 0xffff)
+		ul = 0xffff;
+	if (bl > 0xffff)
+		bl = 0xffff;
+	archive_put8(b, 'G');
+	archive_put(b, &g->t, sizeof g->t);
+	archive_put16(b, g->status);
+	archive_put16(b, g->nvxid);
+	for (i = 0; i < g->nvxid; i++)
+		archive_put32(b, g->vxid[i]);
+	archive_put16(b, ul);
+	archive_put(b, g->url, ul);
+	archive_put16(b, bl);
+	archive_put(b, g->backend, bl);
+
+	if (idx->groups == 0 || g->t < idx->t_min)
+		idx->t_min = g->t;
+	if (idx->groups == 0 || g->t > idx->t_max)
+		idx->t_max = g->t;
+	idx->groups++;
+	if (g->status > 0 && g->status < 1000)
+		idx->status |= 1U << (g->status / 100);
+	if ((l = archive_url_prefix(g->url, 1)) > 0)
+		b->nurl += archive_bloom_add(idx->url, g->url, l);
+	if ((l = archive_url_prefix(g->url, 2)) > 0)
+		b->nurl += archive_bloom_add(idx->url, g->url, l);
+	if (bl > 0) {
+		b->nbackend += archive_bloom_add(idx->backend, g->backend, bl);
+		b->nbackend += archive_bloom_add(idx->backend,
+		    archive_backend_short(g->backend),
+		    strlen(archive_backend_short(g->backend)));
+	}
+}
+
+void
+archive_block_trans(struct archive_block_t *b, uint32_t vxid,
+    uint32_t parent, unsigned type, unsigned reason)
+{
+	archive_put8(b, 'T');
+	archive_put32(b, vxid);
+	archive_put32(b, parent);
+	archive_put8(b, type);
+	archive_put8(b, reason);
+	if (b->idx.vxid_min == 0 || vxid < b->idx.vxid_min)
+		b->idx.vxid_min = vxid;
+	if (vxid > b->idx.vxid_max)
+		b->idx.vxid_max = vxid;
+}
+
+void
+archive_block_record(struct archive_block_t *b, unsigned tag,
+    const char *data, size_t len)
+{
+	archive_put8(b, 'R');
+	archive_put8(b, tag);
+	archive_put32(b, len);
+	archive_put(b, data, len);
+}
+
+void
+archive_block_reset(struct archive_block_t *b)
+{
+	b->len = 0;
+	b->nurl = b->nbackend = 0;
+	memset(&b->idx, 0, sizeof b->idx);
+}
+
+int
+archive_block_full(const struct archive_block_t *b)
+{
+
+	return (b->nurl >= ARCHIVE_BLOOM_KEYS ||
+	    b->nbackend >= ARCHIVE_BLOOM_KEYS);
+}
+
+int
+archive_block_compress(struct archive_block_t *b, char **out)
+{
+	uLongf clen = compressBound(b->len);
+
+	*out = malloc(clen);
+	AN(*out);
+	/* Speed over size, this runs for every request */
+	if (compress2((Bytef *)*out, &clen, (const Bytef *)b->buf, b->len,
+	    Z_BEST_SPEED) != Z_OK) {
+		free(*out);
+		*out = NULL;
+		return (-1);
+	}
+	b->idx.ulen = b->len;
+	b->idx.clen = clen;
+	return (0);
+}
+
+char *
+archive_block_inflate(const struct archive_idx_t *idx, const char *data)
+{
+	uLongf ulen = idx->ulen;
+	char *buf;
+
+	buf = malloc(ulen + 1);
+	AN(buf);
+	if (uncompress((Bytef *)buf, &ulen, (const Bytef *)data,
+	    idx->clen) != Z_OK || ulen != idx->ulen) {
+		free(buf);
+		return (NULL);
+	}
+	return (buf);
+}
+
+void
+archive_cursor_init(struct archive_cursor_t *c, const char *buf,
+    size_t len)
+{
+	memset(c, 0, sizeof *c);
+	c->p = buf;
+	c->e = buf + len;
+}
+
+static int
+archive_get(struct archive_cursor_t *c, void *p, size_t len)
+{
+	if (c->e - c->p < (ptrdiff_t)len)
+		return (-1);
+	memcpy(p, c->p, len);
+	c->p += len;
+	return (0);
+}
+
+/* A length prefixed string into buf, truncated */
+static int
+archive_get_str(struct archive_cursor_t *c, char *buf, size_t size)
+{
+	uint16_t l;
+
+	if (archive_get(c, &l, sizeof l) || c->e - c->p < l)
+		return (-1);
+	if (l >= size) {
+		memcpy(buf, c->p, size - 1);
+		buf[size - 1] = '\0';
+	} else {
+		memcpy(buf, c->p, l);
+		buf[l] = '\0';
+	}
+	c->p += l;
+	return (0);
+}
+
+int
+archive_next(struct archive_cursor_t *c)
+{
+	struct archive_group_t *g = &c->group;
+	uint8_t kind, u8[2];
+	uint16_t u16[2];
+	uint32_t len;
+
+	if (c->p == c->e)
+		return (0);
+	if (archive_get(c, &kind, 1))
+		return (-1);
+	switch (kind) {
+	case 'G':
+		if (archive_get(c, &g->t, sizeof g->t) ||
+		    archive_get(c, u16, sizeof u16) ||
+		    u16[1] > sizeof g->vxid / sizeof *g->vxid ||
+		    archive_get(c, g->vxid, u16[1] * sizeof *g->vxid) ||
+		    archive_get_str(c, c->url, sizeof c->url) ||
+		    archive_get_str(c, c->backend, sizeof c->backend))
+			return (-1);
+		g->status = u16[0];
+		g->nvxid = u16[1];
+		g->url = c->url;
+		g->backend = c->backend;
+		return ('G');
+	case 'T':
+		if (archive_get(c, &c->vxid, sizeof c->vxid) ||
+		    archive_get(c, &c->parent, sizeof c->parent) ||
+		    archive_get(c, u8, sizeof u8))
+			return (-1);
+		c->type = u8[0];
+		c->reason = u8[1];
+		return ('T');
+	case 'R':
+		if (archive_get(c, u8, 1) ||
+		    archive_get(c, &len, sizeof len) || c->e - c->p < len)
+			return (-1);
+		c->tag = u8[0];
+		c->data = c->p;
+		c->len = len;
+		c->p += len;
+		return ('R');
+	default:
+		return (-1);
+	}
+}
+
+static size_t
+archive_query_url(const struct archive_query_t *q)
+{
+	size_t l;
+
+	if (q->url == NULL)
+		return (0);
+	if ((l = archive_url_prefix(q->url, 2)) == 0)
+		l = archive_url_prefix(q->url, 1);
+	return (l);
+}
+
+int
+archive_idx_match(const struct archive_idx_t *idx,
+    const struct archive_query_t *q)
+{
+	size_t l;
+
+	if (idx->groups == 0)
+		return (0);
+	if ((q->from > 0 && idx->t_max < q->from) ||
+	    (q->to > 0 && idx->t_min > q->to))
+		return (0);
+	if (q->vxid != 0 &&
+	    (q->vxid < idx->vxid_min || q->vxid > idx->vxid_max))
+		return (0);
+	if (q->status != 0 && !(idx->status &
+	    (1U << (q->status < 10 ? q->status : q->status / 100))))
+		return (0);
+	if ((l = archive_query_url(q)) > 0 &&
+	    !archive_bloom_has(idx->url, q->url, l))
+		return (0);
+	if (q->backend != NULL &&
+	    !archive_bloom_has(idx->backend, q->backend, strlen(q->backend)))
+		return (0);
+	return (1);
+}
+
+int
+archive_group_match(const struct archive_group_t *g,
+    const struct archive_query_t *q)
+{
+	size_t l;
+	unsigned i;
+
+	if ((q->from > 0 && g->t < q->from) || (q->to > 0 && g->t > q->to))
+		return (0);
+	if (q->vxid != 0) {
+		for (i = 0; i < g->nvxid && g->vxid[i] != q->vxid; i++)
+			continue;
+		if (i == g->nvxid)
+			return (0);
+	}
+	if (q->status != 0 && (q->status < 10 ?
+	    g->status / 100 != q->status : g->status != q->status))
+		return (0);
+	if (q->url != NULL) {
+		l = strlen(q->url);
+		while (l > 1 && q->url[l - 1] == '/')
+			l--;
+		if (strncmp(g->url, q->url, l) || (q->url[l - 1] != '/' &&
+		    g->url[l] != '\0' && g->url[l] != '/' && g->url[l] != '?'))
+			return (0);
+	}
+	if (q->backend != NULL && strcmp(g->backend, q->backend) &&
+	    strcmp(archive_backend_short(g->backend), q->backend))
+		return (0);
+	return (1);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Following the shmlog, see vsl_tail.h.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <vapi/vsl.h>
+#include <vapi/vsm.h>
+
+#include "common.h"
+#include "instance.h"
+#include "ipc.h"
+#include "vsl_tail.h"
+
+/* Borrow these from vsl_dispatch.c */
+const char * const vsl_t_names[VSL_t__MAX] = {
+	[VSL_t_unknown]	= "unknown",
+	[VSL_t_sess]	= "sess",
+	[VSL_t_req]	= "req",
+	[VSL_t_bereq]	= "bereq",
+	[VSL_t_raw]	= "raw",
+};
+
+const char * const vsl_r_names[VSL_r__MAX] = {
+	[VSL_r_unknown]	= "unknown",
+	[VSL_r_http_1]	= "HTTP/1",
+	[VSL_r_rxreq]	= "rxreq",
+	[VSL_r_esi]	= "esi",
+	[VSL_r_restart]	= "restart",
+	[VSL_r_pass]	= "pass",
+	[VSL_r_fetch]	= "fetch",
+	[VSL_r_bgfetch]	= "bgfetch",
+	[VSL_r_pipe]	= "pipe",
+};
+
+void
+vsl_tail_close(struct vsl_tail_t *t)
+{
+	int g;
+
+	for (g = 0; g < VSL_g__MAX; g++)
+		if (t->vslq[g] != NULL)
+			VSLQ_Delete(&t->vslq[g]);
+	if (t->vsl != NULL)
+		VSL_Delete(t->vsl);
+	if (t->vsm != NULL)
+		VSM_Delete(t->vsm);
+	t->vsl = NULL;
+	t->vsm = NULL;
+	t->open = 0;
+}
+
+static int
+vsl_tail_open(struct vsl_tail_t *t, struct agent_core_t *core, int logger)
+{
+	struct VSL_cursor *c;
+	int g;
+
+	if (t->open)
+		return (1);
+	if (time(NULL) < t->retry)
+		return (0);
+	t->retry = time(NULL) + t->interval;
+	t->vsm = VSM_New();
+	AN(t->vsm);
+	t->vsl = VSL_New();
+	AN(t->vsl);
+	if (VSM_n_Arg(t->vsm, instance_get(core)->n_arg) != 1 ||
+	    VSM_Open(t->vsm) != 0) {
+		if (!t->warned)
+			warnlog(logger, "Can't open the shmlog of %s for %s: "
+			    "%s", instance_get(core)->name, t->what,
+			    VSM_Error(t->vsm));
+		t->warned = 1;
+		vsl_tail_close(t);
+		return (0);
+	}
+	for (g = 0; g < VSL_g__MAX; g++) {
+		if (!(t->groupings & (1U << g)))
+			continue;
+		c = VSL_CursorVSM(t->vsl, t->vsm,
+		    VSL_COPT_TAIL | VSL_COPT_BATCH);
+		if (c == NULL) {
+			warnlog(logger, "Can't open the log: %s",
+			    VSL_Error(t->vsl));
+			vsl_tail_close(t);
+			return (0);
+		}
+		t->vslq[g] = VSLQ_New(t->vsl, &c, g, NULL);
+		AN(t->vslq[g]);
+	}
+	logger(logger, "Opened the shmlog of %s for %s",
+	    instance_get(core)->name, t->what);
+	t->warned = 0;
+	t->open = 1;
+	return (1);
+}
+
+int
+vsl_tail_poll(struct vsl_tail_t *t, struct agent_core_t *core, int logger,
+    VSLQ_dispatch_f *func, void *priv)
+{
+	int g, ret, busy = 0;
+
+	if (!vsl_tail_open(t, core, logger))
+		return (0);
+	for (g = 0; g < VSL_g__MAX; g++) {
+		if (t->vslq[g] == NULL)
+			continue;
+		t->g = g;
+		ret = VSLQ_Dispatch(t->vslq[g], func, priv);
+		if (ret == 1)
+			busy = 1;
+		else if (ret < 0 || (ret == 0 && VSM_Abandoned(t->vsm))) {
+			/* varnishd restarted, or we fell behind */
+			debuglog(logger, "Reopening the shmlog of %s (%d)",
+			    instance_get(core)->name, ret);
+			vsl_tail_close(t);
+			t->retry = 0;
+			return (0);
+		}
+	}
+	return (busy);
+}
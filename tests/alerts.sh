@@ -0,0 +1,34 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+init_all
+
+is_running
+
+RULE='{"expr": "rate(MAIN.client_req) > 0", "clear": 10, "url": "http://localhost:'${backendport}'/alert"}'
+test_it PUT alerts/req "$RULE" "Rule stored"
+test_it_long GET alerts "" '"name": "req", "expr": "rate(MAIN.client_req) > 0", "for": 0, "clear": 10'
+test_it_long_fail PUT alerts/bad '{"expr": "rate(MAIN.client_req"}' "Expected ')' at the end"
+test_it_long_fail PUT alerts/bad '{"expr": "foo(MAIN.client_req)"}' "Unknown function at column 4"
+test_it_long_fail PUT alerts/bad '{"for": 1}' "expr must be a string"
+test_it_long_fail PUT "alerts/b%20d" "$RULE" "Rule names are"
+
+sleep 2
+test_it_long GET alerts/req "" '"state": "ok"'
+GET "http://localhost:${VARNISH_PORT}/alert/1" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/alert/2" > /dev/null
+sleep 2
+# The backend answers POST with 501, so the alert fired but isn't delivered
+test_it_long GET alerts/req "" '"state": "\(firing\|resolving\)", "since": [0-9]*, "value": 0, "notified": false'
+test_json alerts
+
+test_it DELETE alerts/req "" "Rule removed"
+test_it_long_fail GET alerts/req "" "No such rule"
+test_it_long GET help/alerts "" "delta(c)"
+
+exit $ret
@@ -0,0 +1,37 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-Y fragmentation"
+init_all
+
+is_running
+
+test_it_long GET analysis "" '"name": "fragmentation", "grouping": "request", "enabled": true'
+test_it_long GET analysis "" '"name": "esi", "grouping": "request", "enabled": false'
+test_json analysis
+
+# Give the analyzer a moment to start tailing the log
+sleep 1
+GET "http://localhost:${VARNISH_PORT}/frag?a=1&b=2" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/frag?b=2&a=1&utm_source=test" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/frag?a=1&b=2" > /dev/null
+sleep 1
+
+test_it_long GET analysis/fragmentation "" '"requests": 3, "hits": 1, "misses": 2'
+test_it_long GET analysis/fragmentation "" '"wasted_misses": 1'
+test_it_long GET analysis/fragmentation "" '"cause": "param-order", "requests": 1, "wasted_misses": 1'
+test_it_long GET analysis/fragmentation "" '"cause": "param:utm_source"'
+test_it_long GET analysis/fragmentation "" '"key": "localhost.*/frag?a=1&b=2", "requests": 3'
+test_json analysis/fragmentation
+
+test_it_long DELETE analysis/fragmentation "" '"groups": 0'
+test_it_long_fail GET analysis/nope "" "No such analyzer"
+test_it_long_fail GET analysis/esi "" "Analyzer not enabled"
+test_it_long GET help/analysis "" "fragmentation - "
+
+exit $ret
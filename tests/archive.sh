@@ -0,0 +1,48 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-A ${TMPDIR}/archive -M 16"
+init_all
+
+is_running
+
+cat ${TMPDIR}/boot.vcl > ${TMPDIR}/archive.vcl
+echo 'sub vcl_recv { if (req.url ~ "^/api/fail") { return (synth(503)); } }' >> ${TMPDIR}/archive.vcl
+test_it_long PUT vcl/archive "$(cat ${TMPDIR}/archive.vcl)" "VCL compiled."
+test_it PUT vcldeploy/archive "" "VCL 'archive' now active"
+
+sleep 1
+GET "http://localhost:${VARNISH_PORT}/api/ok" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/api/fail/1" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/apix" > /dev/null
+# Blocks are written after a few seconds
+sleep 7
+
+if ls ${TMPDIR}/archive/vsl-*.idx > /dev/null 2>&1; then
+	pass
+else
+	fail "No archive segment in ${TMPDIR}/archive"
+fi
+inc
+
+test_it_long GET "log/archive?url=/api&status=5xx" "" '"value": "/api/fail/1"'
+test_it_long GET "log/archive?url=/api&status=5xx" "" '"groups": 1,'
+test_it_long GET "log/archive?url=/api&status=200" "" '"value": "/api/ok"'
+test_it_long GET "log/archive?url=/api/nothing" "" '"log": \[ \], .* "groups": 0,'
+test_it_long GET "log/archive?backend=nothing" "" '"groups": 0, .* "inflated": 0'
+test_it_long GET "log/archive?url=/apix&limit=1" "" '"groups": 1,'
+test_it_long GET "log/archive?url=/api&status=5xx&next=0.0" "" '"groups": 1,'
+test_json "log/archive?status=503"
+test_it_fail GET "log/archive?next=soon" "" "Bad next"
+# /batch passes the query string on
+test_it_long POST batch '[{"path": "/log/archive?next=soon"}]' '"status": 400, .*"body": "Bad next'
+test_it_fail GET "log/archive?status=5x" "" "Bad status, must be like 503 or 5xx"
+test_it_fail GET "log/archive?from=yesterday" "" "Bad time in from"
+test_it_long GET log/archive/stats "" '"enabled": true, "cap": 16777216,'
+
+exit $ret
@@ -54,4 +54,13 @@ for tmo in -1 0 2s; do
 	inc
 done
 
+# listener count parsing
+for l in -1 0 2x; do
+	$ORIGPWD/../src/varnish-agent -l $l -h 2>&1 | grep -q "Invalid number of listeners"
+	if [ $? -eq "0" ]; then pass;
+	else fail "Invalid number of listeners not caught: $l"
+	fi
+	inc
+done
+
 exit $ret
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-Y backendconn"
+init_all
+
+is_running
+
+# Give the analyzer a moment to start tailing the log
+sleep 1
+# The test backend speaks HTTP/1.0, so no connection is reused
+GET "http://localhost:${VARNISH_PORT}/conn/1" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/conn/2" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/conn/3" > /dev/null
+sleep 2
+
+test_it_long GET analysis/backendconn "" '"fetches": 3'
+test_it_long GET analysis/backendconn "" '"backend_conn": 3, "backend_reuse": 0'
+test_it_long GET analysis/backendconn "" '"backend": "[^"]*default", "fetches": 3, "opens": 3, "reuses": 0, "recycles": 0, "closes": 3'
+test_it_long GET analysis/backendconn "" '"lifetime_ms": {"n": 3'
+test_json analysis/backendconn
+test_it_long GET help/analysis "" "backendconn - "
+
+exit $ret
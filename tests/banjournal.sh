@@ -0,0 +1,39 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-j"
+init_all
+
+is_running
+
+test_it POST ban "req.url ~ /journal1" ""
+test_it POST ban "req.url ~ /journal1" "Retry of a ban just added, not added again"
+test_it POST ban "req.url ~ /journal2" ""
+if [ "$(grep -c 'req.url ~ /journal' ${TMPDIR}/vcl/ban.journal)" = "2" ]; then pass; else fail "Journal: $(cat ${TMPDIR}/vcl/ban.journal)"; fi
+inc
+
+# Past the retry window, a repeat is a new ban
+sleep 6
+test_it POST ban "req.url ~ /journal1" ""
+if [ "$(grep -c 'req.url ~ /journal1' ${TMPDIR}/vcl/ban.journal)" = "2" ]; then pass; else fail "Repeat: $(cat ${TMPDIR}/vcl/ban.journal)"; fi
+inc
+
+# The bans are gone with the child, and come back once it runs again
+C=$(lwp-request -m GET http://${PASS}@localhost:${AGENT_PORT}/events |
+    grep -o '"cursor": [0-9]*' | cut -d' ' -f2)
+test_it PUT stop "" ""
+sleep 2
+test_it PUT start "" ""
+sleep 3
+test_it_long GET ban "" "/journal1.*/journal2"
+test_it_long GET events/$C "" '"type": "ban.replay", "data": {"instance": ".*", "bans": "2"}'
+N=$(lwp-request -m GET http://${PASS}@localhost:${AGENT_PORT}/ban | grep -c '/journal1')
+if [ "$N" = "1" ]; then pass; else fail "Replayed more than once: $N"; fi
+inc
+
+exit $ret
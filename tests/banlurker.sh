@@ -0,0 +1,41 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-L"
+init_all
+
+is_running
+
+# The boot VCL doesn't set x-url, so bans stay on req.url
+test_it_long GET banlurker "" '"enabled": true, "vcl": "boot", "ready": false'
+test_it_no_content POST ban/lurk1 ""
+test_it_long GET ban "" "req.url ~ //lurk1"
+
+# With the snippet included they are rewritten
+cp ${TMPDIR}/boot.vcl ${TMPDIR}/lurker.vcl
+lwp-request -m GET http://${PASS}@localhost:${AGENT_PORT}/banlurker/vcl >>${TMPDIR}/lurker.vcl
+test_it_long GET banlurker/vcl "" "set beresp.http.x-url = bereq.url;"
+test_it_long PUT vcl/lurker "$(cat ${TMPDIR}/lurker.vcl)" ""
+test_it PUT vcldeploy/lurker "" "VCL 'lurker' now active"
+test_it_long GET banlurker "" '"vcl": "lurker", "ready": true'
+test_it_no_content POST ban/lurk2 ""
+test_it_long GET ban "" "obj.http.x-url ~ //lurk2"
+test_it POST ban "req.http.host == example.com && req.url ~ /lurk3" ""
+test_it_long GET ban "" "obj.http.x-host == example.com && obj.http.x-url ~ /lurk3"
+
+# Only the fields are rewritten, not the arguments
+test_it POST ban "req.url ~ /lurk5/req.url" ""
+test_it_long GET ban "" "obj.http.x-url ~ /lurk5/req.url"
+test_it POST ban 'req.url ~ "/lurk6/req.http.cookie"' ""
+test_it_long GET ban "" "obj.http.x-url ~ .\?/lurk6/req.http.cookie"
+
+# Anything else of req is left alone
+test_it POST ban "req.http.cookie ~ lurk4" ""
+test_it_long GET ban "" "req.http.cookie ~ lurk4"
+
+exit $ret
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+init_all
+
+is_running
+
+BATCH='[{"method": "GET", "path": "/status"},
+	{"method": "GET", "path": "/vcljson/"},
+	{"path": "/paramjson/"},
+	{"method": "PUT", "path": "/echo", "body": "Foo\\"bar"},
+	{"method": "POST", "path": "/batch", "body": "[]"},
+	{"method": "GET", "path": "/nonexistent"}]'
+
+test_it_long POST batch "$BATCH" '"body": "Child in state running"'
+test_it_long POST batch "$BATCH" '"content_type": "application/json"'
+test_it_long POST batch "$BATCH" '"body": "Foo\\"bar"'
+test_it_long POST batch "$BATCH" '"status": 400, "content_type": null, "body": "Nested batch"'
+test_it_long POST batch "$BATCH" '"status": 500'
+
+NAME="${TMPDIR}/batch.json"
+echo -e "$BATCH" | lwp-request -m POST "http://${PASS}@localhost:${AGENT_PORT}/batch" > $NAME
+FOO=$(jsonlint -v $NAME)
+if [ "x$?" = "x0" ]; then pass; else fail "batch reply is not JSON: $FOO"; fi
+inc
+if [ "$(grep -c '"status"' $NAME)" = "6" ]; then pass; else fail "batch reply has the wrong number of responses"; fi
+inc
+
+ARGS32=$(seq -s '&' 0 32 | sed 's/[0-9]*/a&=1/g')
+test_it_long POST batch "[{\"path\": \"/status?$ARGS32\"}]" '"status": 400, "content_type": null, "body": "Too many query arguments'
+
+test_it_long_fail POST batch "{}" "Expected a JSON array"
+test_it_long_fail POST batch "[1," "Expected a JSON array"
+
+exit $ret
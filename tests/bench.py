@@ -0,0 +1,111 @@
+#!/usr/bin/python
+#
+# Load generator for tests/bench.sh.
+#
+# Drives the given agent endpoints round-robin from a fixed number of
+# threads, each with its own keep-alive connection, for a fixed time.
+# Reports requests, errors, throughput and p50/p99/p999 latency per
+# endpoint.
+#
+# Usage: bench.py [-c concurrency] [-d seconds] [-a user:pass]
+#                 host:port endpoint...
+
+import argparse
+import base64
+import sys
+import threading
+import time
+
+try:
+    import http.client as httplib
+except ImportError:
+    import httplib
+
+def percentile(sorted_samples, q):
+    if not sorted_samples:
+        return 0.0
+    i = int(q * len(sorted_samples))
+    return sorted_samples[min(i, len(sorted_samples) - 1)]
+
+class Worker(threading.Thread):
+    def __init__(self, opts, start_at, stop_at, offset):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.opts = opts
+        self.start_at = start_at
+        self.stop_at = stop_at
+        self.offset = offset
+        self.samples = dict((e, []) for e in opts.endpoints)
+        self.errors = dict((e, 0) for e in opts.endpoints)
+
+    def connect(self):
+        host, _, port = self.opts.target.rpartition(':')
+        return httplib.HTTPConnection(host or 'localhost', int(port),
+            timeout=10)
+
+    def run(self):
+        conn = self.connect()
+        n = self.offset
+        eps = self.opts.endpoints
+        while time.time() < self.start_at:
+            time.sleep(0.001)
+        while time.time() < self.stop_at:
+            ep = eps[n % len(eps)]
+            n += 1
+            t0 = time.time()
+            try:
+                conn.request('GET', '/' + ep.lstrip('/'),
+                    headers=self.opts.headers)
+                r = conn.getresponse()
+                r.read()
+                ok = r.status == 200
+            except (httplib.HTTPException, IOError):
+                ok = False
+                conn.close()
+                conn = self.connect()
+            if ok:
+                self.samples[ep].append(time.time() - t0)
+            else:
+                self.errors[ep] += 1
+        conn.close()
+
+def main():
+    p = argparse.ArgumentParser(description='varnish-agent load generator')
+    p.add_argument('-c', type=int, default=8, dest='concurrency',
+        help='concurrent connections (default 8)')
+    p.add_argument('-d', type=float, default=10, dest='duration',
+        help='seconds to run (default 10)')
+    p.add_argument('-a', dest='auth', help='user:pass for basic auth')
+    p.add_argument('target', help='agent host:port')
+    p.add_argument('endpoints', nargs='+')
+    opts = p.parse_args()
+    opts.headers = {}
+    if opts.auth:
+        opts.headers['Authorization'] = 'Basic ' + \
+            base64.b64encode(opts.auth.encode()).decode()
+
+    start_at = time.time() + 0.2
+    stop_at = start_at + opts.duration
+    workers = [Worker(opts, start_at, stop_at, i)
+        for i in range(opts.concurrency)]
+    for w in workers:
+        w.start()
+    for w in workers:
+        w.join()
+
+    sys.stdout.write('%-16s %9s %7s %10s %9s %9s %9s\n' % ('endpoint',
+        'requests', 'errors', 'req/s', 'p50 ms', 'p99 ms', 'p999 ms'))
+    total = 0
+    for ep in opts.endpoints:
+        s = sorted(x for w in workers for x in w.samples[ep])
+        errors = sum(w.errors[ep] for w in workers)
+        total += len(s)
+        sys.stdout.write('%-16s %9d %7d %10.1f %9.3f %9.3f %9.3f\n' % (
+            ep, len(s), errors, len(s) / opts.duration,
+            percentile(s, 0.50) * 1000, percentile(s, 0.99) * 1000,
+            percentile(s, 0.999) * 1000))
+    sys.stdout.write('%-16s %9d %7s %10.1f\n' % ('total', total, '',
+        total / opts.duration))
+
+if __name__ == '__main__':
+    main()
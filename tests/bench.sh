@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# Benchmark the agent against fake_varnishd.py, a stand-in for the
+# varnishd management interface, and report throughput and latency per
+# endpoint. Not part of "make check"; run it with "make bench".
+#
+# Tunables (environment):
+#   BENCH_SIZE         VCLs, backends, parameters and bans served (1000)
+#   BENCH_LATENCY      CLI reply latency, "[command=]ms", space separated (0)
+#   BENCH_CONCURRENCY  concurrent HTTP connections (8)
+#   BENCH_DURATION     seconds per run (10)
+#   BENCH_ENDPOINTS    agent endpoints to drive
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+BENCH_SIZE="${BENCH_SIZE:-1000}"
+BENCH_LATENCY="${BENCH_LATENCY:-0}"
+BENCH_CONCURRENCY="${BENCH_CONCURRENCY:-8}"
+BENCH_DURATION="${BENCH_DURATION:-10}"
+BENCH_ENDPOINTS="${BENCH_ENDPOINTS:-ping status vclactive vcljson/ paramjson/ backendjson/ ban}"
+CLI_LOG="${TMPDIR}/fake_varnishd.log"
+
+start_fake_varnishd() {
+	head -c 16 /dev/urandom > "$TMPDIR/secret"
+	printf "Starting fake varnishd: "
+	LATENCY=""
+	for l in $BENCH_LATENCY; do
+		LATENCY="$LATENCY -l $l"
+	done
+	python -u fake_varnishd.py -S "$TMPDIR/secret" -s "$BENCH_SIZE" \
+	    $LATENCY >"$CLI_LOG" 2>&1 &
+	echo $! > "$VARNISH_PID"
+	for i in x x x x x x x x x x; do
+		sleep 0.2
+		CLI_PORT=$(grep -F 'Serving CLI' "$CLI_LOG" | awk '{print $6}')
+		[ -n "$CLI_PORT" ] && break
+	done
+	if [ -z "$CLI_PORT" ]; then
+		echo "Unable to start fake varnishd."
+		cat "$CLI_LOG"
+		exit 1
+	fi
+	echo "pid $(cat $VARNISH_PID), port $CLI_PORT."
+}
+
+bench_cleanup() {
+	echo -n "Stopping: "
+	stop_agent
+	stop_varnish
+	echo
+	rm -rf ${TMPDIR}
+}
+
+trap 'bench_cleanup' EXIT
+mkdir -p ${TMPDIR}/vcl ${TMPDIR}/html
+init_password
+start_fake_varnishd
+ARGS="-T 127.0.0.1:$CLI_PORT -S $TMPDIR/secret"
+start_agent
+
+echo "Size $BENCH_SIZE, latency ${BENCH_LATENCY}ms," \
+    "concurrency $BENCH_CONCURRENCY, ${BENCH_DURATION}s"
+python bench.py -c "$BENCH_CONCURRENCY" -d "$BENCH_DURATION" -a "$PASS" \
+    localhost:$AGENT_PORT $BENCH_ENDPOINTS
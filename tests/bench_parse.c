@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmarks for what runs on every dashboard poll: the parsers
+ * turning varnishd CLI output into JSON, the /log callback and
+ * VSB_quote().
+ *
+ * The CLI parsers read the outputs in datadir, at 10 and 1000 VCLs,
+ * backends and parameters, 10000 too with -L (fake_varnishd.py -w
+ * writes them, "make bench" into bench-data/), and in the formatting
+ * of a real varnishd 4.1 (<command>.real): long
+ * backend names, Sick and "(no probe)" backends, wrapped multi-paragraph
+ * parameter descriptions, "Default is:" lines and quoted values.
+ * vlog_cb_func() is fed a VSL file of as many records, written at start
+ * with the tag numbers of the libvarnishapi we are linked with, and read
+ * back through VSLQ like /log does. "log/dispatch" is the same without
+ * formatting, the floor vlog_cb_func() adds to. The modules are
+ * included here so their static functions can be called directly.
+ *
+ * Usage: bench_parse [-d datadir] [-t seconds] [-o results]
+ *                    [-c baseline] [-T threshold] [-L]
+ */
+
+#include "modules/vcl.c"
+#include "modules/vbackends.c"
+#include "modules/vparams.c"
+#include "modules/vlog.c"
+#include "microbench.h"
+
+#include <limits.h>
+#include <stdarg.h>
+#include <vapi/vsl_int.h>
+
+int threads_started = 0;
+
+static const unsigned sizes[] = { 10, 1000, 10000 };
+#define NSIZES (sizeof sizes / sizeof sizes[0])
+
+/* The 10000 cases take long, param.show/10000 half a minute per op */
+static unsigned nsizes = NSIZES - 1;
+
+struct bench_input_t {
+	char *raw;
+	char *copy;
+	size_t len;
+};
+
+struct bench_vlog_t {
+	char path[1024];
+	unsigned records;
+	unsigned n;
+	struct vlog_req_priv vrp;
+};
+
+struct bench_quote_t {
+	const char *s;
+	int len;
+	struct vsb *vsb;
+};
+
+static void
+bench_vcl_list(void *priv)
+{
+	struct bench_input_t *in = priv;
+
+	VSB_delete(vcl_list_json(in->raw));
+}
+
+/*
+ * Like the HTTP handlers, every op builds its reply in a new vsb.
+ * vbackends_show_json() tokenizes its input in place, so it also gets a
+ * fresh copy every time.
+ */
+static void
+bench_backend_list(void *priv)
+{
+	struct bench_input_t *in = priv;
+	struct vsb *vsb;
+
+	memcpy(in->copy, in->raw, in->len + 1);
+	vsb = VSB_new_auto();
+	AN(vsb);
+	vbackends_show_json(vsb, in->copy);
+	VSB_delete(vsb);
+}
+
+static void
+bench_param_show(void *priv)
+{
+	struct bench_input_t *in = priv;
+	struct vsb *vsb;
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	vparams_show_json(vsb, in->raw);
+	VSB_delete(vsb);
+}
+
+static int
+count_cb(struct VSL_data *vsl, struct VSL_transaction * const trans[],
+    void *priv)
+{
+	unsigned *n = priv;
+	int i;
+
+	(void)vsl;
+	for (i = 0; trans[i] != NULL; i++)
+		while (VSL_Next(trans[i]->c) == 1)
+			(*n)++;
+	return (0);
+}
+
+static void
+vlog_dispatch(const char *path, VSLQ_dispatch_f *func, void *priv)
+{
+	struct VSL_data *vsl;
+	struct VSL_cursor *c;
+	struct VSLQ *vslq;
+
+	vsl = VSL_New();
+	AN(vsl);
+	c = VSL_CursorFile(vsl, path, 0);
+	AN(c);
+	vslq = VSLQ_New(vsl, &c, VSL_g_request, NULL);
+	AN(vslq);
+	while (VSLQ_Dispatch(vslq, func, priv) > 0)
+		continue;
+	(void)VSLQ_Flush(vslq, func, priv);
+	VSLQ_Delete(&vslq);
+	VSL_Delete(vsl);
+}
+
+static void
+bench_log_dispatch(void *priv)
+{
+	struct bench_vlog_t *bv = priv;
+
+	bv->n = 0;
+	vlog_dispatch(bv->path, count_cb, &bv->n);
+}
+
+static void
+bench_vlog_cb(void *priv)
+{
+	struct bench_vlog_t *bv = priv;
+
+	bv->vrp.answer = VSB_new_auto();
+	AN(bv->vrp.answer);
+	bv->vrp.entries = 0;
+	vlog_dispatch(bv->path, vlog_cb_func, &bv->vrp);
+	bv->n = bv->vrp.entries;
+	VSB_delete(bv->vrp.answer);
+}
+
+/*
+ * VSB_quote() appends to a reply already being built, so it reuses one.
+ */
+static void
+bench_quote(void *priv)
+{
+	struct bench_quote_t *q = priv;
+
+	VSB_clear(q->vsb);
+	VSB_quote(q->vsb, q->s, q->len, 0);
+}
+
+static void
+vsl_record(FILE *f, enum VSL_tag_e tag, unsigned vxid, const char *fmt, ...)
+{
+	uint32_t w[2], pad = 0;
+	char buf[512];
+	va_list ap;
+	int l;
+
+	va_start(ap, fmt);
+	l = vsnprintf(buf, sizeof buf, fmt, ap) + 1;
+	va_end(ap);
+	assert(l > 0 && l <= (int)sizeof buf);
+	w[0] = ((uint32_t)tag << 24) | l;
+	w[1] = vxid | VSL_CLIENTMARKER;
+	AN(fwrite(w, sizeof w, 1, f));
+	AN(fwrite(buf, l, 1, f));
+	if (VSL_BYTES(VSL_WORDS(l)) > l)
+		AN(fwrite(&pad, VSL_BYTES(VSL_WORDS(l)) - l, 1, f));
+}
+
+/*
+ * Requests of ten records each, with a User-Agent that needs quoting.
+ */
+static int
+vlog_fixture(struct bench_vlog_t *bv, unsigned records)
+{
+	const char *tmp;
+	unsigned u, vxid;
+	FILE *f;
+	int fd;
+
+	tmp = getenv("TMPDIR");
+	snprintf(bv->path, sizeof bv->path, "%s/vlog-bench.XXXXXX",
+	    tmp ? tmp : "/tmp");
+	fd = mkstemp(bv->path);
+	if (fd < 0)
+		return (-1);
+	f = fdopen(fd, "w");
+	AN(f);
+	AN(fwrite(VSL_FILE_ID, sizeof VSL_FILE_ID, 1, f));
+	for (u = 0; u < records / 10; u++) {
+		vxid = 1000 + u;
+		vsl_record(f, SLT_Begin, vxid, "req %u rxreq", vxid / 2);
+		vsl_record(f, SLT_ReqStart, vxid, "127.0.0.1 %u", 40000 + u);
+		vsl_record(f, SLT_ReqMethod, vxid, "GET");
+		vsl_record(f, SLT_ReqURL, vxid, "/bench/%u?q=%u", u, u * 7);
+		vsl_record(f, SLT_ReqProtocol, vxid, "HTTP/1.1");
+		vsl_record(f, SLT_ReqHeader, vxid, "Host: bench.example.com");
+		vsl_record(f, SLT_ReqHeader, vxid, "User-Agent: Mozilla/5.0 "
+		    "(X11; \"bench\" \\%u\\)", u);
+		vsl_record(f, SLT_RespStatus, vxid, "200");
+		vsl_record(f, SLT_Timestamp, vxid, "Resp: %u.%06u 0.000%03u "
+		    "0.000010", 1500000000 + u, u % 1000000, u % 1000);
+		vsl_record(f, SLT_End, vxid, "%s", "");
+	}
+	bv->records = records;
+	return (fclose(f));
+}
+
+static char *
+slurp(const char *dir, const char *cmd, const char *size, size_t *len)
+{
+	char path[1024], *buf;
+	FILE *f;
+	long l;
+
+	snprintf(path, sizeof path, "%s/%s.%s", dir, cmd, size);
+	f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	AZ(fseek(f, 0, SEEK_END));
+	l = ftell(f);
+	assert(l >= 0);
+	rewind(f);
+	buf = malloc(l + 1);
+	AN(buf);
+	assert(fread(buf, 1, l, f) == (size_t)l);
+	buf[l] = '\0';
+	(void)fclose(f);
+	*len = l;
+	return (buf);
+}
+
+static void
+run(const char *name, mb_func_f *f, void *priv, double seconds,
+    const char *extra)
+{
+	struct mb_result r;
+
+	mb_run(&r, name, f, priv, seconds);
+	mb_print(&r, extra);
+}
+
+static void
+run_cli_one(const char *dir, const char *cmd, const char *size, mb_func_f *f,
+    double seconds)
+{
+	struct bench_input_t in;
+	char name[64];
+
+	in.raw = slurp(dir, cmd, size, &in.len);
+	in.copy = malloc(in.len + 1);
+	AN(in.copy);
+	snprintf(name, sizeof name, "cli/%s/%s", cmd, size);
+	run(name, f, &in, seconds, NULL);
+	free(in.copy);
+	free(in.raw);
+}
+
+static void
+run_cli(const char *dir, const char *cmd, mb_func_f *f, double seconds)
+{
+	char size[16];
+	unsigned u;
+
+	for (u = 0; u < nsizes; u++) {
+		snprintf(size, sizeof size, "%u", sizes[u]);
+		run_cli_one(dir, cmd, size, f, seconds);
+	}
+	run_cli_one(dir, cmd, "real", f, seconds);
+}
+
+static void
+run_vlog(double seconds)
+{
+	struct bench_vlog_t bv;
+	char name[64], extra[64];
+	unsigned u;
+
+	memset(&bv, 0, sizeof bv);
+	bv.vrp.limit = UINT_MAX;
+	for (u = 0; u < nsizes; u++) {
+		if (vlog_fixture(&bv, sizes[u])) {
+			fprintf(stderr, "Cannot write %s: %s\n", bv.path,
+			    strerror(errno));
+			exit(1);
+		}
+		snprintf(name, sizeof name, "log/dispatch/%u", sizes[u]);
+		run(name, bench_log_dispatch, &bv, seconds, NULL);
+		snprintf(name, sizeof name, "log/vlog_cb_func/%u", sizes[u]);
+		bench_vlog_cb(&bv);
+		snprintf(extra, sizeof extra, "%u of %u records", bv.n,
+		    bv.records);
+		run(name, bench_vlog_cb, &bv, seconds, extra);
+		(void)unlink(bv.path);
+	}
+}
+
+static void
+run_quote(double seconds)
+{
+	static const char *plain = "/bench/some/path/to/an/object.html";
+	static const char *escaped = "Mozilla/5.0 (X11; \"bench\" \\1\\) "
+	    "\"quoted\"\ttabbed\r\n";
+	struct bench_quote_t q;
+	char *lng;
+	int i;
+
+	q.vsb = VSB_new_auto();
+	AN(q.vsb);
+	q.s = plain;
+	q.len = strlen(plain);
+	run("quote/plain", bench_quote, &q, seconds, NULL);
+	q.s = escaped;
+	q.len = strlen(escaped);
+	run("quote/escaped", bench_quote, &q, seconds, NULL);
+	lng = malloc(4097);
+	AN(lng);
+	for (i = 0; i < 4096; i++)
+		lng[i] = i % 64 == 63 ? '"' : 'a' + i % 26;
+	lng[4096] = '\0';
+	q.s = lng;
+	q.len = 4096;
+	run("quote/4k", bench_quote, &q, seconds, NULL);
+	free(lng);
+	VSB_delete(q.vsb);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-d datadir] [-t seconds] [-o results] "
+	    "[-c baseline] [-T threshold] [-L]\n", argv0);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *dir = "bench-data";
+	double seconds = 1.0, threshold = 10.0;
+	const char *out = NULL, *base = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:t:o:c:T:Lh")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 't':
+			seconds = strtod(optarg, NULL);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'c':
+			base = optarg;
+			break;
+		case 'T':
+			threshold = strtod(optarg, NULL);
+			break;
+		case 'L':
+			nsizes = NSIZES;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (out != NULL && mb_record(out)) {
+		fprintf(stderr, "Cannot write %s: %s\n", out, strerror(errno));
+		return (1);
+	}
+	if (base != NULL && mb_compare(base, threshold)) {
+		fprintf(stderr, "Cannot read %s: %s\n", base, strerror(errno));
+		return (1);
+	}
+
+	mb_print_header();
+	run_cli(dir, "vcl.list", bench_vcl_list, seconds);
+	run_cli(dir, "backend.list", bench_backend_list, seconds);
+	run_cli(dir, "param.show", bench_param_show, seconds);
+	run_vlog(seconds);
+	run_quote(seconds);
+	return (mb_done() ? 1 : 0);
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmarks for the /stats formats, at 10k+ counters.
+ *
+ * vsm_fixture() writes a synthetic shmlog with as many VBE, SMA and LCK
+ * blocks as asked for, which is opened like any other and fed through
+ * the serializers of the vstat module, included here so its static
+ * functions can be called directly. "iterate" is VSC_Iter() alone, the
+ * floor every format pays.
+ *
+ * Usage: bench_stats [-b backends] [-s storages] [-l locks] [-t seconds]
+ */
+
+
+#include "modules/vstat.c"
+#include "microbench.h"
+
+int threads_started = 0;
+
+struct bench_stats_t {
+	struct VSM_data *vd;
+	struct vsb *vsb;
+	struct vstat_udp_t udp;
+	struct vstat_udp_inst_t in;
+	unsigned n;
+};
+
+static int
+count_cb(void *priv, const struct VSC_point * const pt)
+{
+	unsigned *n = priv;
+
+	if (pt != NULL)
+		(*n)++;
+	return (0);
+}
+
+static void
+bench_iterate(void *priv)
+{
+	struct bench_stats_t *b = priv;
+
+	b->n = 0;
+	(void)VSC_Iter(b->vd, NULL, count_cb, &b->n);
+}
+
+static void
+bench_json(void *priv)
+{
+	struct bench_stats_t *b = priv;
+
+	VSB_clear(b->vsb);
+	do_json(b->vd, b->vsb);
+}
+
+static void
+bench_compact(void *priv)
+{
+	struct bench_stats_t *b = priv;
+
+	VSB_clear(b->vsb);
+	do_compact(b->vd, b->vsb);
+}
+
+/*
+ * What vstat_udp_emit() does for an instance, short of sending.
+ */
+static void
+bench_udp(void *priv)
+{
+	struct bench_stats_t *b = priv;
+	struct vstat_udp_t *udp = &b->udp;
+
+	udp->in = &b->in;
+	udp->k = 0;
+	udp->now = time(NULL);
+	udp->dt = 1.0;
+	udp->npkt = 0;
+	VSB_clear(udp->buf);
+	(void)VSC_Iter(b->vd, NULL, vstat_udp_cb, udp);
+	AZ(VSB_finish(udp->buf));
+}
+
+static void
+report(struct bench_stats_t *b, const char *name, mb_func_f *f,
+    struct vsb *out, double seconds)
+{
+	struct mb_result r;
+	char extra[128];
+
+	mb_run(&r, name, f, b, seconds);
+	if (out != NULL)
+		snprintf(extra, sizeof extra, "%8.1f ns/counter %9zd bytes",
+		    r.ns_op / b->n, VSB_len(out));
+	else
+		snprintf(extra, sizeof extra, "%8.1f ns/counter", r.ns_op / b->n);
+	mb_print(&r, extra);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-b backends] [-s storages] "
+	    "[-l locks] [-t seconds]\n", argv0);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_stats_t b;
+	unsigned nvbe = 1000, nsma = 4, nlck = 30;
+	double seconds = 2.0;
+	char dir[1024], path[1100];
+	const char *tmp;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:s:l:t:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			nvbe = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			nsma = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			nlck = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			seconds = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	tmp = getenv("TMPDIR");
+	snprintf(dir, sizeof dir, "%s/vstat-bench.XXXXXX", tmp ? tmp : "/tmp");
+	if (mkdtemp(dir) == NULL || vsm_fixture(dir, nvbe, nsma, nlck)) {
+		fprintf(stderr, "Cannot write fixture in %s: %s\n", dir,
+		    strerror(errno));
+		return (1);
+	}
+
+	memset(&b, 0, sizeof b);
+	b.vd = VSM_New();
+	AN(b.vd);
+	assert(VSM_n_Arg(b.vd, dir) == 1);
+	if (VSM_Open(b.vd)) {
+		fprintf(stderr, "Cannot open fixture: %s\n", VSM_Error(b.vd));
+		return (1);
+	}
+	b.vsb = VSB_new_auto();
+	AN(b.vsb);
+	b.udp.prefix = strdup("varnish");
+	b.udp.mtu = VSTAT_UDP_MTU;
+	b.udp.buf = VSB_new_auto();
+	AN(b.udp.buf);
+
+	bench_iterate(&b);
+	printf("Counters: %u (%u VBE, %u SMA, %u LCK blocks)\n", b.n, nvbe,
+	    nsma, nlck);
+	mb_print_header();
+	report(&b, "stats/iterate", bench_iterate, NULL, seconds);
+	report(&b, "stats/json", bench_json, b.vsb, seconds);
+	report(&b, "stats/compact", bench_compact, b.vsb, seconds);
+	b.udp.graphite = 0;
+	report(&b, "stats/statsd", bench_udp, b.udp.buf, seconds);
+	b.udp.graphite = 1;
+	report(&b, "stats/graphite", bench_udp, b.udp.buf, seconds);
+
+	VSM_Delete(b.vd);
+	snprintf(path, sizeof path, "%s/_.vsm", dir);
+	(void)unlink(path);
+	(void)rmdir(dir);
+	return (0);
+}
@@ -0,0 +1,36 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+# One live peer agent, watching the same varnishd, and one dead peer.
+PEER_PORT=$(( 1024 + ( $RANDOM % 48000 ) ))
+echo -e "localhost:${PEER_PORT}\nlocalhost:1" > ${TMPDIR}/peers
+ARGS="-f ${TMPDIR}/peers"
+init_all
+
+printf "Starting peer agent on port $PEER_PORT: "
+mkdir -p ${TMPDIR}/vcl-peer
+$ORIGPWD/../src/varnish-agent -K ${TMPDIR}/agent-secret -n ${TMPDIR} \
+	-p ${TMPDIR}/vcl-peer/ -H ${TMPDIR}/html/ -P ${TMPDIR}/peer.pid \
+	-c $PEER_PORT >${TMPDIR}/peer.log
+pidwait peer $PEER_PORT
+
+is_running
+
+test_json stats/compact
+test_it_long GET stats/compact "" '"counters": {'
+test_it_long GET stats/compact "" '"MAIN.uptime": '
+
+test_json cluster/stats
+test_it_long GET "cluster/stats?timeout=500" "" '"partial": true'
+test_it_long GET cluster/stats "" '"node": "local", "state": "ok"'
+test_it_long GET cluster/stats "" "\"node\": \"localhost:${PEER_PORT}\", \"state\": \"ok\""
+test_it_long GET cluster/stats "" '"node": "localhost:1", "state": "missing"'
+test_it_long GET cluster/stats "" '"MAIN.n_backend": {"value": [0-9]*, "nodes": \[[0-9]*, [0-9]*, null\]}'
+
+kill $(cat ${TMPDIR}/peer.pid)
+exit $ret
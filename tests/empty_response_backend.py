@@ -8,8 +8,23 @@ class EmptyResponseHandler(BaseHTTPServer.BaseHTTPRequestHandler):
         self.send_response(204)
         self.end_headers()
 
+    # /esi/page includes two fragments, for tests/esi.sh
+    def send_esi_response(self):
+        if self.path == '/esi/page':
+            body = '<esi:include src="/esi/frag/1"/>' \
+                '<esi:include src="/esi/frag/2"/>'
+        else:
+            body = 'fragment'
+        self.send_response(200)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
     def do_GET(self):
-        self.send_empty_response()
+        if self.path.startswith('/esi/'):
+            self.send_esi_response()
+        else:
+            self.send_empty_response()
 
     def do_HEAD(self):
         self.send_empty_response()
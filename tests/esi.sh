@@ -0,0 +1,30 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-Y esi"
+init_all
+
+is_running
+
+cat ${TMPDIR}/boot.vcl > ${TMPDIR}/esi.vcl
+echo 'sub vcl_backend_response { set beresp.do_esi = true; }' >> ${TMPDIR}/esi.vcl
+test_it_long PUT vcl/esi "$(cat ${TMPDIR}/esi.vcl)" "VCL compiled."
+test_it PUT vcldeploy/esi "" "VCL 'esi' now active"
+
+sleep 1
+GET "http://localhost:${VARNISH_PORT}/esi/page" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/esi/page" > /dev/null
+sleep 1
+
+test_it_long GET analysis/esi "" '"pages": 2, "fragments": 4'
+test_it_long GET analysis/esi "" '"pattern": "/esi/frag/\*", "count": 4.*"hits": 2, "misses": 2'
+test_it_long GET analysis/esi "" '"pattern": "/esi/page", "pages": 2.*"fragments_avg": 2.0'
+test_it_long GET analysis/esi "" '"depth": 1, "url": "/esi/frag/1"'
+test_json analysis/esi
+
+exit $ret
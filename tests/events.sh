@@ -0,0 +1,44 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+init_all
+
+cursor() {
+	lwp-request -m GET "http://${PASS}@localhost:${AGENT_PORT}/events" |
+	    grep -o '"cursor": [0-9]*' | cut -d' ' -f2
+}
+
+is_running
+test_json events
+
+# Things that already happened are returned right away.
+C=$(cursor)
+test_it POST ban "req.url ~ /events" ""
+test_it_long GET events/$C "" '"type": "ban", "data": {"expression": "req.url ~ /events"}'
+
+# Long-poll: wait for the next event.
+C=$(cursor)
+OUT="${TMPDIR}/events.out"
+lwp-request -m GET "http://${PASS}@localhost:${AGENT_PORT}/events/$C" > $OUT &
+WAITER=$!
+sleep 1
+if [ ! -s $OUT ]; then pass; else fail "events/$C returned early: $(cat $OUT)"; fi
+inc
+test_it PUT param/default_ttl 100 ""
+wait $WAITER
+if grep -q '"type": "param", "data": {"name": "default_ttl", "value": "100"}' $OUT; then pass; else fail "No param event: $(cat $OUT)"; fi
+inc
+
+# Changes made behind our back are picked up by the watcher.
+C=$(cursor)
+varnishadm $N_ARG stop > /dev/null 2>&1
+test_it_long GET events/$C "" '"type": "child", "data": {"state": "Child in state stopped"'
+test_it PUT start "" ""
+
+test_it_long GET events/123456789 "" '"missed": true'
+test_it_fail GET events/foo "" "Bad cursor"
+exit $ret
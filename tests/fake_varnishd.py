@@ -0,0 +1,217 @@
+#!/usr/bin/python
+#
+# Stand-in for the varnishd management interface, for tests/bench.sh.
+#
+# Speaks the CLI protocol the agent expects on -T: an authentication
+# challenge when a secret file is given, "VCLI" framed replies
+# ("%-3d %-8d\n" + body + "\n") and canned answers to vcl.list,
+# param.show, backend.list, ban.list, status and ping. The size of the
+# canned lists and the reply latency are set on the command line, so
+# the agent's parsers and HTTP front end can be measured without a
+# running Varnish.
+#
+# With -w, the vcl.list, backend.list and param.show -l replies for -s
+# are written to <dir>/<command>.<size> instead, as input for the C
+# microbenchmarks ("make bench" writes tests/bench-data/).
+#
+# Usage: fake_varnishd.py [-T addr:port] [-S secret] [-s size]
+#                         [-l [command=]ms ...] [-w dir]
+
+import argparse
+import hashlib
+import os
+import socket
+import sys
+import threading
+import time
+
+CLIS_UNKNOWN = 101
+CLIS_PARAM = 106
+CLIS_AUTH = 107
+CLIS_OK = 200
+CLIS_CLOSE = 500
+
+def vcl_list(size):
+    out = ['%-10s %4s/%-8s %6s %s' % ('active', 'auto', 'warm', 0, 'boot')]
+    for i in range(1, size):
+        out.append('%-10s %4s/%-8s %6s %s' %
+            ('available', 'auto', 'warm', 0, 'vcl-%d' % i))
+    return '\n'.join(out) + '\n'
+
+def backend_list(size):
+    out = ['%-30s %-10s %s' % ('Backend name', 'Admin', 'Probe')]
+    for i in range(size):
+        out.append('%-30s %-10s %s' %
+            ('boot.be%d(127.0.0.1,,%d)' % (i, 8000 + i), 'probe',
+            'Healthy 5/5'))
+    return '\n'.join(out) + '\n'
+
+def param_entry(i):
+    name = 'param_%d' % i
+    if i % 3 == 0:
+        value = '%d [seconds] (default)' % i
+    elif i % 3 == 1:
+        value = '%d [bytes]\n        Default is: 1024' % i
+    else:
+        value = 'on [bool] (default)'
+    return (name,
+        '%s\n'
+        '        Value is: %s\n'
+        '        Minimum is: 0\n'
+        '        Maximum is: %d\n'
+        '\n'
+        '        Synthetic parameter number %d, generated by the\n'
+        '        benchmark stand-in for varnishd.\n'
+        '\n' % (name, value, i * 2 + 1, i))
+
+def ban_list(size):
+    out = ['Present bans:']
+    now = time.time()
+    for i in range(size):
+        out.append('%10.6f %5d -  req.url ~ ^/bench/%d' %
+            (now - i, 0, i))
+    return '\n'.join(out) + '\n'
+
+class Fixture(object):
+    def __init__(self, size):
+        self.params = [param_entry(i) for i in range(size)]
+        self.byname = dict(self.params)
+        self.replies = {
+            'vcl.list': vcl_list(size),
+            'backend.list': backend_list(size),
+            'ban.list': ban_list(size),
+            'status': 'Child in state running',
+        }
+
+    def answer(self, line):
+        words = line.split()
+        if not words:
+            return CLIS_UNKNOWN, 'Empty request.'
+        cmd, args = words[0], words[1:]
+        if cmd == 'ping':
+            return CLIS_OK, 'PONG %d 1.0' % int(time.time())
+        if cmd == 'param.show':
+            if not args or args == ['-l']:
+                return CLIS_OK, ''.join(e for _, e in self.params)
+            entry = self.byname.get(args[-1])
+            if entry is None:
+                return CLIS_PARAM, 'Unknown parameter "%s".' % args[-1]
+            return CLIS_OK, entry
+        if cmd == 'vcl.show':
+            return CLIS_OK, ('vcl 4.0;\n'
+                'backend default { .host = "127.0.0.1"; }\n')
+        if cmd in ('ban', 'vcl.use', 'vcl.discard', 'param.set',
+            'backend.set_health', 'start', 'stop'):
+            return CLIS_OK, ''
+        if cmd in self.replies:
+            return CLIS_OK, self.replies[cmd]
+        return CLIS_UNKNOWN, 'Unknown request.\nType \'help\' for more info.'
+
+def frame(status, body):
+    if not isinstance(body, bytes):
+        body = body.encode()
+    return ('%-3d %-8d\n' % (status, len(body))).encode() + body + b'\n'
+
+def auth_response(challenge, secret):
+    h = hashlib.sha256()
+    h.update(challenge + b'\n')
+    h.update(secret)
+    h.update(challenge + b'\n')
+    return h.hexdigest()
+
+def serve(conn, opts, fixture):
+    f = conn.makefile('rb')
+    try:
+        authed = opts.secret is None
+        if authed:
+            conn.sendall(frame(CLIS_OK, 'Varnish Cache CLI 1.0 (bench)'))
+        else:
+            challenge = ''.join('%c' % (ord('a') + b % 26)
+                for b in bytearray(os.urandom(32))).encode()
+            conn.sendall(frame(CLIS_AUTH, challenge +
+                b'\n\nAuthentication required.\n'))
+        while True:
+            line = f.readline()
+            if not line:
+                break
+            line = line.decode('latin-1').strip()
+            if not authed:
+                words = line.split()
+                if (len(words) == 2 and words[0] == 'auth' and
+                    words[1] == auth_response(challenge, opts.secret)):
+                    authed = True
+                    conn.sendall(frame(CLIS_OK, 'Authenticated'))
+                    continue
+                conn.sendall(frame(CLIS_CLOSE, 'Authentication failed'))
+                break
+            cmd = line.split(' ', 1)[0]
+            delay = opts.latency.get(cmd, opts.latency.get(None, 0))
+            if delay:
+                time.sleep(delay / 1000.0)
+            status, body = fixture.answer(line)
+            conn.sendall(frame(status, body))
+            if cmd == 'quit':
+                break
+    except socket.error:
+        pass
+    finally:
+        f.close()
+        conn.close()
+
+def parse_latency(values):
+    latency = {}
+    for v in values:
+        cmd, _, ms = v.rpartition('=')
+        latency[cmd or None] = float(ms)
+    return latency
+
+def dump(directory, size):
+    fixture = Fixture(size)
+    replies = {
+        'vcl.list': fixture.replies['vcl.list'],
+        'backend.list': fixture.replies['backend.list'],
+        'param.show': fixture.answer('param.show -l')[1],
+    }
+    for cmd, body in replies.items():
+        with open(os.path.join(directory, '%s.%d' % (cmd, size)), 'w') as f:
+            f.write(body)
+
+def main():
+    p = argparse.ArgumentParser(description='varnishd CLI stand-in')
+    p.add_argument('-T', default='127.0.0.1:0', dest='listen',
+        help='address:port to listen on (port 0 picks one)')
+    p.add_argument('-S', dest='secretfile',
+        help='secret file; enables the authentication challenge')
+    p.add_argument('-s', type=int, default=10, dest='size',
+        help='number of VCLs, backends, parameters and bans (default 10)')
+    p.add_argument('-l', action='append', default=[], dest='latency',
+        metavar='[CMD=]MS', help='reply latency in milliseconds, for '
+        'all commands or for one (may be repeated)')
+    p.add_argument('-w', dest='dump', metavar='DIR',
+        help='write the canned replies to DIR and exit')
+    opts = p.parse_args()
+    if opts.dump:
+        dump(opts.dump, opts.size)
+        return
+    opts.latency = parse_latency(opts.latency)
+    opts.secret = None
+    if opts.secretfile:
+        with open(opts.secretfile, 'rb') as s:
+            opts.secret = s.read()
+
+    host, _, port = opts.listen.rpartition(':')
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind((host or '127.0.0.1', int(port)))
+    sock.listen(16)
+    fixture = Fixture(opts.size)
+    sys.stdout.write('Serving CLI on %s port %d\n' % sock.getsockname())
+    sys.stdout.flush()
+    while True:
+        conn, _ = sock.accept()
+        t = threading.Thread(target=serve, args=(conn, opts, fixture))
+        t.daemon = True
+        t.start()
+
+if __name__ == '__main__':
+    main()
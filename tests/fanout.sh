@@ -0,0 +1,35 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+# One live peer agent, managing the same varnishd, and one dead peer.
+PEER_PORT=$(( 1024 + ( $RANDOM % 48000 ) ))
+echo -e "# Test peers\nlocalhost:${PEER_PORT}\n\nlocalhost:1 # dead" > ${TMPDIR}/peers
+ARGS="-f ${TMPDIR}/peers"
+init_all
+
+printf "Starting peer agent on port $PEER_PORT: "
+mkdir -p ${TMPDIR}/vcl-peer
+$ORIGPWD/../src/varnish-agent -K ${TMPDIR}/agent-secret -n ${TMPDIR} \
+	-p ${TMPDIR}/vcl-peer/ -H ${TMPDIR}/html/ -P ${TMPDIR}/peer.pid \
+	-c $PEER_PORT >${TMPDIR}/peer.log
+pidwait peer $PEER_PORT
+
+is_running
+
+test_it_long_fail POST "ban?fanout=all" "req.url ~ /fanout" '"local": {"status": 200'
+test_it_long_fail POST "ban?fanout=all" "req.url ~ /fanout" "\"peer\": \"localhost:${PEER_PORT}\", \"status\": 200"
+test_it_long_fail POST "ban?fanout=all" "req.url ~ /fanout" '"peer": "localhost:1", "status": 0'
+test_it_long GET ban "" "/fanout"
+
+# Only the admin URLs fan out, and only with ?fanout=all
+test_it GET "echo?fanout=all" "" ""
+test_it POST ban "req.url ~ /nofanout" ""
+test_it POST "ban?fanout=0" "req.url ~ /nofanout" ""
+
+kill $(cat ${TMPDIR}/peer.pid)
+exit $ret
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-Y gzip"
+init_all
+
+is_running
+
+cat ${TMPDIR}/boot.vcl > ${TMPDIR}/gzip.vcl
+echo 'sub vcl_backend_response { set beresp.do_gzip = true; }' >> ${TMPDIR}/gzip.vcl
+test_it_long PUT vcl/gzip "$(cat ${TMPDIR}/gzip.vcl)" "VCL compiled."
+test_it PUT vcldeploy/gzip "" "VCL 'gzip' now active"
+
+sleep 1
+# Gzipped on the fetch, gunzipped for each client without gzip support
+GET "http://localhost:${VARNISH_PORT}/esi/frag/1" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/esi/frag/1" > /dev/null
+sleep 1
+
+test_it_long GET analysis/gzip "" '"gzip": {"ops": 1, "bytes_in": 8,'
+test_it_long GET analysis/gzip "" '"gunzip": {"ops": 2,'
+test_it_long GET analysis/gzip "" '"n_gzip": 1, "n_gunzip": 2'
+test_it_long GET analysis/gzip "" '"pattern": "/esi/frag/\*", "gunzips": 2, "esi": 0, "bytes_out": 16'
+test_json analysis/gzip
+test_it_long GET help/analysis "" "gzip - "
+
+exit $ret
@@ -0,0 +1,36 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+# Two names for the same varnishd: "other" is the default instance, and
+# the -n added by start_agent becomes the second one.
+ln -s "$TMPDIR" "$TMPDIR/other"
+SECOND="$(basename "$TMPDIR")"
+ARGS="-n ${TMPDIR}/other"
+init_all
+
+is_running
+
+test_json instances
+test_json instances/stats
+test_it_long GET instances "" '"name": "other", "default": true'
+test_it_long GET instances "" "\"name\": \"${SECOND}\", \"default\": false"
+test_it_long GET instances/stats "" '"instances": 2'
+
+test_it GET i/other/status "" "Child in state running"
+test_it GET "i/${SECOND}/status" "" "Child in state running"
+test_it_fail GET i/nonexistent/status "" "No such instance"
+test_it_fail GET "i/${SECOND}/i/other/status" "" "Nested instance"
+
+test_it_long POST "i/${SECOND}/batch" '[{"path": "/status"}]' '"body": "Child in state running"'
+
+VCL="vcl 4.0; backend default { .host = \"localhost:$backendport\"; }"
+test_it_long PUT "i/${SECOND}/vcl/second" "$VCL" "VCL compiled."
+if [ -f "${TMPDIR}/vcl/${SECOND}/second.auto.vcl" ]; then pass; else fail "VCL of ${SECOND} not stored in its own directory"; fi
+inc
+
+exit $ret
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-l 4 -a 127.0.0.1 -a ::1"
+init_all
+
+is_running
+for i in $(seq 1 20); do
+	test_it_long GET vcl/ "" "active"
+done
+test_json stats
+
+FOO=$(lwp-request -m GET http://${PASS}@[::1]:${AGENT_PORT}/status)
+if [ "x$FOO" = "xChild in state running" ]; then pass; else fail "IPv6 listener: $FOO"; fi
+inc
+
+exit $ret
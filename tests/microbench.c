@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timing, allocation counting and baselines for the C microbenchmarks,
+ * see microbench.h.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "microbench.h"
+
+/*
+ * Count allocations by wrapping the glibc allocator, which also catches
+ * the ones strdup() and asprintf() make from inside libc.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static uint64_t mb_nalloc;
+
+void *
+malloc(size_t size)
+{
+
+	mb_nalloc++;
+	return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+
+	mb_nalloc++;
+	return (__libc_calloc(n, size));
+}
+
+void *
+realloc(void *p, size_t size)
+{
+
+	mb_nalloc++;
+	return (__libc_realloc(p, size));
+}
+#define MB_ALLOCS()	((double)mb_nalloc)
+#else
+#define MB_ALLOCS()	(-1.0)
+#endif
+
+struct mb_base_t {
+	char name[128];
+	double ns_op;
+	double allocs_op;
+};
+
+static struct mb_base_t *mb_base;
+static unsigned mb_nbase;
+static double mb_threshold;
+static unsigned mb_regressions;
+static FILE *mb_out;
+
+static double
+mb_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+/*
+ * Batches grow until one takes a millisecond, so the clock is read
+ * rarely compared to the ops being timed. The first call warms up.
+ */
+void
+mb_run(struct mb_result *r, const char *name, mb_func_f *f, void *priv,
+    double seconds)
+{
+	double t0, t, prev, end, a0;
+	uint64_t batch = 1, i;
+
+	r->name = name;
+	r->ops = 0;
+
+	/* An op slower than the whole run is timed just once */
+	a0 = MB_ALLOCS();
+	t0 = mb_now();
+	f(priv);
+	t = mb_now();
+	if (t - t0 >= seconds) {
+		r->ops = 1;
+		r->ns_op = (t - t0) * 1e9;
+		r->allocs_op = a0 < 0 ? -1.0 : MB_ALLOCS() - a0;
+		return;
+	}
+	end = t + seconds / 10;
+	while (mb_now() < end)
+		f(priv);
+
+	a0 = MB_ALLOCS();
+	t0 = prev = mb_now();
+	end = t0 + seconds;
+	do {
+		for (i = 0; i < batch; i++)
+			f(priv);
+		r->ops += batch;
+		t = mb_now();
+		if (t - prev < 1e-3 && batch < (1 << 20))
+			batch *= 2;
+		prev = t;
+	} while (t < end);
+	r->ns_op = (t - t0) * 1e9 / r->ops;
+	r->allocs_op = a0 < 0 ? -1.0 : (MB_ALLOCS() - a0) / r->ops;
+}
+
+int
+mb_record(const char *path)
+{
+
+	mb_out = fopen(path, "w");
+	if (mb_out == NULL)
+		return (-1);
+	fprintf(mb_out, "# benchmark ns/op allocs/op\n");
+	return (0);
+}
+
+int
+mb_compare(const char *path, double threshold)
+{
+	struct mb_base_t b;
+	char line[256];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return (-1);
+	mb_threshold = threshold;
+	while (fgets(line, sizeof line, f) != NULL) {
+		if (line[0] == '#' || sscanf(line, "%127s %lf %lf", b.name,
+		    &b.ns_op, &b.allocs_op) != 3)
+			continue;
+		mb_base = realloc(mb_base, (mb_nbase + 1) * sizeof *mb_base);
+		if (mb_base == NULL) {
+			(void)fclose(f);
+			errno = ENOMEM;
+			return (-1);
+		}
+		mb_base[mb_nbase++] = b;
+	}
+	(void)fclose(f);
+	return (0);
+}
+
+void
+mb_print_header(void)
+{
+
+	printf("%-32s %10s %14s %10s%s\n", "benchmark", "ops", "ns/op",
+	    "allocs/op", mb_base != NULL ? "   vs baseline" : "");
+}
+
+void
+mb_print(const struct mb_result *r, const char *extra)
+{
+	const struct mb_base_t *b = NULL;
+	char cmp[64] = "";
+	double d;
+	unsigned u;
+
+	for (u = 0; u < mb_nbase; u++)
+		if (!strcmp(mb_base[u].name, r->name))
+			b = &mb_base[u];
+	if (b != NULL) {
+		d = b->ns_op > 0 ? (r->ns_op / b->ns_op - 1) * 100 : 0;
+		snprintf(cmp, sizeof cmp, "   %+6.1f%% %+.1f allocs%s", d,
+		    r->allocs_op - b->allocs_op,
+		    d > mb_threshold || r->allocs_op > b->allocs_op + 0.05 ?
+		    " REGRESSION" : "");
+		if (strstr(cmp, "REGRESSION"))
+			mb_regressions++;
+	} else if (mb_base != NULL)
+		snprintf(cmp, sizeof cmp, "   (new)");
+
+	printf("%-32s %10ju %14.0f %10.1f%s%s%s\n", r->name,
+	    (uintmax_t)r->ops, r->ns_op, r->allocs_op, cmp,
+	    extra ? "  " : "", extra ? extra : "");
+	if (mb_out != NULL)
+		fprintf(mb_out, "%s %.0f %.1f\n", r->name, r->ns_op,
+		    r->allocs_op);
+}
+
+int
+mb_done(void)
+{
+
+	if (mb_out != NULL)
+		(void)fclose(mb_out);
+	mb_out = NULL;
+	if (mb_base != NULL)
+		printf("%u regression%s against the baseline\n",
+		    mb_regressions, mb_regressions == 1 ? "" : "s");
+	return (mb_regressions);
+}
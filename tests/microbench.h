@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Helpers shared by the C microbenchmarks in tests/, see "make bench".
+ */
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdint.h>
+
+struct VSM_data;
+
+/*
+ * mb_run() calls f(priv) repeatedly for about seconds, after a short
+ * warm-up, and fills in r. Every call is one op. With glibc, malloc(),
+ * calloc() and realloc() are counted too, for allocs_op; elsewhere it
+ * is -1.
+ */
+typedef void mb_func_f(void *priv);
+
+struct mb_result {
+	const char *name;
+	uint64_t ops;
+	double ns_op;
+	double allocs_op;
+};
+
+void mb_run(struct mb_result *r, const char *name, mb_func_f *f,
+    void *priv, double seconds);
+
+/*
+ * mb_print() writes a result to stdout, and to the file given to
+ * mb_record() if any, one "name ns/op allocs/op" line each. With a
+ * baseline from mb_compare(), it also shows the change against the
+ * baseline result of the same name, and counts it as a regression if
+ * ns/op grew by more than threshold percent or allocs/op grew at all.
+ * mb_done() closes the record and returns the number of regressions.
+ */
+int mb_record(const char *path);
+int mb_compare(const char *path, double threshold);
+void mb_print_header(void);
+void mb_print(const struct mb_result *r, const char *extra);
+int mb_done(void);
+
+/*
+ * Write a synthetic _.vsm to dir, in the layout libvarnishapi 4.1 reads:
+ * one MAIN block and nvbe VBE, nsma SMA and nlck LCK blocks, every
+ * counter set to a different value. Returns 0 or -1 with errno set.
+ */
+int vsm_fixture(const char *dir, unsigned nvbe, unsigned nsma,
+    unsigned nlck);
+
+#endif
@@ -0,0 +1,69 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+init_all
+
+# A collector writing the body of each POST on a line
+OTLP_LOG="${TMPDIR}/otlp.log"
+python -c '
+import sys
+try:
+	from http.server import BaseHTTPRequestHandler, HTTPServer
+except ImportError:
+	from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+class H(BaseHTTPRequestHandler):
+	def do_POST(self):
+		body = self.rfile.read(int(self.headers["Content-Length"]))
+		with open(sys.argv[1], "a") as f:
+			f.write(self.headers["Content-Type"] + " " +
+			    body.decode().replace("\n", "") + "\n")
+		self.send_response(200)
+		self.end_headers()
+	def log_message(self, *args):
+		pass
+s = HTTPServer(("127.0.0.1", 0), H)
+open(sys.argv[1] + ".port", "w").write(str(s.server_address[1]))
+s.serve_forever()
+' "$OTLP_LOG" &
+OTLP_PID=$!
+trap "kill $OTLP_PID 2>/dev/null; cleanup" EXIT
+while [ ! -s "${OTLP_LOG}.port" ]; do sleep 0.1; done
+OTLP_URL="http://127.0.0.1:$(cat ${OTLP_LOG}.port)/v1/traces"
+
+is_running
+
+test_it_long GET push/otlp/traces "" '"enabled": false'
+test_it_fail PUT push/otlp/traces '{"endpoint": "collector:4318"}' "endpoint must be an http:// or https:// url"
+test_it_fail PUT push/otlp/traces "{\"endpoint\": \"${OTLP_URL}\", \"sample\": 2}" "sample must be between 0 and 1"
+test_it_long PUT push/otlp/traces "{\"endpoint\": \"${OTLP_URL}\", \"sample\": 1, \"interval\": 1, \"service\": \"edge\"}" '"enabled": true, .* "service": "edge", "sample": 1, "batch": 512, "interval": 1'
+# Give the exporter a moment to open the log
+sleep 2
+
+# The caller's trace, and one the caller did not sample
+GET -H "traceparent: 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01" "http://localhost:${VARNISH_PORT}/otlp/1" > /dev/null
+GET -H "traceparent: 00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-00" "http://localhost:${VARNISH_PORT}/otlp/2" > /dev/null
+sleep 4
+
+if ! grep -q '^application/json {"resourceSpans":\[{"resource":{"attributes":\[{"key":"service.name","value":{"stringValue":"edge"}}' "$OTLP_LOG"; then
+	fail "No OTLP request with the service name"
+elif ! grep -q '"traceId":"4bf92f3577b34da6a3ce929d0e0e4736","spanId":"[0-9a-f]\{16\}","parentSpanId":"00f067aa0ba902b7","name":"GET","kind":2' "$OTLP_LOG"; then
+	fail "No SERVER span in the caller's trace"
+elif ! grep -q '"traceId":"4bf92f3577b34da6a3ce929d0e0e4736","spanId":"[0-9a-f]\{16\}","parentSpanId":"[0-9a-f]\{16\}","name":"GET","kind":3' "$OTLP_LOG"; then
+	fail "No CLIENT span for the backend request"
+elif grep -q '0af7651916cd43dd8448eb211c80319c' "$OTLP_LOG"; then
+	fail "A trace the caller did not sample was exported"
+else
+	pass
+fi
+inc
+test_it_long GET push/otlp/traces "" '"traces": 2, "sampled": 1, "spans": 2, "exported": 2, "failed": 0'
+
+test_it_long DELETE push/otlp/traces "" '"enabled": false'
+test_it_long GET help/otlp "" "traceparent"
+
+exit $ret
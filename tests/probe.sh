@@ -0,0 +1,26 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+init_all
+
+is_running
+
+test_it_long GET backendprobe "" '"enabled": false'
+test_it_long PUT backendprobe '{"interval": 1}' '"enabled": true, "interval": 1'
+sleep 3
+test_it_long GET backendprobe "" 'default", "address"'
+test_it_long GET backendprobe "" '"errors": {"connect": 0, "timeout": 0'
+test_it_long GET backendprobe "" '"p99_ms"'
+test_json backendprobe
+
+test_it_long_fail PUT backendprobe '{"interval": 0}' "interval must be at least 1"
+test_it_long_fail PUT backendprobe '{"path": "probe"}' "path must start with /"
+test_it_long DELETE backendprobe "" '"enabled": false'
+test_it_long GET help/backend "" "p50\|histogram"
+
+exit $ret
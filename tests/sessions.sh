@@ -0,0 +1,27 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-Y sessions"
+init_all
+
+is_running
+
+# Give the analyzer a moment to start tailing the log
+sleep 1
+# One request per connection
+GET "http://localhost:${VARNISH_PORT}/sess/1" > /dev/null
+GET "http://localhost:${VARNISH_PORT}/sess/2" > /dev/null
+sleep 1
+
+test_it_long GET analysis/sessions "" '"sessions": 2, "requests": 2, "requests_per_session": {"n": 2, "min": 1.000'
+test_it_long GET analysis/sessions "" '"close_reasons": \[ {"reason": "[A-Z_]*", "count": 2, "share": 1.000}'
+test_it_long GET analysis/sessions "" '"sessions": 2, "requests": 2, "proxied": 0, "requests_avg": 1.00'
+test_json analysis/sessions
+test_it_long GET help/analysis "" "sessions - "
+
+exit $ret
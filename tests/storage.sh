@@ -0,0 +1,29 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-Y storage"
+init_all
+
+is_running
+
+test_it_long GET analysis "" '"name": "storage", "grouping": "counters"'
+# Give the analyzer a moment to sample the counters
+sleep 2
+
+# -s malloc,50m
+test_it_long GET analysis/storage "" '"storage": "SMA.s0", "bytes": [0-9]*, "space": [0-9]*, "capacity": 52428800'
+# Less than a quarter of an hour of history, no forecast yet
+test_it_long GET analysis/storage "" '"trend_per_hour": null, "seasonal": false, "forecast_1h": null, "forecast_24h": null, "time_to_full": null, "alert": false'
+# A minute may have passed, so there may be a point already
+test_it_long GET analysis/storage "" '"nuked_per_minute": {"last": \(null\|[0-9][0-9]*\), .*"alert": false}'
+test_json analysis/storage
+
+test_it PUT "push/url/analysis" "http://localhost:${AGENT_PORT}/echo" "Url stored"
+test_it_long GET help/analysis "" "storage - "
+
+exit $ret
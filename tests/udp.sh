@@ -0,0 +1,62 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+init_all
+
+# A UDP receiver writing one datagram per line, with its size first
+UDP_LOG="${TMPDIR}/udp.log"
+python -c '
+import socket, sys
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.bind(("127.0.0.1", 0))
+open(sys.argv[1] + ".port", "w").write(str(s.getsockname()[1]))
+while True:
+	d = s.recv(65535)
+	with open(sys.argv[1], "a") as f:
+		f.write("%d %s\n" % (len(d), d.decode().replace("\n", ";")))
+' "$UDP_LOG" &
+UDP_PID=$!
+trap "kill $UDP_PID 2>/dev/null; cleanup" EXIT
+while [ ! -s "${UDP_LOG}.port" ]; do sleep 0.1; done
+UDP_PORT="$(cat ${UDP_LOG}.port)"
+
+is_running
+
+test_it_long GET push/udp/stats "" '"enabled": false'
+test_it_fail PUT push/udp/stats '{"address": "localhost"}' "address must be host:port"
+test_it_fail PUT push/udp/stats "{\"address\": \"127.0.0.1:${UDP_PORT}\", \"mtu\": 10}" "mtu must be between 64 and 65507"
+test_it_fail PUT push/udp/stats "{\"address\": \"127.0.0.1:${UDP_PORT}\", \"format\": \"carbon\"}" "format must be statsd or graphite"
+
+test_it_long PUT push/udp/stats "{\"address\": \"127.0.0.1:${UDP_PORT}\", \"mtu\": 512, \"filter\": [\"!MAIN.n_*\", \"MAIN.*\"]}" '"format": "statsd", "prefix": "varnish", "filter": \["!MAIN.n_\*", "MAIN.\*"\], "mtu": 512'
+sleep 3
+if ! grep -q 'varnish\.MAIN\.uptime:[0-9]*|g' "$UDP_LOG"; then
+	fail "No StatsD gauge for MAIN.uptime"
+elif ! grep -q 'varnish\.MAIN\.client_req:[0-9]*|c' "$UDP_LOG"; then
+	fail "No StatsD counter for MAIN.client_req"
+elif grep -q 'MAIN\.n_\|SMA\.' "$UDP_LOG"; then
+	fail "Filtered counters were sent"
+elif awk '$1 > 512 { exit 1 }' "$UDP_LOG"; then
+	pass
+else
+	fail "A datagram was larger than the mtu"
+fi
+inc
+test_it_long GET push/udp/stats "" '"errors": 0'
+
+test_it_long PUT push/udp/stats "{\"address\": \"127.0.0.1:${UDP_PORT}\", \"format\": \"graphite\", \"prefix\": \"cache\"}" '"format": "graphite", "prefix": "cache"'
+sleep 3
+if grep -q 'cache\.MAIN\.client_req [0-9.]* [0-9]*' "$UDP_LOG"; then
+	pass
+else
+	fail "No Graphite line for MAIN.client_req"
+fi
+inc
+
+test_it_long DELETE push/udp/stats "" '"enabled": false'
+
+exit $ret
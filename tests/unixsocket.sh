@@ -0,0 +1,49 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+SOCK="${TMPDIR}/agent.sock"
+ARGS="-U ${SOCK}"
+init_all
+
+# GET over the unix socket, without credentials. Prints the status line.
+unix_get() {
+	python -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+s.connect(sys.argv[1])
+s.sendall(("GET /" + sys.argv[2] + " HTTP/1.0\r\n\r\n").encode())
+r = b""
+while True:
+	d = s.recv(4096)
+	if not d:
+		break
+	r += d
+sys.stdout.write(r.decode().split("\r\n")[0] + "\n")
+sys.stdout.write(r.decode().split("\r\n\r\n", 1)[1])
+' "$SOCK" "$1"
+}
+
+is_running
+
+if [ -S "$SOCK" ]; then pass; else fail "No socket at $SOCK"; fi
+inc
+
+if [ "$(stat -c %a "$SOCK")" = "660" ]; then pass; else fail "Bad mode on $SOCK"; fi
+inc
+
+FOO=$(unix_get status)
+if echo "$FOO" | head -n1 | grep -q " 200 "; then pass; else fail "status over unix socket: $FOO"; fi
+inc
+if echo "$FOO" | grep -q "Child in state running"; then pass; else fail "status over unix socket: $FOO"; fi
+inc
+
+FOO=$(unix_get vcljson/)
+if echo "$FOO" | grep -q '"vcls"'; then pass; else fail "vcljson over unix socket: $FOO"; fi
+inc
+
+exit $ret
@@ -0,0 +1,43 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+ARGS="-B error"
+init_all
+
+is_running
+
+BACKEND="vcl 4.0; backend default { .host = \"localhost\"; }"
+PASSALL="$BACKEND
+sub vcl_recv {
+	if (req.http.Cookie ~ \"session\") {
+		return (hash);
+	}
+	return (pass);
+}"
+VARY="$BACKEND
+sub vcl_recv {
+	set req.url = std.querysort(req.url);
+}
+sub vcl_backend_response {
+	set beresp.http.Vary = \"User-Agent\";
+}"
+
+test_it_long POST vcl/lint "$PASSALL" '"worst": "error"'
+test_it_long POST vcl/lint "$PASSALL" '"line": 3, "severity": "warning", "rule": "cookie-regex"'
+test_it_long POST vcl/lint "$PASSALL" '"line": 6, "severity": "error", "rule": "pass-all"'
+test_it_long POST vcl/lint "$PASSALL" '"rule": "querystring"'
+test_it_long POST vcl/lint "$VARY" '"worst": "warning"'
+test_it_long POST vcl/lint "$VARY" '"line": 6, "severity": "warning", "rule": "vary-unbounded"'
+test_it_long_fail POST vcl/lint "" "No VCL found"
+
+# -B error refuses the first, the second is stored with its findings
+test_it_long_fail PUT vcl/lint1 "$PASSALL" "VCL refused"
+test_it_long PUT vcl/lint2 "$BACKEND" "querystring"
+test_it_long GET help/vcl "" "/vcl/lint"
+
+exit $ret
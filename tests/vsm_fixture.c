@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2015 Varnish Software Group
+ * All rights reserved.
+ *
+ * Author: Kristian Lyngstøl <kristian@bohemians.org>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A synthetic shared memory segment for the stats benchmarks.
+ *
+ * libvarnishapi 4.1 finds the counters by walking the chunks of
+ * <dir>/_.vsm: a VSM_head, then VSM_chunk headers linked by offset, each
+ * followed by its payload. Chunks of class "Stat" hold a struct
+ * VSC_C_<type> of uint64_t counters, whose layout is compiled into the
+ * library. The structures below mirror vsm_priv.h, which is not
+ * installed, and the payloads are made large enough for any 4.1 counter
+ * block, so the library reads real-looking values for every field it
+ * knows about.
+ */
+
+#include <sys/types.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "microbench.h"
+
+#define VSM_MARKER_LEN		8
+#define VSM_IDENT_LEN		128
+
+struct VSM_chunk {
+	char			marker[VSM_MARKER_LEN];
+	ssize_t			len;		/* Of the payload */
+	ssize_t			next;		/* Offset, 0 for the last */
+	char			class[VSM_MARKER_LEN];
+	char			type[VSM_MARKER_LEN];
+	char			ident[VSM_IDENT_LEN];
+};
+
+struct VSM_head {
+	char			marker[VSM_MARKER_LEN];
+	ssize_t			hdrsize;
+	ssize_t			shm_size;
+	ssize_t			first;		/* Offset, first chunk */
+	unsigned		alloc_seq;
+	uint64_t		age;
+};
+
+#define FIXTURE_MAIN_SIZE	8192
+#define FIXTURE_SIZE		1024
+#define FIXTURE_ALIGN(x)	(((x) + 15) & ~(ssize_t)15)
+
+struct fixture_t {
+	char *b;
+	ssize_t len;
+	ssize_t *prev;		// next of the previous chunk
+	uint64_t val;
+};
+
+static void
+fixture_chunk(struct fixture_t *fx, const char *type, const char *ident,
+    ssize_t size)
+{
+	struct VSM_chunk *c;
+	uint64_t *p;
+	ssize_t i;
+
+	c = (struct VSM_chunk *)(void *)(fx->b + fx->len);
+	memcpy(c->marker, "VSMCHUNK", VSM_MARKER_LEN);
+	c->len = size;
+	c->next = 0;
+	assert(strlen(type) < VSM_MARKER_LEN);
+	memcpy(c->class, "Stat", sizeof "Stat");
+	memcpy(c->type, type, strlen(type) + 1);
+	snprintf(c->ident, VSM_IDENT_LEN, "%s", ident);
+	*fx->prev = fx->len;
+	fx->prev = &c->next;
+
+	p = (uint64_t *)(void *)(c + 1);
+	for (i = 0; i < size / (ssize_t)sizeof *p; i++)
+		p[i] = fx->val++ * 7919 % 1000003;
+	fx->len += FIXTURE_ALIGN(sizeof *c + size);
+}
+
+int
+vsm_fixture(const char *dir, unsigned nvbe, unsigned nsma, unsigned nlck)
+{
+	struct fixture_t fx;
+	struct VSM_head *h;
+	char path[1024], ident[VSM_IDENT_LEN];
+	ssize_t size, chunk;
+	unsigned u;
+	int fd, e;
+
+	chunk = FIXTURE_ALIGN(sizeof (struct VSM_chunk) + FIXTURE_SIZE);
+	size = FIXTURE_ALIGN(sizeof *h) +
+	    FIXTURE_ALIGN(sizeof (struct VSM_chunk) + FIXTURE_MAIN_SIZE) +
+	    chunk * ((ssize_t)nvbe + nsma + nlck);
+	memset(&fx, 0, sizeof fx);
+	fx.b = calloc(1, size);
+	if (fx.b == NULL)
+		return (-1);
+
+	h = (struct VSM_head *)(void *)fx.b;
+	memcpy(h->marker, "VSMHEAD0", VSM_MARKER_LEN);
+	h->hdrsize = sizeof *h;
+	h->shm_size = size;
+	h->alloc_seq = 1;
+	h->age = 1;
+	fx.len = FIXTURE_ALIGN(sizeof *h);
+	fx.prev = &h->first;
+	fx.val = 1;
+
+	fixture_chunk(&fx, "MAIN", "", FIXTURE_MAIN_SIZE);
+	for (u = 0; u < nsma; u++) {
+		snprintf(ident, sizeof ident, "s%u", u);
+		fixture_chunk(&fx, "SMA", ident, FIXTURE_SIZE);
+	}
+	for (u = 0; u < nlck; u++) {
+		snprintf(ident, sizeof ident, "lck%u", u);
+		fixture_chunk(&fx, "LCK", ident, FIXTURE_SIZE);
+	}
+	for (u = 0; u < nvbe; u++) {
+		snprintf(ident, sizeof ident, "boot.be%u", u);
+		fixture_chunk(&fx, "VBE", ident, FIXTURE_SIZE);
+	}
+	assert(fx.len == size);
+
+	snprintf(path, sizeof path, "%s/_.vsm", dir);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		free(fx.b);
+		return (-1);
+	}
+	if (write(fd, fx.b, size) != size) {
+		e = errno ? errno : EIO;
+		(void)close(fd);
+		free(fx.b);
+		errno = e;
+		return (-1);
+	}
+	free(fx.b);
+	return (close(fd));
+}
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+if [ "$(basename $PWD)" != "tests" ]; then
+	echo "Must run tests from tests/ directory"
+	exit 1
+fi
+. util.sh
+
+init_all
+
+is_running
+
+# Wait for warming job $1 to finish
+warm_wait() {
+	for a in x x x x x x x x x x; do
+		FOO=$(lwp-request -m GET http://${PASS}@localhost:${AGENT_PORT}/warm/$1)
+		echo "$FOO" | grep -q '"state": "running"\|"state": "queued"' || break
+		sleep 0.5
+	done
+}
+
+test_it_long POST warm "/warm1\n/warm2\nhttp://example.com/warm3" '"id": 1, "state": "queued"'
+warm_wait 1
+test_it_long GET warm/1 "" '"state": "done", "urls": 3, "done": 3, "hit": 0, "miss": 3, "errors": 0'
+
+test_it_long POST warm '{"urls": ["/warm1", "/warm2"], "concurrency": 2, "rate": 10}' '"id": 2'
+warm_wait 2
+test_it_long GET warm/2 "" '"state": "done", "urls": 2, "done": 2, "hit": 2'
+
+test_it_long POST warm '{"top": 2}' '"id": 3'
+warm_wait 3
+test_it_long GET warm/3 "" '"state": "done", "urls": 2, "done": 2, "hit": 2'
+
+test_json warm
+test_it_long_fail POST warm '{"top": 0}' "top is out of range"
+test_it_long_fail POST warm '{}' "Need urls or top"
+test_it_long_fail DELETE warm/42 "" "No such job"
+test_it_long GET help/warm "" "max_error_rate"
+
+exit $ret